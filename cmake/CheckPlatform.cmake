@@ -44,3 +44,11 @@
   check_include_files(sys/un.h HAVE_SYS_UN)
   check_include_files(time.h HAVE_TIME)
   check_include_files(unistd.h HAVE_UNISTD)
+
+  # The io_uring poll backend needs multishot poll and timed waits
+  include(CheckSymbolExists)
+  check_symbol_exists(IORING_POLL_ADD_MULTI linux/io_uring.h HAVE_IO_URING_POLL_MULTI)
+  check_symbol_exists(IORING_FEAT_EXT_ARG linux/io_uring.h HAVE_IO_URING_EXT_ARG)
+  if(HAVE_IO_URING_POLL_MULTI AND HAVE_IO_URING_EXT_ARG)
+    add_definitions(-DHAVE_IO_URING)
+  endif()
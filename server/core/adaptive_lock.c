@@ -0,0 +1,366 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file adaptive_lock.c  - Locks that spin briefly and then sleep
+ *
+ * A waiting thread first spins, doubling the number of pause instructions
+ * between its attempts, then yields the processor once and finally marks
+ * the lock as having sleepers and sleeps on the futex of the lock. The
+ * thread that releases a lock marked this way wakes up one sleeper.
+ *
+ * The contention of each call site is kept in a fixed size hash table that
+ * is indexed by the file and line of the call site. A site is added to the
+ * table the first time a thread waits there and is never removed, so its
+ * counters can be updated without locks.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <adaptive_lock.h>
+#include <spinlock.h>
+#include <dcb.h>
+
+/** Number of spinning rounds before yielding */
+#define ADAPTIVE_LOCK_SPINS 10
+
+/** Maximum number of pause instructions between two attempts */
+#define ADAPTIVE_LOCK_MAX_BACKOFF 256
+
+/** Number of call sites that can be recorded */
+#define ADAPTIVE_LOCK_SITES 256
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/**
+ * The contention of a call site
+ */
+typedef struct
+{
+    const char *file;       /*< File of the call site, NULL if the slot is free */
+    const char *name;       /*< The lock expression at the call site */
+    int        line;        /*< Line of the call site */
+    uint64_t   waits;       /*< Number of times a thread had to wait */
+    uint64_t   sleeps;      /*< Number of times a thread had to sleep */
+    uint64_t   total_ns;    /*< Total time spent waiting */
+    uint64_t   max_ns;      /*< Longest wait */
+} ADAPTIVE_LOCK_SITE;
+
+static ADAPTIVE_LOCK_SITE sites[ADAPTIVE_LOCK_SITES];
+static SPINLOCK sites_lock = SPINLOCK_INIT;
+static int n_dropped = 0;
+
+/**
+ * Initialise a lock
+ *
+ * @param lock  The lock
+ */
+void
+adaptive_lock_init(ADAPTIVE_LOCK *lock)
+{
+    lock->lock = 0;
+}
+
+/**
+ * Return the time of the monotonic clock
+ *
+ * @return The time in nanoseconds
+ */
+static uint64_t
+adaptive_lock_clock()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Find the slot of a call site, adding it to the table if it is not there
+ *
+ * @param name  The lock expression
+ * @param file  The file of the call site
+ * @param line  The line of the call site
+ * @return      The slot or NULL if the table is full
+ */
+static ADAPTIVE_LOCK_SITE *
+adaptive_lock_site(const char *name, const char *file, int line)
+{
+    unsigned int start = (((uintptr_t)file >> 3) ^ (line * 2654435761U)) % ADAPTIVE_LOCK_SITES;
+    unsigned int i = start;
+
+    /** The file and line are constants, comparing the pointers is enough */
+    do
+    {
+        const char *site_file = __atomic_load_n(&sites[i].file, __ATOMIC_ACQUIRE);
+
+        if (site_file == NULL)
+        {
+            break;
+        }
+        if (site_file == file && sites[i].line == line)
+        {
+            return &sites[i];
+        }
+        i = (i + 1) % ADAPTIVE_LOCK_SITES;
+    }
+    while (i != start);
+
+    spinlock_acquire(&sites_lock);
+    i = start;
+    do
+    {
+        if (sites[i].file == NULL)
+        {
+            sites[i].name = name;
+            sites[i].line = line;
+            __atomic_store_n(&sites[i].file, file, __ATOMIC_RELEASE);
+            break;
+        }
+        if (sites[i].file == file && sites[i].line == line)
+        {
+            break;
+        }
+        i = (i + 1) % ADAPTIVE_LOCK_SITES;
+    }
+    while (i != start);
+    spinlock_release(&sites_lock);
+
+    return sites[i].file == file && sites[i].line == line ? &sites[i] : NULL;
+}
+
+/**
+ * Record a wait at a call site
+ *
+ * @param name      The lock expression
+ * @param file      The file of the call site
+ * @param line      The line of the call site
+ * @param elapsed   How long the thread waited in nanoseconds
+ * @param slept     Whether the thread slept
+ */
+static void
+adaptive_lock_record(const char *name, const char *file, int line,
+                     uint64_t elapsed, bool slept)
+{
+    ADAPTIVE_LOCK_SITE *site = adaptive_lock_site(name, file, line);
+    uint64_t max;
+
+    if (site == NULL)
+    {
+        __atomic_add_fetch(&n_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_add_fetch(&site->waits, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->total_ns, elapsed, __ATOMIC_RELAXED);
+    if (slept)
+    {
+        __atomic_add_fetch(&site->sleeps, 1, __ATOMIC_RELAXED);
+    }
+
+    max = __atomic_load_n(&site->max_ns, __ATOMIC_RELAXED);
+    while (elapsed > max &&
+           !__atomic_compare_exchange_n(&site->max_ns, &max, elapsed, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        ;
+    }
+}
+
+/**
+ * Wait for a lock that was found taken. This is the slow path of
+ * adaptive_lock_acquire().
+ *
+ * @param lock  The lock
+ * @param name  The lock expression at the call site
+ * @param file  The file of the call site
+ * @param line  The line of the call site
+ */
+void
+adaptive_lock_wait(ADAPTIVE_LOCK *lock, const char *name, const char *file, int line)
+{
+    uint64_t start = adaptive_lock_clock();
+    int backoff = 1;
+    bool slept = false;
+
+    for (int round = 0; round <= ADAPTIVE_LOCK_SPINS; round++)
+    {
+        if (round == ADAPTIVE_LOCK_SPINS)
+        {
+            /** Give a preempted holder a chance to run before sleeping */
+            sched_yield();
+        }
+        else
+        {
+            for (int i = 0; i < backoff; i++)
+            {
+                cpu_relax();
+            }
+            if (backoff < ADAPTIVE_LOCK_MAX_BACKOFF)
+            {
+                backoff *= 2;
+            }
+        }
+
+        if (__atomic_load_n(&lock->lock, __ATOMIC_RELAXED) == 0 &&
+            adaptive_lock_acquire_nowait(lock))
+        {
+            adaptive_lock_record(name, file, line, adaptive_lock_clock() - start, false);
+            return;
+        }
+    }
+
+    /** The lock is taken with the sleepers mark since other threads may
+     * still be sleeping on it */
+    while (__atomic_exchange_n(&lock->lock, 2, __ATOMIC_ACQUIRE) != 0)
+    {
+        syscall(SYS_futex, &lock->lock, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        slept = true;
+    }
+
+    adaptive_lock_record(name, file, line, adaptive_lock_clock() - start, slept);
+}
+
+/**
+ * Wake up one thread sleeping on a lock. Called by adaptive_lock_release().
+ *
+ * @param lock  The lock
+ */
+void
+adaptive_lock_wake(ADAPTIVE_LOCK *lock)
+{
+    syscall(SYS_futex, &lock->lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Format a time in nanoseconds for display
+ *
+ * @param buf   The buffer to format to
+ * @param size  The size of the buffer
+ * @param ns    The time in nanoseconds
+ */
+static void
+adaptive_lock_format_time(char *buf, size_t size, uint64_t ns)
+{
+    if (ns < 1000)
+    {
+        snprintf(buf, size, "%luns", (unsigned long)ns);
+    }
+    else if (ns < 1000000)
+    {
+        snprintf(buf, size, "%.1fus", ns / 1000.0);
+    }
+    else if (ns < 1000000000)
+    {
+        snprintf(buf, size, "%.1fms", ns / 1000000.0);
+    }
+    else
+    {
+        snprintf(buf, size, "%.1fs", ns / 1000000000.0);
+    }
+}
+
+/**
+ * Compare the total wait time of two call sites, longest first
+ */
+static int
+adaptive_lock_site_cmp(const void *a, const void *b)
+{
+    uint64_t ta = ((const ADAPTIVE_LOCK_SITE *)a)->total_ns;
+    uint64_t tb = ((const ADAPTIVE_LOCK_SITE *)b)->total_ns;
+
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+/**
+ * Print the contention of the call sites of the adaptive locks, the sites
+ * where threads waited the longest in total first
+ *
+ * @param dcb   The DCB to print to
+ */
+void
+dShowLockStats(DCB *dcb)
+{
+    ADAPTIVE_LOCK_SITE *copy;
+    int n = 0;
+
+    if ((copy = malloc(sizeof(sites))) == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < ADAPTIVE_LOCK_SITES; i++)
+    {
+        if (__atomic_load_n(&sites[i].file, __ATOMIC_ACQUIRE))
+        {
+            copy[n].file = sites[i].file;
+            copy[n].name = sites[i].name;
+            copy[n].line = sites[i].line;
+            copy[n].waits = __atomic_load_n(&sites[i].waits, __ATOMIC_RELAXED);
+            copy[n].sleeps = __atomic_load_n(&sites[i].sleeps, __ATOMIC_RELAXED);
+            copy[n].total_ns = __atomic_load_n(&sites[i].total_ns, __ATOMIC_RELAXED);
+            copy[n].max_ns = __atomic_load_n(&sites[i].max_ns, __ATOMIC_RELAXED);
+            n++;
+        }
+    }
+
+    qsort(copy, n, sizeof(ADAPTIVE_LOCK_SITE), adaptive_lock_site_cmp);
+
+    dcb_printf(dcb, "\nLock contention.\n\n");
+    dcb_printf(dcb, "%-24s | %-28s | Waits      | Sleeps     | Total     | Avg       | Max\n",
+               "Lock", "Call site");
+    dcb_printf(dcb, "-------------------------+------------------------------+------------+"
+               "------------+-----------+-----------+----------\n");
+
+    for (int i = 0; i < n; i++)
+    {
+        const char *file = strrchr(copy[i].file, '/');
+        char site[64];
+        char total[20];
+        char avg[20];
+        char max[20];
+
+        snprintf(site, sizeof(site), "%s:%d", file ? file + 1 : copy[i].file, copy[i].line);
+        adaptive_lock_format_time(total, sizeof(total), copy[i].total_ns);
+        adaptive_lock_format_time(avg, sizeof(avg), copy[i].waits ? copy[i].total_ns / copy[i].waits : 0);
+        adaptive_lock_format_time(max, sizeof(max), copy[i].max_ns);
+
+        dcb_printf(dcb, "%-24s | %-28s | %10lu | %10lu | %-9s | %-9s | %s\n",
+                   copy[i].name, site, (unsigned long)copy[i].waits,
+                   (unsigned long)copy[i].sleeps, total, avg, max);
+    }
+
+    if (n_dropped)
+    {
+        dcb_printf(dcb, "\n%d waits were not recorded, the call site table is full.\n",
+                   n_dropped);
+    }
+
+    free(copy);
+}
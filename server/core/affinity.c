@@ -0,0 +1,586 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file affinity.c  - Placement of the polling threads on CPUs and NUMA nodes
+ *
+ * The NUMA topology is read from sysfs when MaxScale starts. The value of
+ * thread_affinity is turned into an ordered list of CPUs and polling thread
+ * N is bound to the Nth CPU of the list, wrapping around if there are more
+ * threads than CPUs:
+ *
+ * - auto: all the CPUs MaxScale may run on, taking one CPU from each NUMA
+ *   node in turn so that the threads are spread evenly over the nodes
+ * - irq:<interface>: the CPUs that handle the interrupts of the network
+ *   interface first, then the other CPUs of their nodes and then the rest
+ * - a list of CPUs such as 0-3,8: the listed CPUs in ascending order
+ *
+ * A bound thread sets its memory policy to local allocation. Together with
+ * the per-thread arenas of malloc this makes the memory it allocates come
+ * from the node of its CPU.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <affinity.h>
+#include <maxconfig.h>
+#include <log_manager.h>
+#include <platform.h>
+#include <dcb.h>
+
+#define AFFINITY_NODE_PATH      "/sys/devices/system/node"
+#define AFFINITY_INTERRUPTS     "/proc/interrupts"
+
+static int n_nodes = 1;                 /*< Number of NUMA nodes */
+static int cpu_node[CPU_SETSIZE];       /*< The NUMA node of each CPU */
+static cpu_set_t process_cpus;          /*< The CPUs MaxScale was allowed to use */
+static int *thread_cpu = NULL;          /*< The CPU of each polling thread, -1 if not bound */
+static int n_thread_cpu = 0;            /*< Number of entries in thread_cpu */
+
+static thread_local int current_cpu = -1;   /*< The CPU the thread is bound to */
+static thread_local int current_node = -1;  /*< The node of that CPU */
+
+/**
+ * Parse a list of CPUs in the format used by the kernel, for example 0-3,8
+ *
+ * @param str   The list
+ * @param set   The set to fill
+ * @return      Number of CPUs in the list or -1 if the list is malformed
+ */
+int
+affinity_parse_cpulist(const char *str, cpu_set_t *set)
+{
+    const char *ptr = str;
+
+    CPU_ZERO(set);
+
+    while (isspace(*ptr))
+    {
+        ptr++;
+    }
+
+    while (*ptr)
+    {
+        char *end;
+        long first, last;
+
+        if (!isdigit(*ptr))
+        {
+            return -1;
+        }
+        first = last = strtol(ptr, &end, 10);
+        ptr = end;
+
+        if (*ptr == '-')
+        {
+            ptr++;
+            if (!isdigit(*ptr))
+            {
+                return -1;
+            }
+            last = strtol(ptr, &end, 10);
+            ptr = end;
+        }
+
+        if (first > last || last >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, set);
+        }
+
+        if (*ptr == ',')
+        {
+            ptr++;
+        }
+        else
+        {
+            while (isspace(*ptr))
+            {
+                ptr++;
+            }
+            if (*ptr)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return CPU_COUNT(set);
+}
+
+/**
+ * Read a list of CPUs from a file
+ *
+ * @param path  The file
+ * @param set   The set to fill
+ * @return      Number of CPUs in the list or -1 on error
+ */
+static int
+affinity_read_cpulist(const char *path, cpu_set_t *set)
+{
+    FILE *file;
+    char *line = NULL;
+    size_t size = 0;
+    int rval = -1;
+
+    if ((file = fopen(path, "r")) != NULL)
+    {
+        if (getline(&line, &size, file) != -1)
+        {
+            rval = affinity_parse_cpulist(line, set);
+        }
+        free(line);
+        fclose(file);
+    }
+
+    return rval;
+}
+
+/**
+ * Read the NUMA node of each CPU. Without NUMA support all CPUs are on node 0.
+ */
+static void
+affinity_read_topology()
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    if ((dir = opendir(AFFINITY_NODE_PATH)) == NULL)
+    {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX];
+        cpu_set_t set;
+        int node;
+        char extra;
+
+        if (sscanf(entry->d_name, "node%d%c", &node, &extra) != 1)
+        {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s/cpulist", AFFINITY_NODE_PATH, entry->d_name);
+        if (affinity_read_cpulist(path, &set) > 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if (CPU_ISSET(cpu, &set))
+                {
+                    cpu_node[cpu] = node;
+                }
+            }
+        }
+        if (node >= n_nodes)
+        {
+            n_nodes = node + 1;
+        }
+    }
+
+    closedir(dir);
+}
+
+/**
+ * Check whether a line of /proc/interrupts belongs to a network interface.
+ * The interrupts of a multi-queue interface are named after the interface,
+ * for example eth0-TxRx-3.
+ *
+ * @param line  The line
+ * @param iface The name of the interface
+ * @return      True if the interface name is one of the words of the line
+ */
+static bool
+affinity_irq_matches(const char *line, const char *iface)
+{
+    size_t len = strlen(iface);
+    const char *ptr = line;
+
+    while ((ptr = strstr(ptr, iface)) != NULL)
+    {
+        bool start = ptr == line || isspace(ptr[-1]) || ptr[-1] == ',';
+        bool end = !isalnum(ptr[len]) && ptr[len] != '_' && ptr[len] != '.';
+
+        if (start && end)
+        {
+            return true;
+        }
+        ptr += len;
+    }
+
+    return false;
+}
+
+/**
+ * Find the CPUs that handle the interrupts of a network interface
+ *
+ * @param iface The name of the interface
+ * @param set   The set to fill
+ * @return      Number of CPUs found
+ */
+static int
+affinity_irq_cpus(const char *iface, cpu_set_t *set)
+{
+    FILE *file;
+    char *line = NULL;
+    size_t size = 0;
+
+    CPU_ZERO(set);
+
+    if ((file = fopen(AFFINITY_INTERRUPTS, "r")) == NULL)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("Failed to open %s: %d, %s", AFFINITY_INTERRUPTS,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        return 0;
+    }
+
+    while (getline(&line, &size, file) != -1)
+    {
+        char path[PATH_MAX];
+        cpu_set_t irq_set;
+        int irq;
+
+        if (sscanf(line, " %d:", &irq) == 1 && affinity_irq_matches(line, iface))
+        {
+            snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+            if (affinity_read_cpulist(path, &irq_set) > 0)
+            {
+                CPU_OR(set, set, &irq_set);
+            }
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    return CPU_COUNT(set);
+}
+
+/**
+ * Append the CPUs of a set to a list, taking one CPU from each NUMA node
+ * in turn
+ *
+ * @param set   The CPUs to append
+ * @param order The list
+ * @param n     Number of CPUs in the list
+ * @return      Number of CPUs in the list after appending
+ */
+static int
+affinity_spread(cpu_set_t *set, int *order, int n)
+{
+    int next[n_nodes];
+    bool added;
+
+    memset(next, 0, sizeof(next));
+
+    do
+    {
+        added = false;
+
+        for (int node = 0; node < n_nodes; node++)
+        {
+            while (next[node] < CPU_SETSIZE &&
+                   !(CPU_ISSET(next[node], set) && cpu_node[next[node]] == node))
+            {
+                next[node]++;
+            }
+            if (next[node] < CPU_SETSIZE)
+            {
+                order[n++] = next[node]++;
+                added = true;
+            }
+        }
+    }
+    while (added);
+
+    return n;
+}
+
+/**
+ * Order the CPUs for the polling threads of the irq:<interface> placement
+ *
+ * @param iface The name of the interface
+ * @param order The list to fill
+ * @return      Number of CPUs in the list
+ */
+static int
+affinity_irq_order(const char *iface, int *order)
+{
+    cpu_set_t irq_cpus, node_cpus, other_cpus;
+    bool irq_nodes[n_nodes];
+    int n = 0;
+
+    if (affinity_irq_cpus(iface, &irq_cpus) == 0)
+    {
+        MXS_WARNING("No interrupts of the network interface '%s' were found, "
+                    "spreading the polling threads over all CPUs.", iface);
+        return affinity_spread(&process_cpus, order, 0);
+    }
+
+    CPU_AND(&irq_cpus, &irq_cpus, &process_cpus);
+    memset(irq_nodes, 0, sizeof(irq_nodes));
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &irq_cpus))
+        {
+            irq_nodes[cpu_node[cpu]] = true;
+        }
+    }
+
+    CPU_ZERO(&node_cpus);
+    CPU_ZERO(&other_cpus);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &process_cpus) && !CPU_ISSET(cpu, &irq_cpus))
+        {
+            if (irq_nodes[cpu_node[cpu]])
+            {
+                CPU_SET(cpu, &node_cpus);
+            }
+            else
+            {
+                CPU_SET(cpu, &other_cpus);
+            }
+        }
+    }
+
+    n = affinity_spread(&irq_cpus, order, n);
+    n = affinity_spread(&node_cpus, order, n);
+    n = affinity_spread(&other_cpus, order, n);
+
+    return n;
+}
+
+/**
+ * Read the NUMA topology and choose the CPUs of the polling threads. This
+ * must be called before the polling threads are started.
+ *
+ * @param n_threads Number of polling threads
+ * @return          False if the thread_affinity parameter cannot be applied
+ */
+bool
+affinity_init(int n_threads)
+{
+    const char *value = config_thread_affinity();
+    int order[CPU_SETSIZE];
+    int n = 0;
+
+    affinity_read_topology();
+
+    if (sched_getaffinity(0, sizeof(process_cpus), &process_cpus) != 0)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("Failed to get the CPU affinity of MaxScale: %d, %s",
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        return false;
+    }
+
+    if (strcmp(value, "none") == 0)
+    {
+        return true;
+    }
+    else if (strcmp(value, "auto") == 0)
+    {
+        n = affinity_spread(&process_cpus, order, 0);
+    }
+    else if (strncmp(value, "irq:", 4) == 0)
+    {
+        n = affinity_irq_order(value + 4, order);
+    }
+    else
+    {
+        cpu_set_t set;
+
+        if (affinity_parse_cpulist(value, &set) <= 0)
+        {
+            MXS_ERROR("Invalid value for 'thread_affinity': %s", value);
+            return false;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                if (!CPU_ISSET(cpu, &process_cpus))
+                {
+                    MXS_ERROR("CPU %d of 'thread_affinity' is not available to MaxScale.", cpu);
+                    return false;
+                }
+                order[n++] = cpu;
+            }
+        }
+    }
+
+    if (n == 0)
+    {
+        MXS_ERROR("No CPUs were found for 'thread_affinity=%s'.", value);
+        return false;
+    }
+
+    if ((thread_cpu = malloc(n_threads * sizeof(int))) == NULL)
+    {
+        return false;
+    }
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_cpu[i] = order[i % n];
+    }
+    n_thread_cpu = n_threads;
+
+    if (n_threads > n)
+    {
+        MXS_WARNING("The %d polling threads share %d CPUs.", n_threads, n);
+    }
+    MXS_NOTICE("Binding the polling threads to CPUs, thread_affinity=%s, "
+               "%d NUMA node%s.", value, n_nodes, n_nodes > 1 ? "s" : "");
+
+    return true;
+}
+
+/**
+ * Bind the calling polling thread to its CPU and make it allocate memory
+ * from the NUMA node of the CPU
+ *
+ * @param thread_id The ID of the polling thread
+ */
+void
+affinity_thread_start(int thread_id)
+{
+    cpu_set_t set;
+    int cpu, rc;
+
+    if (thread_id >= n_thread_cpu || (cpu = thread_cpu[thread_id]) == -1)
+    {
+        return;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ((rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("Failed to bind polling thread %d to CPU %d: %d, %s",
+                  thread_id, cpu, rc, strerror_r(rc, errbuf, sizeof(errbuf)));
+        thread_cpu[thread_id] = -1;
+        return;
+    }
+
+    /** MaxScale may have been started with an interleaving memory policy */
+    if (n_nodes > 1 && syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) != 0)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_WARNING("Failed to set the memory policy of polling thread %d: %d, %s",
+                    thread_id, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+    }
+
+    current_cpu = cpu;
+    current_node = cpu_node[cpu];
+    MXS_INFO("Polling thread %d is bound to CPU %d on NUMA node %d.",
+             thread_id, cpu, current_node);
+}
+
+/**
+ * Let a thread started by a bound polling thread run on any of the CPUs
+ * MaxScale was started with instead of inheriting the CPU of the polling
+ * thread
+ *
+ * @param attr  The attributes of the new thread
+ */
+void
+affinity_thread_attr(pthread_attr_t *attr)
+{
+    if (current_cpu != -1)
+    {
+        pthread_attr_setaffinity_np(attr, sizeof(process_cpus), &process_cpus);
+    }
+}
+
+/**
+ * Return the NUMA node the calling thread runs on
+ *
+ * @return The node or -1 if it is not known
+ */
+int
+affinity_node()
+{
+    int cpu;
+
+    if (current_node != -1)
+    {
+        return current_node;
+    }
+    if (n_nodes == 1)
+    {
+        return 0;
+    }
+    return (cpu = sched_getcpu()) >= 0 && cpu < CPU_SETSIZE ? cpu_node[cpu] : -1;
+}
+
+/**
+ * Return the number of NUMA nodes
+ *
+ * @return Number of nodes
+ */
+int
+affinity_nodes()
+{
+    return n_nodes;
+}
+
+/**
+ * Print the CPU and NUMA node of each polling thread
+ *
+ * @param dcb   The DCB to print to
+ */
+void
+dprintAffinity(DCB *dcb)
+{
+    dcb_printf(dcb, "\nThread placement, thread_affinity=%s, %d NUMA node%s.\n\n",
+               config_thread_affinity(), n_nodes, n_nodes > 1 ? "s" : "");
+
+    if (thread_cpu == NULL)
+    {
+        dcb_printf(dcb, "The polling threads are not bound to CPUs.\n");
+        return;
+    }
+
+    dcb_printf(dcb, " ID | CPU  | NUMA node\n");
+    dcb_printf(dcb, "----+------+----------\n");
+    for (int i = 0; i < n_thread_cpu; i++)
+    {
+        if (thread_cpu[i] == -1)
+        {
+            dcb_printf(dcb, " %2d | None |\n", i);
+        }
+        else
+        {
+            dcb_printf(dcb, " %2d | %4d | %d\n", i, thread_cpu[i], cpu_node[thread_cpu[i]]);
+        }
+    }
+}
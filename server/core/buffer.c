@@ -121,6 +121,7 @@ gwbuf_alloc(unsigned int size)
     rval->gwbuf_type = GWBUF_TYPE_UNDEFINED;
     rval->gwbuf_info = GWBUF_INFO_NONE;
     rval->gwbuf_bufobj = NULL;
+    rval->stamp = 0;
     CHK_GWBUF(rval);
 retblock:
     if (rval == NULL)
@@ -349,6 +350,7 @@ gwbuf_clone(GWBUF *buf)
     rval->gwbuf_type = buf->gwbuf_type;
     rval->gwbuf_info = buf->gwbuf_info;
     rval->gwbuf_bufobj = buf->gwbuf_bufobj;
+    rval->stamp = buf->stamp;
     rval->tail = rval;
     rval->next = NULL;
     CHK_GWBUF(rval);
@@ -415,6 +417,7 @@ GWBUF *gwbuf_clone_portion(GWBUF *buf,
     clonebuf->hint = NULL;
     clonebuf->gwbuf_info = buf->gwbuf_info;
     clonebuf->gwbuf_bufobj = buf->gwbuf_bufobj;
+    clonebuf->stamp = buf->stamp;
     clonebuf->next = NULL;
     clonebuf->tail = clonebuf;
     CHK_GWBUF(clonebuf);
@@ -696,7 +699,10 @@ void gwbuf_add_buffer_object(GWBUF* buf,
     }
     *p_b = newb;
     /** Set flag */
-    buf->gwbuf_info |= GWBUF_INFO_PARSED;
+    if (id == GWBUF_PARSING_INFO)
+    {
+        buf->gwbuf_info |= GWBUF_INFO_PARSED;
+    }
     /** Unlock */
     spinlock_release(&buf->gwbuf_lock);
 }
@@ -826,6 +832,7 @@ gwbuf_make_contiguous(GWBUF *orig)
     {
         newbuf->gwbuf_type = orig->gwbuf_type;
         newbuf->hint = hint_dup(orig->hint);
+        newbuf->stamp = orig->stamp;
         ptr = GWBUF_DATA(newbuf);
 
         while (orig)
@@ -76,6 +76,7 @@
 #include <sys/utsname.h>
 #include <dbusers.h>
 #include <gw.h>
+#include <affinity.h>
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
 
@@ -154,6 +155,9 @@ static char *listener_params[] =
     "ssl_key",
     "ssl_version",
     "ssl_cert_verify_depth",
+    "ssl_session_cache_size",
+    "ssl_session_timeout",
+    "ssl_session_tickets",
     NULL
 };
 
@@ -174,6 +178,7 @@ static char *monitor_params[] =
     "backend_connect_timeout",
     "backend_read_timeout",
     "backend_write_timeout",
+    "probe_threads",
     "available_when_donor",
     "disable_master_role_setting",
     "use_priority",
@@ -865,6 +870,87 @@ config_pollsleep()
     return gateway.pollsleep;
 }
 
+/**
+ * Return whether the listeners should open one SO_REUSEPORT socket per
+ * polling thread.
+ *
+ * @return True if SO_REUSEPORT listeners are enabled
+ */
+bool
+config_reuseport()
+{
+    return gateway.reuseport;
+}
+
+/**
+ * Return the maximum number of client connections a listener accepts
+ * before it yields the thread to other events.
+ *
+ * @return The number of connections, 0 for no limit
+ */
+unsigned int
+config_accept_batch()
+{
+    return gateway.accept_batch;
+}
+
+/**
+ * Return whether the writes done while an event is processed are flushed
+ * once the processing of the event has finished.
+ *
+ * @return True if deferred flushing is enabled
+ */
+bool
+config_deferred_flush()
+{
+    return gateway.deferred_flush;
+}
+
+/**
+ * Return whether the latency of routed queries is traced
+ *
+ * @return True if query tracing is enabled
+ */
+bool
+config_query_trace()
+{
+    return gateway.query_trace;
+}
+
+/**
+ * Return the number of slowest queries that query tracing keeps
+ *
+ * @return The number of queries
+ */
+unsigned int
+config_query_trace_slowest()
+{
+    return gateway.query_trace_slowest;
+}
+
+/**
+ * Return how the polling threads are placed on CPUs
+ *
+ * @return "none", "auto", "irq:<interface>" or a list of CPUs
+ */
+const char*
+config_thread_affinity()
+{
+    return gateway.thread_affinity;
+}
+
+/**
+ * Return the name of the mechanism the polling threads use to wait for
+ * network I/O.
+ *
+ * @return "epoll" or "io_uring"
+ */
+const char*
+config_poll_backend()
+{
+    return gateway.poll_backend;
+}
+
 /**
  * Return the feedback config data pointer
  *
@@ -941,6 +1027,70 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.pollsleep = atoi(value);
     }
+    else if (strcmp(name, "reuseport") == 0)
+    {
+        gateway.reuseport = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "accept_batch") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.accept_batch = intval;
+        }
+        else
+        {
+            MXS_WARNING("Invalid value for 'accept_batch': %s", value);
+        }
+    }
+    else if (strcmp(name, "deferred_flush") == 0)
+    {
+        gateway.deferred_flush = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "query_trace") == 0)
+    {
+        gateway.query_trace = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "query_trace_slowest") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.query_trace_slowest = intval;
+        }
+        else
+        {
+            MXS_WARNING("Invalid value for 'query_trace_slowest': %s", value);
+        }
+    }
+    else if (strcmp(name, "thread_affinity") == 0)
+    {
+        cpu_set_t cpus;
+
+        if (strcmp(value, "none") == 0 || strcmp(value, "auto") == 0 ||
+            (strncmp(value, "irq:", 4) == 0 && value[4]) ||
+            affinity_parse_cpulist(value, &cpus) > 0)
+        {
+            snprintf(gateway.thread_affinity, sizeof(gateway.thread_affinity), "%s", value);
+        }
+        else
+        {
+            MXS_WARNING("Invalid value for 'thread_affinity': %s", value);
+        }
+    }
+    else if (strcmp(name, "poll_backend") == 0)
+    {
+        if (strcmp(value, "epoll") == 0 || strcmp(value, "io_uring") == 0)
+        {
+            strcpy(gateway.poll_backend, value);
+        }
+        else
+        {
+            MXS_WARNING("Invalid value for 'poll_backend': %s", value);
+        }
+    }
     else if (strcmp(name, "ms_timestamp") == 0)
     {
         mxs_log_set_highprecision_enabled(config_truth_value((char*)value));
@@ -1050,6 +1200,7 @@ static SSL_LISTENER *
 make_ssl_structure (CONFIG_CONTEXT *obj, bool require_cert, int *error_count)
 {
     char *ssl, *ssl_version, *ssl_cert, *ssl_key, *ssl_ca_cert, *ssl_cert_verify_depth;
+    char *ssl_session_cache_size, *ssl_session_timeout, *ssl_session_tickets;
     int local_errors = 0;
     SSL_LISTENER *new_ssl;
 
@@ -1069,7 +1220,13 @@ make_ssl_structure (CONFIG_CONTEXT *obj, bool require_cert, int *error_count)
             ssl_ca_cert = config_get_value(obj->parameters, "ssl_ca_cert");
             ssl_version = config_get_value(obj->parameters, "ssl_version");
             ssl_cert_verify_depth = config_get_value(obj->parameters, "ssl_cert_verify_depth");
+            ssl_session_cache_size = config_get_value(obj->parameters, "ssl_session_cache_size");
+            ssl_session_timeout = config_get_value(obj->parameters, "ssl_session_timeout");
+            ssl_session_tickets = config_get_value(obj->parameters, "ssl_session_tickets");
             new_ssl->ssl_init_done = false;
+            new_ssl->ssl_session_cache_size = DEFAULT_SSL_SESSION_CACHE_SIZE;
+            new_ssl->ssl_session_timeout = DEFAULT_SSL_SESSION_TIMEOUT;
+            new_ssl->ssl_session_tickets = true;
 
             if (ssl_version)
             {
@@ -1100,6 +1257,33 @@ make_ssl_structure (CONFIG_CONTEXT *obj, bool require_cert, int *error_count)
                 new_ssl->ssl_cert_verify_depth = 9;
             }
 
+            if (ssl_session_cache_size)
+            {
+                new_ssl->ssl_session_cache_size = atoi(ssl_session_cache_size);
+                if (new_ssl->ssl_session_cache_size < 0)
+                {
+                    MXS_ERROR("Invalid parameter value for 'ssl_session_cache_size'"
+                              " for service '%s': %s", obj->object, ssl_session_cache_size);
+                    local_errors++;
+                }
+            }
+
+            if (ssl_session_timeout)
+            {
+                new_ssl->ssl_session_timeout = atoi(ssl_session_timeout);
+                if (new_ssl->ssl_session_timeout <= 0)
+                {
+                    MXS_ERROR("Invalid parameter value for 'ssl_session_timeout'"
+                              " for service '%s': %s", obj->object, ssl_session_timeout);
+                    local_errors++;
+                }
+            }
+
+            if (ssl_session_tickets)
+            {
+                new_ssl->ssl_session_tickets = config_truth_value(ssl_session_tickets);
+            }
+
             listener_set_certificates(new_ssl, ssl_cert, ssl_key, ssl_ca_cert);
 
             if (require_cert && new_ssl->ssl_cert == NULL)
@@ -1219,6 +1403,13 @@ global_defaults()
     gateway.auth_conn_timeout = DEFAULT_AUTH_CONNECT_TIMEOUT;
     gateway.auth_read_timeout = DEFAULT_AUTH_READ_TIMEOUT;
     gateway.auth_write_timeout = DEFAULT_AUTH_WRITE_TIMEOUT;
+    gateway.reuseport = false;
+    gateway.accept_batch = DEFAULT_ACCEPT_BATCH;
+    strcpy(gateway.poll_backend, DEFAULT_POLL_BACKEND);
+    gateway.deferred_flush = true;
+    gateway.query_trace = false;
+    gateway.query_trace_slowest = DEFAULT_QUERY_TRACE_SLOWEST;
+    strcpy(gateway.thread_affinity, DEFAULT_THREAD_AFFINITY);
     if (version_string != NULL)
     {
         gateway.version_string = strdup(version_string);
@@ -2703,6 +2894,16 @@ int create_new_monitor(CONFIG_CONTEXT *context, CONFIG_CONTEXT *obj, HASHTABLE*
             }
         }
 
+        char *probe_threads = config_get_value(obj->parameters, "probe_threads");
+        if (probe_threads)
+        {
+            if (!monitorSetProbeThreads(obj->element, atoi(probe_threads)))
+            {
+                MXS_ERROR("Failed to set probe_threads");
+                error_count++;
+            }
+        }
+
         /* get the servers to monitor */
         char *s, *lasts;
         s = strtok_r(servers, ",", &lasts);
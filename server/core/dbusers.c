@@ -53,6 +53,9 @@
 #include <mysql_client_server_protocol.h>
 #include <mysqld_error.h>
 #include <regex.h>
+#include <rcu.h>
+#include <hk_heartbeat.h>
+#include <time.h>
 
 /** Don't include the root user */
 #define USERS_QUERY_NO_ROOT " AND user.user NOT IN ('root')"
@@ -111,6 +114,119 @@
 MaxScale authentication will proceed without including database permissions. \
 See earlier error messages for user '%s' for more information."
 
+/**
+ * Number of partitions the rows of the users query are divided into. A reload
+ * first fetches the row count and checksum of every partition and then only
+ * the rows of the partitions that have changed. The partition expression
+ * must agree with USERS_PARTITIONS.
+ */
+#define USERS_PARTITIONS 256
+#define USERS_PARTITION_EXPR "MOD(CRC32(CONCAT(user, '@', host)), 256)"
+
+/**
+ * The checksum of a partition is the XOR of a 64-bit MD5 prefix of each row.
+ * A linear hash such as CRC32 would let coordinated changes to the rows of
+ * a partition cancel out.
+ */
+#define MYSQL_USERS_PARTITION_QUERY "SELECT " USERS_PARTITION_EXPR " AS part, \
+    COUNT(1), BIT_XOR(CONV(SUBSTRING(MD5(COALESCE(userdata, '')), 1, 16), 16, 10)) \
+    FROM (%s) AS tbl GROUP BY part"
+
+#define MYSQL_USERS_PARTITION_ROWS_QUERY "SELECT tbl.*, " USERS_PARTITION_EXPR " AS part \
+    FROM (%s) AS tbl"
+
+#define MYSQL_USERS_PARTITION_WHERE " WHERE " USERS_PARTITION_EXPR " IN ("
+
+/** Number of columns in the users query with database grants */
+#define USERS_ROW_COLUMNS 6
+
+/** get_users() return value when no users have changed since the previous load */
+#define USERS_UNCHANGED -2
+
+/** get_users_partitioned() return value when the users must be loaded in full */
+#define USERS_LOAD_FALLBACK -3
+
+/**
+ * A row of the users query
+ */
+typedef struct mysql_users_row
+{
+    char *col[USERS_ROW_COLUMNS];
+    struct mysql_users_row *next;
+} MYSQL_USERS_ROW;
+
+/**
+ * The rows a users table was built from, kept for differential reloads
+ */
+typedef struct mysql_users_rows
+{
+    char *server;                           /*< The server the rows were loaded from */
+    uint32_t count[USERS_PARTITIONS];       /*< Number of rows in each partition */
+    uint64_t checksum[USERS_PARTITIONS];    /*< Checksum of the rows in each partition */
+    MYSQL_USERS_ROW *rows[USERS_PARTITIONS];
+} MYSQL_USERS_ROWS;
+
+/** Initial number of buckets in the user index, doubled as users are added */
+#define MYSQL_USER_INDEX_INITIAL_SIZE 64
+
+/**
+ * A grant in the host match index. Addresses are in host byte order.
+ */
+typedef struct mysql_host_grant
+{
+    uint32_t addr;                  /*< The granted address */
+    uint32_t mask;                  /*< The netmask of the grant */
+    char *resource;                 /*< NULL for no database grants, "" for any database */
+    char *auth;                     /*< The authentication data */
+    uint8_t password[SHA_DIGEST_LENGTH]; /*< The auth decoded to SHA1(SHA1(password)) */
+    struct mysql_host_grant *next;
+} MYSQL_HOST_GRANT;
+
+/**
+ * A node in the path compressed CIDR prefix trie of a user. The root node
+ * has a zero length prefix and holds the grants for any host.
+ */
+typedef struct mysql_host_node
+{
+    uint32_t prefix;                /*< The prefix, bits past len are zero */
+    int len;                        /*< Length of the prefix in bits */
+    MYSQL_HOST_GRANT *grants;       /*< Grants for exactly this prefix */
+    struct mysql_host_node *child[2];
+} MYSQL_HOST_NODE;
+
+/**
+ * A host with single-character wildcards, e.g. 192.168._.1
+ */
+typedef struct mysql_host_pattern
+{
+    char *pattern;
+    MYSQL_HOST_GRANT *grant;
+    struct mysql_host_pattern *next;
+} MYSQL_HOST_PATTERN;
+
+/**
+ * All host grants of one user
+ */
+typedef struct mysql_user_entry
+{
+    char *user;
+    unsigned int hash;
+    MYSQL_HOST_NODE root;           /*< The CIDR prefix trie */
+    MYSQL_HOST_PATTERN *patterns;   /*< Wildcard hosts in the order they were added */
+    MYSQL_HOST_PATTERN *last_pattern;
+    struct mysql_user_entry *next;
+} MYSQL_USER_ENTRY;
+
+/**
+ * The host match index of a MySQL users table, built as users are added
+ */
+typedef struct mysql_user_index
+{
+    MYSQL_USER_ENTRY **buckets;
+    unsigned int size;              /*< Number of buckets, a power of two */
+    unsigned int n_users;
+} MYSQL_USER_INDEX;
+
 static int add_databases(SERVICE *service, MYSQL *con);
 static int add_wildcard_users(USERS *users, char* name, char* host,
                               char* password, char* anydb, char* db, HASHTABLE* hash);
@@ -120,7 +236,13 @@ static void *dbusers_valueread(int fd);
 static int dbusers_valuewrite(int fd, void *value);
 static int get_all_users(SERVICE *service, USERS *users);
 static int get_databases(SERVICE *, MYSQL *);
-static int get_users(SERVICE *service, USERS *users);
+static int get_users(SERVICE *service, USERS *users, USERS *previous);
+static int get_users_partitioned(SERVICE *service, MYSQL *con, SERVER *server,
+                                 USERS *users, USERS *previous);
+static int add_user_row(SERVICE *service, USERS *users, char **row, bool db_grants,
+                        bool *anon_user);
+static void users_rows_free(void *data);
+static void users_reload_done(SERVICE *service, struct timespec *start, int result);
 static MYSQL *gw_mysql_init(void);
 static int gw_mysql_set_timeouts(MYSQL* handle);
 static bool host_has_singlechar_wildcard(const char *host);
@@ -133,11 +255,24 @@ static int resource_add(HASHTABLE *, char *, char *);
 static HASHTABLE *resource_alloc();
 static void *resource_fetch(HASHTABLE *, char *);
 static void resource_free(HASHTABLE *resource);
+static void users_free_deferred(void *data);
+static void resource_free_deferred(void *data);
 static int uh_cmpfun(void* v1, void* v2);
 static int uh_hfun(void* key);
 static void *uh_keydup(void* key);
 static void uh_keyfree(void* key);
 static int wildcard_db_grant(char* str);
+static bool resource_matches(const char *requested, const char *granted);
+static MYSQL_USER_INDEX *user_index_alloc();
+static void user_index_free(void *data);
+static bool user_index_add(MYSQL_USER_INDEX *index, MYSQL_USER_HOST *key, const char *auth);
+static bool user_index_build(USERS *users);
+static unsigned int user_index_hash(const char *user);
+static inline uint32_t host_prefix_mask(int len);
+static MYSQL_HOST_GRANT *host_grants_match(MYSQL_HOST_GRANT *grants, uint32_t addr,
+                                           const char *resource, bool exact);
+static MYSQL_HOST_GRANT *user_index_find(USERS *users, MYSQL_USER_HOST *key,
+                                         bool wildcard_hosts);
 
 /**
  * Get the user data query with databases
@@ -236,7 +371,7 @@ static bool host_matches_singlechar_wildcard(const char* user, const char* wild)
 int
 load_mysql_users(SERVICE *service)
 {
-    return get_users(service, service->users);
+    return get_users(service, service->users, NULL);
 }
 
 /**
@@ -252,6 +387,7 @@ reload_mysql_users(SERVICE *service)
     int i;
     USERS *newusers, *oldusers;
     HASHTABLE *oldresources;
+    struct timespec start;
 
     if ((newusers = mysql_users_alloc()) == NULL)
     {
@@ -260,19 +396,24 @@ reload_mysql_users(SERVICE *service)
 
     oldresources = service->resources;
 
-    i = get_users(service, newusers);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    i = get_users(service, newusers, NULL);
+    users_reload_done(service, &start, i);
 
     spinlock_acquire(&service->spin);
-    oldusers = service->users;
-
-    service->users = newusers;
-
+    oldusers = rcu_xchg_pointer(service->users, newusers);
     spinlock_release(&service->spin);
 
-    /* free the old table */
-    users_free(oldusers);
-    /* free old resources */
-    resource_free(oldresources);
+    /* The polling threads read the tables without locks, free them after
+     * all threads have passed a quiescent state */
+    if (oldusers)
+    {
+        rcu_call(users_free_deferred, oldusers);
+    }
+    if (oldresources && oldresources != service->resources)
+    {
+        rcu_call(resource_free_deferred, oldresources);
+    }
 
     return i;
 }
@@ -280,7 +421,9 @@ reload_mysql_users(SERVICE *service)
 /**
  * Replace the user/passwd form mysql.user table into the service users' hashtable
  * environment.
- * The replacement is succesful only if the users' table checksums differ
+ * The replacement is succesful only if the users' table checksums differ.
+ * Only the rows that have changed since the current table was loaded are
+ * fetched from the backend, the rest are taken from the current table.
  *
  * @param service   The current service
  * @return      -1 on any error or the number of users inserted (0 means no users at all)
@@ -291,6 +434,7 @@ replace_mysql_users(SERVICE *service)
     int i;
     USERS *newusers, *oldusers;
     HASHTABLE *oldresources;
+    struct timespec start;
 
     if ((newusers = mysql_users_alloc()) == NULL)
     {
@@ -300,13 +444,36 @@ replace_mysql_users(SERVICE *service)
     oldresources = service->resources;
 
     /* load db users ad db grants */
-    i = get_users(service, newusers);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    i = get_users(service, newusers, rcu_dereference(service->users));
+    users_reload_done(service, &start, i);
+
+    if (i == USERS_UNCHANGED)
+    {
+        MXS_DEBUG("%lu [replace_mysql_users] users' tables not switched, no rows have changed",
+                  pthread_self());
+        users_free(newusers);
+
+        /* the database names are always refreshed */
+        if (oldresources && oldresources != service->resources)
+        {
+            rcu_call(resource_free_deferred, oldresources);
+        }
+        return 0;
+    }
 
     if (i <= 0)
     {
+        HASHTABLE *newresources = service->resources;
+
         users_free(newusers);
         /* restore resources */
         service->resources = oldresources;
+
+        if (newresources && newresources != oldresources)
+        {
+            rcu_call(resource_free_deferred, newresources);
+        }
         return i;
     }
 
@@ -330,18 +497,20 @@ replace_mysql_users(SERVICE *service)
         /* replace the service with effective new data */
         MXS_DEBUG("%lu [replace_mysql_users] users' tables replaced, checksum differs",
                   pthread_self());
-        service->users = newusers;
+        rcu_assign_pointer(service->users, newusers);
     }
 
-    /* free old resources */
-    resource_free(oldresources);
-
     spinlock_release(&service->spin);
 
+    /* free the old tables once no polling thread can be reading them */
+    if (oldresources && oldresources != service->resources)
+    {
+        rcu_call(resource_free_deferred, oldresources);
+    }
+
     if (i && oldusers)
     {
-        /* free the old table */
-        users_free(oldusers);
+        rcu_call(users_free_deferred, oldusers);
     }
 
     return i;
@@ -1236,16 +1405,184 @@ cleanup:
     return total_users;
 }
 
+/**
+ * Add one row of the users query to a users table
+ *
+ * Up to six fields could be returned: user, host, passwd, concat(), anydb and db.
+ *
+ * @param service   The current service
+ * @param users     The users table into which to add the user
+ * @param row       The row
+ * @param db_grants Whether the row has the database grant fields
+ * @param anon_user Set to true if the row is for an anonymous user
+ * @return 1 if the user was added, -1 for a duplicate and 0 if it was not added
+ */
+static int
+add_user_row(SERVICE *service, USERS *users, char **row, bool db_grants, bool *anon_user)
+{
+    char dbnm[MYSQL_DATABASE_MAXLEN + 1];
+    char *password = NULL;
+    int rc = 0;
+
+    /** If the username is empty, the backend server still has anonymous
+     * user in it. This will mean that localhost addresses do not match
+     * the wildcard host '%' */
+    if (strlen(row[0]) == 0)
+    {
+        *anon_user = true;
+        return 0;
+    }
+
+    if (row[2] != NULL)
+    {
+        /* detect mysql_old_password (pre 4.1 protocol) */
+        if (strlen(row[2]) == 16)
+        {
+            MXS_ERROR("%s: The user %s@%s has on old password in the "
+                      "backend database. MaxScale does not support these "
+                      "old passwords. This user will not be able to connect "
+                      "via MaxScale. Update the users password to correct "
+                      "this.", service->name, row[0], row[1]);
+            return 0;
+        }
+
+        /* passwd+1 (escaping the first byte that is '*') */
+        if (strlen(row[2]) > 1)
+        {
+            password = row[2] + 1;
+        }
+        else
+        {
+            password = row[2];
+        }
+    }
+
+    /*
+     * add user@host and DB global priv and specificsa grant (if possible)
+     */
+    if (db_grants)
+    {
+        bool havedb = false;
+        /* we have dbgrants, store them */
+        if (row[5])
+        {
+            strncpy(dbnm, row[5], MYSQL_DATABASE_MAXLEN);
+            dbnm[MYSQL_DATABASE_MAXLEN] = '\0';
+            havedb = true;
+            if (service->strip_db_esc)
+            {
+                strip_escape_chars(dbnm);
+                MXS_DEBUG("[%s]: %s -> %s", service->name, row[5], dbnm);
+            }
+        }
+
+        if (havedb && wildcard_db_grant(row[5]))
+        {
+            if (service->optimize_wildcard)
+            {
+                rc = add_wildcard_users(users, row[0], row[1], password, row[4],
+                                        dbnm, service->resources);
+                MXS_INFO("%s: Converted '%s' to %d individual database grants.",
+                         service->name, row[5], rc);
+            }
+            else
+            {
+                /** Use ANYDB for wildcard grants */
+                rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
+                                                    password, "Y", NULL);
+            }
+        }
+        else
+        {
+            rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
+                                                password, row[4],
+                                                havedb ? dbnm : NULL);
+        }
+
+    }
+    else
+    {
+        /* we don't have dbgrants, simply set ANY DB for the user */
+        rc = add_mysql_users_with_host_ipv4(users, row[0], row[1], password,
+                                            "Y", NULL);
+    }
+
+    if (rc == 1)
+    {
+        if (db_grants)
+        {
+            char dbgrant[MYSQL_DATABASE_MAXLEN + 1] = "";
+            if (row[4] != NULL)
+            {
+                if (strcmp(row[4], "Y"))
+                {
+                    strcpy(dbgrant, "ANY");
+                }
+                else if (row[5])
+                {
+                    strncpy(dbgrant, row[5], MYSQL_DATABASE_MAXLEN);
+                }
+            }
+
+            if (!strlen(dbgrant))
+            {
+                strcpy(dbgrant, "no db");
+            }
+
+            /* Log the user being added with its db grants */
+            MXS_INFO("%s: User %s@%s for database %s added to "
+                     "service user table.",
+                     service->name,
+                     row[0],
+                     row[1],
+                     dbgrant);
+        }
+        else
+        {
+            /* Log the user being added (without db grants) */
+            MXS_INFO("%s: User %s@%s added to service user table.",
+                     service->name,
+                     row[0],
+                     row[1]);
+        }
+    }
+    else if (rc == -1)
+    {
+        /** Duplicate user*/
+        if (service->log_auth_warnings)
+        {
+            MXS_WARNING("Duplicate MySQL user found for "
+                        "service [%s]: %s@%s%s%s", service->name, row[0],
+                        row[1], db_grants ? " for database: " : "",
+                        db_grants ? row[5] : "");
+        }
+    }
+    else
+    {
+        if (service->log_auth_warnings)
+        {
+            MXS_WARNING("Failed to add user %s@%s for"
+                        " service [%s]. This user will be unavailable"
+                        " via MaxScale.", row[0], row[1], service->name);
+        }
+    }
+
+    return rc;
+}
+
 /**
  * Load the user/passwd form mysql.user table into the service users' hashtable
  * environment.
  *
  * @param service   The current service
  * @param users     The users table into which to load the users
- * @return          -1 on any error or the number of users inserted
+ * @param previous  The users table currently in use. If given, only the rows
+ *                  that have changed since it was loaded are fetched.
+ * @return          -1 on any error, USERS_UNCHANGED if nothing has changed since
+ *                  the previous table was loaded or the number of users inserted
  */
 static int
-get_users(SERVICE *service, USERS *users)
+get_users(SERVICE *service, USERS *users, USERS *previous)
 {
     MYSQL *con = NULL;
     MYSQL_ROW row;
@@ -1387,6 +1724,14 @@ get_users(SERVICE *service, USERS *users)
         }
     }
 
+    int rc = get_users_partitioned(service, con, server->server, users, previous);
+
+    if (rc != USERS_LOAD_FALLBACK)
+    {
+        mysql_close(con);
+        return rc;
+    }
+
     char querybuffer[MAX_QUERY_STR_LEN];
     const char *usercount = get_usercount_query(server->server->server_string,
                                                 service->enable_root, querybuffer);
@@ -1535,162 +1880,12 @@ get_users(SERVICE *service, USERS *users)
 
     while ((row = mysql_fetch_row(result)))
     {
-
-        /**
-         * Up to six fields could be returned.
-         * user,host,passwd,concat(),anydb,db
-         * passwd+1 (escaping the first byte that is '*')
-         */
-
-        int rc = 0;
-        char *password = NULL;
-
-        /** If the username is empty, the backend server still has anonymous
-         * user in it. This will mean that localhost addresses do not match
-         * the wildcard host '%' */
-        if (strlen(row[0]) == 0)
-        {
-            anon_user = true;
-            continue;
-        }
-
-        if (row[2] != NULL)
-        {
-            /* detect mysql_old_password (pre 4.1 protocol) */
-            if (strlen(row[2]) == 16)
-            {
-                MXS_ERROR("%s: The user %s@%s has on old password in the "
-                          "backend database. MaxScale does not support these "
-                          "old passwords. This user will not be able to connect "
-                          "via MaxScale. Update the users password to correct "
-                          "this.", service->name, row[0], row[1]);
-                continue;
-            }
-
-            if (strlen(row[2]) > 1)
-            {
-                password = row[2] + 1;
-            }
-            else
-            {
-                password = row[2];
-            }
-        }
-
-        /*
-         * add user@host and DB global priv and specificsa grant (if possible)
-         */
-        if (db_grants)
-        {
-            bool havedb = false;
-            /* we have dbgrants, store them */
-            if (row[5])
-            {
-                unsigned long *rowlen = mysql_fetch_lengths(result);
-                memcpy(dbnm, row[5], rowlen[5]);
-                memset(dbnm + rowlen[5], 0, 1);
-                havedb = true;
-                if (service->strip_db_esc)
-                {
-                    strip_escape_chars(dbnm);
-                    MXS_DEBUG("[%s]: %s -> %s", service->name, row[5], dbnm);
-                }
-            }
-
-            if (havedb && wildcard_db_grant(row[5]))
-            {
-                if (service->optimize_wildcard)
-                {
-                    rc = add_wildcard_users(users, row[0], row[1], password, row[4],
-                                            dbnm, service->resources);
-                    MXS_INFO("%s: Converted '%s' to %d individual database grants.",
-                             service->name, row[5], rc);
-                }
-                else
-                {
-                    /** Use ANYDB for wildcard grants */
-                    rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
-                                                        password, "Y", NULL);
-                }
-            }
-            else
-            {
-                rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
-                                                    password, row[4],
-                                                    havedb ? dbnm : NULL);
-            }
-
-        }
-        else
-        {
-            /* we don't have dbgrants, simply set ANY DB for the user */
-            rc = add_mysql_users_with_host_ipv4(users, row[0], row[1], password,
-                                                "Y", NULL);
-        }
-
-        if (rc == 1)
+        if (add_user_row(service, users, row, db_grants, &anon_user) == 1)
         {
-            if (db_grants)
-            {
-                char dbgrant[MYSQL_DATABASE_MAXLEN + 1] = "";
-                if (row[4] != NULL)
-                {
-                    if (strcmp(row[4], "Y"))
-                    {
-                        strcpy(dbgrant, "ANY");
-                    }
-                    else if (row[5])
-                    {
-                        strncpy(dbgrant, row[5], MYSQL_DATABASE_MAXLEN);
-                    }
-                }
-
-                if (!strlen(dbgrant))
-                {
-                    strcpy(dbgrant, "no db");
-                }
-
-                /* Log the user being added with its db grants */
-                MXS_INFO("%s: User %s@%s for database %s added to "
-                         "service user table.",
-                         service->name,
-                         row[0],
-                         row[1],
-                         dbgrant);
-            }
-            else
-            {
-                /* Log the user being added (without db grants) */
-                MXS_INFO("%s: User %s@%s added to service user table.",
-                         service->name,
-                         row[0],
-                         row[1]);
-            }
-
             /* Append data in the memory area for SHA1 digest */
             strncat(users_data, row[3], users_data_row_len);
             total_users++;
         }
-        else if (rc == -1)
-        {
-            /** Duplicate user*/
-            if (service->log_auth_warnings)
-            {
-                MXS_WARNING("Duplicate MySQL user found for "
-                            "service [%s]: %s@%s%s%s", service->name, row[0],
-                            row[1], db_grants ? " for database: " : "",
-                            db_grants ? row[5] : "");
-            }
-        }
-        else
-        {
-            if (service->log_auth_warnings)
-            {
-                MXS_WARNING("Failed to add user %s@%s for"
-                            " service [%s]. This user will be unavailable"
-                            " via MaxScale.", row[0], row[1], service->name);
-            }
-        }
     }
 
     /* compute SHA1 digest for users' data */
@@ -1712,80 +1907,1005 @@ get_users(SERVICE *service, USERS *users)
 }
 
 /**
- * Allocate a new MySQL users table for mysql specific users@host as key
+ * Copy a row of the users query
  *
- *  @return The users table
+ * @param row The row
+ * @return The copy or NULL on memory allocation failure
  */
-USERS *
-mysql_users_alloc()
+static MYSQL_USERS_ROW *
+users_row_copy(char **row)
 {
-    USERS *rval;
+    MYSQL_USERS_ROW *copy = calloc(1, sizeof(MYSQL_USERS_ROW));
 
-    if ((rval = calloc(1, sizeof(USERS))) == NULL)
+    if (copy)
     {
-        return NULL;
+        for (int i = 0; i < USERS_ROW_COLUMNS; i++)
+        {
+            if (row[i] && (copy->col[i] = strdup(row[i])) == NULL)
+            {
+                while (i-- > 0)
+                {
+                    free(copy->col[i]);
+                }
+                free(copy);
+                return NULL;
+            }
+        }
     }
 
-    if ((rval->data = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE, uh_hfun,
-                                      uh_cmpfun)) == NULL)
+    return copy;
+}
+
+/**
+ * Free a list of rows
+ *
+ * @param row The first row
+ */
+static void
+users_row_list_free(MYSQL_USERS_ROW *row)
+{
+    while (row)
     {
-        free(rval);
-        return NULL;
+        MYSQL_USERS_ROW *next = row->next;
+
+        for (int i = 0; i < USERS_ROW_COLUMNS; i++)
+        {
+            free(row->col[i]);
+        }
+        free(row);
+        row = next;
     }
+}
 
-    /* set the MySQL user@host print routine for the debug interface */
+/**
+ * Free the rows a users table was built from
+ *
+ * @param data The rows
+ */
+static void
+users_rows_free(void *data)
+{
+    MYSQL_USERS_ROWS *rows = (MYSQL_USERS_ROWS *)data;
+
+    for (int i = 0; i < USERS_PARTITIONS; i++)
+    {
+        users_row_list_free(rows->rows[i]);
+    }
+    free(rows->server);
+    free(rows);
+}
+
+/**
+ * Load the users partition by partition and fetch only the partitions whose
+ * row count or checksum differ from those of the previous load.
+ *
+ * The partitions are computed by the backend from user@host so the rows of
+ * a user@host always land in the same partition. The rows are kept with the
+ * users table so that the next reload can reuse the partitions that have not
+ * changed.
+ *
+ * @param service   The current service
+ * @param con       Connection to the backend
+ * @param server    The backend server
+ * @param users     The users table into which to load the users
+ * @param previous  The users table currently in use or NULL for a full load
+ * @return The number of users inserted, USERS_UNCHANGED, -1 on error or
+ * USERS_LOAD_FALLBACK if the partition queries cannot be used
+ */
+static int
+get_users_partitioned(SERVICE *service, MYSQL *con, SERVER *server,
+                      USERS *users, USERS *previous)
+{
+    MYSQL_USERS_ROWS *old = previous ? previous->rows : NULL;
+    MYSQL_USERS_ROWS *rows;
+    MYSQL_USERS_ROW *tail[USERS_PARTITIONS] = {NULL};
+    bool changed[USERS_PARTITIONS];
+    char subquery[MAX_QUERY_STR_LEN];
+    char server_id[strlen(server->name) + 16];
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    bool anon_user = false;
+    int n_changed = 0;
+    int n_rows = 0;
+    int total_users = 0;
+    const char *password = strstr(server->server_string, "5.7.") ?
+        MYSQL57_PASSWORD : MYSQL_PASSWORD;
+
+    snprintf(subquery, sizeof(subquery), MYSQL_USERS_DB_QUERY_TEMPLATE "%s", password, password,
+             service->enable_root ? "" : USERS_QUERY_NO_ROOT);
+    snprintf(server_id, sizeof(server_id), "%s:%d", server->name, server->port);
+
+    size_t querylen = strlen(subquery) + strlen(MYSQL_USERS_PARTITION_QUERY) +
+        strlen(MYSQL_USERS_PARTITION_ROWS_QUERY) + strlen(MYSQL_USERS_PARTITION_WHERE) +
+        strlen(MYSQL_USERS_ORDER_BY) + USERS_PARTITIONS * 4 + 1;
+    char *query = malloc(querylen);
+
+    if (query == NULL || (rows = calloc(1, sizeof(MYSQL_USERS_ROWS))) == NULL)
+    {
+        free(query);
+        return -1;
+    }
+
+    if ((rows->server = strdup(server_id)) == NULL)
+    {
+        free(query);
+        users_rows_free(rows);
+        return -1;
+    }
+
+    /** Row count and checksum of each partition */
+    snprintf(query, querylen, MYSQL_USERS_PARTITION_QUERY, subquery);
+
+    if (mysql_query(con, query) || (result = mysql_store_result(con)) == NULL)
+    {
+        MXS_INFO("%s: Failed to load the users partition by partition, loading all "
+                 "users instead: %s", service->name, mysql_error(con));
+        free(query);
+        users_rows_free(rows);
+        return USERS_LOAD_FALLBACK;
+    }
+
+    while ((row = mysql_fetch_row(result)))
+    {
+        int part = row[0] ? atoi(row[0]) : -1;
+
+        if (part >= 0 && part < USERS_PARTITIONS)
+        {
+            rows->count[part] = strtoul(row[1], NULL, 10);
+            rows->checksum[part] = row[2] ? strtoull(row[2], NULL, 10) : 0;
+        }
+    }
+    mysql_free_result(result);
+
+    for (int i = 0; i < USERS_PARTITIONS; i++)
+    {
+        changed[i] = old == NULL || strcmp(old->server, rows->server) != 0 ||
+            old->count[i] != rows->count[i] || old->checksum[i] != rows->checksum[i];
+
+        if (changed[i])
+        {
+            n_changed++;
+        }
+    }
+
+    /* the checksum of the users' table is that of its partitions */
+    uint64_t digest_data[USERS_PARTITIONS * 2];
+    for (int i = 0; i < USERS_PARTITIONS; i++)
+    {
+        digest_data[i] = rows->count[i];
+    }
+    memcpy(digest_data + USERS_PARTITIONS, rows->checksum, sizeof(rows->checksum));
+    SHA1((const unsigned char *)digest_data, sizeof(digest_data), users->cksum);
+
+    /* load all mysql database names */
+    int dbnames = get_databases(service, con);
+    MXS_DEBUG("Loaded %d MySQL Database Names for service [%s]",
+              dbnames, service->name);
+
+    if (n_changed == 0)
+    {
+        free(query);
+        users_rows_free(rows);
+        return USERS_UNCHANGED;
+    }
+
+    /** Fetch the rows of the changed partitions */
+    int len = snprintf(query, querylen, MYSQL_USERS_PARTITION_ROWS_QUERY, subquery);
+
+    if (n_changed < USERS_PARTITIONS)
+    {
+        const char *sep = "";
+        len += snprintf(query + len, querylen - len, MYSQL_USERS_PARTITION_WHERE);
+
+        for (int i = 0; i < USERS_PARTITIONS; i++)
+        {
+            if (changed[i])
+            {
+                len += snprintf(query + len, querylen - len, "%s%d", sep, i);
+                sep = ",";
+            }
+        }
+        len += snprintf(query + len, querylen - len, ")");
+    }
+    snprintf(query + len, querylen - len, MYSQL_USERS_ORDER_BY);
+
+    if (mysql_query(con, query) || (result = mysql_store_result(con)) == NULL)
+    {
+        MXS_ERROR("Loading users for service [%s] encountered error: [%s].",
+                  service->name, mysql_error(con));
+        free(query);
+        users_rows_free(rows);
+        return -1;
+    }
+    free(query);
+
+    while ((row = mysql_fetch_row(result)))
+    {
+        int part = row[USERS_ROW_COLUMNS] ? atoi(row[USERS_ROW_COLUMNS]) : -1;
+        MYSQL_USERS_ROW *copy;
+
+        if (part < 0 || part >= USERS_PARTITIONS || !changed[part] || row[0] == NULL)
+        {
+            continue;
+        }
+
+        if ((copy = users_row_copy(row)) == NULL)
+        {
+            MXS_ERROR("Memory allocation for user data failed.");
+            mysql_free_result(result);
+            users_rows_free(rows);
+            return -1;
+        }
+
+        if (tail[part])
+        {
+            tail[part]->next = copy;
+        }
+        else
+        {
+            rows->rows[part] = copy;
+        }
+        tail[part] = copy;
+        n_rows++;
+    }
+    mysql_free_result(result);
+
+    /** Reuse the rows of the unchanged partitions */
+    for (int i = 0; i < USERS_PARTITIONS; i++)
+    {
+        if (changed[i])
+        {
+            continue;
+        }
+
+        for (MYSQL_USERS_ROW *prev = old->rows[i]; prev; prev = prev->next)
+        {
+            MYSQL_USERS_ROW *copy = users_row_copy(prev->col);
+
+            if (copy == NULL)
+            {
+                MXS_ERROR("Memory allocation for user data failed.");
+                users_rows_free(rows);
+                return -1;
+            }
+
+            if (tail[i])
+            {
+                tail[i]->next = copy;
+            }
+            else
+            {
+                rows->rows[i] = copy;
+            }
+            tail[i] = copy;
+        }
+    }
+
+    for (int i = 0; i < USERS_PARTITIONS; i++)
+    {
+        for (MYSQL_USERS_ROW *r = rows->rows[i]; r; r = r->next)
+        {
+            if (add_user_row(service, users, r->col, true, &anon_user) == 1)
+            {
+                total_users++;
+            }
+        }
+    }
+
+    /** Set the parameter if it is not configured by the user */
+    if (service->localhost_match_wildcard_host == SERVICE_PARAM_UNINIT)
+    {
+        service->localhost_match_wildcard_host = anon_user ? 0 : 1;
+    }
+
+    if (n_changed < USERS_PARTITIONS)
+    {
+        atomic_add(&service->users_stats.n_partial, 1);
+    }
+    service->users_stats.last_rows = n_rows;
+    service->users_stats.rows += n_rows;
+
+    MXS_INFO("%s: Loaded %d rows from %d of %d partitions of the users.",
+             service->name, n_rows, n_changed, USERS_PARTITIONS);
+
+    users->rows = rows;
+    users->rowsFree = users_rows_free;
+
+    return total_users;
+}
+
+/**
+ * Update the reload statistics of a service
+ *
+ * @param service The service
+ * @param start   When the reload started
+ * @param result  The return value of get_users()
+ */
+static void
+users_reload_done(SERVICE *service, struct timespec *start, int result)
+{
+    SERVICE_USERS_STATS *stats = &service->users_stats;
+    struct timespec end;
+    int ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms = (end.tv_sec - start->tv_sec) * 1000 + (end.tv_nsec - start->tv_nsec) / 1000000;
+
+    if (result == USERS_UNCHANGED)
+    {
+        atomic_add(&stats->n_unchanged, 1);
+    }
+    else if (result < 0)
+    {
+        atomic_add(&stats->n_failed, 1);
+    }
+    else
+    {
+        atomic_add(&stats->n_reloads, 1);
+    }
+
+    stats->last_ms = ms;
+    stats->total_ms += ms;
+
+    if (ms > stats->max_ms)
+    {
+        stats->max_ms = ms;
+    }
+
+    stats->completed = hkheartbeat;
+}
+
+/**
+ * Allocate a new MySQL users table for mysql specific users@host as key
+ *
+ *  @return The users table
+ */
+USERS *
+mysql_users_alloc()
+{
+    USERS *rval;
+
+    if ((rval = calloc(1, sizeof(USERS))) == NULL)
+    {
+        return NULL;
+    }
+
+    if ((rval->data = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE, uh_hfun,
+                                      uh_cmpfun)) == NULL)
+    {
+        free(rval);
+        return NULL;
+    }
+
+    if ((rval->index = user_index_alloc()) == NULL)
+    {
+        hashtable_free(rval->data);
+        free(rval);
+        return NULL;
+    }
+    rval->indexFree = user_index_free;
+
+    /* set the MySQL user@host print routine for the debug interface */
     rval->usersCustomUserFormat = mysql_format_user_entry;
 
-    /* the key is handled by uh_keydup/uh_keyfree.
-     * the value is a (char *): it's handled by strdup/free
-     */
-    hashtable_memory_fns(rval->data, (HASHMEMORYFN) uh_keydup,
-                         (HASHMEMORYFN) strdup, (HASHMEMORYFN) uh_keyfree,
-                         (HASHMEMORYFN) free);
+    /* the key is handled by uh_keydup/uh_keyfree.
+     * the value is a (char *): it's handled by strdup/free
+     */
+    hashtable_memory_fns(rval->data, (HASHMEMORYFN) uh_keydup,
+                         (HASHMEMORYFN) strdup, (HASHMEMORYFN) uh_keyfree,
+                         (HASHMEMORYFN) free);
+
+    return rval;
+}
+
+/**
+ * Add a new MySQL user to the user table. The user name must be unique
+ *
+ * @param users     The users table
+ * @param user      The user name
+ * @param auth      The authentication data
+ * @return          The number of users added to the table
+ */
+int
+mysql_users_add(USERS *users, MYSQL_USER_HOST *key, char *auth)
+{
+    int add;
+
+    if (key == NULL || key->user == NULL)
+    {
+        return 0;
+    }
+
+    atomic_add(&users->stats.n_adds, 1);
+    add = hashtable_add(users->data, key, auth);
+
+    if (add && users->index && !user_index_add(users->index, key, auth))
+    {
+        /** The new entry is the only one that compares equal to the key */
+        hashtable_delete(users->data, key);
+        add = 0;
+    }
+    atomic_add(&users->stats.n_entries, add);
+
+    return add;
+}
+
+/**
+ * Fetch the authentication data for a particular user from the users table
+ *
+ * A published users table is never modified, it is replaced as a whole by
+ * reload_mysql_users() and replace_mysql_users(). The lookup therefore takes
+ * no locks and does not touch any shared counters.
+ *
+ * @param users The MySQL users table
+ * @param key   The key with user@host
+ * @return  The authentication data or NULL on error
+ */
+char *mysql_users_fetch(USERS *users, MYSQL_USER_HOST *key)
+{
+    if (users == NULL || key == NULL)
+    {
+        return NULL;
+    }
+    return hashtable_fetch_nolock(users->data, key);
+}
+
+/**
+ * Find the authentication data for a client from the users table
+ *
+ * @param users          The MySQL users table
+ * @param key            The client user, address, hostname and database
+ * @param wildcard_hosts If false, only grants for the exact client address match
+ * @return The authentication data or NULL if no grant matches
+ * @see user_index_find
+ */
+char *mysql_users_find(USERS *users, MYSQL_USER_HOST *key, bool wildcard_hosts)
+{
+    MYSQL_HOST_GRANT *grant = user_index_find(users, key, wildcard_hosts);
+    return grant ? grant->auth : NULL;
+}
+
+/**
+ * Find the SHA1(SHA1(password)) of a client from the users table
+ *
+ * The digest is decoded from the hexadecimal authentication data when the
+ * user is added so a login does not need to convert it.
+ *
+ * @param users          The MySQL users table
+ * @param key            The client user, address, hostname and database
+ * @param wildcard_hosts If false, only grants for the exact client address match
+ * @param password       Buffer of SHA_DIGEST_LENGTH bytes where the digest is
+ *                       copied, all zeros for a user without a password
+ * @return True if a grant matched
+ * @see user_index_find
+ */
+bool mysql_users_find_password(USERS *users, MYSQL_USER_HOST *key, bool wildcard_hosts,
+                               uint8_t *password)
+{
+    MYSQL_HOST_GRANT *grant = user_index_find(users, key, wildcard_hosts);
+
+    if (grant)
+    {
+        memcpy(password, grant->password, SHA_DIGEST_LENGTH);
+    }
+
+    return grant != NULL;
+}
+
+/**
+ * Find the grant that matches a client
+ *
+ * The grants of the user are searched from the most specific to the least
+ * specific: the longest matching IPv4 prefix first, then the hosts with
+ * single-character wildcards and finally the grants for any host. The cost
+ * of the lookup depends only on the length of the address, not on the
+ * number of grants.
+ *
+ * @param users          The MySQL users table
+ * @param key            The client user, address, hostname and database
+ * @param wildcard_hosts If false, only grants for the exact client address match
+ * @return The matching grant or NULL if no grant matches
+ */
+static MYSQL_HOST_GRANT *user_index_find(USERS *users, MYSQL_USER_HOST *key,
+                                         bool wildcard_hosts)
+{
+    MYSQL_USER_INDEX *index;
+    MYSQL_USER_ENTRY *entry;
+    MYSQL_HOST_NODE *path[33];
+    MYSQL_HOST_NODE *node;
+    MYSQL_HOST_PATTERN *pattern;
+    uint32_t addr;
+    int depth = 0;
+
+    if (users == NULL || key == NULL || key->user == NULL ||
+        (index = users->index) == NULL)
+    {
+        return NULL;
+    }
+
+    unsigned int hash = user_index_hash(key->user);
+
+    for (entry = index->buckets[hash & (index->size - 1)]; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && strcmp(entry->user, key->user) == 0)
+        {
+            break;
+        }
+    }
+
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    addr = ntohl(key->ipv4.sin_addr.s_addr);
+
+    /** Collect the nodes whose prefix covers the address */
+    for (node = &entry->root; node && (addr & host_prefix_mask(node->len)) == node->prefix;
+         node = node->child[(addr >> (31 - node->len)) & 1])
+    {
+        path[depth++] = node;
+
+        if (node->len == 32)
+        {
+            break;
+        }
+    }
+
+    if (!wildcard_hosts)
+    {
+        /** Only grants for exactly this address */
+        while (--depth >= 0)
+        {
+            MYSQL_HOST_GRANT *grant = host_grants_match(path[depth]->grants, addr,
+                                                        key->resource, true);
+
+            if (grant)
+            {
+                return grant;
+            }
+        }
+
+        return NULL;
+    }
+
+    /** Longest prefix first, the root is checked last */
+    while (--depth > 0)
+    {
+        MYSQL_HOST_GRANT *grant = host_grants_match(path[depth]->grants, addr,
+                                                    key->resource, false);
+
+        if (grant)
+        {
+            return grant;
+        }
+    }
+
+    if (*key->hostname)
+    {
+        for (pattern = entry->patterns; pattern; pattern = pattern->next)
+        {
+            if (host_matches_singlechar_wildcard(key->hostname, pattern->pattern) &&
+                resource_matches(key->resource, pattern->grant->resource))
+            {
+                return pattern->grant;
+            }
+        }
+    }
+
+    return host_grants_match(entry->root.grants, addr, key->resource, false);
+}
+
+/**
+ * Hash a user name for the host match index
+ *
+ * @param user The user name
+ * @return The hash value
+ */
+static unsigned int user_index_hash(const char *user)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*user)
+    {
+        hash = (hash ^ (unsigned char)*user++) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Return the netmask for a prefix length
+ *
+ * @param len Prefix length in bits
+ * @return The netmask in host byte order
+ */
+static inline uint32_t host_prefix_mask(int len)
+{
+    return len <= 0 ? 0 : 0xFFFFFFFFu << (32 - len);
+}
+
+/**
+ * Find the first grant in a list that matches the address and database
+ *
+ * @param grants   List of grants
+ * @param addr     Client address in host byte order
+ * @param resource The database the client requested
+ * @param exact    Only match grants for exactly this address
+ * @return The first matching grant or NULL if none matched
+ */
+static MYSQL_HOST_GRANT *host_grants_match(MYSQL_HOST_GRANT *grants, uint32_t addr,
+                                           const char *resource, bool exact)
+{
+    for (MYSQL_HOST_GRANT *grant = grants; grant; grant = grant->next)
+    {
+        if ((exact ? addr == grant->addr : (addr & grant->mask) == grant->addr) &&
+            resource_matches(resource, grant->resource))
+        {
+            return grant;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Free a list of grants
+ *
+ * @param grant The first grant in the list
+ */
+static void host_grants_free(MYSQL_HOST_GRANT *grant)
+{
+    while (grant)
+    {
+        MYSQL_HOST_GRANT *next = grant->next;
+        free(grant->resource);
+        free(grant->auth);
+        free(grant);
+        grant = next;
+    }
+}
+
+/**
+ * Free the children of a trie node and the grants stored in them
+ *
+ * @param node The trie node
+ */
+static void host_node_free_children(MYSQL_HOST_NODE *node)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (node->child[i])
+        {
+            host_node_free_children(node->child[i]);
+            host_grants_free(node->child[i]->grants);
+            free(node->child[i]);
+        }
+    }
+}
 
-    return rval;
+/**
+ * Allocate a trie node
+ *
+ * @param prefix The prefix, bits past len must be zero
+ * @param len    Length of the prefix in bits
+ * @return The new node or NULL on memory allocation failure
+ */
+static MYSQL_HOST_NODE *host_node_alloc(uint32_t prefix, int len)
+{
+    MYSQL_HOST_NODE *node = calloc(1, sizeof(MYSQL_HOST_NODE));
+
+    if (node)
+    {
+        node->prefix = prefix;
+        node->len = len;
+    }
+
+    return node;
 }
 
 /**
- * Add a new MySQL user to the user table. The user name must be unique
+ * Find or create the trie node for a prefix. Nodes are only created where
+ * prefixes branch, so the trie has at most two nodes per grant.
  *
- * @param users     The users table
- * @param user      The user name
- * @param auth      The authentication data
- * @return          The number of users added to the table
+ * @param root   The root of the trie
+ * @param prefix The prefix, bits past len must be zero
+ * @param len    Length of the prefix in bits
+ * @return The node for the prefix or NULL on memory allocation failure
  */
-int
-mysql_users_add(USERS *users, MYSQL_USER_HOST *key, char *auth)
+static MYSQL_HOST_NODE *host_trie_insert(MYSQL_HOST_NODE *root, uint32_t prefix, int len)
 {
-    int add;
+    MYSQL_HOST_NODE *node = root;
 
-    if (key == NULL || key->user == NULL)
+    while (node->len < len)
     {
-        return 0;
+        int bit = (prefix >> (31 - node->len)) & 1;
+        MYSQL_HOST_NODE *child = node->child[bit];
+
+        if (child == NULL)
+        {
+            return (node->child[bit] = host_node_alloc(prefix, len));
+        }
+
+        /** Length of the common prefix of the child and the new prefix */
+        uint32_t diff = (prefix ^ child->prefix) & host_prefix_mask(MIN(len, child->len));
+        int common = diff ? __builtin_clz(diff) : MIN(len, child->len);
+
+        if (common < child->len)
+        {
+            /** Split the edge to the child */
+            MYSQL_HOST_NODE *split = host_node_alloc(prefix & host_prefix_mask(common), common);
+
+            if (split == NULL)
+            {
+                return NULL;
+            }
+
+            split->child[(child->prefix >> (31 - common)) & 1] = child;
+            node->child[bit] = split;
+            child = split;
+        }
+
+        node = child;
     }
 
-    atomic_add(&users->stats.n_adds, 1);
-    add = hashtable_add(users->data, key, auth);
-    atomic_add(&users->stats.n_entries, add);
+    return node;
+}
 
-    return add;
+/**
+ * Allocate the host match index for a MySQL users table
+ *
+ * @return The new index or NULL on memory allocation failure
+ */
+static MYSQL_USER_INDEX *user_index_alloc()
+{
+    MYSQL_USER_INDEX *index = calloc(1, sizeof(MYSQL_USER_INDEX));
+
+    if (index)
+    {
+        if ((index->buckets = calloc(MYSQL_USER_INDEX_INITIAL_SIZE,
+                                     sizeof(MYSQL_USER_ENTRY *))) == NULL)
+        {
+            free(index);
+            return NULL;
+        }
+        index->size = MYSQL_USER_INDEX_INITIAL_SIZE;
+    }
+
+    return index;
 }
 
 /**
- * Fetch the authentication data for a particular user from the users table
+ * Free the host match index of a MySQL users table
  *
- * @param users The MySQL users table
- * @param key   The key with user@host
- * @return  The authentication data or NULL on error
+ * @param data The index
  */
-char *mysql_users_fetch(USERS *users, MYSQL_USER_HOST *key)
+static void user_index_free(void *data)
 {
-    if (key == NULL)
+    MYSQL_USER_INDEX *index = (MYSQL_USER_INDEX *)data;
+
+    for (unsigned int i = 0; i < index->size; i++)
+    {
+        MYSQL_USER_ENTRY *entry = index->buckets[i];
+
+        while (entry)
+        {
+            MYSQL_USER_ENTRY *next = entry->next;
+            MYSQL_HOST_PATTERN *pattern = entry->patterns;
+
+            while (pattern)
+            {
+                MYSQL_HOST_PATTERN *pnext = pattern->next;
+                host_grants_free(pattern->grant);
+                free(pattern->pattern);
+                free(pattern);
+                pattern = pnext;
+            }
+
+            host_node_free_children(&entry->root);
+            host_grants_free(entry->root.grants);
+            free(entry->user);
+            free(entry);
+            entry = next;
+        }
+    }
+
+    free(index->buckets);
+    free(index);
+}
+
+/**
+ * Find the index entry of a user, creating it if it does not exist
+ *
+ * @param index The host match index
+ * @param user  The user name
+ * @return The entry or NULL on memory allocation failure
+ */
+static MYSQL_USER_ENTRY *user_index_get(MYSQL_USER_INDEX *index, const char *user)
+{
+    unsigned int hash = user_index_hash(user);
+    MYSQL_USER_ENTRY *entry;
+
+    for (entry = index->buckets[hash & (index->size - 1)]; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && strcmp(entry->user, user) == 0)
+        {
+            return entry;
+        }
+    }
+
+    if (index->n_users >= index->size)
+    {
+        /** Keep the chains short by doubling the number of buckets */
+        unsigned int size = index->size * 2;
+        MYSQL_USER_ENTRY **buckets = calloc(size, sizeof(MYSQL_USER_ENTRY *));
+
+        if (buckets)
+        {
+            for (unsigned int i = 0; i < index->size; i++)
+            {
+                while ((entry = index->buckets[i]))
+                {
+                    index->buckets[i] = entry->next;
+                    entry->next = buckets[entry->hash & (size - 1)];
+                    buckets[entry->hash & (size - 1)] = entry;
+                }
+            }
+
+            free(index->buckets);
+            index->buckets = buckets;
+            index->size = size;
+        }
+    }
+
+    if ((entry = calloc(1, sizeof(MYSQL_USER_ENTRY))) == NULL ||
+        (entry->user = strdup(user)) == NULL)
     {
+        free(entry);
         return NULL;
     }
-    atomic_add(&users->stats.n_fetches, 1);
-    return hashtable_fetch(users->data, key);
+
+    entry->hash = hash;
+    entry->next = index->buckets[hash & (index->size - 1)];
+    index->buckets[hash & (index->size - 1)] = entry;
+    index->n_users++;
+
+    return entry;
+}
+
+/**
+ * Add a user@host to the host match index
+ *
+ * @param index The host match index
+ * @param key   The user@host as stored in the users table
+ * @param auth  The authentication data
+ * @return True on success, false on memory allocation failure
+ */
+static bool user_index_add(MYSQL_USER_INDEX *index, MYSQL_USER_HOST *key, const char *auth)
+{
+    MYSQL_USER_ENTRY *entry;
+    MYSQL_HOST_GRANT *grant;
+    MYSQL_HOST_GRANT **list;
+
+    if ((entry = user_index_get(index, key->user)) == NULL ||
+        (grant = calloc(1, sizeof(MYSQL_HOST_GRANT))) == NULL)
+    {
+        return false;
+    }
+
+    if ((grant->auth = strdup(auth)) == NULL ||
+        (key->resource && (grant->resource = strdup(key->resource)) == NULL))
+    {
+        host_grants_free(grant);
+        return false;
+    }
+
+    /** The hexadecimal SHA1(SHA1(password)) without the leading '*' */
+    size_t auth_len = strlen(auth);
+
+    if (auth_len)
+    {
+        gw_hex2bin(grant->password, auth,
+                   MIN(auth_len, SHA_DIGEST_LENGTH * 2));
+    }
+
+    if (*key->hostname)
+    {
+        MYSQL_HOST_PATTERN *pattern = calloc(1, sizeof(MYSQL_HOST_PATTERN));
+
+        if (pattern == NULL || (pattern->pattern = strdup(key->hostname)) == NULL)
+        {
+            free(pattern);
+            host_grants_free(grant);
+            return false;
+        }
+
+        pattern->grant = grant;
+
+        if (entry->last_pattern)
+        {
+            entry->last_pattern->next = pattern;
+        }
+        else
+        {
+            entry->patterns = pattern;
+        }
+        entry->last_pattern = pattern;
+        return true;
+    }
+
+    int len = key->netmask < 0 ? 0 : key->netmask > 32 ? 32 : key->netmask;
+    MYSQL_HOST_NODE *node;
+
+    grant->mask = host_prefix_mask(len);
+    grant->addr = ntohl(key->ipv4.sin_addr.s_addr);
+
+    if ((node = host_trie_insert(&entry->root, grant->addr & grant->mask, len)) == NULL)
+    {
+        host_grants_free(grant);
+        return false;
+    }
+
+    /** Keep the grants of a node in the order they were added */
+    for (list = &node->grants; *list; list = &(*list)->next)
+    {
+        ;
+    }
+    *list = grant;
+
+    return true;
+}
+
+/**
+ * Build the host match index for a users table that was filled without
+ * mysql_users_add(), e.g. loaded from a file
+ *
+ * @param users The MySQL users table
+ * @return True on success
+ */
+static bool user_index_build(USERS *users)
+{
+    MYSQL_USER_INDEX *index;
+    HASHITERATOR *iter;
+    MYSQL_USER_HOST *key;
+    bool rval = true;
+
+    if ((index = user_index_alloc()) == NULL ||
+        (iter = hashtable_iterator(users->data)) == NULL)
+    {
+        if (index)
+        {
+            user_index_free(index);
+        }
+        return false;
+    }
+
+    while (rval && (key = hashtable_next(iter)))
+    {
+        char *auth = hashtable_fetch(users->data, key);
+
+        if (auth && !user_index_add(index, key, auth))
+        {
+            rval = false;
+        }
+    }
+
+    hashtable_iterator_free(iter);
+
+    if (!rval)
+    {
+        user_index_free(index);
+        return false;
+    }
+
+    if (users->index)
+    {
+        users->indexFree(users->index);
+    }
+    users->index = index;
+    users->indexFree = user_index_free;
+
+    return true;
 }
 
 /**
@@ -1848,73 +2968,78 @@ static int uh_cmpfun(void* v1, void* v2)
          (!wildcard_host && (hu1->ipv4.sin_addr.s_addr == hu2->ipv4.sin_addr.s_addr) &&
           (hu1->netmask >= hu2->netmask))))
     {
-        /* if no database name was passed, auth is ok */
-        if (hu1->resource == NULL || (hu1->resource && !strlen(hu1->resource)))
-        {
-            return 0;
-        }
-        else
-        {
-            /* (1) check for no database grants at all and deny auth */
-            if (hu2->resource == NULL)
-            {
-                return 1;
-            }
-            /* (2) check for ANY database grant and allow auth */
-            if (!strlen(hu2->resource))
-            {
-                return 0;
-            }
-            /* (3) check for database name specific grant and allow auth */
-            if (hu1->resource && hu2->resource && strcmp(hu1->resource,
-                                                         hu2->resource) == 0)
-            {
-                return 0;
-            }
+        return resource_matches(hu1->resource, hu2->resource) ? 0 : 1;
+    }
+    else
+    {
+        return 1;
+    }
+}
 
-            if (hu2->resource && strlen(hu2->resource) && strchr(hu2->resource, '%') != NULL)
-            {
-                regex_t re;
-                char db[MYSQL_DATABASE_MAXLEN * 2 + 1];
-                strcpy(db, hu2->resource);
-                int len = strlen(db);
-                char* ptr = strrchr(db, '%');
+/**
+ * Check if the database the client requested is covered by a grant
+ *
+ * @param requested The database the client requested, NULL or empty for none
+ * @param granted   The granted database, NULL for no database grants and
+ *                  empty for any database
+ * @return True if the client may use the database
+ */
+static bool resource_matches(const char *requested, const char *granted)
+{
+    /* if no database name was passed, auth is ok */
+    if (requested == NULL || *requested == '\0')
+    {
+        return true;
+    }
 
-                if (ptr == NULL)
-                {
-                    return 1;
-                }
+    /* (1) check for no database grants at all and deny auth */
+    if (granted == NULL)
+    {
+        return false;
+    }
 
-                while (ptr)
-                {
-                    memmove(ptr + 1, ptr, (len - (ptr - db)) + 1);
-                    *ptr = '.';
-                    *(ptr + 1) = '*';
-                    len = strlen(db);
-                    ptr = strrchr(db, '%');
-                }
+    /* (2) check for ANY database grant and allow auth */
+    if (*granted == '\0')
+    {
+        return true;
+    }
 
-                if ((regcomp(&re, db, REG_ICASE | REG_NOSUB)))
-                {
-                    return 1;
-                }
+    /* (3) check for database name specific grant and allow auth */
+    if (strcmp(requested, granted) == 0)
+    {
+        return true;
+    }
 
-                if (regexec(&re, hu1->resource, 0, NULL, 0) == 0)
-                {
-                    regfree(&re);
-                    return 0;
-                }
-                regfree(&re);
-            }
+    if (strchr(granted, '%') != NULL)
+    {
+        regex_t re;
+        char db[MYSQL_DATABASE_MAXLEN * 2 + 1];
+        strcpy(db, granted);
+        int len = strlen(db);
+        char* ptr = strrchr(db, '%');
+        bool rval = false;
 
-            /* no matches, deny auth */
-            return 1;
+        while (ptr)
+        {
+            memmove(ptr + 1, ptr, (len - (ptr - db)) + 1);
+            *ptr = '.';
+            *(ptr + 1) = '*';
+            len = strlen(db);
+            ptr = strrchr(db, '%');
         }
+
+        if ((regcomp(&re, db, REG_ICASE | REG_NOSUB)))
+        {
+            return false;
+        }
+
+        rval = regexec(&re, requested, 0, NULL, 0) == 0;
+        regfree(&re);
+        return rval;
     }
-    else
-    {
-        return 1;
-    }
+
+    /* no matches, deny auth */
+    return false;
 }
 
 /**
@@ -2077,6 +3202,28 @@ resource_free(HASHTABLE *resources)
     }
 }
 
+/**
+ * Free a users table that was retired with rcu_call()
+ *
+ * @param data The users table
+ */
+static void
+users_free_deferred(void *data)
+{
+    users_free((USERS *)data);
+}
+
+/**
+ * Free a resources table that was retired with rcu_call()
+ *
+ * @param data The resources table
+ */
+static void
+resource_free_deferred(void *data)
+{
+    resource_free((HASHTABLE *)data);
+}
+
 /**
  * Allocate a MySQL database names table
  *
@@ -2504,7 +3651,15 @@ dbusers_save(USERS *users, const char *filename)
 int
 dbusers_load(USERS *users, const char *filename)
 {
-    return hashtable_load(users->data, filename, dbusers_keyread, dbusers_valueread);
+    int rval = hashtable_load(users->data, filename, dbusers_keyread, dbusers_valueread);
+
+    if (rval > 0 && !user_index_build(users))
+    {
+        MXS_ERROR("Failed to allocate memory for the users loaded from '%s'.", filename);
+        rval = -1;
+    }
+
+    return rval;
 }
 
 /**
@@ -87,35 +87,125 @@
 #include <log_manager.h>
 #include <hashtable.h>
 #include <hk_heartbeat.h>
+#include <statistics.h>
+#include <platform.h>
+#include <maxconfig.h>
+#include <affinity.h>
+#include <sys/uio.h>
 
 #define SSL_ERRBUF_LEN 140
 
-static  DCB             *allDCBs = NULL;        /* Diagnostics need a list of DCBs */
+/** Bounds of the adaptive read buffer size, powers of two */
+#define DCB_READ_SIZE_MIN 512
+#define DCB_READ_SIZE_INITIAL 4096
+
+/**
+ * Socket system call statistics, kept separately for the client side
+ * and the backend side of the sessions
+ */
+typedef struct
+{
+    ts_stats_t n_events;    /*< Read events that returned data */
+    ts_stats_t n_reads;     /*< Calls to read() */
+    ts_stats_t n_writes;    /*< Calls to write() */
+    ts_stats_t n_written;   /*< Bytes written */
+} DCB_IO_STATS;
+
+enum
+{
+    DCB_IO_CLIENT,
+    DCB_IO_BACKEND,
+    DCB_IO_SIDES
+};
+
+static DCB_IO_STATS io_stats[DCB_IO_SIDES];
+static bool io_stats_enabled = false;
+
+/**
+ * SSL handshake and record statistics
+ */
+typedef struct
+{
+    ts_stats_t n_full;      /*< Completed full handshakes */
+    ts_stats_t n_resumed;   /*< Completed handshakes that resumed a session */
+    ts_stats_t n_failed;    /*< Failed handshakes */
+    ts_stats_t n_records;   /*< Calls to SSL_write */
+    ts_stats_t n_written;   /*< Bytes written with SSL_write */
+} DCB_SSL_STATS;
+
+static DCB_SSL_STATS ssl_stats[DCB_IO_SIDES];
+
+#define DCB_SSL_STATS_ADD(dcb, field, value) \
+    do { if (io_stats_enabled) ts_stats_add(ssl_stats[DCB_IO_SIDE(dcb)].field, value); } while (0)
+
+/** Maximum amount of plaintext in one SSL record */
+#define DCB_SSL_RECORD_SIZE 16384
+
+/** Backend DCBs are the ones connected to a server */
+#define DCB_IO_SIDE(dcb) ((dcb)->server ? DCB_IO_BACKEND : DCB_IO_CLIENT)
+#define DCB_IO_STATS_ADD(dcb, field, value) \
+    do { if (io_stats_enabled) ts_stats_add(io_stats[DCB_IO_SIDE(dcb)].field, value); } while (0)
+
+/** Record when the data of a query was read from the client of a traced session */
+#define DCB_TRACE_STAMP(dcb, buf) \
+    do { if ((dcb)->session && (dcb)->session->trace && !(dcb)->server) (buf)->stamp = rdtsc(); } while (0)
+
+/** Maximum number of DCBs whose writes one event can defer */
+#define DCB_DEFERRED_MAX 16
+/** Write queue length at which deferred writes are flushed without waiting */
+#define DCB_DEFERRED_FLUSH_BYTES 16384
+/** Maximum number of buffers written with one system call */
+#define DCB_WRITEV_MAX 64
+
+/**
+ * The DCBs whose write queues are flushed when the polling thread has
+ * finished processing the current event
+ */
+typedef struct
+{
+    bool active;                    /*< Writes are being deferred */
+    int  n_dcbs;                    /*< Number of DCBs in the list */
+    DCB  *dcbs[DCB_DEFERRED_MAX];   /*< DCBs with deferred writes */
+} DCB_DEFERRED;
+
+static thread_local DCB_DEFERRED deferred;
+
+/** Number of shards in the registry of DCBs. Polling threads beyond this
+ * number share the shards. */
+#define DCB_SHARDS 64
+
+/**
+ * A shard of the registry of all DCBs that the diagnostics use. A DCB is
+ * linked into the shard of the thread that allocated it so that connections
+ * made on different threads do not contend on a lock. Each shard is on its
+ * own cache line.
+ */
+typedef struct
+{
+    SPINLOCK lock;
+    DCB      *head;
+} __attribute__((aligned(64))) DCB_SHARD;
+
+static  DCB_SHARD       dcb_shards[DCB_SHARDS];
 static  int             nDCBs = 0;
 static  int             maxDCBs = 0;
-static  DCB             *zombies = NULL;
 static  int             nzombies = 0;
 static  int             maxzombies = 0;
-static  SPINLOCK        dcbspin = SPINLOCK_INIT;
-static  SPINLOCK        zombiespin = SPINLOCK_INIT;
 
 static void dcb_final_free(DCB *dcb);
 static void dcb_call_callback(DCB *dcb, DCB_REASON reason);
-static DCB * dcb_get_next (DCB *dcb);
 static int  dcb_null_write(DCB *dcb, GWBUF *buf);
 static int  dcb_null_close(DCB *dcb);
 static int  dcb_null_auth(DCB *dcb, SERVER *server, SESSION *session, GWBUF *buf);
-static inline int  dcb_isvalid_nolock(DCB *dcb);
-static inline DCB * dcb_find_in_list(DCB *dcb);
-static inline void dcb_process_victim_queue(DCB *listofdcb);
+static void dcb_zombie_expired(void *data);
 static void dcb_stop_polling_and_shutdown (DCB *dcb);
 static bool dcb_maybe_add_persistent(DCB *);
+static void dcb_persistent_expired(void *data);
 static inline bool dcb_write_parameter_check(DCB *dcb, GWBUF *queue);
-static int dcb_bytes_readable(DCB *dcb);
-static int dcb_read_no_bytes_available(DCB *dcb, int nreadtotal);
 static int dcb_create_SSL(DCB* dcb);
 static int dcb_read_SSL(DCB *dcb, GWBUF **head);
-static GWBUF *dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *nsingleread);
+static GWBUF *dcb_basic_read(DCB *dcb, int bufsize, int *nsingleread);
+static void dcb_adapt_read_size(DCB *dcb, int nreadtotal, bool filled);
 static GWBUF *dcb_basic_read_SSL(DCB *dcb, int *nsingleread);
 #if defined(FAKE_CODE)
 static inline void dcb_write_fake_code(DCB *dcb);
@@ -124,6 +214,9 @@ static void dcb_log_write_failure(DCB *dcb, GWBUF *queue, int eno);
 static inline void dcb_write_tidy_up(DCB *dcb, bool below_water);
 static int gw_write(DCB *dcb, bool *stop_writing);
 static int gw_write_SSL(DCB *dcb, bool *stop_writing);
+static bool dcb_defer_flush(DCB *dcb);
+static bool dcb_undefer_flush(DCB *dcb);
+static void dcb_pack_writeq_SSL(DCB *dcb);
 static void dcb_log_errors_SSL (DCB *dcb, const char *called_by, int ret);
 
 size_t dcb_get_session_id(
@@ -158,17 +251,6 @@ bool dcb_get_ses_log_info(
     return false;
 }
 
-/**
- * Return the pointer to the list of zombie DCB's
- *
- * @return Zombies DCB list
- */
-DCB *
-dcb_get_zombies(void)
-{
-    return zombies;
-}
-
 /**
  * Allocate a new DCB.
  *
@@ -193,7 +275,7 @@ dcb_alloc(dcb_role_t role)
     newdcb->dcb_errhandle_called = false;
     newdcb->dcb_role = role;
     spinlock_init(&newdcb->dcb_initlock);
-    spinlock_init(&newdcb->writeqlock);
+    adaptive_lock_init(&newdcb->writeqlock);
     spinlock_init(&newdcb->delayqlock);
     spinlock_init(&newdcb->authlock);
     spinlock_init(&newdcb->cb_lock);
@@ -213,10 +295,13 @@ dcb_alloc(dcb_role_t role)
 
     memset(&newdcb->stats, 0, sizeof(DCBSTATS));        // Zero the statistics
     newdcb->state = DCB_STATE_ALLOC;
-    bitmask_init(&newdcb->memdata.bitmask);
     newdcb->writeqlen = 0;
     newdcb->high_water = 0;
     newdcb->low_water = 0;
+    newdcb->read_size = DCB_READ_SIZE_INITIAL;
+    newdcb->numa_node = affinity_node();
+    newdcb->poll_handle = NULL;
+    timer_init(&newdcb->timer, NULL, newdcb);
     newdcb->session = NULL;
     newdcb->server = NULL;
     newdcb->service = NULL;
@@ -233,24 +318,23 @@ dcb_alloc(dcb_role_t role)
     newdcb->user = NULL;
     newdcb->flags = 0;
 
-    spinlock_acquire(&dcbspin);
-    if (allDCBs == NULL)
+    newdcb->shard = ts_stats_get_thread_id() % DCB_SHARDS;
+    DCB_SHARD *shard = &dcb_shards[newdcb->shard];
+    spinlock_acquire(&shard->lock);
+    newdcb->prev = NULL;
+    newdcb->next = shard->head;
+    if (shard->head)
     {
-        allDCBs = newdcb;
+        shard->head->prev = newdcb;
     }
-    else
-    {
-        DCB *ptr = allDCBs;
-        while (ptr->next)
-            ptr = ptr->next;
-        ptr->next = newdcb;
-    }
-    nDCBs++;
-    if (nDCBs > maxDCBs)
+    shard->head = newdcb;
+    spinlock_release(&shard->lock);
+
+    int n = atomic_add(&nDCBs, 1) + 1;
+    if (n > maxDCBs)
     {
-        maxDCBs = nDCBs;
+        maxDCBs = n;
     }
-    spinlock_release(&dcbspin);
     return newdcb;
 }
 
@@ -329,35 +413,28 @@ dcb_final_free(DCB *dcb)
         MXS_ERROR("dcb_final_free: DCB %p has outstanding events.", dcb);
     }
 
-    /*< First remove this DCB from the chain */
-    spinlock_acquire(&dcbspin);
-    if (allDCBs == dcb)
+    /** The timer function may be running in another polling thread */
+    timer_cancel_sync(&dcb->timer);
+
+    /*< First remove this DCB from the registry */
+    DCB_SHARD *shard = &dcb_shards[dcb->shard];
+    spinlock_acquire(&shard->lock);
+    if (dcb->prev)
     {
-        /*<
-         * Deal with the special case of removing the DCB at the head of
-         * the chain.
-         */
-        allDCBs = dcb->next;
+        dcb->prev->next = dcb->next;
     }
     else
     {
-        /*<
-         * We find the DCB that point to the one we are removing and then
-         * set the next pointer of that DCB to the next pointer of the
-         * DCB we are removing.
-         */
-        DCB *ptr = allDCBs;
-        while (ptr && ptr->next != dcb)
-        {
-            ptr = ptr->next;
-        }
-        if (ptr)
-        {
-            ptr->next = dcb->next;
-        }
+        shard->head = dcb->next;
+    }
+    if (dcb->next)
+    {
+        dcb->next->prev = dcb->prev;
     }
-    nDCBs--;
-    spinlock_release(&dcbspin);
+    dcb->next = NULL;
+    dcb->prev = NULL;
+    spinlock_release(&shard->lock);
+    atomic_add(&nDCBs, -1);
 
     if (dcb->session) {
         /*<
@@ -443,242 +520,118 @@ dcb_free_all_memory(DCB *dcb)
     {
         SSL_free(dcb->ssl);
     }
-    bitmask_free(&dcb->memdata.bitmask);
     free(dcb);
 }
 
 /**
- * Process the DCB zombie queue
+ * Release a closed DCB once no polling thread can reference it
  *
- * This routine is called by each of the polling threads with
- * the thread id of the polling thread. It must clear the bit in
- * the memdata bitmask for the polling thread that calls it. If the
- * operation of clearing this bit means that no bits are set in
- * the memdata.bitmask then the DCB is no longer able to be
- * referenced and it can be finally removed.
+ * This is called when the grace period of a DCB retired by dcb_close has
+ * ended. A DCB that is still polled is first either moved to the persistent
+ * pool of its server or removed from the poll set and shut down, after
+ * which it is retired again. Once it is no longer polled, the file
+ * descriptor is closed and the DCB is freed.
  *
- * @param       threadid        The thread ID of the caller
+ * @param data  The closed DCB
  */
-DCB *
-dcb_process_zombies(int threadid)
+static void
+dcb_zombie_expired(void *data)
 {
-    DCB *zombiedcb;
-    DCB *previousdcb = NULL, *nextdcb;
-    DCB *listofdcb = NULL;
+    DCB *dcb = (DCB *)data;
 
-    /**
-     * Perform a dirty read to see if there is anything in the queue.
-     * This avoids threads hitting the queue spinlock when the queue
-     * is empty. This will really help when the only entry is being
-     * freed, since the queue is updated before the expensive call to
-     * dcb_final_free.
-     */
-    if (!zombies)
+    CHK_DCB(dcb);
+
+    /** A DCB that is in the event queue is processed once more first */
+    if (dcb->evq.next || dcb->evq.prev)
     {
-        return NULL;
+        rcu_retire(&dcb->memdata.rcu, dcb_zombie_expired, dcb);
+        return;
     }
 
-    /*
-     * Process the zombie queue and create a list of DCB's that can be
-     * finally freed. This processing is down under a spinlock that
-     * will prevent new entries being added to the zombie queue. Therefore
-     * we do not want to do any expensive operations under this spinlock
-     * as it will block other threads. The expensive operations will be
-     * performed on the victim queue within holding the zombie queue
-     * spinlock.
+    /*<
+     * Stop dcb's listening and modify state accordingly.
      */
-    spinlock_acquire(&zombiespin);
-    zombiedcb = zombies;
-    while (zombiedcb)
+    spinlock_acquire(&dcb->dcb_initlock);
+    if (dcb->state == DCB_STATE_POLLING  || dcb->state == DCB_STATE_LISTENING)
     {
-        CHK_DCB(zombiedcb);
-        nextdcb = zombiedcb->memdata.next;
-        /*
-         * Skip processing of DCB's that are
-         * in the event queue waiting to be processed.
-         */
-        if (zombiedcb->evq.next || zombiedcb->evq.prev)
+        if (dcb->state == DCB_STATE_LISTENING)
         {
-            previousdcb = zombiedcb;
+            MXS_ERROR("%lu [%s] Error : Removing DCB %p but was in state %s "
+                      "which is not expected for a call to dcb_close, although it"
+                      "should be processed correctly. ",
+                      pthread_self(),
+                      __func__,
+                      dcb,
+                      STRDCBSTATE(dcb->state));
         }
         else
         {
-
-            if (bitmask_clear_without_spinlock(&zombiedcb->memdata.bitmask, threadid))
+            /* Must be DCB_STATE_POLLING */
+            spinlock_release(&dcb->dcb_initlock);
+            if (0 == dcb->persistentstart && dcb_maybe_add_persistent(dcb))
             {
-                /**
-                 * Remove the DCB from the zombie queue
-                 * and call the final free routine for the
-                 * DCB
-                 *
-                 * zombiedcb is the DCB we are processing
-                 * previousdcb is the previous DCB on the zombie
-                 * queue or NULL if the DCB is at the head of the
-                 * queue.  Remove zombiedcb from the zombies list.
-                 */
-                if (NULL == previousdcb)
-                {
-                    zombies = zombiedcb->memdata.next;
-                }
-                else
-                {
-                    previousdcb->memdata.next = zombiedcb->memdata.next;
-                }
-
-                MXS_DEBUG("%lu [%s] Remove dcb "
-                          "%p fd %d in state %s from the "
-                          "list of zombies.",
-                          pthread_self(),
-                          __func__,
-                          zombiedcb,
-                          zombiedcb->fd,
-                          STRDCBSTATE(zombiedcb->state));
-                /*<
-                 * Move zombie dcb to linked list of victim dcbs.
-                 * The variable dcb is used to hold the last DCB
-                 * to have been added to the linked list, or NULL
-                 * if none has yet been added.  If the list
-                 * (listofdcb) is not NULL, then it follows that
-                 * dcb will also not be null.
-                 */
-                nzombies--;
-                zombiedcb->memdata.next = listofdcb;
-                listofdcb = zombiedcb;
+                /* Have taken DCB into persistent pool, no further killing */
+                atomic_add(&nzombies, -1);
             }
             else
             {
-                /* Since we didn't remove this dcb from the zombies
-                   list, we need to advance the previous pointer */
-                previousdcb = zombiedcb;
+                dcb_stop_polling_and_shutdown(dcb);
+                rcu_retire(&dcb->memdata.rcu, dcb_zombie_expired, dcb);
             }
+            return;
         }
-        zombiedcb = nextdcb;
     }
-    spinlock_release(&zombiespin);
-
-    if (listofdcb)
+    /*
+     * Into the final close logic, so if DCB is for backend server, we
+     * must decrement the number of current connections.
+     */
+    if (dcb->server && 0 == dcb->persistentstart)
     {
-        dcb_process_victim_queue(listofdcb);
+        atomic_add(&dcb->server->stats.n_current, -1);
     }
 
-    return zombies;
-}
-
-/**
- * Process the victim queue, selected from the list of zombies
- *
- * These are the DCBs that are not in use by any thread.  The corresponding
- * file descriptor is closed, the DCB marked as disconnected and the DCB
- * itself is finally freed.
- *
- * @param       listofdcb       The first victim DCB
- */
-static inline void
-dcb_process_victim_queue(DCB *listofdcb)
-{
-    DCB *dcb = listofdcb;
-
-    while (dcb != NULL)
+    if (dcb->fd > 0)
     {
-        DCB *nextdcb;
         /*<
-         * Stop dcb's listening and modify state accordingly.
-         */
-        spinlock_acquire(&dcb->dcb_initlock);
-        if (dcb->state == DCB_STATE_POLLING  || dcb->state == DCB_STATE_LISTENING)
-        {
-            if (dcb->state == DCB_STATE_LISTENING)
-            {
-                MXS_ERROR("%lu [%s] Error : Removing DCB %p but was in state %s "
-                          "which is not expected for a call to dcb_close, although it"
-                          "should be processed correctly. ",
-                          pthread_self(),
-                          __func__,
-                          dcb,
-                          STRDCBSTATE(dcb->state));
-            }
-            else
-            {
-                /* Must be DCB_STATE_POLLING */
-                spinlock_release(&dcb->dcb_initlock);
-                if (0 == dcb->persistentstart && dcb_maybe_add_persistent(dcb))
-                {
-                    /* Have taken DCB into persistent pool, no further killing */
-                    dcb = dcb->memdata.next;
-                    continue;
-                }
-                else
-                {
-                    DCB *nextdcb;
-                    dcb_stop_polling_and_shutdown(dcb);
-                    spinlock_acquire(&zombiespin);
-                    bitmask_copy(&dcb->memdata.bitmask, poll_bitmask());
-                    nextdcb = dcb->memdata.next;
-                    dcb->memdata.next = zombies;
-                    zombies = dcb;
-                    nzombies++;
-                    if (nzombies > maxzombies)
-                    {
-                        maxzombies = nzombies;
-                    }
-                    spinlock_release(&zombiespin);
-                    dcb = nextdcb;
-                    continue;
-                }
-            }
-        }
-        /*
-         * Into the final close logic, so if DCB is for backend server, we
-         * must decrement the number of current connections.
+         * Close file descriptor and move to clean-up phase.
          */
-        if (dcb->server && 0 == dcb->persistentstart)
+        if (close(dcb->fd) < 0)
         {
-            atomic_add(&dcb->server->stats.n_current, -1);
+            int eno = errno;
+            errno = 0;
+            char errbuf[STRERROR_BUFLEN];
+            MXS_ERROR("%lu [dcb_zombie_expired] Error : Failed to close "
+                      "socket %d on dcb %p due error %d, %s.",
+                      pthread_self(),
+                      dcb->fd,
+                      dcb,
+                      eno,
+                      strerror_r(eno, errbuf, sizeof(errbuf)));
         }
-
-        if (dcb->fd > 0)
+        else
         {
-            /*<
-             * Close file descriptor and move to clean-up phase.
-             */
-            if (close(dcb->fd) < 0)
-            {
-                int eno = errno;
-                errno = 0;
-                char errbuf[STRERROR_BUFLEN];
-                MXS_ERROR("%lu [dcb_process_victim_queue] Error : Failed to close "
-                          "socket %d on dcb %p due error %d, %s.",
-                          pthread_self(),
-                          dcb->fd,
-                          dcb,
-                          eno,
-                          strerror_r(eno, errbuf, sizeof(errbuf)));
-            }
-            else
-            {
 #if defined(FAKE_CODE)
-                conn_open[dcb->fd] = false;
+            conn_open[dcb->fd] = false;
 #endif /* FAKE_CODE */
-                dcb->fd = DCBFD_CLOSED;
+            dcb->fd = DCBFD_CLOSED;
 
-                MXS_DEBUG("%lu [dcb_process_victim_queue] Closed socket "
-                          "%d on dcb %p.",
-                          pthread_self(),
-                          dcb->fd,
-                          dcb);
-            }
+            MXS_DEBUG("%lu [dcb_zombie_expired] Closed socket "
+                      "%d on dcb %p.",
+                      pthread_self(),
+                      dcb->fd,
+                      dcb);
         }
+    }
 
-        dcb_get_ses_log_info(dcb,
-                             &mxs_log_tls.li_sesid,
-                             &mxs_log_tls.li_enabled_priorities);
+    dcb_get_ses_log_info(dcb,
+                         &mxs_log_tls.li_sesid,
+                         &mxs_log_tls.li_enabled_priorities);
+
+    dcb->state = DCB_STATE_DISCONNECTED;
+    spinlock_release(&dcb->dcb_initlock);
+    atomic_add(&nzombies, -1);
+    dcb_final_free(dcb);
 
-        dcb->state = DCB_STATE_DISCONNECTED;
-        nextdcb = dcb->memdata.next;
-        spinlock_release(&dcb->dcb_initlock);
-        dcb_final_free(dcb);
-        dcb = nextdcb;
-    }
     /** Reset threads session data */
     mxs_log_tls.li_sesid = 0;
 }
@@ -850,6 +803,95 @@ dcb_connect(SERVER *server, SESSION *session, const char *protocol)
     return dcb;
 }
 
+/**
+ * Allocate the socket system call statistics. Called once at startup after
+ * the thread specific statistics have been initialized.
+ */
+void
+dcb_init_io_stats()
+{
+    for (int i = 0; i < DCB_IO_SIDES; i++)
+    {
+        io_stats[i].n_events = ts_stats_alloc();
+        io_stats[i].n_reads = ts_stats_alloc();
+        io_stats[i].n_writes = ts_stats_alloc();
+        io_stats[i].n_written = ts_stats_alloc();
+        ssl_stats[i].n_full = ts_stats_alloc();
+        ssl_stats[i].n_resumed = ts_stats_alloc();
+        ssl_stats[i].n_failed = ts_stats_alloc();
+        ssl_stats[i].n_records = ts_stats_alloc();
+        ssl_stats[i].n_written = ts_stats_alloc();
+
+        if (io_stats[i].n_events == NULL || io_stats[i].n_reads == NULL ||
+            io_stats[i].n_writes == NULL || io_stats[i].n_written == NULL ||
+            ssl_stats[i].n_full == NULL || ssl_stats[i].n_resumed == NULL ||
+            ssl_stats[i].n_failed == NULL || ssl_stats[i].n_records == NULL ||
+            ssl_stats[i].n_written == NULL)
+        {
+            MXS_ERROR("Failed to allocate memory for the socket I/O statistics.");
+            return;
+        }
+    }
+
+    io_stats_enabled = true;
+}
+
+/**
+ * Print the socket system call statistics of the client and backend
+ * connections. A request is a read event that returned data, one client
+ * query or one batch of backend response data. The SSL handshake and record
+ * statistics follow.
+ *
+ * @param pdcb  DCB to print results to
+ */
+void
+dprintDCBIOStats(DCB *pdcb)
+{
+    static const char *sides[DCB_IO_SIDES] = {"Client", "Backend"};
+
+    if (!io_stats_enabled)
+    {
+        return;
+    }
+
+    dcb_printf(pdcb, "\nSocket I/O Statistics.\n\n");
+    dcb_printf(pdcb, "%-8s | %-12s | %-12s | %-12s | %-16s | Bytes/Write\n",
+               "Side", "Requests", "Reads", "Writes", "Syscalls/Request");
+    dcb_printf(pdcb, "---------+--------------+--------------+--------------+------------------+------------\n");
+
+    for (int i = 0; i < DCB_IO_SIDES; i++)
+    {
+        long events = ts_stats_sum(io_stats[i].n_events);
+        long reads = ts_stats_sum(io_stats[i].n_reads);
+        long writes = ts_stats_sum(io_stats[i].n_writes);
+        long written = ts_stats_sum(io_stats[i].n_written);
+
+        dcb_printf(pdcb, "%-8s | %12ld | %12ld | %12ld | %16.2f | %.1f\n",
+                   sides[i], events, reads, writes,
+                   events ? (double)(reads + writes) / events : 0.0,
+                   writes ? (double)written / writes : 0.0);
+    }
+
+    dcb_printf(pdcb, "\nSSL Statistics.\n\n");
+    dcb_printf(pdcb, "%-8s | %-12s | %-12s | %-12s | %-12s | Bytes/Record\n",
+               "Side", "Full", "Resumed", "Failed", "Records");
+    dcb_printf(pdcb, "---------+--------------+--------------+--------------+--------------+-------------\n");
+
+    for (int i = 0; i < DCB_IO_SIDES; i++)
+    {
+        long records = ts_stats_sum(ssl_stats[i].n_records);
+        long written = ts_stats_sum(ssl_stats[i].n_written);
+
+        dcb_printf(pdcb, "%-8s | %12ld | %12ld | %12ld | %12ld | %.1f\n",
+                   sides[i],
+                   (long)ts_stats_sum(ssl_stats[i].n_full),
+                   (long)ts_stats_sum(ssl_stats[i].n_resumed),
+                   (long)ts_stats_sum(ssl_stats[i].n_failed),
+                   records,
+                   records ? (double)written / records : 0.0);
+    }
+}
+
 /**
  * General purpose read routine to read data from a socket in the
  * Descriptor Control Block and append it to a linked list of buffers.
@@ -857,6 +899,13 @@ dcb_connect(SERVER *server, SESSION *session, const char *protocol)
  * parameter indicates the maximum number of bytes to be read (needed
  * for SSL processing) with 0 meaning no limit.
  *
+ * The socket is read into buffers of dcb->read_size bytes until a read
+ * returns less than was asked for. A short read means the socket has been
+ * drained and, as the descriptors are polled edge-triggered, any data that
+ * arrives after it generates a new event. The buffer size adapts to the
+ * amount of data the DCB usually receives so that most events need a
+ * single system call.
+ *
  * @param dcb       The DCB to read from
  * @param head      Pointer to linked list to append data to
  * @param maxbytes  Maximum bytes to read (0 = no limit)
@@ -868,6 +917,7 @@ int dcb_read(DCB   *dcb,
 {
     int     nsingleread = 0;
     int     nreadtotal = 0;
+    bool    filled = false;
 
     if (SSL_HANDSHAKE_DONE == dcb->ssl_state || SSL_ESTABLISHED == dcb->ssl_state)
     {
@@ -888,25 +938,29 @@ int dcb_read(DCB   *dcb,
 
     while (0 == maxbytes || nreadtotal < maxbytes)
     {
-        int bytes_available;
+        GWBUF *buffer;
+        int bufsize = dcb->read_size;
 
-        bytes_available = dcb_bytes_readable(dcb);
-        if (bytes_available <= 0)
+        if (maxbytes)
         {
-            return bytes_available < 0 ? -1 :
-                /** Handle closed client socket */
-                dcb_read_no_bytes_available(dcb, nreadtotal);
+            bufsize = MIN(bufsize, maxbytes - nreadtotal);
         }
-        else
-        {
-            GWBUF *buffer;
-            dcb->last_read = hkheartbeat;
 
-            buffer = dcb_basic_read(dcb, bytes_available, maxbytes, nreadtotal, &nsingleread);
-            if (buffer)
+        buffer = dcb_basic_read(dcb, bufsize, &nsingleread);
+
+        if (buffer == NULL)
+        {
+            /** Nothing was read from a client socket that has failed */
+            if (nsingleread < 0 && nreadtotal == 0 && dcb_isclient(dcb))
             {
-                nreadtotal += nsingleread;
-                /* <editor-fold defaultstate="collapsed" desc=" Debug Logging "> */
+                nreadtotal = -1;
+            }
+            break;
+        }
+
+        dcb->last_read = hkheartbeat;
+        nreadtotal += nsingleread;
+        /* <editor-fold defaultstate="collapsed" desc=" Debug Logging "> */
         MXS_DEBUG("%lu [dcb_read] Read %d bytes from dcb %p in state %s "
                   "fd %d.",
                   pthread_self(),
@@ -915,104 +969,67 @@ int dcb_read(DCB   *dcb,
                   STRDCBSTATE(dcb->state),
                   dcb->fd);
         /* </editor-fold> */
-                /*< Append read data to the gwbuf */
-                *head = gwbuf_append(*head, buffer);
-            }
-            else
-            {
-                break;
-            }
-        }
-    } /*< while (0 == maxbytes || nreadtotal < maxbytes) */
+        DCB_TRACE_STAMP(dcb, buffer);
+        /*< Append read data to the gwbuf */
+        *head = gwbuf_append(*head, buffer);
 
-    return nreadtotal;
-}
+        if (nsingleread < bufsize)
+        {
+            /** The socket has been drained */
+            break;
+        }
 
-/**
- * Find the number of bytes available for the DCB's socket
- *
- * @param dcb       The DCB to read from
- * @return          -1 on error, otherwise the total number of bytes available
- */
-static int
-dcb_bytes_readable(DCB *dcb)
-{
-    int bytesavailable;
+        filled = filled || bufsize == dcb->read_size;
+    } /*< while (0 == maxbytes || nreadtotal < maxbytes) */
 
-    if (-1 == ioctl(dcb->fd, FIONREAD, &bytesavailable))
+    if (nreadtotal > 0)
     {
-        char errbuf[STRERROR_BUFLEN];
-        /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
-            MXS_ERROR("%lu [dcb_read] Error : ioctl FIONREAD for dcb %p in "
-                      "state %s fd %d failed due error %d, %s.",
-                      pthread_self(),
-                      dcb,
-                      STRDCBSTATE(dcb->state),
-                      dcb->fd,
-                      errno,
-                      strerror_r(errno, errbuf, sizeof(errbuf)));
-            /* </editor-fold> */
-        return -1;
-    }
-    else
-    {
-        return bytesavailable;
+        DCB_IO_STATS_ADD(dcb, n_events, 1);
+        dcb_adapt_read_size(dcb, nreadtotal, filled);
     }
+
+    return nreadtotal;
 }
 
 /**
- * Determine the return code needed when read has run out of data
+ * Adapt the read buffer size of a DCB to the amount of data read in the
+ * last read event. The size is doubled when a read filled the whole buffer
+ * and halved when the event returned less than a quarter of it.
  *
- * @param dcb           The DCB to read from
- * @param nreadtotal    Number of bytes that have been read
- * @return              -1 on error, 0 for conditions not treated as error
+ * @param dcb           The DCB that was read from
+ * @param nreadtotal    Number of bytes read in the event
+ * @param filled        Whether a read filled a full sized buffer
  */
-static int
-dcb_read_no_bytes_available(DCB *dcb, int nreadtotal)
+static void
+dcb_adapt_read_size(DCB *dcb, int nreadtotal, bool filled)
 {
-    /** Handle closed client socket */
-    if (nreadtotal == 0 && dcb_isclient(dcb))
+    if (filled)
     {
-        char c;
-        int l_errno = 0;
-        int r = -1;
-
-        /* try to read 1 byte, without consuming the socket buffer */
-        r = recv(dcb->fd, &c, sizeof(char), MSG_PEEK);
-        l_errno = errno;
-
-        if (r <= 0 &&
-            l_errno != EAGAIN &&
-            l_errno != EWOULDBLOCK &&
-            l_errno != 0)
+        if (dcb->read_size < MAX_BUFFER_SIZE)
         {
-            return -1;
+            dcb->read_size *= 2;
         }
     }
-    return nreadtotal;
+    else if (nreadtotal < dcb->read_size / 4 && dcb->read_size > DCB_READ_SIZE_MIN)
+    {
+        dcb->read_size /= 2;
+    }
 }
 
 /**
  * Basic read function to carry out a single read operation on the DCB socket.
  *
  * @param dcb               The DCB to read from
- * @param bytesavailable    Pointer to linked list to append data to
- * @param maxbytes          Maximum bytes to read (0 = no limit)
- * @param nreadtotal        Total number of bytes already read
- * @param nsingleread       To be set as the number of bytes read this time
+ * @param bufsize           Number of bytes to read at most
+ * @param nsingleread       To be set as the number of bytes read this time,
+ *                          0 if the socket was drained or closed and -1 on error
  * @return                  GWBUF* buffer containing new data, or null.
  */
 static GWBUF *
-dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *nsingleread)
+dcb_basic_read(DCB *dcb, int bufsize, int *nsingleread)
 {
     GWBUF *buffer;
 
-    int bufsize = MIN(bytesavailable, MAX_BUFFER_SIZE);
-    if (maxbytes)
-    {
-        bufsize = MIN(bufsize, maxbytes-nreadtotal);
-    }
-
     if ((buffer = gwbuf_alloc(bufsize)) == NULL)
     {
         /*<
@@ -1035,10 +1052,11 @@ dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *
     {
         *nsingleread = read(dcb->fd, GWBUF_DATA(buffer), bufsize);
         dcb->stats.n_reads++;
+        DCB_IO_STATS_ADD(dcb, n_reads, 1);
 
         if (*nsingleread <= 0)
         {
-            if (errno != 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            if (*nsingleread < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
             {
                 char errbuf[STRERROR_BUFLEN];
                 /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
@@ -1052,9 +1070,17 @@ dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *
                           strerror_r(errno, errbuf, sizeof(errbuf)));
                 /* </editor-fold> */
             }
+            else
+            {
+                *nsingleread = 0;
+            }
             gwbuf_free(buffer);
             buffer = NULL;
         }
+        else if (*nsingleread < bufsize)
+        {
+            GWBUF_RTRIM(buffer, bufsize - *nsingleread);
+        }
     }
     return buffer;
 }
@@ -1094,6 +1120,7 @@ dcb_read_SSL(DCB *dcb, GWBUF **head)
     if (buffer)
     {
         nreadtotal += nsingleread;
+        DCB_TRACE_STAMP(dcb, buffer);
         *head = gwbuf_append(*head, buffer);
 
         while (SSL_pending(dcb->ssl))
@@ -1103,6 +1130,7 @@ dcb_read_SSL(DCB *dcb, GWBUF **head)
             if (NULL != buffer)
             {
                 nreadtotal += nsingleread;
+                DCB_TRACE_STAMP(dcb, buffer);
                 /*< Append read data to the gwbuf */
                 *head = gwbuf_append(*head, buffer);
             }
@@ -1167,18 +1195,18 @@ dcb_basic_read_SSL(DCB *dcb, int *nsingleread)
             *nsingleread = -1;
             return NULL;
         }
-        spinlock_acquire(&dcb->writeqlock);
+        adaptive_lock_acquire(&dcb->writeqlock);
         /* If we were in a retry situation, need to clear flag and attempt write */
         if (dcb->ssl_read_want_write || dcb->ssl_read_want_read)
         {
             dcb->ssl_read_want_write = false;
             dcb->ssl_read_want_read = false;
-            spinlock_release(&dcb->writeqlock);
+            adaptive_lock_release(&dcb->writeqlock);
             dcb_drain_writeq(dcb);
         }
         else
         {
-            spinlock_release(&dcb->writeqlock);
+            adaptive_lock_release(&dcb->writeqlock);
         }
         break;
 
@@ -1198,10 +1226,10 @@ dcb_basic_read_SSL(DCB *dcb, int *nsingleread)
                   pthread_self(),
                   __func__
                 );
-        spinlock_acquire(&dcb->writeqlock);
+        adaptive_lock_acquire(&dcb->writeqlock);
         dcb->ssl_read_want_write = false;
         dcb->ssl_read_want_read = true;
-        spinlock_release(&dcb->writeqlock);
+        adaptive_lock_release(&dcb->writeqlock);
         *nsingleread = 0;
         break;
 
@@ -1211,10 +1239,10 @@ dcb_basic_read_SSL(DCB *dcb, int *nsingleread)
                   pthread_self(),
                   __func__
                 );
-        spinlock_acquire(&dcb->writeqlock);
+        adaptive_lock_acquire(&dcb->writeqlock);
         dcb->ssl_read_want_write = true;
         dcb->ssl_read_want_read = false;
-        spinlock_release(&dcb->writeqlock);
+        adaptive_lock_release(&dcb->writeqlock);
         *nsingleread = 0;
         break;
 
@@ -1278,6 +1306,11 @@ dcb_log_errors_SSL (DCB *dcb, const char *called_by, int ret)
 /**
  * General purpose routine to write to a DCB
  *
+ * While a polling thread processes an event, the writes are only queued and
+ * the write queue is flushed once the event has been processed. The packets
+ * a router writes one by one then leave in a single system call. A queue
+ * that grows past DCB_DEFERRED_FLUSH_BYTES is flushed immediately.
+ *
  * @param dcb   The DCB of the client
  * @param queue Queue of buffers to write
  * @return      0 on failure, 1 on success
@@ -1295,7 +1328,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
         return 0;
     }
 
-    spinlock_acquire(&dcb->writeqlock);
+    adaptive_lock_acquire(&dcb->writeqlock);
     empty_queue = (dcb->writeq == NULL);
     /*
      * Add our data to the write queue.  If the queue already had data,
@@ -1305,7 +1338,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
      */
     atomic_add(&dcb->writeqlen, gwbuf_length(queue));
     dcb->writeq = gwbuf_append(dcb->writeq, queue);
-    spinlock_release(&dcb->writeqlock);
+    adaptive_lock_release(&dcb->writeqlock);
     dcb->stats.n_buffered++;
     MXS_DEBUG("%lu [dcb_write] Append to writequeue. %d writes "
               "buffered for dcb %p in state %s fd %d",
@@ -1314,7 +1347,17 @@ dcb_write(DCB *dcb, GWBUF *queue)
               dcb,
               STRDCBSTATE(dcb->state),
               dcb->fd);
-    if (empty_queue) dcb_drain_writeq(dcb);
+    if (empty_queue)
+    {
+        if (!dcb_defer_flush(dcb))
+        {
+            dcb_drain_writeq(dcb);
+        }
+    }
+    else if (dcb->writeqlen >= DCB_DEFERRED_FLUSH_BYTES && dcb_undefer_flush(dcb))
+    {
+        dcb_drain_writeq(dcb);
+    }
     dcb_write_tidy_up(dcb, below_water);
 
     return 1;
@@ -1507,7 +1550,7 @@ dcb_drain_writeq(DCB *dcb)
     bool stop_writing = false;
     bool above_water = (dcb->low_water && dcb->writeqlen > dcb->low_water);
 
-    spinlock_acquire(&dcb->writeqlock);
+    adaptive_lock_acquire(&dcb->writeqlock);
     if (dcb->ssl_read_want_write)
     {
         poll_fake_event(dcb, EPOLLIN);
@@ -1530,9 +1573,16 @@ dcb_drain_writeq(DCB *dcb)
         if (stop_writing) break;
         /*
          * Pull the number of bytes we have written from
-         * queue with have.
+         * queue with have. The write may span several buffers.
          */
-        dcb->writeq = gwbuf_consume(dcb->writeq, written);
+        int left = written;
+        do
+        {
+            int len = MIN(left, (int)GWBUF_LENGTH(dcb->writeq));
+            dcb->writeq = gwbuf_consume(dcb->writeq, len);
+            left -= len;
+        }
+        while (left > 0 && dcb->writeq);
         MXS_DEBUG("%lu [dcb_drain_writeq] Wrote %d Bytes to dcb %p "
                   "in state %s fd %d",
                   pthread_self(),
@@ -1542,7 +1592,7 @@ dcb_drain_writeq(DCB *dcb)
                   dcb->fd);
         total_written += written;
     }
-    spinlock_release(&dcb->writeqlock);
+    adaptive_lock_release(&dcb->writeqlock);
 
     if (total_written)
     {
@@ -1566,10 +1616,78 @@ dcb_drain_writeq(DCB *dcb)
 }
 
 /**
- * Removes dcb from poll set, and adds it to zombies list. As a consequence,
- * dcb first moves to DCB_STATE_NOPOLLING, and then to DCB_STATE_ZOMBIE state.
- * At the end of the function state may not be DCB_STATE_ZOMBIE because once
- * dcb_initlock is released parallel threads may change the state.
+ * Start deferring the writes of the calling thread. Called by the polling
+ * thread before it processes an event.
+ */
+void
+dcb_defer_writes()
+{
+    deferred.active = config_deferred_flush();
+}
+
+/**
+ * Stop deferring the writes of the calling thread and flush the write queues
+ * of the DCBs written to since dcb_defer_writes was called.
+ */
+void
+dcb_flush_deferred()
+{
+    deferred.active = false;
+
+    /** A DCB is removed from the list before it is flushed as the callbacks
+     * of the flush can close other DCBs in the list */
+    while (deferred.n_dcbs > 0)
+    {
+        DCB *dcb = deferred.dcbs[--deferred.n_dcbs];
+        dcb_drain_writeq(dcb);
+    }
+}
+
+/**
+ * Defer the flush of the write queue of a DCB to the end of the current event
+ *
+ * @param dcb   The DCB whose write queue was empty
+ * @return True if the flush was deferred, false if it must be done now
+ */
+static bool
+dcb_defer_flush(DCB *dcb)
+{
+    if (!deferred.active || deferred.n_dcbs == DCB_DEFERRED_MAX ||
+        dcb->writeqlen >= DCB_DEFERRED_FLUSH_BYTES)
+    {
+        return false;
+    }
+
+    deferred.dcbs[deferred.n_dcbs++] = dcb;
+    return true;
+}
+
+/**
+ * Remove a DCB from the deferred flush list of the calling thread
+ *
+ * @param dcb   The DCB to remove
+ * @return True if the DCB was in the list
+ */
+static bool
+dcb_undefer_flush(DCB *dcb)
+{
+    for (int i = 0; i < deferred.n_dcbs; i++)
+    {
+        if (deferred.dcbs[i] == dcb)
+        {
+            deferred.dcbs[i] = deferred.dcbs[--deferred.n_dcbs];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Marks the dcb as a zombie and retires it. Once every polling thread has
+ * passed a quiescent state the dcb is removed from the poll set and shut
+ * down, and after another grace period its socket is closed and it is freed.
+ * Closing a dcb takes no global lock.
  *
  * Parameters:
  * @param dcb The DCB to close
@@ -1592,6 +1710,12 @@ dcb_close(DCB *dcb)
         raise(SIGABRT);
     }
 
+    /** Send what was written to the DCB during the current event */
+    if (dcb_undefer_flush(dcb))
+    {
+        dcb_drain_writeq(dcb);
+    }
+
     /**
      * dcb_close may be called for freshly created dcb, in which case
      * it only needs to be freed.
@@ -1611,8 +1735,7 @@ dcb_close(DCB *dcb)
         return;
     }
 
-    spinlock_acquire(&zombiespin);
-    if (!dcb->dcb_is_zombie)
+    if (!__atomic_exchange_n(&dcb->dcb_is_zombie, true, __ATOMIC_ACQ_REL))
     {
         if (0 == dcb->persistentstart && dcb->server && DCB_STATE_POLLING == dcb->state)
         {
@@ -1624,23 +1747,17 @@ dcb_close(DCB *dcb)
                 dcb->user = strdup(user);
             }
         }
-        /*<
-         * Add closing dcb to the top of the list, setting zombie marker
-         */
-        dcb->dcb_is_zombie = true;
-        dcb->memdata.next = zombies;
-        zombies = dcb;
-        nzombies++;
-        if (nzombies > maxzombies) maxzombies = nzombies;
-        /*< Set bit for each maxscale thread. This should be done before
-         * the state is changed, so as to protect the DCB from premature
-         * destruction. */
-        if (dcb->server)
+        int n = atomic_add(&nzombies, 1) + 1;
+        if (n > maxzombies)
         {
-            bitmask_copy(&dcb->memdata.bitmask, poll_bitmask());
+            maxzombies = n;
         }
+        /*<
+         * Release the DCB when no polling thread can be processing an
+         * event for it any more.
+         */
+        rcu_retire(&dcb->memdata.rcu, dcb_zombie_expired, dcb);
     }
-    spinlock_release(&zombiespin);
 }
 
 /**
@@ -1689,9 +1806,13 @@ dcb_maybe_add_persistent(DCB *dcb)
             free(loopcallback);
         }
         spinlock_release(&dcb->cb_lock);
+        timer_init(&dcb->timer, dcb_persistent_expired, dcb);
         spinlock_acquire(&dcb->server->persistlock);
         dcb->nextpersistent = dcb->server->persistent;
         dcb->server->persistent = dcb;
+        /** Purge the pool once this DCB has been in it for too long. The
+         * timer is cancelled if the DCB is taken from the pool. */
+        timer_arm(&dcb->timer, hkheartbeat + (dcb->server->persistmaxtime + 1) * 10);
         spinlock_release(&dcb->server->persistlock);
         atomic_add(&dcb->server->stats.n_persistent, 1);
         atomic_add(&dcb->server->stats.n_current, -1);
@@ -1789,14 +1910,17 @@ void printAllDCBs()
 {
     DCB *dcb;
 
-    spinlock_acquire(&dcbspin);
-    dcb = allDCBs;
-    while (dcb)
+    for (int i = 0; i < DCB_SHARDS; i++)
     {
-        printDCB(dcb);
-        dcb = dcb->next;
+        spinlock_acquire(&dcb_shards[i].lock);
+        dcb = dcb_shards[i].head;
+        while (dcb)
+        {
+            printDCB(dcb);
+            dcb = dcb->next;
+        }
+        spinlock_release(&dcb_shards[i].lock);
     }
-    spinlock_release(&dcbspin);
 }
 
 /**
@@ -1861,15 +1985,6 @@ dprintOneDCB(DCB *pdcb, DCB *dcb)
         dcb_printf(pdcb, "\tRole:                     %s\n", rolename);
         free(rolename);
     }
-    if (!bitmask_isallclear(&dcb->memdata.bitmask))
-    {
-        char *bitmasktext = bitmask_render_readable(&dcb->memdata.bitmask);
-        if (bitmasktext)
-        {
-            dcb_printf(pdcb, "\tBitMask:                %s\n", bitmasktext);
-            free(bitmasktext);
-        }
-    }
     dcb_printf(pdcb, "\tStatistics:\n");
     dcb_printf(pdcb, "\t\tNo. of Reads:             %d\n", dcb->stats.n_reads);
     dcb_printf(pdcb, "\t\tNo. of Writes:            %d\n", dcb->stats.n_writes);
@@ -1900,20 +2015,26 @@ dprintAllDCBs(DCB *pdcb)
 {
     DCB *dcb;
 
-    spinlock_acquire(&dcbspin);
+    /** The shards are printed one at a time so that DCBs can be allocated
+     * and freed in the other shards meanwhile */
+    for (int i = 0; i < DCB_SHARDS; i++)
+    {
+        spinlock_acquire(&dcb_shards[i].lock);
 #if SPINLOCK_PROFILE
-    dcb_printf(pdcb, "DCB List Spinlock Statistics:\n");
-    spinlock_stats(&dcbspin, spin_reporter, pdcb);
-    dcb_printf(pdcb, "Zombie Queue Lock Statistics:\n");
-    spinlock_stats(&zombiespin, spin_reporter, pdcb);
+        if (dcb_shards[i].head)
+        {
+            dcb_printf(pdcb, "DCB List Shard %d Spinlock Statistics:\n", i);
+            spinlock_stats(&dcb_shards[i].lock, spin_reporter, pdcb);
+        }
 #endif
-    dcb = allDCBs;
-    while (dcb)
-    {
-        dprintOneDCB(pdcb, dcb);
-        dcb = dcb->next;
+        dcb = dcb_shards[i].head;
+        while (dcb)
+        {
+            dprintOneDCB(pdcb, dcb);
+            dcb = dcb->next;
+        }
+        spinlock_release(&dcb_shards[i].lock);
     }
-    spinlock_release(&dcbspin);
 }
 
 /**
@@ -1926,23 +2047,26 @@ dListDCBs(DCB *pdcb)
 {
     DCB *dcb;
 
-    spinlock_acquire(&dcbspin);
-    dcb = allDCBs;
     dcb_printf(pdcb, "Descriptor Control Blocks\n");
     dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------\n");
     dcb_printf(pdcb, " %-16s | %-26s | %-18s | %s\n",
                "DCB", "State", "Service", "Remote");
     dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------\n");
-    while (dcb)
+    for (int i = 0; i < DCB_SHARDS; i++)
     {
-        dcb_printf(pdcb, " %-16p | %-26s | %-18s | %s\n",
-                   dcb, gw_dcb_state2string(dcb->state),
-                   ((dcb->session && dcb->session->service) ? dcb->session->service->name : ""),
-                   (dcb->remote ? dcb->remote : ""));
-        dcb = dcb->next;
+        spinlock_acquire(&dcb_shards[i].lock);
+        dcb = dcb_shards[i].head;
+        while (dcb)
+        {
+            dcb_printf(pdcb, " %-16p | %-26s | %-18s | %s\n",
+                       dcb, gw_dcb_state2string(dcb->state),
+                       ((dcb->session && dcb->session->service) ? dcb->session->service->name : ""),
+                       (dcb->remote ? dcb->remote : ""));
+            dcb = dcb->next;
+        }
+        spinlock_release(&dcb_shards[i].lock);
     }
     dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------\n\n");
-    spinlock_release(&dcbspin);
 }
 
 /**
@@ -1955,27 +2079,30 @@ dListClients(DCB *pdcb)
 {
     DCB *dcb;
 
-    spinlock_acquire(&dcbspin);
-    dcb = allDCBs;
     dcb_printf(pdcb, "Client Connections\n");
     dcb_printf(pdcb, "-----------------+------------------+----------------------+------------\n");
     dcb_printf(pdcb, " %-15s | %-16s | %-20s | %s\n",
                "Client", "DCB", "Service", "Session");
     dcb_printf(pdcb, "-----------------+------------------+----------------------+------------\n");
-    while (dcb)
+    for (int i = 0; i < DCB_SHARDS; i++)
     {
-        if (dcb_isclient(dcb) && dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+        spinlock_acquire(&dcb_shards[i].lock);
+        dcb = dcb_shards[i].head;
+        while (dcb)
         {
-            dcb_printf(pdcb, " %-15s | %16p | %-20s | %10p\n",
-                       (dcb->remote ? dcb->remote : ""),
-                       dcb, (dcb->session->service ?
-                             dcb->session->service->name : ""),
-                       dcb->session);
+            if (dcb_isclient(dcb) && dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+            {
+                dcb_printf(pdcb, " %-15s | %16p | %-20s | %10p\n",
+                           (dcb->remote ? dcb->remote : ""),
+                           dcb, (dcb->session->service ?
+                                 dcb->session->service->name : ""),
+                           dcb->session);
+            }
+            dcb = dcb->next;
         }
-        dcb = dcb->next;
+        spinlock_release(&dcb_shards[i].lock);
     }
     dcb_printf(pdcb, "-----------------+------------------+----------------------+------------\n\n");
-    spinlock_release(&dcbspin);
 }
 
 
@@ -2055,8 +2182,6 @@ dprintDCB(DCB *pdcb, DCB *dcb)
 #if SPINLOCK_PROFILE
     dcb_printf(pdcb, "\tInitlock Statistics:\n");
     spinlock_stats(&dcb->dcb_initlock, spin_reporter, pdcb);
-    dcb_printf(pdcb, "\tWrite Queue Lock Statistics:\n");
-    spinlock_stats(&dcb->writeqlock, spin_reporter, pdcb);
     dcb_printf(pdcb, "\tDelay Queue Lock Statistics:\n");
     spinlock_stats(&dcb->delayqlock, spin_reporter, pdcb);
     dcb_printf(pdcb, "\tPollin Lock Statistics:\n");
@@ -2198,6 +2323,7 @@ gw_write_SSL(DCB *dcb, bool *stop_writing)
     int written;
     char errbuf[STRERROR_BUFLEN];
 
+    dcb_pack_writeq_SSL(dcb);
     written = SSL_write(dcb->ssl, GWBUF_DATA(dcb->writeq), GWBUF_LENGTH(dcb->writeq));
 
     *stop_writing = false;
@@ -2205,6 +2331,8 @@ gw_write_SSL(DCB *dcb, bool *stop_writing)
     {
     case SSL_ERROR_NONE:
         /* Successful write */
+        DCB_SSL_STATS_ADD(dcb, n_records, 1);
+        DCB_SSL_STATS_ADD(dcb, n_written, written);
         dcb->ssl_write_want_read = false;
         dcb->ssl_write_want_write = false;
         break;
@@ -2247,7 +2375,58 @@ gw_write_SSL(DCB *dcb, bool *stop_writing)
 }
 
 /**
- * Write data to a DCB. The data is taken from the DCB's write queue.
+ * Pack small buffers at the head of the write queue into one buffer so that
+ * they are encrypted into a single SSL record. Each SSL_write produces at
+ * least one record with its own header, MAC and padding, so writing the
+ * packets of a reply one by one costs both CPU and bandwidth. The caller
+ * must hold the write queue lock.
+ *
+ * @param dcb   The DCB whose write queue is packed
+ */
+static void
+dcb_pack_writeq_SSL(DCB *dcb)
+{
+    GWBUF *head = dcb->writeq;
+    unsigned int len = 0;
+    int n = 0;
+
+    /** A retried write must start with the data of the failed one */
+    if (dcb->ssl_write_want_read || dcb->ssl_write_want_write || head->next == NULL)
+    {
+        return;
+    }
+
+    for (GWBUF *b = head; b && len + GWBUF_LENGTH(b) <= DCB_SSL_RECORD_SIZE; b = b->next)
+    {
+        len += GWBUF_LENGTH(b);
+        n++;
+    }
+
+    GWBUF *packed;
+
+    if (n < 2 || (packed = gwbuf_alloc(len)) == NULL)
+    {
+        return;
+    }
+
+    uint8_t *ptr = GWBUF_DATA(packed);
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned int buflen = GWBUF_LENGTH(head);
+        memcpy(ptr, GWBUF_DATA(head), buflen);
+        ptr += buflen;
+        head = gwbuf_consume(head, buflen);
+    }
+
+    packed->next = head;
+    packed->tail = head ? head->tail : packed;
+    dcb->writeq = packed;
+}
+
+/**
+ * Write data to a DCB. The data is taken from the DCB's write queue, up to
+ * DCB_WRITEV_MAX buffers of it with one system call.
  *
  * @param dcb           The DCB to write buffer
  * @param stop_writing  Set to true if the caller should stop writing, false otherwise
@@ -2258,17 +2437,28 @@ gw_write(DCB *dcb, bool *stop_writing)
 {
     int written = 0;
     int fd = dcb->fd;
-    size_t nbytes = GWBUF_LENGTH(dcb->writeq);
+    struct iovec iov[DCB_WRITEV_MAX];
+    int iovcnt = 0;
+    size_t nbytes = 0;
     void *buf = GWBUF_DATA(dcb->writeq);
     int saved_errno;
 
+    /** Gather the queued buffers so that they are sent with one call */
+    for (GWBUF *b = dcb->writeq; b && iovcnt < DCB_WRITEV_MAX; b = b->next)
+    {
+        iov[iovcnt].iov_base = GWBUF_DATA(b);
+        iov[iovcnt].iov_len = GWBUF_LENGTH(b);
+        nbytes += iov[iovcnt].iov_len;
+        iovcnt++;
+    }
+
     errno = 0;
 
 #if defined(FAKE_CODE)
     if (fd > 0 && dcb_fake_write_errno[fd] != 0)
     {
         ss_dassert(dcb_fake_write_ev[fd] != 0);
-        written = write(fd, buf, nbytes/2); /*< leave peer to read missing bytes */
+        written = write(fd, buf, iov[0].iov_len/2); /*< leave peer to read missing bytes */
 
         if (written > 0)
         {
@@ -2278,15 +2468,23 @@ gw_write(DCB *dcb, bool *stop_writing)
     }
     else if (fd > 0)
     {
-        written = write(fd, buf, nbytes);
+        written = writev(fd, iov, iovcnt);
     }
 #else
     if (fd > 0)
     {
-        written = write(fd, buf, nbytes);
+        written = writev(fd, iov, iovcnt);
     }
 #endif /* FAKE_CODE */
 
+    dcb->stats.n_writes++;
+    DCB_IO_STATS_ADD(dcb, n_writes, 1);
+
+    if (written > 0)
+    {
+        DCB_IO_STATS_ADD(dcb, n_written, written);
+    }
+
 #if defined(SS_DEBUG_MYSQL)
     {
         size_t   len;
@@ -2525,78 +2723,32 @@ dcb_call_callback(DCB *dcb, DCB_REASON reason)
 }
 
 /**
- * Check the passed DCB to ensure it is in the list of allDCBS
+ * Check the passed DCB to ensure it is in the registry of all DCBs
  *
  * @param       dcb     The DCB to check
- * @return      1 if the DCB is in the list, otherwise 0
+ * @return      1 if the DCB is in the registry, otherwise 0
  */
 int
 dcb_isvalid(DCB *dcb)
 {
     int rval = 0;
 
-    if (dcb)
-    {
-        spinlock_acquire(&dcbspin);
-        rval = dcb_isvalid_nolock(dcb);
-        spinlock_release(&dcbspin);
-    }
-
-    return rval;
-}
-
-/**
- * Find a DCB in the list of all DCB's
- *
- * @param dcb       The DCB to find
- * @return          A pointer to the DCB or NULL if not in the list
- */
-static inline DCB *
-dcb_find_in_list (DCB *dcb)
-{
-    DCB *ptr = NULL;
-    if (dcb)
+    /** The DCB may already have been freed, so its shard is not known */
+    for (int i = 0; dcb && i < DCB_SHARDS && rval == 0; i++)
     {
-        ptr = allDCBs;
-        while (ptr && ptr != dcb)
+        spinlock_acquire(&dcb_shards[i].lock);
+        for (DCB *ptr = dcb_shards[i].head; ptr; ptr = ptr->next)
         {
-            ptr = ptr->next;
+            if (ptr == dcb)
+            {
+                rval = 1;
+                break;
+            }
         }
+        spinlock_release(&dcb_shards[i].lock);
     }
-    return ptr;
-}
 
-/**
- * Check the passed DCB to ensure it is in the list of allDCBS.
- * Requires that the DCB list is already locked before call.
- *
- * @param       dcb     The DCB to check
- * @return      1 if the DCB is in the list, otherwise 0
- */
-static inline int
-dcb_isvalid_nolock(DCB *dcb)
-{
-    return (dcb == dcb_find_in_list(dcb));
-}
-
-
-/**
- * Get the next DCB in the list of all DCB's
- *
- * @param dcb           The current DCB
- * @return      The pointer to the next DCB or NULL if this is the last
- */
-static DCB *
-dcb_get_next(DCB *dcb)
-{
-    spinlock_acquire(&dcbspin);
-    if (dcb) {
-        dcb = dcb_isvalid_nolock(dcb) ? dcb->next : NULL;
-    }
-    else dcb = allDCBs;
-    spinlock_release(&dcbspin);
-
-    return dcb;
+    return rval;
 }
 
 /**
@@ -2618,21 +2770,25 @@ dcb_call_foreach(struct server* server, DCB_REASON reason)
     case DCB_REASON_NOT_RESPONDING:
     {
         DCB *dcb;
-        spinlock_acquire(&dcbspin);
-        dcb = allDCBs;
 
-        while (dcb != NULL)
+        for (int i = 0; i < DCB_SHARDS; i++)
         {
-            spinlock_acquire(&dcb->dcb_initlock);
-            if (dcb->state == DCB_STATE_POLLING && dcb->server &&
-                strcmp(dcb->server->unique_name,server->unique_name) == 0)
+            spinlock_acquire(&dcb_shards[i].lock);
+            dcb = dcb_shards[i].head;
+
+            while (dcb != NULL)
             {
-                dcb_call_callback(dcb, DCB_REASON_NOT_RESPONDING);
+                spinlock_acquire(&dcb->dcb_initlock);
+                if (dcb->state == DCB_STATE_POLLING && dcb->server &&
+                    strcmp(dcb->server->unique_name,server->unique_name) == 0)
+                {
+                    dcb_call_callback(dcb, DCB_REASON_NOT_RESPONDING);
+                }
+                spinlock_release(&dcb->dcb_initlock);
+                dcb = dcb->next;
             }
-            spinlock_release(&dcb->dcb_initlock);
-            dcb = dcb->next;
+            spinlock_release(&dcb_shards[i].lock);
         }
-        spinlock_release(&dcbspin);
         break;
     }
 
@@ -2653,21 +2809,25 @@ dcb_hangup_foreach(struct server* server)
     MXS_DEBUG("%lu [dcb_hangup_foreach]", pthread_self());
 
     DCB *dcb;
-    spinlock_acquire(&dcbspin);
-    dcb = allDCBs;
 
-    while (dcb != NULL)
+    for (int i = 0; i < DCB_SHARDS; i++)
     {
-        spinlock_acquire(&dcb->dcb_initlock);
-        if (dcb->state == DCB_STATE_POLLING && dcb->server &&
-            strcmp(dcb->server->unique_name,server->unique_name) == 0)
+        spinlock_acquire(&dcb_shards[i].lock);
+        dcb = dcb_shards[i].head;
+
+        while (dcb != NULL)
         {
-            poll_fake_hangup_event(dcb);
+            spinlock_acquire(&dcb->dcb_initlock);
+            if (dcb->state == DCB_STATE_POLLING && dcb->server &&
+                strcmp(dcb->server->unique_name,server->unique_name) == 0)
+            {
+                poll_fake_hangup_event(dcb);
+            }
+            spinlock_release(&dcb->dcb_initlock);
+            dcb = dcb->next;
         }
-        spinlock_release(&dcb->dcb_initlock);
-        dcb = dcb->next;
+        spinlock_release(&dcb_shards[i].lock);
     }
-    spinlock_release(&dcbspin);
 }
 
 
@@ -2787,6 +2947,24 @@ dcb_persistent_clean_count(DCB *dcb, bool cleanall)
     return count;
 }
 
+/**
+ * Timer function of a DCB in the persistent pool. It is called when the DCB
+ * has been in the pool for longer than the server allows and removes it and
+ * any other expired DCBs from the pool.
+ *
+ * @param data  The DCB in the persistent pool
+ */
+static void
+dcb_persistent_expired(void *data)
+{
+    DCB *dcb = (DCB *)data;
+
+    if (dcb->persistentstart > 0 && dcb->server)
+    {
+        dcb_persistent_clean_count(dcb, false);
+    }
+}
+
 /**
  * Return DCB counts optionally filtered by usage
  *
@@ -2799,50 +2977,53 @@ dcb_count_by_usage(DCB_USAGE usage)
     int rval = 0;
     DCB *ptr;
 
-    spinlock_acquire(&dcbspin);
-    ptr = allDCBs;
-    while (ptr)
+    for (int i = 0; i < DCB_SHARDS; i++)
     {
-        switch (usage)
+        spinlock_acquire(&dcb_shards[i].lock);
+        ptr = dcb_shards[i].head;
+        while (ptr)
         {
-        case DCB_USAGE_CLIENT:
-            if (dcb_isclient(ptr))
-            {
-                rval++;
-            }
-            break;
-        case DCB_USAGE_LISTENER:
-            if (ptr->state == DCB_STATE_LISTENING)
-            {
-                rval++;
-            }
-            break;
-        case DCB_USAGE_BACKEND:
-            if (dcb_isclient(ptr) == 0
-                && ptr->dcb_role == DCB_ROLE_REQUEST_HANDLER)
-            {
-                rval++;
-            }
-            break;
-        case DCB_USAGE_INTERNAL:
-            if (ptr->dcb_role == DCB_ROLE_REQUEST_HANDLER)
-            {
-                rval++;
-            }
-            break;
-        case DCB_USAGE_ZOMBIE:
-            if (DCB_ISZOMBIE(ptr))
+            switch (usage)
             {
+            case DCB_USAGE_CLIENT:
+                if (dcb_isclient(ptr))
+                {
+                    rval++;
+                }
+                break;
+            case DCB_USAGE_LISTENER:
+                if (ptr->state == DCB_STATE_LISTENING)
+                {
+                    rval++;
+                }
+                break;
+            case DCB_USAGE_BACKEND:
+                if (dcb_isclient(ptr) == 0
+                    && ptr->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+                {
+                    rval++;
+                }
+                break;
+            case DCB_USAGE_INTERNAL:
+                if (ptr->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+                {
+                    rval++;
+                }
+                break;
+            case DCB_USAGE_ZOMBIE:
+                if (DCB_ISZOMBIE(ptr))
+                {
+                    rval++;
+                }
+                break;
+            case DCB_USAGE_ALL:
                 rval++;
+                break;
             }
-            break;
-        case DCB_USAGE_ALL:
-            rval++;
-            break;
+            ptr = ptr->next;
         }
-        ptr = ptr->next;
+        spinlock_release(&dcb_shards[i].lock);
     }
-    spinlock_release(&dcbspin);
     return rval;
 }
 
@@ -2907,6 +3088,14 @@ int dcb_accept_SSL(DCB* dcb)
     {
         case SSL_ERROR_NONE:
             MXS_DEBUG("SSL_accept done for %s@%s", user, remote);
+            if (SSL_session_reused(dcb->ssl))
+            {
+                DCB_SSL_STATS_ADD(dcb, n_resumed, 1);
+            }
+            else
+            {
+                DCB_SSL_STATS_ADD(dcb, n_full, 1);
+            }
             dcb->ssl_state = SSL_ESTABLISHED;
             dcb->ssl_read_want_write = false;
             return 1;
@@ -2933,6 +3122,7 @@ int dcb_accept_SSL(DCB* dcb)
         case SSL_ERROR_SYSCALL:
             MXS_DEBUG("SSL connection SSL_ERROR_SYSCALL error during accept %s@%s", user, remote);
             dcb_log_errors_SSL(dcb, __func__, ssl_rval);
+            DCB_SSL_STATS_ADD(dcb, n_failed, 1);
             dcb->ssl_state = SSL_HANDSHAKE_FAILED;
             poll_fake_hangup_event(dcb);
             return -1;
@@ -2941,6 +3131,7 @@ int dcb_accept_SSL(DCB* dcb)
         default:
             MXS_DEBUG("SSL connection shut down with error during SSL accept %s@%s", user, remote);
             dcb_log_errors_SSL(dcb, __func__, 0);
+            DCB_SSL_STATS_ADD(dcb, n_failed, 1);
             dcb->ssl_state = SSL_HANDSHAKE_FAILED;
             poll_fake_hangup_event(dcb);
             return -1;
@@ -2954,6 +3145,8 @@ int dcb_accept_SSL(DCB* dcb)
  * This functions starts an SSL client connection to a server which is expecting
  * an SSL handshake. The DCB should already have a TCP connection to the server and
  * this connection should be in a state that expects an SSL handshake.
+ * The last session established with the server is offered to it so that the
+ * server can resume it instead of doing a full handshake.
  * THIS CODE IS UNUSED AND UNTESTED as at 4 Jan 2016
  * @param dcb DCB to connect
  * @return 1 on success, -1 on error and 0 if the SSL handshake is still ongoing
@@ -2961,12 +3154,48 @@ int dcb_accept_SSL(DCB* dcb)
 int dcb_connect_SSL(DCB* dcb)
 {
     int ssl_rval;
+    SERVER *server = dcb->server;
+
+    /** No session means that the handshake has not been started */
+    if (server && SSL_get_session(dcb->ssl) == NULL)
+    {
+        spinlock_acquire(&server->lock);
+        if (server->ssl_session)
+        {
+            SSL_set_session(dcb->ssl, server->ssl_session);
+        }
+        spinlock_release(&server->lock);
+    }
 
     ssl_rval = SSL_connect(dcb->ssl);
     switch (SSL_get_error(dcb->ssl, ssl_rval))
     {
         case SSL_ERROR_NONE:
             MXS_DEBUG("SSL_connect done for %s", dcb->remote);
+            if (SSL_session_reused(dcb->ssl))
+            {
+                DCB_SSL_STATS_ADD(dcb, n_resumed, 1);
+            }
+            else
+            {
+                SSL_SESSION *session = SSL_get1_session(dcb->ssl);
+
+                DCB_SSL_STATS_ADD(dcb, n_full, 1);
+
+                if (server && session)
+                {
+                    spinlock_acquire(&server->lock);
+                    SSL_SESSION *old = server->ssl_session;
+                    server->ssl_session = session;
+                    spinlock_release(&server->lock);
+                    session = old;
+                }
+
+                if (session)
+                {
+                    SSL_SESSION_free(session);
+                }
+            }
             return 1;
 
         case SSL_ERROR_WANT_READ:
@@ -2986,12 +3215,14 @@ int dcb_connect_SSL(DCB* dcb)
         case SSL_ERROR_SYSCALL:
             MXS_DEBUG("SSL connection shut down with SSL_ERROR_SYSCALL during SSL connect %s", dcb->remote);
             dcb_log_errors_SSL(dcb, __func__, ssl_rval);
+            DCB_SSL_STATS_ADD(dcb, n_failed, 1);
             poll_fake_hangup_event(dcb);
             return -1;
 
         default:
             MXS_DEBUG("SSL connection shut down with error during SSL connect %s", dcb->remote);
             dcb_log_errors_SSL(dcb, __func__, 0);
+            DCB_SSL_STATS_ADD(dcb, n_failed, 1);
             poll_fake_hangup_event(dcb);
             return -1;
     }
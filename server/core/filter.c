@@ -475,3 +475,26 @@ filterUpstream(FILTER_DEF *filter, void *fsession, UPSTREAM *upstream)
     }
     return me;
 }
+
+/**
+ * Return the instance wide statistics of a filter as a result set
+ *
+ * Only filters that implement the optional getStatistics entry point
+ * are able to provide a result set.
+ *
+ * @param name  The name of the filter
+ * @return A result set or NULL if the filter does not provide statistics
+ */
+RESULTSET *
+filterGetStatistics(char *name)
+{
+    FILTER_DEF *filter;
+
+    if ((filter = filter_find(name)) == NULL || filter->filter == NULL ||
+        filter->obj == NULL || filter->obj->getStatistics == NULL)
+    {
+        return NULL;
+    }
+
+    return filter->obj->getStatistics(filter->filter);
+}
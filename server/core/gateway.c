@@ -90,6 +90,9 @@
 #include <sys/prctl.h>
 #include <sys/file.h>
 #include <statistics.h>
+#include <query_trace.h>
+#include <metrics.h>
+#include <affinity.h>
 
 #define STRING_BUFFER_SIZE 1024
 #define PIDFD_CLOSED -1
@@ -1902,6 +1905,7 @@ int main(int argc, char **argv)
 
     /** Initialize statistics */
     ts_stats_init();
+    query_trace_init();
 
     /* Init MaxScale poll system */
     poll_init();
@@ -1940,12 +1944,25 @@ int main(int argc, char **argv)
      */
     hkinit();
 
+    /* Start taking snapshots of the metrics */
+    metrics_init();
+
     /*<
      * Start the polling threads, note this is one less than is
      * configured as the main thread will also poll.
      */
     n_threads = config_threadcount();
     threads = calloc(n_threads, sizeof(THREAD));
+
+    /* Choose the CPUs of the polling threads */
+    if (!affinity_init(n_threads))
+    {
+        char* logerr = "Failed to apply the thread_affinity parameter.";
+        print_log_n_stderr(true, !daemon_mode, logerr, logerr, 0);
+        rc = MAXSCALE_INTERNALERROR;
+        goto return_main;
+    }
+
     /*<
      * Start server threads.
      */
@@ -430,6 +430,34 @@ hashtable_fetch(HASHTABLE *table, void *key)
     }
 }
 
+/**
+ * Fetch an item from a hash table that is no longer modified without
+ * taking the read lock. This is only safe for tables that are published
+ * as immutable snapshots, such as the service user tables.
+ *
+ * @param table         The hash table
+ * @param key           The key value
+ * @return The item or NULL if the item was not found
+ */
+void *
+hashtable_fetch_nolock(HASHTABLE *table, void *key)
+{
+    HASHENTRIES *entry;
+
+    if (table == NULL || key == NULL || 0 == table->hashsize)
+    {
+        return NULL;
+    }
+
+    entry = table->entries[table->hashfn(key) % table->hashsize];
+    while (entry && entry->key && table->cmpfn(key, entry->key) != 0)
+    {
+        entry = entry->next;
+    }
+
+    return entry ? entry->value : NULL;
+}
+
 /**
  * Print hash table statistics to the standard output
  *
@@ -17,9 +17,10 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <housekeeper.h>
 #include <thread.h>
-#include <spinlock.h>
+#include <platform.h>
 #include <log_manager.h>
 
 /**
@@ -27,12 +28,26 @@
  *
  * The housekeeper provides a mechanism to allow for tasks, function
  * calls basically, to be run on a tiem basis. A task may be run
- * repeatedly, with a given frequency (in seconds), or may be a one
- * shot task that will only be run once after a specified number of
- * seconds.
+ * repeatedly, with a given frequency, or may be a one shot task that
+ * will only be run once after a specified time. The times have a
+ * resolution of one millisecond.
+ *
+ * The tasks that are not running are kept in a heap ordered by the time
+ * they are next due. The scheduler thread sleeps until the first task in
+ * the heap is due and then hands it to a small pool of worker threads. A
+ * repeated task is put back in the heap once it has finished, so a task
+ * never runs in two workers at the same time.
+ *
+ * The tasks added with hktask_add() and hktask_oneshot() are exclusive:
+ * only one of them runs at a time, as when all tasks were run by a single
+ * thread, since their owners may rely on that. A task added with
+ * hktask_add_concurrent_ms() or hktask_oneshot_concurrent_ms() protects its
+ * data with its own locks and runs in parallel with the other tasks, so a
+ * slow exclusive task does not delay it.
  *
  * The housekeeper also maintains a global variable, hkheartbeat, that
- * is incremented every 100ms.
+ * is advanced every 100ms by the scheduler thread. It is derived from the
+ * monotonic clock and does not depend on how long the tasks take.
  *
  * @verbatim
  * Revision History
@@ -44,20 +59,81 @@
  * @endverbatim
  */
 
+/** Number of threads that run the tasks */
+#define HK_WORKERS 4
+
+/** The length of a heartbeat in milliseconds */
+#define HK_HEARTBEAT_MS 100
+
 /**
  * List of all tasks that need to be run
  */
 static HKTASK *tasks = NULL;
 /**
- * Spinlock to protect the tasks list
+ * The lock that protects the tasks list, the heap and the queue of the
+ * workers. A mutex, since the threads wait for the condition variables
+ * while holding it.
  */
-static SPINLOCK tasklock = SPINLOCK_INIT;
+static pthread_mutex_t tasklock = PTHREAD_MUTEX_INITIALIZER;
+/** Signaled when the first task in the heap changes */
+static pthread_cond_t hk_sched_cond;
+/** Signaled when a task is queued for the workers */
+static pthread_cond_t hk_work_cond = PTHREAD_COND_INITIALIZER;
+/** Signaled when a worker has finished running a task */
+static pthread_cond_t hk_done_cond = PTHREAD_COND_INITIALIZER;
+
+/** The tasks that are not running, ordered by their next due time */
+static HKTASK **heap = NULL;
+static int heap_size = 0;
+static int heap_capacity = 0;
+
+/** The tasks that are due and wait for a worker */
+static HKTASK *queue_head = NULL;
+static HKTASK *queue_tail = NULL;
+
+/** An exclusive task is being run by a worker */
+static bool exclusive_running = false;
 
 static int do_shutdown = 0;
+static bool hk_started = false;
 long hkheartbeat = 0; /*< One heartbeat is 100 milliseconds */
+static long hk_start_ms = 0;
 static THREAD hk_thr_handle;
+static THREAD hk_workers[HK_WORKERS];
+
+/** The task the calling worker thread is running */
+static thread_local HKTASK *hk_current = NULL;
 
 static void hkthread(void *);
+static void hkworker(void *);
+
+/**
+ * Return the time of the monotonic clock
+ *
+ * @return The time in milliseconds
+ */
+static long
+hk_clock_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Return the time of the monotonic clock
+ *
+ * @return The time in microseconds
+ */
+static long
+hk_clock_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
 
 /**
  * Initialise the housekeeper thread
@@ -65,6 +141,29 @@ static void hkthread(void *);
 void
 hkinit()
 {
+    pthread_condattr_t attr;
+
+    if (hk_started)
+    {
+        return;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hk_sched_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    hk_start_ms = hk_clock_ms();
+    hk_started = true;
+
+    for (int i = 0; i < HK_WORKERS; i++)
+    {
+        if (thread_start(&hk_workers[i], hkworker, NULL) == NULL)
+        {
+            MXS_ERROR("Failed to start housekeeper worker thread.");
+        }
+    }
+
     if (thread_start(&hk_thr_handle, hkthread, NULL) == NULL)
     {
         MXS_ERROR("Failed to start housekeeper thread.");
@@ -72,28 +171,175 @@ hkinit()
 }
 
 /**
- * Add a new task to the housekeepers lists of tasks that should be
- * run periodically.
+ * Swap two tasks in the heap. The caller holds the tasklock.
+ */
+static void
+hk_heap_swap(int a, int b)
+{
+    HKTASK *task = heap[a];
+
+    heap[a] = heap[b];
+    heap[b] = task;
+    heap[a]->index = a;
+    heap[b]->index = b;
+}
+
+/**
+ * Move a task towards the top of the heap until its parent is due first.
+ * The caller holds the tasklock.
  *
- * The task will be first run frequency seconds after this call is
- * made and will the be executed repeatedly every frequency seconds
- * until the task is removed.
+ * @param i The position of the task
+ */
+static void
+hk_heap_up(int i)
+{
+    while (i > 0 && heap[(i - 1) / 2]->nextdue > heap[i]->nextdue)
+    {
+        hk_heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * Move a task towards the bottom of the heap until its children are due
+ * after it. The caller holds the tasklock.
  *
- * Task names must be unique.
+ * @param i The position of the task
+ */
+static void
+hk_heap_down(int i)
+{
+    for (;;)
+    {
+        int first = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < heap_size && heap[left]->nextdue < heap[first]->nextdue)
+        {
+            first = left;
+        }
+        if (right < heap_size && heap[right]->nextdue < heap[first]->nextdue)
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            break;
+        }
+        hk_heap_swap(i, first);
+        i = first;
+    }
+}
+
+/**
+ * Add a task to the heap and wake up the scheduler if the task is due
+ * first. The caller holds the tasklock.
  *
- * @param name          The unique name for this housekeeper task
- * @param taskfn        The function to call for the task
- * @param data          Data to pass to the task function
- * @param frequency     How often to run the task, expressed in seconds
- * @return              Return the time in seconds when the task will be first run
- *                      if the task was added, otherwise 0
+ * @param task  The task
+ * @return      True if the task was added
  */
-int
-hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
+static bool
+hk_heap_push(HKTASK *task)
 {
-    HKTASK *task, *ptr;
+    if (heap_size == heap_capacity)
+    {
+        int capacity = heap_capacity ? heap_capacity * 2 : 16;
+        HKTASK **new_heap = realloc(heap, capacity * sizeof(HKTASK *));
 
-    if ((task = (HKTASK *)malloc(sizeof(HKTASK))) == NULL)
+        if (new_heap == NULL)
+        {
+            return false;
+        }
+        heap = new_heap;
+        heap_capacity = capacity;
+    }
+
+    task->state = HK_SCHEDULED;
+    task->index = heap_size;
+    heap[heap_size++] = task;
+    hk_heap_up(task->index);
+
+    if (task->index == 0 && hk_started)
+    {
+        pthread_cond_signal(&hk_sched_cond);
+    }
+
+    return true;
+}
+
+/**
+ * Remove a task from the heap. The caller holds the tasklock.
+ *
+ * @param task  The task
+ */
+static void
+hk_heap_remove(HKTASK *task)
+{
+    int i = task->index;
+
+    heap_size--;
+    if (i != heap_size)
+    {
+        hk_heap_swap(i, heap_size);
+        hk_heap_down(i);
+        hk_heap_up(i);
+    }
+    task->index = -1;
+}
+
+/**
+ * Remove a task from the list of all tasks. The caller holds the tasklock.
+ *
+ * @param task  The task
+ */
+static void
+hk_list_remove(HKTASK *task)
+{
+    HKTASK **pptr = &tasks;
+
+    while (*pptr && *pptr != task)
+    {
+        pptr = &(*pptr)->next;
+    }
+    if (*pptr)
+    {
+        *pptr = task->next;
+    }
+}
+
+/**
+ * Free a task
+ *
+ * @param task  The task
+ */
+static void
+hk_task_free(HKTASK *task)
+{
+    free(task->name);
+    free(task);
+}
+
+/**
+ * Add a task to the housekeeper
+ *
+ * @param name      The unique name for this housekeeper task
+ * @param taskfn    The function to call for the task
+ * @param data      Data to pass to the task function
+ * @param type      The task type
+ * @param frequency How often to run a repeated task in milliseconds
+ * @param when      How many milliseconds until the task is first run
+ * @param exclusive Whether the task must not run with other exclusive tasks
+ * @return          Return the time in seconds when the task will be first run
+ *                  if the task was added, otherwise 0
+ */
+static int
+hktask_create(const char *name, void (*taskfn)(void *), void *data,
+              HKTASK_TYPE type, int frequency, int when, bool exclusive)
+{
+    HKTASK *task, **pptr;
+
+    if ((task = (HKTASK *)calloc(1, sizeof(HKTASK))) == NULL)
     {
         return 0;
     }
@@ -105,40 +351,100 @@ hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
     task->task = taskfn;
     task->data = data;
     task->frequency = frequency;
-    task->type = HK_REPEATED;
-    task->nextdue = time(0) + frequency;
-    task->next = NULL;
-    spinlock_acquire(&tasklock);
-    ptr = tasks;
-    while (ptr && ptr->next)
+    task->type = type;
+    task->exclusive = exclusive;
+    task->nextdue = hk_clock_ms() + when;
+    task->index = -1;
+
+    pthread_mutex_lock(&tasklock);
+    for (pptr = &tasks; *pptr; pptr = &(*pptr)->next)
     {
-        if (strcmp(ptr->name, name) == 0)
+        if (strcmp((*pptr)->name, name) == 0)
         {
-            spinlock_release(&tasklock);
-            free(task->name);
-            free(task);
-            return 0;
+            break;
         }
-        ptr = ptr->next;
     }
-    if (ptr)
+    if (*pptr || !hk_heap_push(task))
     {
-        if (strcmp(ptr->name, name) == 0)
-        {
-            spinlock_release(&tasklock);
-            free(task->name);
-            free(task);
-            return 0;
-        }
-        ptr->next = task;
+        pthread_mutex_unlock(&tasklock);
+        hk_task_free(task);
+        return 0;
     }
-    else
+    *pptr = task;
+    pthread_mutex_unlock(&tasklock);
+
+    return time(0) + (when + 999) / 1000;
+}
+
+/**
+ * Add a new task to the housekeepers lists of tasks that should be
+ * run periodically.
+ *
+ * The task will be first run frequency seconds after this call is
+ * made and will the be executed repeatedly every frequency seconds
+ * until the task is removed.
+ *
+ * Task names must be unique.
+ *
+ * @param name          The unique name for this housekeeper task
+ * @param taskfn        The function to call for the task
+ * @param data          Data to pass to the task function
+ * @param frequency     How often to run the task, expressed in seconds
+ * @return              Return the time in seconds when the task will be first run
+ *                      if the task was added, otherwise 0
+ */
+int
+hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
+{
+    return hktask_add_ms(name, taskfn, data, frequency * 1000);
+}
+
+/**
+ * Add a new task to the housekeepers lists of tasks that should be
+ * run periodically, with the frequency given in milliseconds.
+ *
+ * Task names must be unique.
+ *
+ * @param name          The unique name for this housekeeper task
+ * @param taskfn        The function to call for the task
+ * @param data          Data to pass to the task function
+ * @param frequency     How often to run the task, expressed in milliseconds
+ * @return              Return the time in seconds when the task will be first run
+ *                      if the task was added, otherwise 0
+ */
+int
+hktask_add_ms(const char *name, void (*taskfn)(void *), void *data, int frequency)
+{
+    if (frequency < 1)
     {
-        tasks = task;
+        frequency = 1;
     }
-    spinlock_release(&tasklock);
 
-    return task->nextdue;
+    return hktask_create(name, taskfn, data, HK_REPEATED, frequency, frequency, true);
+}
+
+/**
+ * Add a new task that may run at the same time as the other tasks. The task
+ * must protect the data it shares with other threads with its own locks.
+ *
+ * Task names must be unique.
+ *
+ * @param name          The unique name for this housekeeper task
+ * @param taskfn        The function to call for the task
+ * @param data          Data to pass to the task function
+ * @param frequency     How often to run the task, expressed in milliseconds
+ * @return              Return the time in seconds when the task will be first run
+ *                      if the task was added, otherwise 0
+ */
+int
+hktask_add_concurrent_ms(const char *name, void (*taskfn)(void *), void *data, int frequency)
+{
+    if (frequency < 1)
+    {
+        frequency = 1;
+    }
+
+    return hktask_create(name, taskfn, data, HK_REPEATED, frequency, frequency, false);
 }
 
 /**
@@ -157,152 +463,311 @@ hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
 int
 hktask_oneshot(const char *name, void (*taskfn)(void *), void *data, int when)
 {
-    HKTASK *task, *ptr;
-
-    if ((task = (HKTASK *)malloc(sizeof(HKTASK))) == NULL)
-    {
-        return 0;
-    }
-    if ((task->name = strdup(name)) == NULL)
-    {
-        free(task);
-        return 0;
-    }
-    task->task = taskfn;
-    task->data = data;
-    task->frequency = 0;
-    task->type = HK_ONESHOT;
-    task->nextdue = time(0) + when;
-    task->next = NULL;
-    spinlock_acquire(&tasklock);
-    ptr = tasks;
-    while (ptr && ptr->next)
-    {
-        if (strcmp(ptr->name, name) == 0)
-        {
-            spinlock_release(&tasklock);
-            free(task->name);
-            free(task);
-            return 0;
-        }
-        ptr = ptr->next;
-    }
-    if (ptr)
-    {
-        ptr->next = task;
-    }
-    else
-    {
-        tasks = task;
-    }
-    spinlock_release(&tasklock);
+    return hktask_oneshot_ms(name, taskfn, data, when * 1000);
+}
 
-    return task->nextdue;
+/**
+ * Add a one-shot task to the housekeeper task list, with the delay given
+ * in milliseconds
+ *
+ * Task names must be unique.
+ *
+ * @param name          The unique name for this housekeeper task
+ * @param taskfn        The function to call for the task
+ * @param data          Data to pass to the task function
+ * @param when          How many milliseconds until the task is executed
+ * @return              Return the time in seconds when the task will be first run
+ *                      if the task was added, otherwise 0
+ */
+int
+hktask_oneshot_ms(const char *name, void (*taskfn)(void *), void *data, int when)
+{
+    return hktask_create(name, taskfn, data, HK_ONESHOT, 0, when > 0 ? when : 0, true);
 }
 
+/**
+ * Add a one-shot task that may run at the same time as the other tasks. The
+ * task must protect the data it shares with other threads with its own locks.
+ *
+ * Task names must be unique.
+ *
+ * @param name          The unique name for this housekeeper task
+ * @param taskfn        The function to call for the task
+ * @param data          Data to pass to the task function
+ * @param when          How many milliseconds until the task is executed
+ * @return              Return the time in seconds when the task will be first run
+ *                      if the task was added, otherwise 0
+ */
+int
+hktask_oneshot_concurrent_ms(const char *name, void (*taskfn)(void *), void *data, int when)
+{
+    return hktask_create(name, taskfn, data, HK_ONESHOT, 0, when > 0 ? when : 0, false);
+}
 
 /**
  * Remove a named task from the housekeepers task list
  *
+ * If the task is being run by another thread, the call waits until it has
+ * finished, so the data of the task can be freed once this returns. A task
+ * may remove itself, in which case it is freed once it returns.
+ *
  * @param name          The task name to remove
  * @return              Returns 0 if the task could not be removed
  */
 int
 hktask_remove(const char *name)
 {
-    HKTASK *ptr, *lptr = NULL;
+    HKTASK *ptr;
 
-    spinlock_acquire(&tasklock);
-    ptr = tasks;
-    while (ptr && strcmp(ptr->name, name) != 0)
+    pthread_mutex_lock(&tasklock);
+    for (ptr = tasks; ptr; ptr = ptr->next)
     {
-        lptr = ptr;
-        ptr = ptr->next;
+        if (strcmp(ptr->name, name) == 0)
+        {
+            break;
+        }
     }
-    if (ptr && lptr)
+
+    if (ptr == NULL)
     {
-        lptr->next = ptr->next;
+        pthread_mutex_unlock(&tasklock);
+        return 0;
     }
-    else if (ptr)
+
+    hk_list_remove(ptr);
+
+    switch (ptr->state)
     {
-        tasks = ptr->next;
+    case HK_SCHEDULED:
+        hk_heap_remove(ptr);
+        break;
+
+    case HK_QUEUED:
+        /** The worker that takes the task from the queue frees it */
+        ptr->removed = true;
+        ptr = NULL;
+        break;
+
+    case HK_RUNNING:
+        ptr->removed = true;
+        if (ptr == hk_current)
+        {
+            /** Freed by the worker once the task returns */
+            ptr = NULL;
+        }
+        else
+        {
+            ptr->waited = true;
+            while (ptr->state == HK_RUNNING)
+            {
+                pthread_cond_wait(&hk_done_cond, &tasklock);
+            }
+        }
+        break;
     }
-    spinlock_release(&tasklock);
+    pthread_mutex_unlock(&tasklock);
 
     if (ptr)
     {
-        free(ptr->name);
-        free(ptr);
-        return 1;
-    }
-    else
-    {
-        return 0;
+        hk_task_free(ptr);
     }
-}
 
+    return 1;
+}
 
 /**
  * The housekeeper thread implementation.
  *
- * This function is responsible for executing the housekeeper tasks.
- *
- * The implementation of the callng of the task functions is such that
- * the tasks are called without the tasklock spinlock being held. This
- * allows manipulation of the housekeeper task list during execution of
- * one of the tasks. The resutl is that upon completion of a task the
- * search for tasks to run must restart from the start of the queue.
- * It is vital that the task->nextdue tiem is updated before the task
- * is run.
+ * This function advances the heartbeat and hands the tasks that are due to
+ * the worker threads. It sleeps until the first task in the heap is due or
+ * the next heartbeat, whichever comes first. The tasks are taken out of the
+ * heap while they wait for a worker or run, so a task that is still running
+ * when it would next be due is not started again.
  *
  * @param       data            Unused, here to satisfy the thread system
  */
 void
 hkthread(void *data)
 {
-    HKTASK *ptr;
-    time_t now;
-    void (*taskfn)(void *);
-    void *taskdata;
-    int i;
+    pthread_mutex_lock(&tasklock);
+    while (!do_shutdown)
+    {
+        long now = hk_clock_ms();
+        long beat = (now - hk_start_ms) / HK_HEARTBEAT_MS;
+        long wakeup = hk_start_ms + (beat + 1) * HK_HEARTBEAT_MS;
+        struct timespec ts;
 
-    for (;;)
+        __atomic_store_n(&hkheartbeat, beat, __ATOMIC_RELAXED);
+
+        while (heap_size > 0 && heap[0]->nextdue <= now)
+        {
+            HKTASK *task = heap[0];
+
+            hk_heap_remove(task);
+            task->state = HK_QUEUED;
+            task->next_queued = NULL;
+            if (queue_tail)
+            {
+                queue_tail->next_queued = task;
+            }
+            else
+            {
+                queue_head = task;
+            }
+            queue_tail = task;
+            pthread_cond_signal(&hk_work_cond);
+        }
+
+        if (heap_size > 0 && heap[0]->nextdue < wakeup)
+        {
+            wakeup = heap[0]->nextdue;
+        }
+
+        ts.tv_sec = wakeup / 1000;
+        ts.tv_nsec = (wakeup % 1000) * 1000000;
+        pthread_cond_timedwait(&hk_sched_cond, &tasklock, &ts);
+    }
+    pthread_mutex_unlock(&tasklock);
+}
+
+/**
+ * Take the first task that can be run from the queue of the workers. An
+ * exclusive task is skipped while another exclusive task is running. The
+ * caller holds the tasklock.
+ *
+ * @return The task or NULL if no queued task can be run
+ */
+static HKTASK *
+hk_queue_take()
+{
+    HKTASK *prev = NULL;
+    HKTASK *task;
+
+    for (task = queue_head; task; prev = task, task = task->next_queued)
+    {
+        if (task->removed || !task->exclusive || !exclusive_running)
+        {
+            break;
+        }
+    }
+
+    if (task)
     {
-        for (i = 0; i < 10; i++)
+        if (prev)
+        {
+            prev->next_queued = task->next_queued;
+        }
+        else
+        {
+            queue_head = task->next_queued;
+        }
+        if (queue_tail == task)
+        {
+            queue_tail = prev;
+        }
+    }
+
+    return task;
+}
+
+/**
+ * A housekeeper worker thread. The worker runs the tasks that the scheduler
+ * has queued without holding the tasklock, so the tasks may add and remove
+ * tasks. Once a repeated task has finished, it is put back in the heap.
+ *
+ * @param       data            Unused, here to satisfy the thread system
+ */
+static void
+hkworker(void *data)
+{
+    pthread_mutex_lock(&tasklock);
+    while (!do_shutdown)
+    {
+        HKTASK *task = hk_queue_take();
+        long start;
+        long elapsed;
+
+        if (task == NULL)
+        {
+            pthread_cond_wait(&hk_work_cond, &tasklock);
+            continue;
+        }
+
+        if (task->removed)
+        {
+            hk_task_free(task);
+            continue;
+        }
+
+        if (task->exclusive)
+        {
+            exclusive_running = true;
+        }
+        task->state = HK_RUNNING;
+        hk_current = task;
+        pthread_mutex_unlock(&tasklock);
+
+        start = hk_clock_us();
+        task->task(task->data);
+        elapsed = hk_clock_us() - start;
+
+        pthread_mutex_lock(&tasklock);
+        hk_current = NULL;
+        if (task->exclusive)
         {
-            if (do_shutdown)
+            /** The queued exclusive tasks may now be run */
+            exclusive_running = false;
+            if (queue_head)
             {
-                return;
+                pthread_cond_broadcast(&hk_work_cond);
             }
-            thread_millisleep(100);
-            hkheartbeat++;
         }
-        now = time(0);
-        spinlock_acquire(&tasklock);
-        ptr = tasks;
-        while (ptr)
+        task->runs++;
+        task->total_us += elapsed;
+        task->last_us = elapsed;
+        if (elapsed > task->max_us)
         {
-            if (ptr->nextdue <= now)
+            task->max_us = elapsed;
+        }
+
+        if (task->removed)
+        {
+            if (task->waited)
             {
-                ptr->nextdue = now + ptr->frequency;
-                taskfn = ptr->task;
-                taskdata = ptr->data;
-                spinlock_release(&tasklock);
-                (*taskfn)(taskdata);
-                if (ptr->type == HK_ONESHOT)
-                {
-                    hktask_remove(ptr->name);
-                }
-                spinlock_acquire(&tasklock);
-                ptr = tasks;
+                /** The remover frees the task */
+                task->state = HK_SCHEDULED;
+                pthread_cond_broadcast(&hk_done_cond);
             }
             else
             {
-                ptr = ptr->next;
+                hk_task_free(task);
+            }
+        }
+        else if (task->type == HK_ONESHOT)
+        {
+            hk_list_remove(task);
+            hk_task_free(task);
+        }
+        else
+        {
+            long now = hk_clock_ms();
+
+            /** Keep the rate unless the task overran its next run */
+            task->nextdue += task->frequency;
+            if (task->nextdue <= now)
+            {
+                task->nextdue = now + task->frequency;
+            }
+            if (!hk_heap_push(task))
+            {
+                MXS_ERROR("Failed to allocate memory to reschedule housekeeper "
+                          "task '%s', the task is removed.", task->name);
+                hk_list_remove(task);
+                hk_task_free(task);
             }
         }
-        spinlock_release(&tasklock);
     }
+    pthread_mutex_unlock(&tasklock);
 }
 
 /**
@@ -312,7 +777,38 @@ hkthread(void *data)
 void
 hkshutdown()
 {
+    pthread_mutex_lock(&tasklock);
     do_shutdown = 1;
+    if (hk_started)
+    {
+        pthread_cond_signal(&hk_sched_cond);
+    }
+    pthread_cond_broadcast(&hk_work_cond);
+    pthread_mutex_unlock(&tasklock);
+}
+
+/**
+ * Format an interval or a run time for display
+ *
+ * @param buf   The buffer to format to
+ * @param size  The size of the buffer
+ * @param us    The time in microseconds
+ */
+static void
+hk_format_time(char *buf, size_t size, long us)
+{
+    if (us < 1000)
+    {
+        snprintf(buf, size, "%ldus", us);
+    }
+    else if (us < 1000000)
+    {
+        snprintf(buf, size, "%.1fms", us / 1000.0);
+    }
+    else
+    {
+        snprintf(buf, size, "%.1fs", us / 1000000.0);
+    }
 }
 
 /**
@@ -326,21 +822,49 @@ hkshow_tasks(DCB *pdcb)
     HKTASK *ptr;
     struct tm tm;
     char buf[40];
+    char freq[20];
+    char avg[20];
+    char max[20];
+    long now_ms = hk_clock_ms();
+    time_t now = time(0);
 
-    dcb_printf(pdcb, "%-25s | Type     | Frequency | Next Due\n", "Name");
-    dcb_printf(pdcb, "--------------------------+----------+-----------+-------------------------\n");
-    spinlock_acquire(&tasklock);
-    ptr = tasks;
-    while (ptr)
+    dcb_printf(pdcb, "%-25s | Type     | Frequency | Next Due            | Runs     | Avg Time | Max Time\n",
+               "Name");
+    dcb_printf(pdcb, "--------------------------+----------+-----------+---------------------+"
+               "----------+----------+---------\n");
+    pthread_mutex_lock(&tasklock);
+    for (ptr = tasks; ptr; ptr = ptr->next)
     {
-        localtime_r(&ptr->nextdue, &tm);
-        asctime_r(&tm, buf);
-        dcb_printf(pdcb, "%-25s | %-8s | %-9d | %s",
+        if (ptr->state == HK_SCHEDULED)
+        {
+            time_t due = now + (ptr->nextdue - now_ms + 999) / 1000;
+            localtime_r(&due, &tm);
+            strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        }
+        else
+        {
+            strcpy(buf, ptr->state == HK_RUNNING ? "Running" : "Queued");
+        }
+
+        if (ptr->type == HK_REPEATED)
+        {
+            hk_format_time(freq, sizeof(freq), ptr->frequency * 1000L);
+        }
+        else
+        {
+            strcpy(freq, "-");
+        }
+        hk_format_time(avg, sizeof(avg), ptr->runs ? ptr->total_us / (long)ptr->runs : 0);
+        hk_format_time(max, sizeof(max), ptr->max_us);
+
+        dcb_printf(pdcb, "%-25s | %-8s | %-9s | %-19s | %-8lu | %-8s | %s\n",
                    ptr->name,
                    ptr->type == HK_REPEATED ? "Repeated" : "One-Shot",
-                   ptr->frequency,
-                   buf);
-        ptr = ptr->next;
+                   freq,
+                   buf,
+                   ptr->runs,
+                   avg,
+                   max);
     }
-    spinlock_release(&tasklock);
+    pthread_mutex_unlock(&tasklock);
 }
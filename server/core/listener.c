@@ -62,6 +62,8 @@ listener_alloc(char *protocol, char *address, unsigned short port, char *authent
     if ((proto = (SERV_LISTENER *)malloc(sizeof(SERV_LISTENER))) != NULL)
     {
         proto->listener = NULL;
+        proto->shards = NULL;
+        proto->n_shards = 0;
         proto->protocol = strdup(protocol);
         proto->address = address ? strdup(address) : NULL;
         proto->port = port;
@@ -236,6 +238,32 @@ listener_init_SSL(SSL_LISTENER *ssl_listener)
 
         /* Set the verification depth */
         SSL_CTX_set_verify_depth(ssl_listener->ctx,ssl_listener->ssl_cert_verify_depth);
+
+        /**
+         * Let clients that reconnect resume their earlier session with an
+         * abbreviated handshake. The session ID context is required for
+         * resumption when client certificates are verified.
+         */
+        SSL_CTX_set_session_id_context(ssl_listener->ctx, (const unsigned char*)"MaxScale", 8);
+        if (ssl_listener->ssl_session_cache_size > 0)
+        {
+            SSL_CTX_set_session_cache_mode(ssl_listener->ctx, SSL_SESS_CACHE_SERVER);
+            SSL_CTX_sess_set_cache_size(ssl_listener->ctx, ssl_listener->ssl_session_cache_size);
+        }
+        else
+        {
+            SSL_CTX_set_session_cache_mode(ssl_listener->ctx, SSL_SESS_CACHE_OFF);
+        }
+        SSL_CTX_set_timeout(ssl_listener->ctx, ssl_listener->ssl_session_timeout);
+        if (!ssl_listener->ssl_session_tickets)
+        {
+            SSL_CTX_set_options(ssl_listener->ctx, SSL_OP_NO_TICKET);
+        }
+
+        /** The write queue is not packed while a write is pending retry, so a
+         * retried SSL_write gets the same data. A moved buffer is accepted in
+         * case the queue head is nevertheless replaced. */
+        SSL_CTX_set_mode(ssl_listener->ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
         ssl_listener->ssl_init_done = true;
     }
     return 0;
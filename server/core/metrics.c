@@ -0,0 +1,503 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file metrics.c  - Metrics in the Prometheus text exposition format
+ *
+ * The metrics are grouped into families that share a name, a help text and
+ * a type. Each metric of a family is distinguished by the value of a label,
+ * for example the name of a service. The registry is protected by a lock
+ * that is held while the snapshot is taken, so once metrics_remove() returns
+ * the functions of the removed metrics are no longer called.
+ *
+ * The snapshot is a block of text that is replaced as a whole. A request
+ * only copies the current snapshot into a buffer under a lock that is held
+ * for the duration of the copy.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <metrics.h>
+#include <buffer.h>
+#include <dcb.h>
+#include <spinlock.h>
+#include <housekeeper.h>
+#include <maxconfig.h>
+#include <maxscale.h>
+#include <maxscale/poll.h>
+#include <log_manager.h>
+
+/**
+ * A metric of a family
+ */
+typedef struct metric
+{
+    char          *labels;      /*< The formatted labels, an empty string if none */
+    METRIC_FUNC   func;         /*< Returns the value of the metric */
+    void          *data;        /*< The argument of the function */
+    struct metric *next;
+} METRIC;
+
+/**
+ * A family of metrics with the same name
+ */
+typedef struct metric_family
+{
+    char                 *name;
+    char                 *help;
+    metric_type_t        type;
+    METRIC               *metrics;  /*< The metrics in the order they were added */
+    struct metric_family *next;
+} METRIC_FAMILY;
+
+/**
+ * A growing block of text
+ */
+typedef struct
+{
+    char   *data;
+    size_t len;
+    size_t size;
+    bool   failed;      /*< Memory allocation failed */
+} METRIC_TEXT;
+
+static METRIC_FAMILY *families = NULL;
+static METRIC_FAMILY *families_tail = NULL;
+static SPINLOCK metrics_lock = SPINLOCK_INIT;
+
+static char *snapshot = NULL;
+static size_t snapshot_len = 0;
+static SPINLOCK snapshot_lock = SPINLOCK_INIT;
+
+/**
+ * Append formatted text to a block of text
+ *
+ * @param text  The block of text
+ * @param fmt   The format
+ */
+static void
+metric_text_printf(METRIC_TEXT *text, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if (text->failed)
+    {
+        return;
+    }
+
+    va_start(args, fmt);
+    len = vsnprintf(text->data + text->len, text->size - text->len, fmt, args);
+    va_end(args);
+
+    if ((size_t)len >= text->size - text->len)
+    {
+        size_t size = text->size * 2;
+        char *data;
+
+        while (size - text->len <= (size_t)len)
+        {
+            size *= 2;
+        }
+
+        if ((data = realloc(text->data, size)) == NULL)
+        {
+            text->failed = true;
+            return;
+        }
+        text->data = data;
+        text->size = size;
+
+        va_start(args, fmt);
+        vsnprintf(text->data + text->len, text->size - text->len, fmt, args);
+        va_end(args);
+    }
+
+    text->len += len;
+}
+
+/**
+ * Append a string to a block of text, escaping the characters that have a
+ * special meaning in label values and help texts
+ *
+ * @param text      The block of text
+ * @param str       The string
+ * @param quotes    Escape double quotes as well
+ */
+static void
+metric_text_escape(METRIC_TEXT *text, const char *str, bool quotes)
+{
+    for (const char *ptr = str; *ptr; ptr++)
+    {
+        if (*ptr == '\\')
+        {
+            metric_text_printf(text, "\\\\");
+        }
+        else if (*ptr == '\n')
+        {
+            metric_text_printf(text, "\\n");
+        }
+        else if (*ptr == '"' && quotes)
+        {
+            metric_text_printf(text, "\\\"");
+        }
+        else
+        {
+            metric_text_printf(text, "%c", *ptr);
+        }
+    }
+}
+
+/**
+ * Initialise a block of text
+ *
+ * @param text  The block of text
+ * @param size  The initial size
+ * @return      False if memory allocation failed
+ */
+static bool
+metric_text_init(METRIC_TEXT *text, size_t size)
+{
+    text->len = 0;
+    text->size = size;
+    text->failed = false;
+
+    if ((text->data = malloc(size)) == NULL)
+    {
+        return false;
+    }
+    text->data[0] = '\0';
+    return true;
+}
+
+/**
+ * Add a metric. Metrics with the same name form a family and must have the
+ * same type. A metric of a family that has several metrics must have a label
+ * that tells it apart from the other metrics.
+ *
+ * @param name      The name of the metric, e.g. maxscale_service_sessions
+ * @param help      The description of the metric
+ * @param type      The type of the metric
+ * @param label     The name of the label or NULL for no label
+ * @param value     The value of the label
+ * @param func      The function that returns the value of the metric
+ * @param data      The argument of the function, also used with metrics_remove()
+ * @return          True if the metric was added
+ */
+bool
+metric_add(const char *name, const char *help, metric_type_t type,
+           const char *label, const char *value, METRIC_FUNC func, void *data)
+{
+    METRIC_FAMILY *family;
+    METRIC_TEXT labels;
+    METRIC *metric;
+
+    if ((metric = calloc(1, sizeof(METRIC))) == NULL || !metric_text_init(&labels, 64))
+    {
+        free(metric);
+        MXS_ERROR("Failed to allocate memory for metric '%s'.", name);
+        return false;
+    }
+
+    if (label)
+    {
+        metric_text_printf(&labels, "{%s=\"", label);
+        metric_text_escape(&labels, value, true);
+        metric_text_printf(&labels, "\"}");
+    }
+
+    if (labels.failed)
+    {
+        free(labels.data);
+        free(metric);
+        MXS_ERROR("Failed to allocate memory for metric '%s'.", name);
+        return false;
+    }
+
+    metric->labels = labels.data;
+    metric->func = func;
+    metric->data = data;
+
+    spinlock_acquire(&metrics_lock);
+
+    for (family = families; family; family = family->next)
+    {
+        if (strcmp(family->name, name) == 0)
+        {
+            break;
+        }
+    }
+
+    if (family == NULL)
+    {
+        if ((family = calloc(1, sizeof(METRIC_FAMILY))) == NULL ||
+            (family->name = strdup(name)) == NULL ||
+            (family->help = strdup(help)) == NULL)
+        {
+            spinlock_release(&metrics_lock);
+            if (family)
+            {
+                free(family->name);
+                free(family);
+            }
+            free(metric->labels);
+            free(metric);
+            MXS_ERROR("Failed to allocate memory for metric '%s'.", name);
+            return false;
+        }
+
+        family->type = type;
+        if (families_tail)
+        {
+            families_tail->next = family;
+        }
+        else
+        {
+            families = family;
+        }
+        families_tail = family;
+    }
+    else if (family->type != type)
+    {
+        spinlock_release(&metrics_lock);
+        free(metric->labels);
+        free(metric);
+        MXS_ERROR("Metric '%s' was added with two different types.", name);
+        return false;
+    }
+
+    METRIC **pptr = &family->metrics;
+    while (*pptr)
+    {
+        pptr = &(*pptr)->next;
+    }
+    *pptr = metric;
+
+    spinlock_release(&metrics_lock);
+
+    return true;
+}
+
+/**
+ * Remove all the metrics that were added with the given data. This must be
+ * called before the object the functions of the metrics read is freed.
+ *
+ * @param data  The argument of the functions of the metrics
+ */
+void
+metrics_remove(void *data)
+{
+    spinlock_acquire(&metrics_lock);
+
+    for (METRIC_FAMILY *family = families; family; family = family->next)
+    {
+        METRIC **pptr = &family->metrics;
+
+        while (*pptr)
+        {
+            METRIC *metric = *pptr;
+
+            if (metric->data == data)
+            {
+                *pptr = metric->next;
+                free(metric->labels);
+                free(metric);
+            }
+            else
+            {
+                pptr = &metric->next;
+            }
+        }
+    }
+
+    spinlock_release(&metrics_lock);
+}
+
+/**
+ * Read all metrics and replace the snapshot. This is run periodically by
+ * the housekeeper.
+ *
+ * @param data  Unused
+ */
+void
+metrics_snapshot(void *data)
+{
+    METRIC_TEXT text;
+    char *old;
+
+    if (!metric_text_init(&text, snapshot_len > 0 ? snapshot_len + snapshot_len / 4 : 4096))
+    {
+        return;
+    }
+
+    spinlock_acquire(&metrics_lock);
+    for (METRIC_FAMILY *family = families; family; family = family->next)
+    {
+        if (family->metrics == NULL)
+        {
+            continue;
+        }
+
+        metric_text_printf(&text, "# HELP %s ", family->name);
+        metric_text_escape(&text, family->help, false);
+        metric_text_printf(&text, "\n# TYPE %s %s\n", family->name,
+                           family->type == METRIC_COUNTER ? "counter" : "gauge");
+
+        for (METRIC *metric = family->metrics; metric; metric = metric->next)
+        {
+            metric_text_printf(&text, "%s%s %lld\n", family->name, metric->labels,
+                               (long long)metric->func(metric->data));
+        }
+    }
+    spinlock_release(&metrics_lock);
+
+    if (text.failed)
+    {
+        free(text.data);
+        MXS_ERROR("Failed to allocate memory for the metrics snapshot.");
+        return;
+    }
+
+    spinlock_acquire(&snapshot_lock);
+    old = snapshot;
+    snapshot = text.data;
+    snapshot_len = text.len;
+    spinlock_release(&snapshot_lock);
+
+    free(old);
+}
+
+/**
+ * Return a copy of the latest snapshot of the metrics
+ *
+ * @return A buffer with the metrics or NULL if there is no snapshot yet or
+ *         memory allocation failed
+ */
+GWBUF *
+metrics_get()
+{
+    GWBUF *buf = NULL;
+
+    spinlock_acquire(&snapshot_lock);
+    if (snapshot && snapshot_len > 0)
+    {
+        buf = gwbuf_alloc_and_load(snapshot_len, snapshot);
+    }
+    spinlock_release(&snapshot_lock);
+
+    return buf;
+}
+
+/**
+ * Write the latest snapshot of the metrics to a DCB
+ *
+ * @param dcb   The DCB to write to
+ */
+void
+metrics_stream(DCB *dcb)
+{
+    GWBUF *buf = metrics_get();
+
+    if (buf)
+    {
+        dcb->func.write(dcb, buf);
+    }
+}
+
+static int64_t
+metric_uptime(void *data)
+{
+    return maxscale_uptime();
+}
+
+static int64_t
+metric_threads(void *data)
+{
+    return config_threadcount();
+}
+
+static int64_t
+metric_poll_stat(void *data)
+{
+    return poll_get_stat((POLL_STAT)(intptr_t)data);
+}
+
+/**
+ * The metrics of the polling system
+ */
+static const struct
+{
+    const char    *name;
+    const char    *help;
+    metric_type_t type;
+    const char    *label;
+    const char    *value;
+    POLL_STAT     stat;
+} poll_metrics[] =
+{
+    { "maxscale_events_total", "Number of events processed by the polling threads",
+      METRIC_COUNTER, "type", "read", POLL_STAT_READ },
+    { "maxscale_events_total", NULL, METRIC_COUNTER, "type", "write", POLL_STAT_WRITE },
+    { "maxscale_events_total", NULL, METRIC_COUNTER, "type", "error", POLL_STAT_ERROR },
+    { "maxscale_events_total", NULL, METRIC_COUNTER, "type", "hangup", POLL_STAT_HANGUP },
+    { "maxscale_events_total", NULL, METRIC_COUNTER, "type", "accept", POLL_STAT_ACCEPT },
+    { "maxscale_crossnode_events_total",
+      "Number of events processed on another NUMA node than the one their connection was created on",
+      METRIC_COUNTER, NULL, NULL, POLL_STAT_CROSSNODE },
+    { "maxscale_event_queue_length", "Number of events waiting to be processed",
+      METRIC_GAUGE, NULL, NULL, POLL_STAT_EVQ_LEN },
+    { "maxscale_event_queue_time_microseconds", "Time events waited to be processed",
+      METRIC_GAUGE, "quantile", "0.5", POLL_STAT_QTIME_P50 },
+    { "maxscale_event_queue_time_microseconds", NULL, METRIC_GAUGE, "quantile", "0.9", POLL_STAT_QTIME_P90 },
+    { "maxscale_event_queue_time_microseconds", NULL, METRIC_GAUGE, "quantile", "0.99", POLL_STAT_QTIME_P99 },
+    { "maxscale_event_execution_time_microseconds", "Time taken to process events",
+      METRIC_GAUGE, "quantile", "0.5", POLL_STAT_EXECTIME_P50 },
+    { "maxscale_event_execution_time_microseconds", NULL, METRIC_GAUGE, "quantile", "0.9", POLL_STAT_EXECTIME_P90 },
+    { "maxscale_event_execution_time_microseconds", NULL, METRIC_GAUGE, "quantile", "0.99", POLL_STAT_EXECTIME_P99 },
+    { NULL }
+};
+
+/**
+ * Add the global metrics and start taking snapshots
+ */
+void
+metrics_init()
+{
+    const char *help = NULL;
+
+    metric_add("maxscale_uptime_seconds", "Time since MaxScale was started",
+               METRIC_COUNTER, NULL, NULL, metric_uptime, NULL);
+    metric_add("maxscale_threads", "Number of polling threads",
+               METRIC_GAUGE, NULL, NULL, metric_threads, NULL);
+
+    for (int i = 0; poll_metrics[i].name; i++)
+    {
+        if (poll_metrics[i].help)
+        {
+            help = poll_metrics[i].help;
+        }
+        metric_add(poll_metrics[i].name, help, poll_metrics[i].type,
+                   poll_metrics[i].label, poll_metrics[i].value,
+                   metric_poll_stat, (void *)(intptr_t)poll_metrics[i].stat);
+    }
+
+    metrics_snapshot(NULL);
+    hktask_add_concurrent_ms("Metrics", metrics_snapshot, NULL, METRICS_INTERVAL);
+}
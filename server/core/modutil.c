@@ -49,6 +49,17 @@ static const char* sub_percent = ".*";
 static const char* sub_single = "$1.";
 static const char* sub_escape = "\\.";
 
+/**
+ * A contiguous copy of SQL that spans several buffers. The copy is stored as
+ * a buffer object so that it is made only once per packet.
+ */
+typedef struct
+{
+    void *start;    /*< The start of the buffer when the copy was made */
+    int   length;   /*< Length of the SQL */
+    char *sql;      /*< The copy of the SQL */
+} SQL_VIEW;
+
 static void modutil_reply_routing_error(
     DCB*     backend_dcb,
     int      error,
@@ -313,6 +324,113 @@ modutil_get_SQL(GWBUF *buf)
     return rval;
 }
 
+/**
+ * Free a SQL_VIEW buffer object
+ *
+ * @param data The SQL_VIEW to free
+ */
+static void
+sql_view_free(void *data)
+{
+    SQL_VIEW *view = (SQL_VIEW *) data;
+
+    free(view->sql);
+    free(view);
+}
+
+/**
+ * Get a read-only view of the SQL of a COM_QUERY, COM_STMT_PREPARE or
+ * COM_INIT_DB packet.
+ *
+ * NB This sets *sql to point at data that is owned by the buffer, the caller
+ * must not modify or free it. The SQL is not NULL terminated and is valid
+ * until the buffer is freed or modified.
+ *
+ * If the whole packet is in the first buffer of the chain, *sql points into
+ * the packet itself. Otherwise a contiguous copy of the SQL is made and stored
+ * in the buffer, subsequent calls with the same buffer return the same copy.
+ *
+ * @param       buf     The packet buffer
+ * @param       sql     Pointer that is set to point at the SQL data
+ * @param       length  Length of the SQL data
+ * @return      True if the packet contains SQL
+ */
+bool
+modutil_get_SQL_view(GWBUF *buf, char **sql, int *length)
+{
+    unsigned char *ptr;
+    SQL_VIEW *view;
+    int len;
+
+    if (!modutil_is_SQL(buf) && !modutil_is_SQL_prepare(buf) && !MYSQL_IS_COM_INIT_DB(buf))
+    {
+        return false;
+    }
+
+    ptr = GWBUF_DATA(buf);
+    len = gw_mysql_get_byte3(ptr) - 1; // The command byte is not a part of the SQL
+
+    if (len < 0)
+    {
+        return false;
+    }
+
+    if (GWBUF_LENGTH(buf) >= len + 5)
+    {
+        *sql = (char *)ptr + 5;
+        *length = len;
+        return true;
+    }
+
+    if ((view = gwbuf_get_buffer_object_data(buf, GWBUF_SQL_VIEW)) == NULL)
+    {
+        if ((view = calloc(1, sizeof(SQL_VIEW))) == NULL)
+        {
+            return false;
+        }
+        gwbuf_add_buffer_object(buf, GWBUF_SQL_VIEW, view, sql_view_free);
+    }
+
+    if (view->sql == NULL || view->start != buf->start || view->length != len)
+    {
+        GWBUF *next = buf;
+        int clen = GWBUF_LENGTH(buf) - 5;
+        int copied = 0;
+
+        free(view->sql);
+        view->start = NULL;
+
+        if ((view->sql = malloc(len)) == NULL)
+        {
+            return false;
+        }
+
+        ptr += 5;
+
+        while (next && copied < len)
+        {
+            clen = MIN(clen, len - copied);
+            memcpy(view->sql + copied, ptr, clen);
+            copied += clen;
+            next = next->next;
+
+            if (next)
+            {
+                ptr = GWBUF_DATA(next);
+                clen = GWBUF_LENGTH(next);
+            }
+        }
+
+        /** Incomplete packets are not cached */
+        view->start = copied == len ? buf->start : NULL;
+        view->length = copied;
+    }
+
+    *sql = view->sql;
+    *length = view->length;
+    return true;
+}
+
 /**
  * Copy query string from GWBUF buffer to separate memory area.
  *
@@ -529,6 +647,7 @@ GWBUF* modutil_get_next_MySQL_packet(GWBUF** p_readbuf)
     packetbuf = gwbuf_alloc(packetlen);
     target    = GWBUF_DATA(packetbuf);
     packetbuf->gwbuf_type = readbuf->gwbuf_type; /*< Copy the type too */
+    packetbuf->stamp = readbuf->stamp;
     /**
      * Copy first MySQL packet to packetbuf and leave posible other
      * packets to read buffer.
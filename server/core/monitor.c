@@ -35,6 +35,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <monitor.h>
 #include <spinlock.h>
 #include <modules.h>
@@ -63,6 +65,25 @@ static MONITOR  *allMonitors = NULL;
 static SPINLOCK monLock = SPINLOCK_INIT;
 
 static void monitor_servers_free(MONITOR_SERVERS *servers);
+static void mon_probe_pool_free(MON_PROBE_POOL *pool);
+static void mon_show_probe_times(DCB *dcb, MONITOR *monitor);
+
+/**
+ * The worker threads that probe the servers of one monitor
+ */
+struct mon_probe_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;          /**< Signaled when a probe cycle starts */
+    pthread_cond_t done;          /**< Signaled when all probes are done */
+    pthread_t *threads;           /**< The worker threads */
+    int n_threads;                /**< Number of worker threads */
+    MONITOR *mon;                 /**< The monitor */
+    mon_probe_func_t probe;       /**< The probe function of the current cycle */
+    MONITOR_SERVERS *next;        /**< Next server to probe */
+    int pending;                  /**< Probes not yet completed */
+    bool shutdown;                /**< Set when the workers should exit */
+};
 
 /**
  * Allocate a new monitor, load the associated module for the monitor
@@ -99,6 +120,10 @@ monitor_alloc(char *name, char *module)
     mon->write_timeout = DEFAULT_WRITE_TIMEOUT;
     mon->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
     mon->interval = MONITOR_INTERVAL;
+    mon->probe_threads = 0;
+    mon->probe_pool = NULL;
+    mon->cycle_usec = 0;
+    mon->max_cycle_usec = 0;
     mon->parameters = NULL;
     spinlock_init(&mon->lock);
     spinlock_acquire(&monLock);
@@ -193,6 +218,10 @@ monitorStop(MONITOR *monitor)
         monitor->module->stopMonitor(monitor);
         monitor->state = MONITOR_STATE_STOPPED;
 
+        /** The monitor thread has stopped, no probe cycle can be running */
+        mon_probe_pool_free(monitor->probe_pool);
+        monitor->probe_pool = NULL;
+
         MONITOR_SERVERS* db = monitor->databases;
         while (db)
         {
@@ -247,6 +276,8 @@ monitorAddServer(MONITOR *mon, SERVER *server)
     db->mon_prev_status = -1;
     /* pending status is updated by get_replication_tree */
     db->pending_status = 0;
+    db->probe_usec = 0;
+    db->max_probe_usec = 0;
 
     spinlock_acquire(&mon->lock);
 
@@ -319,6 +350,7 @@ monitorShowAll(DCB *dcb)
         {
             ptr->module->diagnostics(dcb, ptr);
         }
+        mon_show_probe_times(dcb, ptr);
         ptr = ptr->next;
     }
     spinlock_release(&monLock);
@@ -339,6 +371,30 @@ monitorShow(DCB *dcb, MONITOR *monitor)
     {
         monitor->module->diagnostics(dcb, monitor);
     }
+    mon_show_probe_times(dcb, monitor);
+}
+
+/**
+ * Show the durations of the server probes of a monitor
+ *
+ * @param dcb           DCB for printing output
+ * @param monitor       The monitor
+ */
+static void
+mon_show_probe_times(DCB *dcb, MONITOR *monitor)
+{
+    dcb_printf(dcb, "\tProbe threads:       %d\n", monitor->probe_threads);
+    dcb_printf(dcb, "\tProbe cycle time:    %lu.%03lums (max %lu.%03lums)\n",
+               monitor->cycle_usec / 1000, monitor->cycle_usec % 1000,
+               monitor->max_cycle_usec / 1000, monitor->max_cycle_usec % 1000);
+
+    for (MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        dcb_printf(dcb, "\tProbe time of %s: %lu.%03lums (max %lu.%03lums)\n",
+                   db->server->unique_name,
+                   db->probe_usec / 1000, db->probe_usec % 1000,
+                   db->max_probe_usec / 1000, db->max_probe_usec % 1000);
+    }
 }
 
 /**
@@ -446,6 +502,26 @@ monitorSetNetworkTimeout(MONITOR *mon, int type, int value)
     return rval;
 }
 
+/**
+ * Set the maximum number of servers that are probed in parallel.
+ *
+ * @param mon           The monitor instance
+ * @param threads       Number of probe threads, 0 for one thread per server
+ * @return True if the value was valid
+ */
+bool
+monitorSetProbeThreads(MONITOR *mon, int threads)
+{
+    if (threads < 0)
+    {
+        MXS_ERROR("Negative value for monitor probe threads.");
+        return false;
+    }
+
+    mon->probe_threads = threads;
+    return true;
+}
+
 /**
  * Provide a row to the result set that defines the set of monitors
  *
@@ -1034,3 +1110,212 @@ void mon_log_state_change(MONITOR_SERVERS *ptr)
     free(prev);
     free(next);
 }
+
+/**
+ * Get the current time of the monotonic clock in microseconds
+ * @return The current time
+ */
+static unsigned long
+mon_time_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Probe one server and record how long the probe took
+ * @param mon Monitor
+ * @param probe Probe function
+ * @param database Server to probe
+ */
+static void
+mon_timed_probe(MONITOR *mon, mon_probe_func_t probe, MONITOR_SERVERS *database)
+{
+    unsigned long start = mon_time_usec();
+
+    probe(mon, database);
+
+    database->probe_usec = mon_time_usec() - start;
+    if (database->probe_usec > database->max_probe_usec)
+    {
+        database->max_probe_usec = database->probe_usec;
+    }
+}
+
+/**
+ * The main function of a probe worker thread
+ * @param data The probe pool
+ * @return Always NULL
+ */
+static void *
+mon_probe_worker(void *data)
+{
+    MON_PROBE_POOL *pool = (MON_PROBE_POOL *)data;
+
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("mysql_thread_init failed in monitor probe thread.");
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true)
+    {
+        while (!pool->shutdown && pool->next == NULL)
+        {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+
+        if (pool->shutdown)
+        {
+            break;
+        }
+
+        MONITOR_SERVERS *database = pool->next;
+        pool->next = database->next;
+        pthread_mutex_unlock(&pool->lock);
+
+        mon_timed_probe(pool->mon, pool->probe, database);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    mysql_thread_end();
+    return NULL;
+}
+
+/**
+ * Create the probe worker threads of a monitor
+ * @param mon Monitor
+ * @param n_threads Number of threads to start
+ * @return New probe pool or NULL on error
+ */
+static MON_PROBE_POOL *
+mon_probe_pool_alloc(MONITOR *mon, int n_threads)
+{
+    MON_PROBE_POOL *pool;
+
+    if ((pool = calloc(1, sizeof(MON_PROBE_POOL))) == NULL ||
+        (pool->threads = calloc(n_threads, sizeof(pthread_t))) == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->mon = mon;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, mon_probe_worker, pool) != 0)
+        {
+            MXS_ERROR("Failed to start probe thread for monitor '%s'.", mon->name);
+            break;
+        }
+        pool->n_threads++;
+    }
+
+    if (pool->n_threads == 0)
+    {
+        mon_probe_pool_free(pool);
+        pool = NULL;
+    }
+
+    return pool;
+}
+
+/**
+ * Stop the probe worker threads and free the pool
+ * @param pool Pool to free, may be NULL
+ */
+static void
+mon_probe_pool_free(MON_PROBE_POOL *pool)
+{
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->n_threads; i++)
+        {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&pool->done);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->threads);
+        free(pool);
+    }
+}
+
+/**
+ * Probe all servers of a monitor
+ *
+ * The servers are probed in parallel by a pool of worker threads so that the
+ * duration of a probe cycle is bounded by the slowest server instead of the
+ * sum of all probes. The probe function must only modify the state of the
+ * server it is given. If the pool cannot be created or only one probe thread
+ * is configured, the servers are probed one at a time.
+ *
+ * @param mon Monitor
+ * @param probe Function that probes one server
+ */
+void
+mon_probe_servers(MONITOR *mon, mon_probe_func_t probe)
+{
+    unsigned long start = mon_time_usec();
+    int n_servers = 0;
+
+    for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+    {
+        n_servers++;
+    }
+
+    int n_threads = mon->probe_threads > 0 ? MIN(mon->probe_threads, n_servers) : n_servers;
+
+    if (n_threads > 1 && mon->probe_pool == NULL)
+    {
+        mon->probe_pool = mon_probe_pool_alloc(mon, n_threads);
+    }
+
+    if (n_threads > 1 && mon->probe_pool)
+    {
+        MON_PROBE_POOL *pool = mon->probe_pool;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->probe = probe;
+        pool->pending = n_servers;
+        pool->next = mon->databases;
+        pthread_cond_broadcast(&pool->work);
+
+        while (pool->pending > 0)
+        {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    else
+    {
+        for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+        {
+            mon_timed_probe(mon, probe, db);
+        }
+    }
+
+    mon->cycle_usec = mon_time_usec() - start;
+    if (mon->cycle_usec > mon->max_cycle_usec)
+    {
+        mon->max_cycle_usec = mon->cycle_usec;
+    }
+}
@@ -23,6 +23,7 @@
 #include <signal.h>
 #include <sys/epoll.h>
 #include <errno.h>
+#include <time.h>
 #include <maxscale/poll.h>
 #include <dcb.h>
 #include <atomic.h>
@@ -37,7 +38,11 @@
 #include <resultset.h>
 #include <session.h>
 #include <statistics.h>
+#include <rcu.h>
+#include <poll_backend.h>
+#include <timer_wheel.h>
 #include <query_classifier.h>
+#include <affinity.h>
 
 #define         PROFILE_POLL    0
 
@@ -86,6 +91,20 @@ int max_poll_sleep;
 #define MUTEX_EPOLL     0
 
 static int epoll_fd = -1;    /*< The epoll file descriptor */
+
+static int epoll_backend_add(DCB *dcb, uint32_t events);
+static int epoll_backend_remove(DCB *dcb);
+static int epoll_backend_wait(POLL_EVENT *events, int max_events, int timeout);
+
+static POLL_BACKEND epoll_backend =
+{
+    "epoll",
+    epoll_backend_add,
+    epoll_backend_remove,
+    epoll_backend_wait
+};
+
+static POLL_BACKEND *backend = NULL; /*< The backend in use */
 static int do_shutdown = 0;  /*< Flag the shutdown of the poll subsystem */
 static GWBITMASK poll_mask;
 #if MUTEX_EPOLL
@@ -98,7 +117,7 @@ static void poll_add_event_to_dcb(DCB* dcb, GWBUF* buf, __uint32_t ev);
 static bool poll_dcb_session_check(DCB *dcb, const char *);
 
 DCB *eventq = NULL;
-SPINLOCK pollqlock = SPINLOCK_INIT;
+ADAPTIVE_LOCK pollqlock = ADAPTIVE_LOCK_INIT;
 
 /**
  * Thread load average, this is the average number of descriptors in each
@@ -158,35 +177,56 @@ static THREAD_DATA *thread_data = NULL;    /*< Status of each thread */
  */
 static struct
 {
-    ts_stats_t *n_read;         /*< Number of read events   */
-    ts_stats_t *n_write;        /*< Number of write events  */
-    ts_stats_t *n_error;        /*< Number of error events  */
-    ts_stats_t *n_hup;          /*< Number of hangup events */
-    ts_stats_t *n_accept;       /*< Number of accept events */
-    ts_stats_t *n_polls;        /*< Number of poll cycles   */
-    ts_stats_t *n_pollev;       /*< Number of polls returning events */
-    ts_stats_t *n_nbpollev;     /*< Number of polls returning events */
-    ts_stats_t *n_nothreads;    /*< Number of times no threads are polling */
-    int n_fds[MAXNFDS];         /*< Number of wakeups with particular n_fds value */
+    ts_stats_t n_read;          /*< Number of read events   */
+    ts_stats_t n_write;         /*< Number of write events  */
+    ts_stats_t n_error;         /*< Number of error events  */
+    ts_stats_t n_hup;           /*< Number of hangup events */
+    ts_stats_t n_accept;        /*< Number of accept events */
+    ts_stats_t n_polls;         /*< Number of poll cycles   */
+    ts_stats_t n_pollev;        /*< Number of polls returning events */
+    ts_stats_t n_nbpollev;      /*< Number of polls returning events */
+    ts_stats_t n_nothreads;     /*< Number of times no threads are polling */
+    ts_stats_t n_fds[MAXNFDS];  /*< Number of wakeups with particular n_fds value */
     int evq_length;             /*< Event queue length */
     int evq_pending;            /*< Number of pending descriptors in event queue */
     int evq_max;                /*< Maximum event queue length */
-    int wake_evqpending;        /*< Woken from epoll_wait with pending events in queue */
-    ts_stats_t *blockingpolls;  /*< Number of epoll_waits with a timeout specified */
+    ts_stats_t wake_evqpending; /*< Woken from epoll_wait with pending events in queue */
+    ts_stats_t blockingpolls;   /*< Number of epoll_waits with a timeout specified */
+    ts_stats_t n_timers;        /*< Number of expired timers */
+    ts_stats_t n_crossnode;     /*< Events processed on another NUMA node than their DCB */
 } pollStats;
 
-#define N_QUEUE_TIMES   30
 /**
- * The event queue statistics
+ * The event queue statistics. The times are in microseconds.
  */
 static struct
 {
-    unsigned int qtimes[N_QUEUE_TIMES+1];
-    unsigned int exectimes[N_QUEUE_TIMES+1];
-    unsigned long maxqtime;
-    unsigned long maxexectime;
+    ts_hist_t qtimes;           /*< Time events spend in the queue */
+    ts_hist_t exectimes;        /*< Time spent executing events */
 } queueStats;
 
+/**
+ * The rows of the event time tables cover the durations between powers of
+ * two microseconds, from 2^EVENT_TIME_MIN_BITS to 2^EVENT_TIME_MAX_BITS
+ */
+#define EVENT_TIME_MIN_BITS 7
+#define EVENT_TIME_MAX_BITS 25
+#define EVENT_TIME_ROWS     (EVENT_TIME_MAX_BITS - EVENT_TIME_MIN_BITS + 2)
+
+/**
+ * Return a monotonic timestamp in microseconds for measuring event times
+ *
+ * @return The current time in microseconds
+ */
+static inline unsigned long
+poll_clock_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
 /**
  * How frequently to call the poll_loadav function used to monitor the load
  * average of the poll subsystem.
@@ -212,19 +252,30 @@ poll_init()
 {
     int i;
 
-    if (epoll_fd != -1)
+    if (backend != NULL)
     {
         return;
     }
-    if ((epoll_fd = epoll_create(MAX_EVENTS)) == -1)
+    if (strcmp(config_poll_backend(), "io_uring") == 0 &&
+        (backend = poll_uring_init(MAX_EVENTS)) == NULL)
     {
-        perror("epoll_create");
-        exit(-1);
+        MXS_WARNING("Falling back to epoll for network I/O.");
+    }
+    if (backend == NULL)
+    {
+        if ((epoll_fd = epoll_create(MAX_EVENTS)) == -1)
+        {
+            perror("epoll_create");
+            exit(-1);
+        }
+        backend = &epoll_backend;
     }
+    MXS_NOTICE("Using %s for network I/O.", backend->name);
     memset(&pollStats, 0, sizeof(pollStats));
-    memset(&queueStats, 0, sizeof(queueStats));
     bitmask_init(&poll_mask);
     n_threads = config_threadcount();
+    rcu_init(n_threads);
+    timer_wheel_init(n_threads);
     if ((thread_data = (THREAD_DATA *)malloc(n_threads * sizeof(THREAD_DATA))) != NULL)
     {
         for (i = 0; i < n_threads; i++)
@@ -242,17 +293,33 @@ poll_init()
         (pollStats.n_pollev = ts_stats_alloc()) == NULL ||
         (pollStats.n_nbpollev = ts_stats_alloc()) == NULL ||
         (pollStats.n_nothreads = ts_stats_alloc()) == NULL ||
-        (pollStats.blockingpolls = ts_stats_alloc()) == NULL)
+        (pollStats.blockingpolls = ts_stats_alloc()) == NULL ||
+        (pollStats.n_timers = ts_stats_alloc()) == NULL ||
+        (pollStats.n_crossnode = ts_stats_alloc()) == NULL ||
+        (pollStats.wake_evqpending = ts_stats_alloc()) == NULL ||
+        (queueStats.qtimes = ts_hist_alloc()) == NULL ||
+        (queueStats.exectimes = ts_hist_alloc()) == NULL)
     {
         perror("Fatal error: Memory allocation failed.");
         exit(-1);
     }
 
+    for (i = 0; i < MAXNFDS; i++)
+    {
+        if ((pollStats.n_fds[i] = ts_stats_alloc()) == NULL)
+        {
+            perror("Fatal error: Memory allocation failed.");
+            exit(-1);
+        }
+    }
+
+    dcb_init_io_stats();
+
 #if MUTEX_EPOLL
     simple_mutex_init(&epoll_wait_mutex, "epoll_wait_mutex");
 #endif
 
-    hktask_add("Load Average", poll_loadav, NULL, POLL_LOAD_FREQ);
+    hktask_add_concurrent_ms("Load Average", poll_loadav, NULL, POLL_LOAD_FREQ * 1000);
     n_avg_samples = 15 * 60 / POLL_LOAD_FREQ;
     avg_samples = (double *)malloc(sizeof(double) * n_avg_samples);
     for (i = 0; i < n_avg_samples; i++)
@@ -286,16 +353,15 @@ poll_add_dcb(DCB *dcb)
     int rc = -1;
     dcb_state_t old_state = dcb->state;
     dcb_state_t new_state;
-    struct epoll_event ev;
+    uint32_t events;
 
     CHK_DCB(dcb);
 
 #ifdef EPOLLRDHUP
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
+    events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
 #else
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
+    events = EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
 #endif
-    ev.data.ptr = dcb;
 
     /*<
      * Choose new state according to the role of dcb.
@@ -339,7 +405,7 @@ poll_add_dcb(DCB *dcb)
      * The only possible failure that will not cause a crash is
      * running out of system resources.
      */
-    rc = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dcb->fd, &ev);
+    rc = backend->add(dcb, events);
     if (rc)
     {
         /* Some errors are actually considered acceptable */
@@ -367,7 +433,6 @@ int
 poll_remove_dcb(DCB *dcb)
 {
     int dcbfd, rc = -1;
-    struct  epoll_event ev;
     CHK_DCB(dcb);
 
     spinlock_acquire(&dcb->dcb_initlock);
@@ -403,7 +468,7 @@ poll_remove_dcb(DCB *dcb)
     spinlock_release(&dcb->dcb_initlock);
     if (dcbfd > 0)
     {
-        rc = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dcbfd, &ev);
+        rc = backend->remove(dcb);
         /**
          * The poll_resolve_error function will always
          * return 0 or crash.  So if it returns non-zero result,
@@ -421,6 +486,61 @@ poll_remove_dcb(DCB *dcb)
     return rc;
 }
 
+/**
+ * Add a descriptor to the epoll set
+ *
+ * @param dcb       The DCB to add
+ * @param events    The events to watch for
+ * @return 0 on success, -1 on error
+ */
+static int
+epoll_backend_add(DCB *dcb, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = dcb;
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dcb->fd, &ev);
+}
+
+/**
+ * Remove a descriptor from the epoll set
+ *
+ * @param dcb       The DCB to remove
+ * @return 0 on success, -1 on error
+ */
+static int
+epoll_backend_remove(DCB *dcb)
+{
+    struct epoll_event ev;
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dcb->fd, &ev);
+}
+
+/**
+ * Wait for events on the epoll set
+ *
+ * @param events        Array where the events are stored
+ * @param max_events    Size of the array
+ * @param timeout       Maximum wait in milliseconds, -1 for no limit
+ * @return Number of events or -1 on error
+ */
+static int
+epoll_backend_wait(POLL_EVENT *events, int max_events, int timeout)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, ev, MIN(max_events, MAX_EVENTS), timeout);
+
+    for (int i = 0; i < n; i++)
+    {
+        events[i].dcb = (DCB *)ev[i].data.ptr;
+        events[i].events = ev[i].events;
+    }
+
+    return n;
+}
+
 /**
  * Check error returns from epoll_ctl. Most result in a crash since they
  * are "impossible". Adding when already present is assumed non-fatal.
@@ -553,12 +673,14 @@ poll_resolve_error(DCB *dcb, int errornum, bool adding)
 void
 poll_waitevents(void *arg)
 {
-    struct epoll_event events[MAX_EVENTS];
+    POLL_EVENT events[MAX_EVENTS];
     int i, nfds, timeout_bias = 1;
     intptr_t thread_id = (intptr_t)arg;
     int poll_spins = 0;
 
+    affinity_thread_start(thread_id);
     ts_stats_set_thread_id(thread_id);
+    timer_wheel_thread(thread_id);
 
     /** Add this thread to the bitmask of running polling threads */
     bitmask_set(&poll_mask, thread_id);
@@ -576,7 +698,7 @@ poll_waitevents(void *arg)
 
         atomic_add(&n_waiting, 1);
 #if BLOCKINGPOLL
-        nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        nfds = backend->wait(events, MAX_EVENTS, -1);
         atomic_add(&n_waiting, -1);
 #else /* BLOCKINGPOLL */
 #if MUTEX_EPOLL
@@ -588,7 +710,7 @@ poll_waitevents(void *arg)
         }
 
         ts_stats_add(pollStats.n_polls, 1);
-        if ((nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 0)) == -1)
+        if ((nfds = backend->wait(events, MAX_EVENTS, 0)) == -1)
         {
             atomic_add(&n_waiting, -1);
             int eno = errno;
@@ -610,14 +732,20 @@ poll_waitevents(void *arg)
          */
         else if (nfds == 0 && pollStats.evq_pending == 0 && poll_spins++ > number_poll_spins)
         {
+            int timeout = (max_poll_sleep * timeout_bias) / 10;
+            int next_timer = timer_wheel_next(thread_id);
+
+            /** Wake up in time for the next timer of this thread */
+            if (next_timer >= 0 && next_timer < timeout)
+            {
+                timeout = next_timer;
+            }
+
             ts_stats_add(pollStats.blockingpolls, 1);
-            nfds = epoll_wait(epoll_fd,
-                              events,
-                              MAX_EVENTS,
-                              (max_poll_sleep * timeout_bias) / 10);
+            nfds = backend->wait(events, MAX_EVENTS, timeout);
             if (nfds == 0 && pollStats.evq_pending)
             {
-                atomic_add(&pollStats.wake_evqpending, 1);
+                ts_stats_add(pollStats.wake_evqpending, 1);
                 poll_spins = 0;
             }
         }
@@ -654,7 +782,7 @@ poll_waitevents(void *arg)
                 thread_data[thread_id].state = THREAD_PROCESSING;
             }
 
-            pollStats.n_fds[(nfds < MAXNFDS ? (nfds - 1) : MAXNFDS - 1)]++;
+            ts_stats_add(pollStats.n_fds[(nfds < MAXNFDS ? (nfds - 1) : MAXNFDS - 1)], 1);
 
             load_average = (load_average * load_samples + nfds) / (load_samples + 1);
             atomic_add(&load_samples, 1);
@@ -672,16 +800,16 @@ poll_waitevents(void *arg)
              */
             for (i = 0; i < nfds; i++)
             {
-                DCB *dcb = (DCB *)events[i].data.ptr;
+                DCB *dcb = events[i].dcb;
                 __uint32_t ev = events[i].events;
 
-                spinlock_acquire(&pollqlock);
+                adaptive_lock_acquire(&pollqlock);
                 if (DCB_POLL_BUSY(dcb))
                 {
                     if (dcb->evq.pending_events == 0)
                     {
                         pollStats.evq_pending++;
-                        dcb->evq.inserted = hkheartbeat;
+                        dcb->evq.inserted = poll_clock_us();
                     }
                     dcb->evq.pending_events |= ev;
                 }
@@ -703,13 +831,13 @@ poll_waitevents(void *arg)
                     }
                     pollStats.evq_length++;
                     pollStats.evq_pending++;
-                    dcb->evq.inserted = hkheartbeat;
+                    dcb->evq.inserted = poll_clock_us();
                     if (pollStats.evq_length > pollStats.evq_max)
                     {
                         pollStats.evq_max = pollStats.evq_length;
                     }
                 }
-                spinlock_release(&pollqlock);
+                adaptive_lock_release(&pollqlock);
             }
         }
 
@@ -724,16 +852,19 @@ poll_waitevents(void *arg)
             timeout_bias = 1;
         }
 
-        if (check_timeouts && hkheartbeat >= next_timeout_check)
-        {
-            process_idle_sessions();
-        }
+        /** Expire the idle sessions and pooled connections whose timers
+         * were armed by this thread */
+        ts_stats_add(pollStats.n_timers, timer_wheel_process(thread_id));
 
         if (thread_data)
         {
             thread_data[thread_id].state = THREAD_ZPROCESSING;
         }
-        dcb_process_zombies(thread_id);
+
+        /** No references to shared data survive past this point. The closed
+         * DCBs whose grace period has ended are freed here. */
+        rcu_quiescent(thread_id);
+
         if (thread_data)
         {
             thread_data[thread_id].state = THREAD_IDLE;
@@ -750,6 +881,7 @@ poll_waitevents(void *arg)
                 thread_data[thread_id].state = THREAD_STOPPED;
             }
             bitmask_clear(&poll_mask, thread_id);
+            rcu_offline(thread_id);
             return;
         }
         if (thread_data)
@@ -815,13 +947,14 @@ process_pollq(int thread_id)
     DCB *dcb;
     int found = 0;
     uint32_t ev;
+    unsigned long now;
     unsigned long qtime;
 
-    spinlock_acquire(&pollqlock);
+    adaptive_lock_acquire(&pollqlock);
     if (eventq == NULL)
     {
         /* Nothing to process */
-        spinlock_release(&pollqlock);
+        adaptive_lock_release(&pollqlock);
         return 0;
     }
     dcb = eventq;
@@ -833,7 +966,7 @@ process_pollq(int thread_id)
     else if (dcb->evq.next == dcb->evq.prev)
     {
         /* Only item in queue is being processed */
-        spinlock_release(&pollqlock);
+        adaptive_lock_release(&pollqlock);
         return 0;
     }
     else
@@ -859,34 +992,26 @@ process_pollq(int thread_id)
         pollStats.evq_pending--;
         ss_dassert(pollStats.evq_pending >= 0);
     }
-    spinlock_release(&pollqlock);
+    adaptive_lock_release(&pollqlock);
 
     if (found == 0)
     {
         return 0;
     }
 
+    now = poll_clock_us();
+    qtime = now - dcb->evq.inserted;
 #if PROFILE_POLL
-    memlog_log(plog, hkheartbeat - dcb->evq.inserted);
+    memlog_log(plog, qtime);
 #endif
-    qtime = hkheartbeat - dcb->evq.inserted;
     dcb->evq.started = hkheartbeat;
+    ts_hist_add(queueStats.qtimes, qtime);
 
-    if (qtime > N_QUEUE_TIMES)
-    {
-        queueStats.qtimes[N_QUEUE_TIMES]++;
-    }
-    else
-    {
-        queueStats.qtimes[qtime]++;
-    }
-    if (qtime > queueStats.maxqtime)
+    CHK_DCB(dcb);
+    if (dcb->numa_node != affinity_node())
     {
-        queueStats.maxqtime = qtime;
+        ts_stats_add(pollStats.n_crossnode, 1);
     }
-
-
-    CHK_DCB(dcb);
     if (thread_data)
     {
         thread_data[thread_id].state = THREAD_PROCESSING;
@@ -923,6 +1048,9 @@ process_pollq(int thread_id)
               dcb,
               STRDCBROLE(dcb->dcb_role));
 
+    /** The writes done by the handlers are sent when they have returned */
+    dcb_defer_writes();
+
     if (ev & EPOLLOUT)
     {
         int eno = 0;
@@ -1110,22 +1238,11 @@ process_pollq(int thread_id)
         }
     }
 #endif
-    qtime = hkheartbeat - dcb->evq.started;
+    dcb_flush_deferred();
 
-    if (qtime > N_QUEUE_TIMES)
-    {
-        queueStats.exectimes[N_QUEUE_TIMES]++;
-    }
-    else
-    {
-        queueStats.exectimes[qtime % N_QUEUE_TIMES]++;
-    }
-    if (qtime > queueStats.maxexectime)
-    {
-        queueStats.maxexectime = qtime;
-    }
+    ts_hist_add(queueStats.exectimes, poll_clock_us() - now);
 
-    spinlock_acquire(&pollqlock);
+    adaptive_lock_acquire(&pollqlock);
     dcb->evq.processing_events = 0;
 
     if (dcb->evq.pending_events == 0)
@@ -1173,7 +1290,7 @@ process_pollq(int thread_id)
     dcb->evq.processing = 0;
     /** Reset session id from thread's local storage */
     mxs_log_tls.li_sesid = 0;
-    spinlock_release(&pollqlock);
+    adaptive_lock_release(&pollqlock);
 
     return 1;
 }
@@ -1250,48 +1367,54 @@ dprintPollStats(DCB *dcb)
     int i;
 
     dcb_printf(dcb, "\nPoll Statistics.\n\n");
-    dcb_printf(dcb, "No. of epoll cycles:                           %d\n",
-               ts_stats_sum(pollStats.n_polls));
-    dcb_printf(dcb, "No. of epoll cycles with wait:                         %d\n",
-               ts_stats_sum(pollStats.blockingpolls));
-    dcb_printf(dcb, "No. of epoll calls returning events:           %d\n",
-               ts_stats_sum(pollStats.n_pollev));
-    dcb_printf(dcb, "No. of non-blocking calls returning events:    %d\n",
-               ts_stats_sum(pollStats.n_nbpollev));
-    dcb_printf(dcb, "No. of read events:                            %d\n",
-               ts_stats_sum(pollStats.n_read));
-    dcb_printf(dcb, "No. of write events:                           %d\n",
-               ts_stats_sum(pollStats.n_write));
-    dcb_printf(dcb, "No. of error events:                           %d\n",
-               ts_stats_sum(pollStats.n_error));
-    dcb_printf(dcb, "No. of hangup events:                          %d\n",
-               ts_stats_sum(pollStats.n_hup));
-    dcb_printf(dcb, "No. of accept events:                          %d\n",
-               ts_stats_sum(pollStats.n_accept));
-    dcb_printf(dcb, "No. of times no threads polling:               %d\n",
-               ts_stats_sum(pollStats.n_nothreads));
+    dcb_printf(dcb, "Poll backend:                                  %s\n",
+               backend ? backend->name : "none");
+    dcb_printf(dcb, "No. of epoll cycles:                           %ld\n",
+               (long)ts_stats_sum(pollStats.n_polls));
+    dcb_printf(dcb, "No. of epoll cycles with wait:                         %ld\n",
+               (long)ts_stats_sum(pollStats.blockingpolls));
+    dcb_printf(dcb, "No. of epoll calls returning events:           %ld\n",
+               (long)ts_stats_sum(pollStats.n_pollev));
+    dcb_printf(dcb, "No. of non-blocking calls returning events:    %ld\n",
+               (long)ts_stats_sum(pollStats.n_nbpollev));
+    dcb_printf(dcb, "No. of read events:                            %ld\n",
+               (long)ts_stats_sum(pollStats.n_read));
+    dcb_printf(dcb, "No. of write events:                           %ld\n",
+               (long)ts_stats_sum(pollStats.n_write));
+    dcb_printf(dcb, "No. of error events:                           %ld\n",
+               (long)ts_stats_sum(pollStats.n_error));
+    dcb_printf(dcb, "No. of hangup events:                          %ld\n",
+               (long)ts_stats_sum(pollStats.n_hup));
+    dcb_printf(dcb, "No. of accept events:                          %ld\n",
+               (long)ts_stats_sum(pollStats.n_accept));
+    dcb_printf(dcb, "No. of times no threads polling:               %ld\n",
+               (long)ts_stats_sum(pollStats.n_nothreads));
     dcb_printf(dcb, "Current event queue length:                    %d\n",
                pollStats.evq_length);
     dcb_printf(dcb, "Maximum event queue length:                    %d\n",
                pollStats.evq_max);
     dcb_printf(dcb, "No. of DCBs with pending events:               %d\n",
                pollStats.evq_pending);
-    dcb_printf(dcb, "No. of wakeups with pending queue:             %d\n",
-               pollStats.wake_evqpending);
+    dcb_printf(dcb, "No. of wakeups with pending queue:             %ld\n",
+               (long)ts_stats_sum(pollStats.wake_evqpending));
+    dcb_printf(dcb, "No. of armed timers:                           %d\n",
+               timer_wheel_armed());
+    dcb_printf(dcb, "No. of expired timers:                         %ld\n",
+               (long)ts_stats_sum(pollStats.n_timers));
+    dcb_printf(dcb, "No. of events on another NUMA node:            %ld\n",
+               (long)ts_stats_sum(pollStats.n_crossnode));
 
     dcb_printf(dcb, "No of poll completions with descriptors\n");
     dcb_printf(dcb, "\tNo. of descriptors\tNo. of poll completions.\n");
     for (i = 0; i < MAXNFDS - 1; i++)
     {
-        dcb_printf(dcb, "\t%2d\t\t\t%d\n", i + 1, pollStats.n_fds[i]);
+        dcb_printf(dcb, "\t%2d\t\t\t%ld\n", i + 1,
+                   (long)ts_stats_sum(pollStats.n_fds[i]));
     }
-    dcb_printf(dcb, "\t>= %d\t\t\t%d\n", MAXNFDS,
-               pollStats.n_fds[MAXNFDS-1]);
+    dcb_printf(dcb, "\t>= %d\t\t\t%ld\n", MAXNFDS,
+               (long)ts_stats_sum(pollStats.n_fds[MAXNFDS-1]));
 
-#if SPINLOCK_PROFILE
-    dcb_printf(dcb, "Event queue lock statistics:\n");
-    spinlock_stats(&pollqlock, spin_reporter, dcb);
-#endif
+    dprintDCBIOStats(dcb);
 }
 
 /**
@@ -1477,6 +1600,8 @@ dShowThreads(DCB *dcb)
             }
         }
     }
+
+    dprintAffinity(dcb);
 }
 
 /**
@@ -1543,7 +1668,7 @@ static void poll_add_event_to_dcb(DCB*       dcb,
     dcb->dcb_readqueue = gwbuf_append(dcb->dcb_readqueue, buf);
     spinlock_release(&dcb->authlock);
 
-    spinlock_acquire(&pollqlock);
+    adaptive_lock_acquire(&pollqlock);
 
     /** Set event to DCB */
     if (DCB_POLL_BUSY(dcb))
@@ -1579,7 +1704,7 @@ static void poll_add_event_to_dcb(DCB*       dcb,
             pollStats.evq_max = pollStats.evq_length;
         }
     }
-    spinlock_release(&pollqlock);
+    adaptive_lock_release(&pollqlock);
 }
 
 /*
@@ -1637,7 +1762,7 @@ void
 poll_fake_event(DCB *dcb, uint32_t ev)
 {
 
-    spinlock_acquire(&pollqlock);
+    adaptive_lock_acquire(&pollqlock);
     /*
      * If the DCB is already on the queue, there are no pending events and
      * there are other events on the queue, then
@@ -1667,7 +1792,7 @@ poll_fake_event(DCB *dcb, uint32_t ev)
     else
     {
         dcb->evq.pending_events = ev;
-        dcb->evq.inserted = hkheartbeat;
+        dcb->evq.inserted = poll_clock_us();
         if (eventq)
         {
             dcb->evq.prev = eventq->evq.prev;
@@ -1683,13 +1808,13 @@ poll_fake_event(DCB *dcb, uint32_t ev)
         }
         pollStats.evq_length++;
         pollStats.evq_pending++;
-        dcb->evq.inserted = hkheartbeat;
+        dcb->evq.inserted = poll_clock_us();
         if (pollStats.evq_length > pollStats.evq_max)
         {
             pollStats.evq_max = pollStats.evq_length;
         }
     }
-    spinlock_release(&pollqlock);
+    adaptive_lock_release(&pollqlock);
 }
 
 /*
@@ -1708,7 +1833,7 @@ poll_fake_hangup_event(DCB *dcb)
     uint32_t ev = EPOLLHUP;
 #endif
 
-    spinlock_acquire(&pollqlock);
+    adaptive_lock_acquire(&pollqlock);
     if (DCB_POLL_BUSY(dcb))
     {
         if (dcb->evq.pending_events == 0)
@@ -1720,7 +1845,7 @@ poll_fake_hangup_event(DCB *dcb)
     else
     {
         dcb->evq.pending_events = ev;
-        dcb->evq.inserted = hkheartbeat;
+        dcb->evq.inserted = poll_clock_us();
         if (eventq)
         {
             dcb->evq.prev = eventq->evq.prev;
@@ -1736,13 +1861,13 @@ poll_fake_hangup_event(DCB *dcb)
         }
         pollStats.evq_length++;
         pollStats.evq_pending++;
-        dcb->evq.inserted = hkheartbeat;
+        dcb->evq.inserted = poll_clock_us();
         if (pollStats.evq_length > pollStats.evq_max)
         {
             pollStats.evq_max = pollStats.evq_length;
         }
     }
-    spinlock_release(&pollqlock);
+    adaptive_lock_release(&pollqlock);
 }
 
 /**
@@ -1756,11 +1881,11 @@ dShowEventQ(DCB *pdcb)
     DCB *dcb;
     char *tmp1, *tmp2;
 
-    spinlock_acquire(&pollqlock);
+    adaptive_lock_acquire(&pollqlock);
     if (eventq == NULL)
     {
         /* Nothing to process */
-        spinlock_release(&pollqlock);
+        adaptive_lock_release(&pollqlock);
         return;
     }
     dcb = eventq;
@@ -1779,9 +1904,104 @@ dShowEventQ(DCB *pdcb)
         dcb = dcb->evq.next;
     }
     while (dcb != eventq);
-    spinlock_release(&pollqlock);
+    adaptive_lock_release(&pollqlock);
+}
+
+
+/**
+ * Format an event time in microseconds for display
+ *
+ * @param buf   The buffer to format to
+ * @param size  The size of the buffer
+ * @param us    The time in microseconds
+ */
+static void
+poll_format_time(char *buf, size_t size, unsigned long us)
+{
+    if (us < 1000)
+    {
+        snprintf(buf, size, "%luus", us);
+    }
+    else if (us < 1000000)
+    {
+        snprintf(buf, size, "%.1fms", us / 1000.0);
+    }
+    else
+    {
+        snprintf(buf, size, "%.1fs", us / 1000000.0);
+    }
+}
+
+/**
+ * Format the duration range of a row of the event time tables
+ *
+ * @param buf   The buffer to format to
+ * @param size  The size of the buffer
+ * @param row   The row, from 0 to EVENT_TIME_ROWS - 1
+ */
+static void
+poll_format_time_row(char *buf, size_t size, int row)
+{
+    char low[20];
+    char high[20];
+
+    poll_format_time(low, sizeof(low), 1UL << (EVENT_TIME_MIN_BITS + row - 1));
+    poll_format_time(high, sizeof(high), 1UL << (EVENT_TIME_MIN_BITS + row));
+
+    if (row == 0)
+    {
+        snprintf(buf, size, "< %s", high);
+    }
+    else if (row == EVENT_TIME_ROWS - 1)
+    {
+        snprintf(buf, size, "> %s", low);
+    }
+    else
+    {
+        snprintf(buf, size, "%s - %s", low, high);
+    }
 }
 
+/**
+ * Return the number of events that fall into a row of the event time tables
+ *
+ * @param snapshot  The merged histogram of the event times
+ * @param row       The row, from 0 to EVENT_TIME_ROWS - 1
+ * @return The number of events
+ */
+static long
+poll_time_row_count(const ts_hist_snapshot_t *snapshot, int row)
+{
+    int64_t below = row == EVENT_TIME_ROWS - 1 ? snapshot->count :
+        ts_hist_count_below(snapshot, 1UL << (EVENT_TIME_MIN_BITS + row));
+    int64_t above = row == 0 ? 0 :
+        ts_hist_count_below(snapshot, 1UL << (EVENT_TIME_MIN_BITS + row - 1));
+
+    return below - above;
+}
+
+/**
+ * Print the percentiles of an event time histogram
+ *
+ * @param pdcb      The DCB to print to
+ * @param desc      The description of the times
+ * @param snapshot  The merged histogram of the times
+ */
+static void
+poll_print_percentiles(DCB *pdcb, const char *desc, const ts_hist_snapshot_t *snapshot)
+{
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    char buf[20];
+
+    dcb_printf(pdcb, "%-14s |", desc);
+    for (int i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        poll_format_time(buf, sizeof(buf), ts_hist_percentile(snapshot, percentiles[i]));
+        dcb_printf(pdcb, " %-8s |", buf);
+    }
+    poll_format_time(buf, sizeof(buf), snapshot->max);
+    dcb_printf(pdcb, " %s\n", buf);
+}
 
 /**
  * Print the event queue statistics
@@ -1791,26 +2011,64 @@ dShowEventQ(DCB *pdcb)
 void
 dShowEventStats(DCB *pdcb)
 {
-    int i;
+    ts_hist_snapshot_t *qtimes = malloc(sizeof(ts_hist_snapshot_t));
+    ts_hist_snapshot_t *exectimes = malloc(sizeof(ts_hist_snapshot_t));
+    char buf[40];
+
+    if (qtimes == NULL || exectimes == NULL)
+    {
+        free(qtimes);
+        free(exectimes);
+        return;
+    }
+
+    ts_hist_merge(queueStats.qtimes, qtimes);
+    ts_hist_merge(queueStats.exectimes, exectimes);
 
     dcb_printf(pdcb, "\nEvent statistics.\n");
-    dcb_printf(pdcb, "Maximum queue time:           %3d00ms\n", queueStats.maxqtime);
-    dcb_printf(pdcb, "Maximum execution time:               %3d00ms\n", queueStats.maxexectime);
     dcb_printf(pdcb, "Maximum event queue length:     %3d\n", pollStats.evq_max);
     dcb_printf(pdcb, "Current event queue length:     %3d\n", pollStats.evq_length);
     dcb_printf(pdcb, "\n");
-    dcb_printf(pdcb, "               |    Number of events\n");
-    dcb_printf(pdcb, "Duration       | Queued     | Executed\n");
-    dcb_printf(pdcb, "---------------+------------+-----------\n");
-    dcb_printf(pdcb, " < 100ms       | %-10d | %-10d\n",
-               queueStats.qtimes[0], queueStats.exectimes[0]);
-    for (i = 1; i < N_QUEUE_TIMES; i++)
-    {
-        dcb_printf(pdcb, " %2d00 - %2d00ms | %-10d | %-10d\n", i, i + 1,
-                   queueStats.qtimes[i], queueStats.exectimes[i]);
-    }
-    dcb_printf(pdcb, " > %2d00ms      | %-10d | %-10d\n", N_QUEUE_TIMES,
-               queueStats.qtimes[N_QUEUE_TIMES], queueStats.exectimes[N_QUEUE_TIMES]);
+    dcb_printf(pdcb, "               | p50      | p90      | p99      | p99.9    | max\n");
+    dcb_printf(pdcb, "---------------+----------+----------+----------+----------+---------\n");
+    poll_print_percentiles(pdcb, "Queue time", qtimes);
+    poll_print_percentiles(pdcb, "Execution time", exectimes);
+    dcb_printf(pdcb, "\n");
+    dcb_printf(pdcb, "                   |    Number of events\n");
+    dcb_printf(pdcb, "Duration           | Queued     | Executed\n");
+    dcb_printf(pdcb, "-------------------+------------+-----------\n");
+    for (int i = 0; i < EVENT_TIME_ROWS; i++)
+    {
+        poll_format_time_row(buf, sizeof(buf), i);
+        dcb_printf(pdcb, " %-17s | %-10ld | %-10ld\n", buf,
+                   poll_time_row_count(qtimes, i), poll_time_row_count(exectimes, i));
+    }
+
+    free(qtimes);
+    free(exectimes);
+}
+
+/**
+ * Return a percentile or the maximum of an event time histogram
+ *
+ * @param hist          The histogram
+ * @param percentile    The percentile or a negative value for the maximum
+ * @return The time in microseconds
+ */
+static int64_t
+poll_time_stat(ts_hist_t hist, double percentile)
+{
+    ts_hist_snapshot_t *snapshot = malloc(sizeof(ts_hist_snapshot_t));
+    int64_t rval = 0;
+
+    if (snapshot)
+    {
+        ts_hist_merge(hist, snapshot);
+        rval = percentile < 0 ? snapshot->max : ts_hist_percentile(snapshot, percentile);
+        free(snapshot);
+    }
+
+    return rval;
 }
 
 /**
@@ -1819,7 +2077,7 @@ dShowEventStats(DCB *pdcb)
  * @param stat  The required statistic
  * @return      The value of that statistic
  */
-int
+int64_t
 poll_get_stat(POLL_STAT stat)
 {
     switch (stat)
@@ -1841,13 +2099,37 @@ poll_get_stat(POLL_STAT stat)
     case POLL_STAT_EVQ_MAX:
         return pollStats.evq_max;
     case POLL_STAT_MAX_QTIME:
-        return (int)queueStats.maxqtime;
+        return poll_time_stat(queueStats.qtimes, -1) / 100000;
     case POLL_STAT_MAX_EXECTIME:
-        return (int)queueStats.maxexectime;
+        return poll_time_stat(queueStats.exectimes, -1) / 100000;
+    case POLL_STAT_QTIME_P50:
+        return poll_time_stat(queueStats.qtimes, 50);
+    case POLL_STAT_QTIME_P90:
+        return poll_time_stat(queueStats.qtimes, 90);
+    case POLL_STAT_QTIME_P99:
+        return poll_time_stat(queueStats.qtimes, 99);
+    case POLL_STAT_EXECTIME_P50:
+        return poll_time_stat(queueStats.exectimes, 50);
+    case POLL_STAT_EXECTIME_P90:
+        return poll_time_stat(queueStats.exectimes, 90);
+    case POLL_STAT_EXECTIME_P99:
+        return poll_time_stat(queueStats.exectimes, 99);
+    case POLL_STAT_CROSSNODE:
+        return ts_stats_sum(pollStats.n_crossnode);
     }
     return 0;
 }
 
+/**
+ * The state of the event times result set
+ */
+typedef struct
+{
+    int row;                            /*< The next row to send */
+    ts_hist_snapshot_t qtimes;          /*< Merged queue times */
+    ts_hist_snapshot_t exectimes;       /*< Merged execution times */
+} EVENT_TIMES_DATA;
+
 /**
  * Provide a row to the result set that defines the event queue statistics
  *
@@ -1858,39 +2140,23 @@ poll_get_stat(POLL_STAT stat)
 static RESULT_ROW *
 eventTimesRowCallback(RESULTSET *set, void *data)
 {
-    int *rowno = (int *)data;
+    EVENT_TIMES_DATA *times = (EVENT_TIMES_DATA *)data;
     char buf[40];
     RESULT_ROW *row;
 
-    if (*rowno >= N_QUEUE_TIMES)
+    if (times->row >= EVENT_TIME_ROWS)
     {
         free(data);
         return NULL;
     }
     row = resultset_make_row(set);
-    if (*rowno == 0)
-    {
-        resultset_row_set(row, 0, "< 100ms");
-    }
-    else if (*rowno == N_QUEUE_TIMES - 1)
-    {
-        snprintf(buf,39, "> %2d00ms", N_QUEUE_TIMES);
-        buf[39] = '\0';
-        resultset_row_set(row, 0, buf);
-    }
-    else
-    {
-        snprintf(buf,39, "%2d00 - %2d00ms", *rowno, (*rowno) + 1);
-        buf[39] = '\0';
-        resultset_row_set(row, 0, buf);
-    }
-    snprintf(buf,39, "%u", queueStats.qtimes[*rowno]);
-    buf[39] = '\0';
+    poll_format_time_row(buf, sizeof(buf), times->row);
+    resultset_row_set(row, 0, buf);
+    snprintf(buf, sizeof(buf), "%ld", poll_time_row_count(&times->qtimes, times->row));
     resultset_row_set(row, 1, buf);
-    snprintf(buf,39, "%u", queueStats.exectimes[*rowno]);
-    buf[39] = '\0';
+    snprintf(buf, sizeof(buf), "%ld", poll_time_row_count(&times->exectimes, times->row));
     resultset_row_set(row, 2, buf);
-    (*rowno)++;
+    times->row++;
     return row;
 }
 
@@ -1903,13 +2169,15 @@ RESULTSET *
 eventTimesGetList()
 {
     RESULTSET *set;
-    int *data;
+    EVENT_TIMES_DATA *data;
 
-    if ((data = (int *)malloc(sizeof(int))) == NULL)
+    if ((data = (EVENT_TIMES_DATA *)malloc(sizeof(EVENT_TIMES_DATA))) == NULL)
     {
         return NULL;
     }
-    *data = 0;
+    data->row = 0;
+    ts_hist_merge(queueStats.qtimes, &data->qtimes);
+    ts_hist_merge(queueStats.exectimes, &data->exectimes);
     if ((set = resultset_create(eventTimesRowCallback, data)) == NULL)
     {
         free(data);
@@ -0,0 +1,560 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file poll_uring.c  - io_uring poll backend
+ *
+ * The descriptors are watched with edge-triggered multishot poll requests on
+ * a ring shared by all polling threads. The completions are read straight
+ * from the shared memory completion ring, so a poll that finds events, or
+ * finds none and does not wait, costs no system call. Only a poll that
+ * has to sleep enters the kernel.
+ *
+ * Each registration is tracked by a URING_POLL that is used as the user data
+ * of the request. It is released only after the kernel has posted the final
+ * completion of the request, so a completion can never refer to freed
+ * memory. A multishot request that the kernel terminates on its own, for
+ * example when the completion ring overflows, is armed again.
+ *
+ * @verbatim
+ * Revision History
+ *
+ * Date         Who                     Description
+ * 18/10/16     MaxScale                Initial implementation
+ *
+ * @endverbatim
+ */
+
+#include <poll_backend.h>
+#include <log_manager.h>
+
+#if defined(HAVE_IO_URING)
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <spinlock.h>
+#include <skygw_utils.h>
+
+/** Number of submission queue entries, the completion queue is larger */
+#define URING_SQ_ENTRIES 256
+
+/**
+ * A descriptor registered with the ring
+ */
+typedef struct
+{
+    DCB      *dcb;
+    int      fd;
+    uint32_t events;
+    bool     removed;   /*< The DCB was removed from the poll set */
+    bool     done;      /*< The request has failed and is not armed */
+} URING_POLL;
+
+/**
+ * The shared ring
+ */
+static struct
+{
+    int                 fd;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_entries;
+    unsigned            *sq_flags;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    SPINLOCK            sq_lock;    /*< Protects the submission queue and the
+                                     *  removed and done flags */
+    SPINLOCK            cq_lock;    /*< Protects the completion queue head */
+} ring;
+
+static int uring_add(DCB *dcb, uint32_t events);
+static int uring_remove(DCB *dcb);
+static int uring_wait(POLL_EVENT *events, int max_events, int timeout);
+
+static POLL_BACKEND uring_backend =
+{
+    "io_uring",
+    uring_add,
+    uring_remove,
+    uring_wait
+};
+
+static int
+uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+            void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete,
+                   flags, arg, argsz);
+}
+
+/**
+ * Map the rings of a new io_uring instance
+ *
+ * @param params The parameters returned by io_uring_setup
+ * @return True on success
+ */
+static bool
+uring_map(struct io_uring_params *params)
+{
+    size_t sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    size_t cq_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    char *sq_ptr, *cq_ptr;
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_size = cq_size = MAX(sq_size, cq_size);
+    }
+
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring.fd, IORING_OFF_SQ_RING);
+
+    if (sq_ptr == MAP_FAILED)
+    {
+        return false;
+    }
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq_ptr = sq_ptr;
+    }
+    else if ((cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring.fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+        munmap(sq_ptr, sq_size);
+        return false;
+    }
+
+    ring.sqes = mmap(NULL, params->sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring.fd, IORING_OFF_SQES);
+
+    if (ring.sqes == MAP_FAILED)
+    {
+        if (cq_ptr != sq_ptr)
+        {
+            munmap(cq_ptr, cq_size);
+        }
+        munmap(sq_ptr, sq_size);
+        return false;
+    }
+
+    ring.sq_head = (unsigned *)(sq_ptr + params->sq_off.head);
+    ring.sq_tail = (unsigned *)(sq_ptr + params->sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq_ptr + params->sq_off.ring_mask);
+    ring.sq_entries = (unsigned *)(sq_ptr + params->sq_off.ring_entries);
+    ring.sq_flags = (unsigned *)(sq_ptr + params->sq_off.flags);
+    ring.sq_array = (unsigned *)(sq_ptr + params->sq_off.array);
+    ring.cq_head = (unsigned *)(cq_ptr + params->cq_off.head);
+    ring.cq_tail = (unsigned *)(cq_ptr + params->cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq_ptr + params->cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq_ptr + params->cq_off.cqes);
+
+    return true;
+}
+
+/**
+ * Queue a poll request and submit all queued requests. The caller must hold
+ * the submission queue lock.
+ *
+ * @param opcode    IORING_OP_POLL_ADD or IORING_OP_POLL_REMOVE
+ * @param reg       The registration the request is for
+ * @return 0 on success, -1 if the submission queue is full
+ */
+static int
+uring_submit(int opcode, URING_POLL *reg)
+{
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring.sq_tail;
+
+    if (tail - head >= *ring.sq_entries)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+
+    if (opcode == IORING_OP_POLL_ADD)
+    {
+        sqe->fd = reg->fd;
+        sqe->poll32_events = reg->events;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = (uintptr_t)reg;
+    }
+    else
+    {
+        /** The completion of the removal itself is not needed */
+        sqe->fd = -1;
+        sqe->addr = (uintptr_t)reg;
+        sqe->user_data = 0;
+    }
+
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    /**
+     * Requests the kernel could not take now stay queued and are submitted
+     * with the next request or by the next wait for events.
+     */
+    while (uring_enter(tail + 1 - head, 0, 0, NULL, 0) == -1 && errno == EINTR)
+    {
+        head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    return 0;
+}
+
+/**
+ * Handle the final completion of a poll request
+ *
+ * @param reg   The registration
+ * @param res   The result of the completion
+ */
+static void
+uring_poll_done(URING_POLL *reg, int res)
+{
+    spinlock_acquire(&ring.sq_lock);
+
+    if (reg->removed)
+    {
+        spinlock_release(&ring.sq_lock);
+        free(reg);
+        return;
+    }
+
+    if (res < 0 || uring_submit(IORING_OP_POLL_ADD, reg) != 0)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        int err = res < 0 ? -res : errno;
+
+        MXS_ERROR("Failed to poll fd %d with io_uring: %d, %s.",
+                  reg->fd, err, strerror_r(err, errbuf, sizeof(errbuf)));
+        reg->done = true;
+    }
+
+    spinlock_release(&ring.sq_lock);
+}
+
+/**
+ * Collect events from the completion queue
+ *
+ * @param events        Array where the events are stored
+ * @param max_events    Size of the array
+ * @return Number of events
+ */
+static int
+uring_harvest(POLL_EVENT *events, int max_events)
+{
+    int n = 0;
+
+    spinlock_acquire(&ring.cq_lock);
+
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && n < max_events)
+    {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        URING_POLL *reg = (URING_POLL *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+
+        head++;
+
+        if (reg == NULL)
+        {
+            /** Completion of a removal */
+            continue;
+        }
+
+        if (res > 0 && !reg->removed)
+        {
+            events[n].dcb = reg->dcb;
+            events[n].events = res;
+            n++;
+        }
+
+        if (!more)
+        {
+            /** Multishot requests end with -ECANCELED when removed */
+            uring_poll_done(reg, res == -ECANCELED ? 0 : res);
+        }
+    }
+
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    spinlock_release(&ring.cq_lock);
+
+    return n;
+}
+
+/**
+ * Add a DCB to the ring
+ *
+ * @param dcb       The DCB
+ * @param events    The EPOLL* events to watch for
+ * @return 0 on success, -1 on error
+ */
+static int
+uring_add(DCB *dcb, uint32_t events)
+{
+    URING_POLL *reg = calloc(1, sizeof(URING_POLL));
+    int rc;
+
+    if (reg == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    reg->dcb = dcb;
+    reg->fd = dcb->fd;
+    reg->events = events;
+
+    spinlock_acquire(&ring.sq_lock);
+    rc = uring_submit(IORING_OP_POLL_ADD, reg);
+    spinlock_release(&ring.sq_lock);
+
+    if (rc == 0)
+    {
+        dcb->poll_handle = reg;
+    }
+    else
+    {
+        free(reg);
+        errno = ENOSPC;
+    }
+
+    return rc;
+}
+
+/**
+ * Remove a DCB from the ring. The DCB gets no new events once this returns
+ * but events collected before may still be in the event queue, as with
+ * epoll.
+ *
+ * @param dcb       The DCB
+ * @return 0 on success, -1 on error
+ */
+static int
+uring_remove(DCB *dcb)
+{
+    URING_POLL *reg = dcb->poll_handle;
+    int rc = 0;
+
+    if (reg == NULL)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    dcb->poll_handle = NULL;
+
+    spinlock_acquire(&ring.sq_lock);
+    reg->removed = true;
+
+    if (reg->done)
+    {
+        spinlock_release(&ring.sq_lock);
+        free(reg);
+        return 0;
+    }
+
+    while ((rc = uring_submit(IORING_OP_POLL_REMOVE, reg)) != 0)
+    {
+        /** Let the kernel drain the submission queue */
+        spinlock_release(&ring.sq_lock);
+        sched_yield();
+        spinlock_acquire(&ring.sq_lock);
+    }
+
+    spinlock_release(&ring.sq_lock);
+
+    return 0;
+}
+
+/**
+ * Wait for events
+ *
+ * @param events        Array where the events are stored
+ * @param max_events    Size of the array
+ * @param timeout       Maximum wait in milliseconds, -1 for no limit
+ * @return Number of events or -1 on error
+ */
+static int
+uring_wait(POLL_EVENT *events, int max_events, int timeout)
+{
+    int n = uring_harvest(events, max_events);
+    /** Requests left in the submission queue when the kernel was busy */
+    unsigned pending = __atomic_load_n(ring.sq_tail, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+    if (n == 0 && (timeout != 0 ||
+                   (__atomic_load_n(ring.sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)))
+    {
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+
+        memset(&arg, 0, sizeof(arg));
+
+        if (timeout >= 0)
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+            arg.ts = (uintptr_t)&ts;
+        }
+
+        if (uring_enter(pending, timeout != 0 ? 1 : 0,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &arg, sizeof(arg)) == -1 &&
+            errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        {
+            return -1;
+        }
+
+        n = uring_harvest(events, max_events);
+    }
+    else if (pending > 0)
+    {
+        uring_enter(pending, 0, 0, NULL, 0);
+    }
+
+    return n;
+}
+
+/**
+ * Check that the kernel delivers edge-triggered multishot poll events
+ *
+ * @return True if a readable pipe generated an event
+ */
+static bool
+uring_probe()
+{
+    static DCB probe_dcb;
+    POLL_EVENT events[4];
+    int fds[2];
+    bool found = false;
+
+    if (pipe(fds) != 0)
+    {
+        return false;
+    }
+
+    probe_dcb.fd = fds[0];
+
+    if (uring_add(&probe_dcb, EPOLLIN | EPOLLET) == 0)
+    {
+        if (write(fds[1], "", 1) == 1)
+        {
+            for (int i = 0; i < 10 && !found; i++)
+            {
+                int n = uring_wait(events, 4, 10);
+
+                for (int j = 0; j < n; j++)
+                {
+                    found = found || (events[j].dcb == &probe_dcb &&
+                                      (events[j].events & EPOLLIN));
+                }
+            }
+        }
+
+        uring_remove(&probe_dcb);
+        uring_wait(events, 4, 0);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return found;
+}
+
+/**
+ * Create the io_uring poll backend
+ *
+ * @param max_events Maximum number of events collected by one wait
+ * @return The backend or NULL if io_uring is not usable on this system
+ */
+POLL_BACKEND *
+poll_uring_init(int max_events)
+{
+    struct io_uring_params params;
+    unsigned required = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = MAX(max_events, URING_SQ_ENTRIES) * 4;
+
+    if ((ring.fd = uring_setup(URING_SQ_ENTRIES, &params)) == -1)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_WARNING("io_uring is not available: %d, %s.",
+                    errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        return NULL;
+    }
+
+    if ((params.features & required) != required || !uring_map(&params))
+    {
+        MXS_WARNING("io_uring does not support the required features.");
+        close(ring.fd);
+        return NULL;
+    }
+
+    spinlock_init(&ring.sq_lock);
+    spinlock_init(&ring.cq_lock);
+
+    if (!uring_probe())
+    {
+        MXS_WARNING("io_uring does not support edge-triggered multishot poll.");
+        close(ring.fd);
+        return NULL;
+    }
+
+    return &uring_backend;
+}
+
+#else /* HAVE_IO_URING */
+
+POLL_BACKEND *
+poll_uring_init(int max_events)
+{
+    MXS_WARNING("MaxScale was built without io_uring support.");
+    return NULL;
+}
+
+#endif /* HAVE_IO_URING */
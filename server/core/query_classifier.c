@@ -25,6 +25,7 @@
 #include <query_classifier.h>
 #include <log_manager.h>
 #include <modules.h>
+#include <query_trace.h>
 
 //#define QC_TRACE_ENABLED
 #undef QC_TRACE_ENABLED
@@ -123,7 +124,11 @@ uint32_t qc_get_type(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_get_type(query);
+    CYCLES start = query_trace_classify_start();
+    uint32_t rval = classifier->qc_get_type(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 qc_query_op_t qc_get_operation(GWBUF* query)
@@ -131,7 +136,11 @@ qc_query_op_t qc_get_operation(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_get_operation(query);
+    CYCLES start = query_trace_classify_start();
+    qc_query_op_t rval = classifier->qc_get_operation(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 char* qc_get_created_table_name(GWBUF* query)
@@ -139,7 +148,11 @@ char* qc_get_created_table_name(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_get_created_table_name(query);
+    CYCLES start = query_trace_classify_start();
+    char* rval = classifier->qc_get_created_table_name(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 bool qc_is_drop_table_query(GWBUF* query)
@@ -147,7 +160,11 @@ bool qc_is_drop_table_query(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_is_drop_table_query(query);
+    CYCLES start = query_trace_classify_start();
+    bool rval = classifier->qc_is_drop_table_query(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 bool qc_is_real_query(GWBUF* query)
@@ -155,7 +172,11 @@ bool qc_is_real_query(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_is_real_query(query);
+    CYCLES start = query_trace_classify_start();
+    bool rval = classifier->qc_is_real_query(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 char** qc_get_table_names(GWBUF* query, int* tblsize, bool fullnames)
@@ -163,7 +184,11 @@ char** qc_get_table_names(GWBUF* query, int* tblsize, bool fullnames)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_get_table_names(query, tblsize, fullnames);
+    CYCLES start = query_trace_classify_start();
+    char** rval = classifier->qc_get_table_names(query, tblsize, fullnames);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 char* qc_get_canonical(GWBUF* query)
@@ -171,7 +196,11 @@ char* qc_get_canonical(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_get_canonical(query);
+    CYCLES start = query_trace_classify_start();
+    char* rval = classifier->qc_get_canonical(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 bool qc_query_has_clause(GWBUF* query)
@@ -179,7 +208,11 @@ bool qc_query_has_clause(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_query_has_clause(query);
+    CYCLES start = query_trace_classify_start();
+    bool rval = classifier->qc_query_has_clause(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 /**
@@ -236,7 +269,11 @@ char* qc_get_affected_fields(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_get_affected_fields(query);
+    CYCLES start = query_trace_classify_start();
+    char* rval = classifier->qc_get_affected_fields(query);
+    query_trace_classify_end(start);
+
+    return rval;
 }
 
 char** qc_get_database_names(GWBUF* query, int* sizep)
@@ -244,5 +281,9 @@ char** qc_get_database_names(GWBUF* query, int* sizep)
     QC_TRACE();
     ss_dassert(classifier);
 
-    return classifier->qc_get_database_names(query, sizep);
+    CYCLES start = query_trace_classify_start();
+    char** rval = classifier->qc_get_database_names(query, sizep);
+    query_trace_classify_end(start);
+
+    return rval;
 }
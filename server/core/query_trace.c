@@ -0,0 +1,832 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file query_trace.c  - Per-query latency tracing
+ *
+ * A traced session routes its queries through query_trace_route_query(),
+ * which times the whole call, and the filters of the session route theirs
+ * through a link that times the call to the next filter or the router. The
+ * time of a component is the time spent in it minus the time spent in the
+ * traced components and the query classifier calls made from it. The query
+ * being routed by a thread is kept in thread local storage, so nothing is
+ * locked while the query is routed.
+ *
+ * The reply to a query may be processed by another thread as soon as the
+ * router has written the query to a backend. The timings of the query are
+ * therefore handed over under the lock of the session trace just before the
+ * router is called, and the first reply completes the trace. The time the
+ * router itself takes is added to the handed over timings once it returns,
+ * unless the reply has already been processed, in which case it is counted
+ * as backend time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <query_trace.h>
+#include <session.h>
+#include <service.h>
+#include <filter.h>
+#include <buffer.h>
+#include <dcb.h>
+#include <router.h>
+#include <maxconfig.h>
+#include <log_manager.h>
+
+/**
+ * A query kept in the list of the slowest queries. The times are in
+ * nanoseconds.
+ */
+typedef struct
+{
+    size_t     ses_id;                          /*< The session of the query */
+    const char *service;                        /*< The service of the query */
+    time_t     when;                            /*< When the query completed */
+    int64_t    phases[QUERY_TRACE_PHASES];      /*< Time spent in each phase */
+    char       sql[QUERY_TRACE_SQL_LEN];        /*< Start of the query text */
+} QUERY_TRACE_SAMPLE;
+
+static const char *phase_names[QUERY_TRACE_PHASES] =
+{
+    "Client read",
+    "Filters",
+    "Classify",
+    "Route",
+    "Backend",
+    "Client write",
+    "Total"
+};
+
+thread_local QUERY_TRACE_TIMES *query_trace_current = NULL;
+thread_local CYCLES query_trace_nested = 0;
+
+static bool trace_enabled = false;
+static double cycles_per_ns = 1.0;
+
+static SPINLOCK stats_lock = SPINLOCK_INIT;
+static QUERY_TRACE_STATS *all_stats = NULL;
+
+static SPINLOCK slowest_lock = SPINLOCK_INIT;
+static QUERY_TRACE_SAMPLE *slowest = NULL;
+static int n_slowest = 0;
+static int max_slowest = 0;
+static int64_t slowest_min = 0;     /*< Shortest time in a full list */
+
+static int query_trace_link_route(void *instance, void *session, GWBUF *buf);
+
+/**
+ * Hand the timings of the query being routed over to the thread that
+ * processes its reply. A query is handed over only once.
+ *
+ * @param trace The trace of the session
+ * @param times The timings of the query
+ */
+static void
+query_trace_publish(QUERY_TRACE *trace, QUERY_TRACE_TIMES *times)
+{
+    spinlock_acquire(&trace->lock);
+    if (trace->published != times->seq)
+    {
+        trace->pending = *times;
+        trace->published = times->seq;
+        trace->waiting = true;
+    }
+    spinlock_release(&trace->lock);
+}
+
+/**
+ * Measure how many time-stamp counter cycles there are in a nanosecond
+ *
+ * @return Cycles per nanosecond
+ */
+static double
+query_trace_calibrate()
+{
+    struct timespec delay = {0, 20000000};
+    struct timespec t0;
+    struct timespec t1;
+    CYCLES c0;
+    CYCLES c1;
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = rdtsc();
+    nanosleep(&delay, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    c1 = rdtsc();
+
+    ns = (t1.tv_sec - t0.tv_sec) * 1000000000.0 + (t1.tv_nsec - t0.tv_nsec);
+
+    return ns > 0 && c1 > c0 ? (c1 - c0) / ns : 1.0;
+}
+
+/**
+ * Convert time-stamp counter cycles to nanoseconds
+ *
+ * @param cycles    Number of cycles
+ * @return Number of nanoseconds
+ */
+static inline int64_t
+query_trace_ns(CYCLES cycles)
+{
+    return (int64_t)(cycles / cycles_per_ns);
+}
+
+/**
+ * Initialise query tracing from the global configuration. This must be
+ * called after the statistics have been initialised and before the
+ * services are started.
+ */
+void
+query_trace_init()
+{
+    if (!config_query_trace())
+    {
+        return;
+    }
+
+    cycles_per_ns = query_trace_calibrate();
+    max_slowest = config_query_trace_slowest();
+
+    if (max_slowest > 0 &&
+        (slowest = calloc(max_slowest, sizeof(QUERY_TRACE_SAMPLE))) == NULL)
+    {
+        MXS_ERROR("Failed to allocate memory for the slowest queries.");
+        max_slowest = 0;
+    }
+
+    trace_enabled = true;
+    MXS_NOTICE("Query tracing enabled, the time-stamp counter runs at %.2f GHz.",
+               cycles_per_ns);
+}
+
+/**
+ * Check whether query tracing is enabled
+ *
+ * @return True if new sessions are traced
+ */
+bool
+query_trace_enabled()
+{
+    return trace_enabled;
+}
+
+/**
+ * Allocate the histograms of a service or a filter and add them to the
+ * list of all histograms
+ *
+ * @param name      Name of the service or filter
+ * @param module    The router or filter module
+ * @param filter    True for a filter
+ * @return The histograms or NULL if memory allocation failed
+ */
+static QUERY_TRACE_STATS *
+query_trace_stats_alloc(const char *name, const char *module, bool filter)
+{
+    QUERY_TRACE_STATS *stats;
+
+    if ((stats = calloc(1, sizeof(QUERY_TRACE_STATS))) == NULL)
+    {
+        return NULL;
+    }
+
+    stats->name = name;
+    stats->module = module;
+    stats->filter = filter;
+
+    for (int i = 0; i < QUERY_TRACE_PHASES; i++)
+    {
+        if ((!filter || i == QUERY_TRACE_FILTERS) &&
+            (stats->phases[i] = ts_hist_alloc()) == NULL)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                ts_hist_free(stats->phases[j]);
+            }
+            free(stats);
+            return NULL;
+        }
+    }
+
+    spinlock_acquire(&stats_lock);
+    stats->next = all_stats;
+    all_stats = stats;
+    spinlock_release(&stats_lock);
+
+    return stats;
+}
+
+/**
+ * Return the histograms of a service or a filter, allocating them when the
+ * first traced session uses it
+ *
+ * @param ptr       Where the histograms are stored
+ * @param lock      The lock of the service or filter
+ * @param name      Name of the service or filter
+ * @param module    The router or filter module
+ * @param filter    True for a filter
+ * @return The histograms or NULL if memory allocation failed
+ */
+static QUERY_TRACE_STATS *
+query_trace_stats_get(QUERY_TRACE_STATS **ptr, SPINLOCK *lock,
+                      const char *name, const char *module, bool filter)
+{
+    QUERY_TRACE_STATS *stats = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+
+    if (stats == NULL)
+    {
+        spinlock_acquire(lock);
+        if ((stats = *ptr) == NULL &&
+            (stats = query_trace_stats_alloc(name, module, filter)) != NULL)
+        {
+            __atomic_store_n(ptr, stats, __ATOMIC_RELEASE);
+        }
+        spinlock_release(lock);
+    }
+
+    return stats;
+}
+
+/**
+ * Start tracing a new session. The filters of the session are made to route
+ * their queries through the links of the trace. This is called once the
+ * filters of the session have been set up.
+ *
+ * @param session   The session
+ * @return False if memory allocation failed
+ */
+bool
+query_trace_session_init(SESSION *session)
+{
+    SERVICE *service = session->service;
+    int n_links = session->n_filters + 1;
+    QUERY_TRACE *trace;
+
+    if (!trace_enabled)
+    {
+        return true;
+    }
+
+    if (query_trace_stats_get(&service->trace_stats, &service->spin, service->name,
+                              service->routerModule, false) == NULL ||
+        (trace = calloc(1, sizeof(QUERY_TRACE) + n_links * sizeof(QUERY_TRACE_LINK))) == NULL)
+    {
+        MXS_ERROR("Failed to allocate memory for the query trace of a session "
+                  "of service '%s'.", service->name);
+        return false;
+    }
+
+    trace->session = session;
+    spinlock_init(&trace->lock);
+    trace->n_links = n_links;
+
+    for (int i = 0; i < n_links; i++)
+    {
+        QUERY_TRACE_LINK *link = &trace->links[i];
+
+        link->trace = trace;
+
+        if (i < session->n_filters)
+        {
+            FILTER_DEF *filter = session->filters[i].filter;
+
+            if (query_trace_stats_get(&filter->trace_stats, &filter->spin, filter->name,
+                                      filter->module, true) == NULL)
+            {
+                MXS_ERROR("Failed to allocate memory for the query trace of "
+                          "filter '%s'.", filter->name);
+                free(trace);
+                return false;
+            }
+
+            link->filter = filter;
+            link->instance = session->filters[i].instance;
+            link->session = session->filters[i].session;
+            link->routeQuery = (void *)filter->obj->routeQuery;
+        }
+        else
+        {
+            link->instance = service->router_instance;
+            link->session = session->router_session;
+            link->routeQuery = (void *)service->router->routeQuery;
+        }
+    }
+
+    for (int i = 0; i < session->n_filters; i++)
+    {
+        DOWNSTREAM next;
+
+        next.instance = &trace->links[i + 1];
+        next.session = trace->links[i + 1].session;
+        next.routeQuery = query_trace_link_route;
+        session->filters[i].filter->obj->setDownstream(session->filters[i].instance,
+                                                       session->filters[i].session,
+                                                       &next);
+    }
+
+    session->trace = trace;
+    return true;
+}
+
+/**
+ * Free the trace of a session
+ *
+ * @param session   The session
+ */
+void
+query_trace_session_free(SESSION *session)
+{
+    free(session->trace);
+    session->trace = NULL;
+}
+
+/**
+ * Route a query to the next component through a link. The time spent in the
+ * component is charged to it if the query is traced by the calling thread.
+ *
+ * @param instance  The link
+ * @param session   The session of the next component
+ * @param buf       The query
+ * @return The return value of the next component
+ */
+static int
+query_trace_link_route(void *instance, void *session, GWBUF *buf)
+{
+    QUERY_TRACE_LINK *link = (QUERY_TRACE_LINK *)instance;
+    QUERY_TRACE_TIMES *times = query_trace_current;
+    CYCLES nested = query_trace_nested;
+    CYCLES start;
+    CYCLES elapsed;
+    CYCLES own;
+    int rval;
+
+    if (times == NULL || times != &link->trace->current)
+    {
+        return link->routeQuery(link->instance, link->session, buf);
+    }
+
+    query_trace_nested = 0;
+    start = rdtsc();
+
+    if (link->filter == NULL)
+    {
+        /** The reply can arrive before the router returns */
+        times->sent = start;
+        query_trace_publish(link->trace, times);
+    }
+
+    rval = link->routeQuery(link->instance, link->session, buf);
+    elapsed = rdtsc() - start;
+    own = elapsed > query_trace_nested ? elapsed - query_trace_nested : 0;
+    query_trace_nested = nested + elapsed;
+
+    if (link->filter)
+    {
+        link->cycles += own;
+        times->phases[QUERY_TRACE_FILTERS] += own;
+    }
+    else
+    {
+        times->phases[QUERY_TRACE_ROUTE] += own;
+    }
+
+    return rval;
+}
+
+/**
+ * Copy the start of the text of a query for the list of the slowest queries
+ *
+ * @param dest  Where to copy the text
+ * @param buf   The query
+ */
+static void
+query_trace_copy_sql(char *dest, GWBUF *buf)
+{
+    int len = 0;
+
+    if (max_slowest > 0 && GWBUF_IS_SQL(buf))
+    {
+        char *sql = (char *)GWBUF_DATA(buf) + 5;
+
+        for (len = 0; len < GWBUF_LENGTH(buf) - 5 && len < QUERY_TRACE_SQL_LEN - 1; len++)
+        {
+            dest[len] = isprint(sql[len]) ? sql[len] : ' ';
+        }
+    }
+
+    dest[len] = '\0';
+}
+
+/**
+ * Route a query of a traced session to the head of its filter chain
+ *
+ * @param session   The session
+ * @param buf       The query
+ * @return The return value of the first component
+ */
+int
+query_trace_route_query(SESSION *session, GWBUF *buf)
+{
+    QUERY_TRACE *trace = session->trace;
+    QUERY_TRACE_TIMES *times = &trace->current;
+    QUERY_TRACE_TIMES *outer = query_trace_current;
+    CYCLES nested = query_trace_nested;
+    CYCLES start = rdtsc();
+    CYCLES end;
+    int rval;
+
+    /** A query that got no reply is not waited for any more */
+    if (__atomic_load_n(&trace->waiting, __ATOMIC_RELAXED))
+    {
+        spinlock_acquire(&trace->lock);
+        trace->waiting = false;
+        spinlock_release(&trace->lock);
+    }
+
+    memset(times->phases, 0, sizeof(times->phases));
+    times->seq = ++trace->seq;
+    times->start = buf->stamp && buf->stamp <= start ? buf->stamp : start;
+    times->phases[QUERY_TRACE_READ] = start - times->start;
+    query_trace_copy_sql(times->sql, buf);
+
+    for (int i = 0; i < trace->n_links; i++)
+    {
+        trace->links[i].cycles = 0;
+    }
+
+    query_trace_current = times;
+    query_trace_nested = 0;
+    rval = query_trace_link_route(&trace->links[0], trace->links[0].session, buf);
+    query_trace_current = outer;
+
+    end = rdtsc();
+    query_trace_nested = nested + (end - start);
+
+    for (int i = 0; i < trace->n_links; i++)
+    {
+        if (trace->links[i].filter)
+        {
+            ts_hist_add(trace->links[i].filter->trace_stats->phases[QUERY_TRACE_FILTERS],
+                        query_trace_ns(trace->links[i].cycles));
+        }
+    }
+
+    spinlock_acquire(&trace->lock);
+    if (trace->published != times->seq)
+    {
+        /** The query did not reach the router */
+        times->sent = end;
+        trace->pending = *times;
+        trace->published = times->seq;
+        trace->waiting = true;
+    }
+    else if (trace->waiting && trace->pending.seq == times->seq)
+    {
+        /** No reply yet, add the time spent in the router */
+        times->sent = end;
+        trace->pending = *times;
+    }
+    spinlock_release(&trace->lock);
+
+    return rval;
+}
+
+/**
+ * Add a query to the list of the slowest queries if it is slow enough
+ *
+ * @param session   The session of the query
+ * @param sql       The start of the query text
+ * @param phases    The time spent in each phase in nanoseconds
+ */
+static void
+query_trace_add_slowest(SESSION *session, const char *sql, int64_t *phases)
+{
+    QUERY_TRACE_SAMPLE *sample = NULL;
+
+    spinlock_acquire(&slowest_lock);
+
+    if (n_slowest < max_slowest)
+    {
+        sample = &slowest[n_slowest++];
+    }
+    else if (phases[QUERY_TRACE_TOTAL] > slowest_min)
+    {
+        for (int i = 0; i < n_slowest; i++)
+        {
+            if (sample == NULL || slowest[i].phases[QUERY_TRACE_TOTAL] <
+                sample->phases[QUERY_TRACE_TOTAL])
+            {
+                sample = &slowest[i];
+            }
+        }
+    }
+
+    if (sample)
+    {
+        sample->ses_id = session->ses_id;
+        sample->service = session->service->name;
+        sample->when = time(NULL);
+        memcpy(sample->phases, phases, sizeof(sample->phases));
+        strcpy(sample->sql, sql);
+
+        if (n_slowest == max_slowest)
+        {
+            int64_t min = slowest[0].phases[QUERY_TRACE_TOTAL];
+
+            for (int i = 1; i < n_slowest; i++)
+            {
+                if (slowest[i].phases[QUERY_TRACE_TOTAL] < min)
+                {
+                    min = slowest[i].phases[QUERY_TRACE_TOTAL];
+                }
+            }
+            __atomic_store_n(&slowest_min, min, __ATOMIC_RELAXED);
+        }
+    }
+
+    spinlock_release(&slowest_lock);
+}
+
+/**
+ * Add the timings of a completed query to the histograms of its service
+ *
+ * @param session   The session of the query
+ * @param times     The timings of the query
+ */
+static void
+query_trace_record(SESSION *session, QUERY_TRACE_TIMES *times)
+{
+    QUERY_TRACE_STATS *stats = session->service->trace_stats;
+    int64_t phases[QUERY_TRACE_PHASES];
+
+    for (int i = 0; i < QUERY_TRACE_PHASES; i++)
+    {
+        phases[i] = query_trace_ns(times->phases[i]);
+        ts_hist_add(stats->phases[i], phases[i]);
+    }
+
+    if (max_slowest > 0 &&
+        phases[QUERY_TRACE_TOTAL] > __atomic_load_n(&slowest_min, __ATOMIC_RELAXED))
+    {
+        query_trace_add_slowest(session, times->sql, phases);
+    }
+}
+
+/**
+ * Route a reply of a traced session to the tail of its filter chain. The
+ * first reply to a routed query completes its trace.
+ *
+ * @param session   The session
+ * @param buf       The reply
+ * @return The return value of the last component
+ */
+int
+query_trace_route_reply(SESSION *session, GWBUF *buf)
+{
+    QUERY_TRACE *trace = session->trace;
+    QUERY_TRACE_TIMES times;
+    bool first = false;
+    CYCLES start = rdtsc();
+    CYCLES end;
+    int rval;
+
+    if (__atomic_load_n(&trace->waiting, __ATOMIC_RELAXED))
+    {
+        spinlock_acquire(&trace->lock);
+        if ((first = trace->waiting))
+        {
+            times = trace->pending;
+            trace->waiting = false;
+        }
+        spinlock_release(&trace->lock);
+    }
+
+    rval = session->tail.clientReply(session->tail.instance, session->tail.session, buf);
+
+    if (first)
+    {
+        /** The counters of different processors may be slightly apart */
+        end = rdtsc();
+        times.phases[QUERY_TRACE_BACKEND] = start > times.sent ? start - times.sent : 0;
+        times.phases[QUERY_TRACE_WRITE] = end - start;
+        times.phases[QUERY_TRACE_TOTAL] = end > times.start ? end - times.start : 0;
+        query_trace_record(session, &times);
+    }
+
+    return rval;
+}
+
+/**
+ * Format a time in nanoseconds for display
+ *
+ * @param buf   The buffer to format to
+ * @param size  The size of the buffer
+ * @param ns    The time in nanoseconds
+ */
+static void
+query_trace_format_time(char *buf, size_t size, int64_t ns)
+{
+    if (ns < 1000)
+    {
+        snprintf(buf, size, "%ldns", (long)ns);
+    }
+    else if (ns < 1000000)
+    {
+        snprintf(buf, size, "%.1fus", ns / 1000.0);
+    }
+    else if (ns < 1000000000)
+    {
+        snprintf(buf, size, "%.1fms", ns / 1000000.0);
+    }
+    else
+    {
+        snprintf(buf, size, "%.1fs", ns / 1000000000.0);
+    }
+}
+
+/**
+ * Print a row of percentiles of a histogram
+ *
+ * @param dcb       The DCB to print to
+ * @param desc      The description of the row
+ * @param hist      The histogram
+ * @param snapshot  Memory for merging the histogram
+ */
+static void
+query_trace_print_hist(DCB *dcb, const char *desc, ts_hist_t hist,
+                       ts_hist_snapshot_t *snapshot)
+{
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    char buf[20];
+
+    ts_hist_merge(hist, snapshot);
+    dcb_printf(dcb, "%-20s | %10ld |", desc, (long)snapshot->count);
+    for (int i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        query_trace_format_time(buf, sizeof(buf), ts_hist_percentile(snapshot, percentiles[i]));
+        dcb_printf(dcb, " %-8s |", buf);
+    }
+    query_trace_format_time(buf, sizeof(buf), snapshot->max);
+    dcb_printf(dcb, " %s\n", buf);
+}
+
+/**
+ * Print the header of a percentile table
+ *
+ * @param dcb   The DCB to print to
+ * @param desc  The title of the first column
+ */
+static void
+query_trace_print_header(DCB *dcb, const char *desc)
+{
+    dcb_printf(dcb, "%-20s | Queries    | p50      | p90      | p99      | p99.9    | max\n", desc);
+    dcb_printf(dcb, "---------------------+------------+----------+----------+"
+               "----------+----------+---------\n");
+}
+
+/**
+ * Compare the total time of two slowest queries, slowest first
+ */
+static int
+query_trace_sample_cmp(const void *a, const void *b)
+{
+    int64_t ta = ((const QUERY_TRACE_SAMPLE *)a)->phases[QUERY_TRACE_TOTAL];
+    int64_t tb = ((const QUERY_TRACE_SAMPLE *)b)->phases[QUERY_TRACE_TOTAL];
+
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+/**
+ * Print the slowest queries
+ *
+ * @param dcb   The DCB to print to
+ */
+static void
+query_trace_print_slowest(DCB *dcb)
+{
+    QUERY_TRACE_SAMPLE *samples;
+    int n;
+
+    if (max_slowest == 0 ||
+        (samples = malloc(max_slowest * sizeof(QUERY_TRACE_SAMPLE))) == NULL)
+    {
+        return;
+    }
+
+    spinlock_acquire(&slowest_lock);
+    n = n_slowest;
+    memcpy(samples, slowest, n * sizeof(QUERY_TRACE_SAMPLE));
+    spinlock_release(&slowest_lock);
+
+    qsort(samples, n, sizeof(QUERY_TRACE_SAMPLE), query_trace_sample_cmp);
+
+    dcb_printf(dcb, "\nSlowest queries.\n\n");
+    for (int i = 0; i < n; i++)
+    {
+        char timebuf[30];
+        char buf[20];
+        struct tm tm;
+
+        localtime_r(&samples[i].when, &tm);
+        strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &tm);
+        query_trace_format_time(buf, sizeof(buf), samples[i].phases[QUERY_TRACE_TOTAL]);
+        dcb_printf(dcb, "%s  %s  Service: %s  Session: %lu\n",
+                   buf, timebuf, samples[i].service, samples[i].ses_id);
+
+        dcb_printf(dcb, "\t");
+        for (int j = 0; j < QUERY_TRACE_TOTAL; j++)
+        {
+            query_trace_format_time(buf, sizeof(buf), samples[i].phases[j]);
+            dcb_printf(dcb, "%s: %s%s", phase_names[j], buf,
+                       j < QUERY_TRACE_TOTAL - 1 ? ", " : "\n");
+        }
+
+        if (samples[i].sql[0])
+        {
+            dcb_printf(dcb, "\t%s\n", samples[i].sql);
+        }
+    }
+
+    free(samples);
+}
+
+/**
+ * Print the query trace statistics of all services and filters
+ *
+ * @param dcb   The DCB to print to
+ */
+void
+dprintQueryTrace(DCB *dcb)
+{
+    ts_hist_snapshot_t *snapshot;
+    QUERY_TRACE_STATS *stats;
+    bool filters = false;
+
+    if (!trace_enabled)
+    {
+        dcb_printf(dcb, "Query tracing is not enabled, add query_trace=true "
+                   "to the [maxscale] section to enable it.\n");
+        return;
+    }
+
+    if ((snapshot = malloc(sizeof(ts_hist_snapshot_t))) == NULL)
+    {
+        return;
+    }
+
+    dcb_printf(dcb, "\nQuery trace statistics.\n");
+
+    spinlock_acquire(&stats_lock);
+    stats = all_stats;
+    spinlock_release(&stats_lock);
+
+    /** The statistics are never freed and new ones are added to the head */
+    for (QUERY_TRACE_STATS *s = stats; s; s = s->next)
+    {
+        if (s->filter)
+        {
+            filters = true;
+            continue;
+        }
+
+        dcb_printf(dcb, "\nService %s (%s)\n\n", s->name, s->module);
+        query_trace_print_header(dcb, "Phase");
+        for (int i = 0; i < QUERY_TRACE_PHASES; i++)
+        {
+            query_trace_print_hist(dcb, phase_names[i], s->phases[i], snapshot);
+        }
+    }
+
+    if (filters)
+    {
+        dcb_printf(dcb, "\nFilters\n\n");
+        query_trace_print_header(dcb, "Filter");
+        for (QUERY_TRACE_STATS *s = stats; s; s = s->next)
+        {
+            if (s->filter)
+            {
+                query_trace_print_hist(dcb, s->name, s->phases[QUERY_TRACE_FILTERS], snapshot);
+            }
+        }
+    }
+
+    query_trace_print_slowest(dcb);
+    free(snapshot);
+}
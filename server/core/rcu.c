@@ -0,0 +1,361 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file rcu.c  - Quiescent state based reclamation
+ *
+ * A global epoch counter is advanced every time an object is retired. Each
+ * polling thread records the epoch it observed the last time it was in a
+ * quiescent state. A retired object can be released once the smallest
+ * recorded epoch is at least the epoch it was retired in, since every
+ * thread has then started a new event loop iteration after the object was
+ * unpublished.
+ *
+ * A polling thread keeps the objects it retires in a thread local limbo
+ * list and releases them in batches when it passes a quiescent state, so
+ * retiring an object takes no lock. Objects retired by other threads go to
+ * a shared list that is drained opportunistically by whichever polling
+ * thread gets its lock.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <rcu.h>
+#include <spinlock.h>
+#include <platform.h>
+#include <skygw_debug.h>
+#include <log_manager.h>
+
+/** The epoch a thread reports once it no longer takes part in the grace periods */
+#define RCU_OFFLINE UINT64_MAX
+
+/** Per-thread observed epoch, padded to a cache line to avoid false sharing */
+typedef struct rcu_thread
+{
+    volatile uint64_t epoch;
+    char pad[64 - sizeof(uint64_t)];
+} RCU_THREAD;
+
+/** A list of retired objects in the order they were retired */
+typedef struct rcu_list
+{
+    RCU_HEAD *head;     /*< Oldest retired object */
+    RCU_HEAD *tail;
+    int      count;
+} RCU_LIST;
+
+/** An object retired with rcu_call */
+typedef struct rcu_callback
+{
+    RCU_HEAD rcu;
+    void (*func)(void *);
+    void *data;
+} RCU_CALLBACK;
+
+static RCU_THREAD *rcu_threads = NULL;
+static int rcu_n_threads = 0;
+static uint64_t rcu_epoch = 1;
+static SPINLOCK rcu_lock = SPINLOCK_INIT;
+static RCU_LIST rcu_shared;     /*< Objects retired outside the polling threads */
+
+/** The polling thread ID of the calling thread, -1 for other threads */
+static thread_local int rcu_self = -1;
+/** The objects retired by the calling polling thread */
+static thread_local RCU_LIST rcu_limbo;
+
+/**
+ * Initialise the reclamation system. Until this is called objects are
+ * released immediately, which is what the single threaded startup code
+ * and the unit tests expect.
+ *
+ * @param n_threads Number of polling threads that take part in the grace periods
+ */
+void
+rcu_init(int n_threads)
+{
+    RCU_THREAD *threads;
+
+    if (rcu_threads || n_threads <= 0)
+    {
+        return;
+    }
+
+    if ((threads = calloc(n_threads, sizeof(RCU_THREAD))) == NULL)
+    {
+        MXS_ERROR("Failed to allocate memory for deferred reclamation, "
+                  "replaced objects will be released immediately.");
+        return;
+    }
+
+    /** Threads that have not yet started cannot hold references, but they
+     * must not let an object go before they have entered their loop. The
+     * epoch zero is older than any retired object. */
+    rcu_n_threads = n_threads;
+    rcu_assign_pointer(rcu_threads, threads);
+}
+
+/**
+ * Append an object to a list of retired objects
+ *
+ * @param list  The list
+ * @param rcu   The reclamation node of the object
+ */
+static void
+rcu_list_append(RCU_LIST *list, RCU_HEAD *rcu)
+{
+    if (list->tail)
+    {
+        list->tail->next = rcu;
+    }
+    else
+    {
+        list->head = rcu;
+    }
+    list->tail = rcu;
+    list->count++;
+}
+
+/**
+ * Find the retired objects in a list that no thread can reference any more
+ * and detach them from the list
+ *
+ * @param list  The list
+ * @return List of objects that can be released
+ */
+static RCU_HEAD *
+rcu_collect(RCU_LIST *list)
+{
+    uint64_t min_epoch = RCU_OFFLINE;
+    RCU_HEAD *done = list->head;
+    RCU_HEAD *last = NULL;
+
+    for (int i = 0; i < rcu_n_threads; i++)
+    {
+        uint64_t epoch = __atomic_load_n(&rcu_threads[i].epoch, __ATOMIC_ACQUIRE);
+
+        if (epoch < min_epoch)
+        {
+            min_epoch = epoch;
+        }
+    }
+
+    while (list->head && list->head->epoch <= min_epoch)
+    {
+        last = list->head;
+        list->head = last->next;
+        list->count--;
+    }
+
+    if (last == NULL)
+    {
+        return NULL;
+    }
+
+    last->next = NULL;
+
+    if (list->head == NULL)
+    {
+        list->tail = NULL;
+    }
+
+    return done;
+}
+
+/**
+ * Release a list of objects. The release functions may retire new objects.
+ *
+ * @param done  The objects to release
+ */
+static void
+rcu_release(RCU_HEAD *done)
+{
+    while (done)
+    {
+        RCU_HEAD *next = done->next;
+        done->func(done->data);
+        done = next;
+    }
+}
+
+/**
+ * Report a quiescent state for a polling thread. The caller must not hold
+ * any pointers obtained with rcu_dereference() when this is called. The
+ * objects whose grace period has ended are released by the caller.
+ *
+ * @param thread_id The polling thread ID
+ */
+void
+rcu_quiescent(int thread_id)
+{
+    if (rcu_threads == NULL || thread_id < 0 || thread_id >= rcu_n_threads)
+    {
+        return;
+    }
+
+    rcu_self = thread_id;
+
+    /** The full barrier orders all earlier reads of shared pointers before
+     * the store of the new epoch */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    __atomic_store_n(&rcu_threads[thread_id].epoch,
+                     __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+
+    if (rcu_limbo.head)
+    {
+        rcu_release(rcu_collect(&rcu_limbo));
+    }
+
+    if (rcu_shared.count > 0 && spinlock_acquire_nowait(&rcu_lock))
+    {
+        RCU_HEAD *done = rcu_collect(&rcu_shared);
+        spinlock_release(&rcu_lock);
+        rcu_release(done);
+    }
+}
+
+/**
+ * Remove a polling thread from the grace period calculations. This is
+ * called by the thread when it exits so that it does not hold back
+ * reclamation. The objects it has retired are handed over to the other
+ * threads.
+ *
+ * @param thread_id The polling thread ID
+ */
+void
+rcu_offline(int thread_id)
+{
+    if (rcu_threads && thread_id >= 0 && thread_id < rcu_n_threads)
+    {
+        __atomic_store_n(&rcu_threads[thread_id].epoch, RCU_OFFLINE, __ATOMIC_RELEASE);
+    }
+
+    rcu_self = -1;
+
+    if (rcu_limbo.head)
+    {
+        spinlock_acquire(&rcu_lock);
+        if (rcu_shared.tail)
+        {
+            rcu_shared.tail->next = rcu_limbo.head;
+        }
+        else
+        {
+            rcu_shared.head = rcu_limbo.head;
+        }
+        rcu_shared.tail = rcu_limbo.tail;
+        rcu_shared.count += rcu_limbo.count;
+        spinlock_release(&rcu_lock);
+
+        rcu_limbo.head = rcu_limbo.tail = NULL;
+        rcu_limbo.count = 0;
+    }
+}
+
+/**
+ * Release an object once no polling thread can reference it. The object
+ * must already have been unpublished when this is called. The reclamation
+ * node is embedded in the object so that retiring it needs no memory.
+ *
+ * @param rcu   The reclamation node of the object
+ * @param func  Function that releases the object
+ * @param data  The object
+ */
+void
+rcu_retire(RCU_HEAD *rcu, void (*func)(void *), void *data)
+{
+    if (rcu_threads == NULL)
+    {
+        func(data);
+        return;
+    }
+
+    rcu->func = func;
+    rcu->data = data;
+    rcu->next = NULL;
+    /** The increment is a full barrier: the unpublishing store is visible
+     * before any thread can observe the new epoch */
+    rcu->epoch = __atomic_add_fetch(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+
+    if (rcu_self >= 0)
+    {
+        rcu_list_append(&rcu_limbo, rcu);
+    }
+    else
+    {
+        spinlock_acquire(&rcu_lock);
+        rcu_list_append(&rcu_shared, rcu);
+        spinlock_release(&rcu_lock);
+    }
+}
+
+/**
+ * Release the object of an rcu_call and the node that was allocated for it
+ *
+ * @param data The RCU_CALLBACK
+ */
+static void
+rcu_callback_release(void *data)
+{
+    RCU_CALLBACK *cb = (RCU_CALLBACK *)data;
+    cb->func(cb->data);
+    free(cb);
+}
+
+/**
+ * Release an object once no polling thread can reference it. The object
+ * must already have been unpublished when this is called.
+ *
+ * @param func Function that releases the object
+ * @param data The object
+ */
+void
+rcu_call(void (*func)(void *), void *data)
+{
+    RCU_CALLBACK *cb;
+
+    if (rcu_threads == NULL)
+    {
+        func(data);
+        return;
+    }
+
+    if ((cb = malloc(sizeof(RCU_CALLBACK))) == NULL)
+    {
+        /** Releasing the object now could pull it from under a reader */
+        MXS_ERROR("Failed to allocate memory for deferred reclamation, "
+                  "leaking a replaced object.");
+        return;
+    }
+
+    cb->func = func;
+    cb->data = data;
+    rcu_retire(&cb->rcu, rcu_callback_release, cb);
+}
+
+/**
+ * Return the number of retired objects waiting for their grace period,
+ * counting the shared list and the objects retired by the calling thread
+ *
+ * @return Number of pending objects
+ */
+int
+rcu_pending()
+{
+    return rcu_shared.count + rcu_limbo.count;
+}
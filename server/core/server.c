@@ -47,6 +47,7 @@
 #include <maxscale/poll.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <metrics.h>
 
 static SPINLOCK server_spin = SPINLOCK_INIT;
 static SERVER *allServers = NULL;
@@ -54,6 +55,36 @@ static SERVER *allServers = NULL;
 static void spin_reporter(void *, char *, int);
 static void server_parameter_free(SERVER_PARAM *tofree);
 
+static int64_t
+server_metric_up(void *data)
+{
+    return SERVER_IS_RUNNING((SERVER *)data) ? 1 : 0;
+}
+
+static int64_t
+server_metric_connections(void *data)
+{
+    return ((SERVER *)data)->stats.n_current;
+}
+
+static int64_t
+server_metric_connections_total(void *data)
+{
+    return ((SERVER *)data)->stats.n_connections;
+}
+
+static int64_t
+server_metric_operations(void *data)
+{
+    return ((SERVER *)data)->stats.n_current_ops;
+}
+
+static int64_t
+server_metric_persistent(void *data)
+{
+    return ((SERVER *)data)->stats.n_persistent;
+}
+
 /**
  * Allocate a new server withn the gateway
  *
@@ -135,6 +166,8 @@ server_free(SERVER *tofreeserver)
     }
     spinlock_release(&server_spin);
 
+    metrics_remove(tofreeserver);
+
     /* Clean up session and free the memory */
     free(tofreeserver->name);
     free(tofreeserver->protocol);
@@ -143,6 +176,11 @@ server_free(SERVER *tofreeserver)
     free(tofreeserver->slaves);
     server_parameter_free(tofreeserver->parameters);
 
+    if (tofreeserver->ssl_session)
+    {
+        SSL_SESSION_free(tofreeserver->ssl_session);
+    }
+
     if (tofreeserver->persistent)
     {
         dcb_persistent_clean_count(tofreeserver->persistent, true);
@@ -189,6 +227,7 @@ server_get_persistent(SERVER *server, char *user, const char *protocol)
                 }
                 free(dcb->user);
                 dcb->user = NULL;
+                timer_cancel(&dcb->timer);
                 spinlock_release(&server->persistlock);
                 atomic_add(&server->stats.n_persistent, -1);
                 atomic_add(&server->stats.n_current, 1);
@@ -226,6 +265,24 @@ void
 server_set_unique_name(SERVER *server, char *name)
 {
     server->unique_name = strdup(name);
+
+    if (server->unique_name)
+    {
+        const char *label = server->unique_name;
+
+        metrics_remove(server);
+        metric_add("maxscale_server_up", "Whether a server is running and not in maintenance",
+                   METRIC_GAUGE, "server", label, server_metric_up, server);
+        metric_add("maxscale_server_connections", "Current number of connections to a server",
+                   METRIC_GAUGE, "server", label, server_metric_connections, server);
+        metric_add("maxscale_server_connections_total", "Number of connections created to a server",
+                   METRIC_COUNTER, "server", label, server_metric_connections_total, server);
+        metric_add("maxscale_server_operations", "Current number of active operations on a server",
+                   METRIC_GAUGE, "server", label, server_metric_operations, server);
+        metric_add("maxscale_server_persistent_connections", "Current number of connections in the "
+                   "persistent pool of a server", METRIC_GAUGE, "server", label,
+                   server_metric_persistent, server);
+    }
 }
 
 /**
@@ -64,11 +64,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <housekeeper.h>
+#include <hk_heartbeat.h>
 #include <resultset.h>
 #include <gw.h>
 #include <gwdirs.h>
 #include <math.h>
 #include <version.h>
+#include <metrics.h>
 
 /** To be used with configuration type checks */
 typedef struct typelib_st
@@ -99,6 +101,19 @@ static int find_type(typelib_t* tl, const char* needle, int maxlen);
 static void service_add_qualified_param(SERVICE*          svc,
                                         CONFIG_PARAMETER* param);
 static void service_internal_restart(void *data);
+static void serviceStartShards(SERVICE *service, SERV_LISTENER *port, const char *config_bind);
+
+static int64_t
+service_metric_sessions(void *data)
+{
+    return ((SERVICE *)data)->stats.n_current;
+}
+
+static int64_t
+service_metric_sessions_total(void *data)
+{
+    return ((SERVICE *)data)->stats.n_sessions;
+}
 
 /**
  * Allocate a new service for the gateway to support
@@ -171,6 +186,11 @@ service_alloc(const char *servname, const char *router)
     allServices = service;
     spinlock_release(&service_spin);
 
+    metric_add("maxscale_service_sessions", "Current number of sessions of a service",
+               METRIC_GAUGE, "service", service->name, service_metric_sessions, service);
+    metric_add("maxscale_service_sessions_total", "Number of sessions created on a service",
+               METRIC_COUNTER, "service", service->name, service_metric_sessions_total, service);
+
     return service;
 }
 
@@ -378,6 +398,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
         {
             port->listener->session->state = SESSION_STATE_LISTENER;
             listeners += 1;
+            serviceStartShards(service, port, config_bind);
         }
         else
         {
@@ -408,6 +429,83 @@ retblock:
     return listeners;
 }
 
+/**
+ * Open the additional listening sockets of a SO_REUSEPORT listener
+ *
+ * When the protocol module enabled SO_REUSEPORT on the listening socket, one
+ * more socket is bound to the same address for each additional polling
+ * thread. The kernel distributes the incoming connections between the
+ * sockets and, as a listener DCB is only processed by one thread at a time,
+ * up to one thread per socket can accept connections concurrently.
+ *
+ * Failing to open an additional socket is not fatal, the port keeps
+ * accepting connections on the sockets that were opened.
+ *
+ * @param service       The service
+ * @param port          The started port
+ * @param config_bind   The address the first listener is bound to
+ */
+static void
+serviceStartShards(SERVICE *service, SERV_LISTENER *port, const char *config_bind)
+{
+#ifdef SO_REUSEPORT
+    int enabled = 0;
+    socklen_t len = sizeof(enabled);
+    int n_threads = config_threadcount();
+
+    if (n_threads < 2 ||
+        getsockopt(port->listener->fd, SOL_SOCKET, SO_REUSEPORT, &enabled, &len) != 0 ||
+        !enabled)
+    {
+        return;
+    }
+
+    if ((port->shards = calloc(n_threads - 1, sizeof(DCB *))) == NULL)
+    {
+        MXS_ERROR("Failed to allocate memory for the listeners of service %s.",
+                  service->name);
+        return;
+    }
+
+    while (port->n_shards < n_threads - 1)
+    {
+        char bind_copy[40];
+        DCB *shard = dcb_alloc(DCB_ROLE_SERVICE_LISTENER);
+
+        if (shard == NULL)
+        {
+            break;
+        }
+
+        shard->listen_ssl = port->listener->listen_ssl;
+        memcpy(&shard->func, &port->listener->func, sizeof(GWPROTOCOL));
+        strncpy(bind_copy, config_bind, sizeof(bind_copy) - 1);
+        bind_copy[sizeof(bind_copy) - 1] = '\0';
+
+        if (!shard->func.listen(shard, bind_copy))
+        {
+            dcb_close(shard);
+            break;
+        }
+
+        if ((shard->session = session_alloc(service, shard)) == NULL)
+        {
+            dcb_close(shard);
+            break;
+        }
+
+        shard->session->state = SESSION_STATE_LISTENER;
+        port->shards[port->n_shards++] = shard;
+    }
+
+    if (port->n_shards < n_threads - 1)
+    {
+        MXS_WARNING("Service %s opened only %d of %d listening sockets for %s.",
+                    service->name, port->n_shards + 1, n_threads, config_bind);
+    }
+#endif
+}
+
 /**
  * Start all ports for a service.
  * serviceStartAllPorts will try to start all listeners associated with the service.
@@ -574,6 +672,14 @@ serviceStop(SERVICE *service)
                 listeners++;
             }
         }
+        for (int i = 0; i < port->n_shards; i++)
+        {
+            if (port->shards[i]->session->state == SESSION_STATE_LISTENER &&
+                poll_remove_dcb(port->shards[i]) == 0)
+            {
+                port->shards[i]->session->state = SESSION_STATE_LISTENER_STOPPED;
+            }
+        }
         port = port->next;
     }
     service->state = SERVICE_STATE_STOPPED;
@@ -606,6 +712,14 @@ serviceRestart(SERVICE *service)
                 listeners++;
             }
         }
+        for (int i = 0; i < port->n_shards; i++)
+        {
+            if (port->shards[i]->session->state == SESSION_STATE_LISTENER_STOPPED &&
+                poll_add_dcb(port->shards[i]) == 0)
+            {
+                port->shards[i]->session->state = SESSION_STATE_LISTENER;
+            }
+        }
         port = port->next;
     }
     service->state = SERVICE_STATE_STARTED;
@@ -648,6 +762,8 @@ service_free(SERVICE *service)
     }
     spinlock_release(&service_spin);
 
+    metrics_remove(service);
+
     /* Clean up session and free the memory */
     while (service->dbref)
     {
@@ -979,12 +1095,8 @@ serviceSetTimeout(SERVICE *service, int val)
         return 0;
     }
 
-    /** Enable the session timeout checks if and only if at least one service is
-     * configured with a idle timeout. */
-    if ((service->conn_idle_timeout = val))
-    {
-       enable_session_timeouts();
-    }
+    /** The timeout applies to the sessions created after this */
+    service->conn_idle_timeout = val;
 
     return 1;
 }
@@ -1268,6 +1380,21 @@ void dprintService(DCB *dcb, SERVICE *service)
     }
     dcb_printf(dcb, "\tUsers data:                          %p\n",
                service->users);
+    if (service->users_stats.n_reloads || service->users_stats.n_unchanged ||
+        service->users_stats.n_failed)
+    {
+        SERVICE_USERS_STATS *st = &service->users_stats;
+        int n_loads = st->n_reloads + st->n_unchanged + st->n_failed;
+
+        dcb_printf(dcb, "\tUsers reloads:                       %d (%d partial, %d unchanged, "
+                   "%d failed)\n", st->n_reloads, st->n_partial, st->n_unchanged, st->n_failed);
+        dcb_printf(dcb, "\tUsers refreshes coalesced:           %d\n", st->n_coalesced);
+        dcb_printf(dcb, "\tUsers refreshes rate limited:        %d\n", st->n_rate_limited);
+        dcb_printf(dcb, "\tUsers rows transferred:              %ld (last %d)\n",
+                   st->rows, st->last_rows);
+        dcb_printf(dcb, "\tUsers reload time:                   last %dms, avg %ldms, max %dms\n",
+                   st->last_ms, st->total_ms / n_loads, st->max_ms);
+    }
     dcb_printf(dcb, "\tTotal connections:                   %d\n",
                service->stats.n_sessions);
     dcb_printf(dcb, "\tCurrently connected:                 %d\n",
@@ -1401,12 +1528,20 @@ service_update(SERVICE *service, char *router, char *user, char *auth)
  * This function replaces the MySQL users used by the service with the latest
  * version found on the backend servers. There is a limit on how often the users
  * can be reloaded and if this limit is exceeded, the reload will fail.
+ *
+ * Authentication failures tend to arrive in bursts. A request that arrives
+ * while a reload is running fails immediately. A request that arrives just
+ * after a reload completed reuses that reload. Neither counts against the
+ * rate limit.
+ *
  * @param service Service to reload
  * @return 0 on success and 1 on error
  */
 int service_refresh_users(SERVICE *service)
 {
     int ret = 1;
+    time_t now;
+
     /* check for another running getUsers request */
     if (!spinlock_acquire_nowait(&service->users_table_spin))
     {
@@ -1417,26 +1552,42 @@ int service_refresh_users(SERVICE *service)
         return 1;
     }
 
-    /* check if refresh rate limit has exceeded */
-    if ((time(NULL) < (service->rate_limit.last + USERS_REFRESH_TIME)) ||
-        (service->rate_limit.nloads > USERS_REFRESH_MAX_PER_TIME))
+    /* a reload that has just completed already has the latest users */
+    if (service->users_stats.completed &&
+        hkheartbeat - service->users_stats.completed < USERS_REFRESH_COALESCE)
     {
+        service->users_stats.n_coalesced++;
         spinlock_release(&service->users_table_spin);
-        MXS_ERROR("%s: Refresh rate limit exceeded for load of users' table.",
-                  service->name);
-
-        return 1;
+        return 0;
     }
 
-    service->rate_limit.nloads++;
+    /* start a new rate limit interval */
+    now = time(NULL);
 
-    /* update time and counter */
-    if (service->rate_limit.nloads > USERS_REFRESH_MAX_PER_TIME)
+    if (now >= service->rate_limit.last + USERS_REFRESH_TIME)
     {
-        service->rate_limit.nloads = 1;
-        service->rate_limit.last = time(NULL);
+        service->rate_limit.last = now;
+        service->rate_limit.nloads = 0;
     }
 
+    /* check if refresh rate limit has exceeded */
+    if (service->rate_limit.nloads >= USERS_REFRESH_MAX_PER_TIME)
+    {
+        service->users_stats.n_rate_limited++;
+
+        /* only log the first rejected refresh of each interval */
+        if (service->rate_limit.nloads++ == USERS_REFRESH_MAX_PER_TIME)
+        {
+            MXS_ERROR("%s: Refresh rate limit exceeded for load of users' table.",
+                      service->name);
+        }
+
+        spinlock_release(&service->users_table_spin);
+        return 1;
+    }
+
+    service->rate_limit.nloads++;
+
     ret = replace_mysql_users(service);
 
     /* remove lock */
@@ -45,25 +45,33 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <housekeeper.h>
+#include <statistics.h>
 
-/** Global session id; updated safely by holding session_spin */
+/** Global session id; updated atomically */
 static size_t session_id;
 
-static SPINLOCK session_spin = SPINLOCK_INIT;
-static SESSION *allSessions = NULL;
-
-static struct session session_dummy_struct;
+/** Number of shards in the registry of sessions. Polling threads beyond this
+ * number share the shards. */
+#define SESSION_SHARDS 64
 
 /**
- * These two are declared in session.h
+ * A shard of the registry of all sessions. A session is linked into the
+ * shard of the thread that created it so that connecting clients on different
+ * threads do not contend on a lock. Each shard is on its own cache line.
  */
-bool check_timeouts = false;
-long next_timeout_check = 0;
+typedef struct
+{
+    ADAPTIVE_LOCK lock;
+    SESSION       *head;
+} __attribute__((aligned(64))) SESSION_SHARD;
+
+static SESSION_SHARD session_shards[SESSION_SHARDS];
 
-static SPINLOCK timeout_lock = SPINLOCK_INIT;
+static struct session session_dummy_struct;
 
 static int session_setup_filters(SESSION *session);
 static void session_simple_free(SESSION *session, DCB *dcb);
+static void session_idle_timeout(void *data);
 
 static void mysql_auth_free_client_data(DCB *dcb);
 
@@ -168,6 +176,12 @@ session_alloc(SERVICE *service, DCB *client_dcb)
                       "Terminating session %s.",
                       service->name);
         }
+
+        if (SESSION_STATE_TO_BE_FREED != session->state
+            && !query_trace_session_init(session))
+        {
+            session->state = SESSION_STATE_TO_BE_FREED;
+        }
     }
 
     if (SESSION_STATE_TO_BE_FREED != session->state)
@@ -198,17 +212,34 @@ session_alloc(SERVICE *service, DCB *client_dcb)
                  session->client_dcb->user,
                  session->client_dcb->remote);
     }
-    spinlock_acquire(&session_spin);
-    /** Assign a session id and increase, insert session into list */
-    session->ses_id = ++session_id;
-    session->next = allSessions;
-    allSessions = session;
-    spinlock_release(&session_spin);
+    /** Assign a session id and insert the session into the registry shard
+     * of this thread */
+    session->ses_id = __atomic_add_fetch(&session_id, 1, __ATOMIC_RELAXED);
+    session->shard = ts_stats_get_thread_id() % SESSION_SHARDS;
+    SESSION_SHARD *shard = &session_shards[session->shard];
+    adaptive_lock_acquire(&shard->lock);
+    session->prev = NULL;
+    session->next = shard->head;
+    if (shard->head)
+    {
+        shard->head->prev = session;
+    }
+    shard->head = session;
+    adaptive_lock_release(&shard->lock);
     atomic_add(&service->stats.n_sessions, 1);
     atomic_add(&service->stats.n_current, 1);
     CHK_SESSION(session);
 
     client_dcb->session = session;
+
+    if (SESSION_STATE_TO_BE_FREED != session->state
+        && client_dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER
+        && service->conn_idle_timeout)
+    {
+        timer_init(&client_dcb->timer, session_idle_timeout, client_dcb);
+        timer_arm(&client_dcb->timer, hkheartbeat + service->conn_idle_timeout * 10 + 1);
+    }
+
     return SESSION_STATE_TO_BE_FREED == session->state ? NULL : session;
 }
 
@@ -396,26 +427,27 @@ session_free(SESSION *session)
     }
     session->state = SESSION_STATE_TO_BE_FREED;
 
-    /* First of all remove from the linked list */
-    spinlock_acquire(&session_spin);
-    if (allSessions == session)
+    /* First of all remove from the registry */
+    SESSION_SHARD *shard = &session_shards[session->shard];
+    adaptive_lock_acquire(&shard->lock);
+    if (session->prev || shard->head == session)
     {
-        allSessions = session->next;
-    }
-    else
-    {
-        SESSION *chksession;
-        chksession = allSessions;
-        while (chksession && chksession->next != session)
+        if (session->prev)
+        {
+            session->prev->next = session->next;
+        }
+        else
         {
-            chksession = chksession->next;
+            shard->head = session->next;
         }
-        if (chksession)
+        if (session->next)
         {
-            chksession->next = session->next;
+            session->next->prev = session->prev;
         }
+        session->next = NULL;
+        session->prev = NULL;
     }
-    spinlock_release(&session_spin);
+    adaptive_lock_release(&shard->lock);
     atomic_add(&session->service->stats.n_current, -1);
 
     /***
@@ -460,6 +492,8 @@ session_free(SESSION *session)
         free(session->filters);
     }
 
+    query_trace_session_free(session);
+
     MXS_INFO("Stopped %s client session [%lu]",
              session->service->name,
              session->ses_id);
@@ -488,18 +522,21 @@ session_isvalid(SESSION *session)
     SESSION *list_session;
     int rval = 0;
 
-    spinlock_acquire(&session_spin);
-    list_session = allSessions;
-    while (list_session)
+    for (int i = 0; i < SESSION_SHARDS && rval == 0; i++)
     {
-        if (list_session == session)
+        adaptive_lock_acquire(&session_shards[i].lock);
+        list_session = session_shards[i].head;
+        while (list_session)
         {
-            rval = 1;
-            break;
+            if (list_session == session)
+            {
+                rval = 1;
+                break;
+            }
+            list_session = list_session->next;
         }
-        list_session = list_session->next;
+        adaptive_lock_release(&session_shards[i].lock);
     }
-    spinlock_release(&session_spin);
 
     return rval;
 }
@@ -534,14 +571,17 @@ printAllSessions()
 {
     SESSION *list_session;
 
-    spinlock_acquire(&session_spin);
-    list_session = allSessions;
-    while (list_session)
+    for (int i = 0; i < SESSION_SHARDS; i++)
     {
-        printSession(list_session);
-        list_session = list_session->next;
+        adaptive_lock_acquire(&session_shards[i].lock);
+        list_session = session_shards[i].head;
+        while (list_session)
+        {
+            printSession(list_session);
+            list_session = list_session->next;
+        }
+        adaptive_lock_release(&session_shards[i].lock);
     }
-    spinlock_release(&session_spin);
 }
 
 
@@ -558,52 +598,58 @@ CheckSessions()
     int noclients = 0;
     int norouter = 0;
 
-    spinlock_acquire(&session_spin);
-    list_session = allSessions;
-    while (list_session)
+    for (int i = 0; i < SESSION_SHARDS; i++)
     {
-        if (list_session->state != SESSION_STATE_LISTENER ||
-            list_session->state != SESSION_STATE_LISTENER_STOPPED)
+        adaptive_lock_acquire(&session_shards[i].lock);
+        list_session = session_shards[i].head;
+        while (list_session)
         {
-            if (list_session->client_dcb == NULL && list_session->refcount)
+            if (list_session->state != SESSION_STATE_LISTENER ||
+                list_session->state != SESSION_STATE_LISTENER_STOPPED)
             {
-                if (noclients == 0)
+                if (list_session->client_dcb == NULL && list_session->refcount)
                 {
-                    printf("Sessions without a client DCB.\n");
-                    printf("==============================\n");
+                    if (noclients == 0)
+                    {
+                        printf("Sessions without a client DCB.\n");
+                        printf("==============================\n");
+                    }
+                    printSession(list_session);
+                    noclients++;
                 }
-                printSession(list_session);
-                noclients++;
             }
+            list_session = list_session->next;
         }
-        list_session = list_session->next;
+        adaptive_lock_release(&session_shards[i].lock);
     }
-    spinlock_release(&session_spin);
     if (noclients)
     {
         printf("%d Sessions have no clients\n", noclients);
     }
-    spinlock_acquire(&session_spin);
-    list_session = allSessions;
-    while (list_session)
+    for (int i = 0; i < SESSION_SHARDS; i++)
     {
-        if (list_session->state != SESSION_STATE_LISTENER ||
-            list_session->state != SESSION_STATE_LISTENER_STOPPED)
+        adaptive_lock_acquire(&session_shards[i].lock);
+        list_session = session_shards[i].head;
+        while (list_session)
         {
-            if (list_session->router_session == NULL && list_session->refcount)
+            if (list_session->state != SESSION_STATE_LISTENER ||
+                list_session->state != SESSION_STATE_LISTENER_STOPPED)
             {
-                if (norouter == 0)
+                if (list_session->router_session == NULL && list_session->refcount)
                 {
-                    printf("Sessions without a router session.\n");
-                    printf("==================================\n");
+                    if (norouter == 0)
+                    {
+                        printf("Sessions without a router session.\n");
+                        printf("==================================\n");
+                    }
+                    printSession(list_session);
+                    norouter++;
                 }
-                printSession(list_session);
-                norouter++;
             }
+            list_session = list_session->next;
         }
-        list_session = list_session->next;
+        adaptive_lock_release(&session_shards[i].lock);
     }
-    spinlock_release(&session_spin);
     if (norouter)
     {
         printf("%d Sessions have no router session\n", norouter);
@@ -625,36 +671,41 @@ dprintAllSessions(DCB *dcb)
     char timebuf[40];
     SESSION *list_session;
 
-    spinlock_acquire(&session_spin);
-    list_session = allSessions;
-    while (list_session)
+    /** The shards are printed one at a time so that sessions can be created
+     * and freed in the other shards meanwhile */
+    for (int i = 0; i < SESSION_SHARDS; i++)
     {
-        dcb_printf(dcb, "Session %d (%p)\n",list_session->ses_id, list_session);
-        dcb_printf(dcb, "\tState:               %s\n", session_state(list_session->state));
-        dcb_printf(dcb, "\tService:             %s (%p)\n", list_session->service->name, list_session->service);
-        dcb_printf(dcb, "\tClient DCB:          %p\n", list_session->client_dcb);
-
-        if (list_session->client_dcb && list_session->client_dcb->remote)
+        adaptive_lock_acquire(&session_shards[i].lock);
+        list_session = session_shards[i].head;
+        while (list_session)
         {
-            dcb_printf(dcb, "\tClient Address:              %s%s%s\n",
-                       list_session->client_dcb->user?list_session->client_dcb->user:"",
-                       list_session->client_dcb->user?"@":"",
-                       list_session->client_dcb->remote);
-        }
+            dcb_printf(dcb, "Session %d (%p)\n",list_session->ses_id, list_session);
+            dcb_printf(dcb, "\tState:               %s\n", session_state(list_session->state));
+            dcb_printf(dcb, "\tService:             %s (%p)\n", list_session->service->name, list_session->service);
+            dcb_printf(dcb, "\tClient DCB:          %p\n", list_session->client_dcb);
 
-        dcb_printf(dcb, "\tConnected:           %s",
-                   asctime_r(localtime_r(&list_session->stats.connect, &result), timebuf));
+            if (list_session->client_dcb && list_session->client_dcb->remote)
+            {
+                dcb_printf(dcb, "\tClient Address:              %s%s%s\n",
+                           list_session->client_dcb->user?list_session->client_dcb->user:"",
+                           list_session->client_dcb->user?"@":"",
+                           list_session->client_dcb->remote);
+            }
 
-        if (list_session->client_dcb && list_session->client_dcb->state == DCB_STATE_POLLING)
-        {
-            double idle = (hkheartbeat - list_session->client_dcb->last_read);
-            idle = idle > 0 ? idle/10.0:0;
-            dcb_printf(dcb, "\tIdle:                            %.0f seconds\n",idle);
-        }
+            dcb_printf(dcb, "\tConnected:           %s",
+                       asctime_r(localtime_r(&list_session->stats.connect, &result), timebuf));
+
+            if (list_session->client_dcb && list_session->client_dcb->state == DCB_STATE_POLLING)
+            {
+                double idle = (hkheartbeat - list_session->client_dcb->last_read);
+                idle = idle > 0 ? idle/10.0:0;
+                dcb_printf(dcb, "\tIdle:                            %.0f seconds\n",idle);
+            }
 
-        list_session = list_session->next;
+            list_session = list_session->next;
+        }
+        adaptive_lock_release(&session_shards[i].lock);
     }
-    spinlock_release(&session_spin);
 }
 
 /**
@@ -718,32 +769,37 @@ void
 dListSessions(DCB *dcb)
 {
     SESSION *list_session;
+    bool header = false;
 
-    spinlock_acquire(&session_spin);
-    list_session = allSessions;
-    if (list_session)
-    {
-        dcb_printf(dcb, "Sessions.\n");
-        dcb_printf(dcb, "-----------------+-----------------+----------------+--------------------------\n");
-        dcb_printf(dcb, "Session          | Client          | Service        | State\n");
-        dcb_printf(dcb, "-----------------+-----------------+----------------+--------------------------\n");
-    }
-    while (list_session)
+    for (int i = 0; i < SESSION_SHARDS; i++)
     {
-        dcb_printf(dcb, "%-16p | %-15s | %-14s | %s\n", list_session,
-                   ((list_session->client_dcb && list_session->client_dcb->remote)
-                    ? list_session->client_dcb->remote : ""),
-                   (list_session->service && list_session->service->name ? list_session->service->name
-                    : ""),
-                   session_state(list_session->state));
-        list_session = list_session->next;
+        adaptive_lock_acquire(&session_shards[i].lock);
+        list_session = session_shards[i].head;
+        if (list_session && !header)
+        {
+            dcb_printf(dcb, "Sessions.\n");
+            dcb_printf(dcb, "-----------------+-----------------+----------------+--------------------------\n");
+            dcb_printf(dcb, "Session          | Client          | Service        | State\n");
+            dcb_printf(dcb, "-----------------+-----------------+----------------+--------------------------\n");
+            header = true;
+        }
+        while (list_session)
+        {
+            dcb_printf(dcb, "%-16p | %-15s | %-14s | %s\n", list_session,
+                       ((list_session->client_dcb && list_session->client_dcb->remote)
+                        ? list_session->client_dcb->remote : ""),
+                       (list_session->service && list_session->service->name ? list_session->service->name
+                        : ""),
+                       session_state(list_session->state));
+            list_session = list_session->next;
+        }
+        adaptive_lock_release(&session_shards[i].lock);
     }
-    if (allSessions)
+    if (header)
     {
         dcb_printf(dcb,
                    "-----------------+-----------------+----------------+--------------------------\n\n");
     }
-    spinlock_release(&session_spin);
 }
 
 /**
@@ -784,17 +840,19 @@ session_state(int state)
 
 SESSION* get_session_by_router_ses(void* rses)
 {
-    SESSION* ses = allSessions;
+    SESSION* ses = NULL;
 
-    while (ses->router_session != rses && ses->next != NULL)
+    for (int i = 0; i < SESSION_SHARDS && ses == NULL; i++)
     {
-        ses = ses->next;
+        adaptive_lock_acquire(&session_shards[i].lock);
+        ses = session_shards[i].head;
+        while (ses && ses->router_session != rses)
+        {
+            ses = ses->next;
+        }
+        adaptive_lock_release(&session_shards[i].lock);
     }
 
-    if (ses->router_session != rses)
-    {
-        ses = NULL;
-    }
     return ses;
 }
 
@@ -946,56 +1004,58 @@ session_getUser(SESSION *session)
     return (session && session->client_dcb) ? session->client_dcb->user : NULL;
 }
 /**
- * Return the pointer to the list of all sessions.
- * @return Pointer to the list of all sessions.
- */
-SESSION *get_all_sessions()
-{
-    return allSessions;
-}
-
-/**
- * Enable the timing out of idle connections.
+ * Call a function for every session. The registry shard that holds the
+ * session is locked while the function is called, so the function must not
+ * allocate or free sessions.
  *
- * This will prevent unnecessary acquisitions of the session spinlock if no
- * service is configured with a session idle timeout.
+ * @param func  Function to call, returning false stops the iteration
+ * @param data  User data passed to the function
+ * @return False if the function stopped the iteration
  */
-void enable_session_timeouts()
+bool session_foreach(bool (*func)(SESSION *, void *), void *data)
 {
-    check_timeouts = true;
+    bool rval = true;
+
+    for (int i = 0; i < SESSION_SHARDS && rval; i++)
+    {
+        adaptive_lock_acquire(&session_shards[i].lock);
+        for (SESSION *ses = session_shards[i].head; ses && rval; ses = ses->next)
+        {
+            rval = func(ses, data);
+        }
+        adaptive_lock_release(&session_shards[i].lock);
+    }
+
+    return rval;
 }
 
 /**
- * Close sessions that have been idle for too long.
+ * Timer function of a client DCB that closes the session once it has been
+ * idle for longer than the idle timeout of the service. Reading from the
+ * client does not touch the timer: it is armed again here for the time
+ * that is left since the last read.
  *
- * If the time since a session last sent data is greater than the set value in the
- * service, it is disconnected. The connection timeout is disabled by default.
+ * @param data  The client DCB
  */
-void process_idle_sessions()
+static void
+session_idle_timeout(void *data)
 {
-    if (spinlock_acquire_nowait(&timeout_lock))
-    {
-        if (hkheartbeat >= next_timeout_check)
-        {
-            /** Because the resolution of the timeout is one second, we only need to
-             * check for it once per second. One heartbeat is 100 milliseconds. */
-            next_timeout_check = hkheartbeat + 10;
-            spinlock_acquire(&session_spin);
-            SESSION *all_session = get_all_sessions();
+    DCB *dcb = (DCB *)data;
+    SESSION *session = dcb->session;
 
-            while (all_session)
-            {
-                if (all_session->service && all_session->client_dcb && all_session->client_dcb->state == DCB_STATE_POLLING &&
-                    hkheartbeat - all_session->client_dcb->last_read > all_session->service->conn_idle_timeout * 10)
-                {
-                    dcb_close(all_session->client_dcb);
-                }
+    if (dcb->state == DCB_STATE_POLLING && session && session->service &&
+        session->service->conn_idle_timeout)
+    {
+        long deadline = dcb->last_read + session->service->conn_idle_timeout * 10;
 
-                all_session = all_session->next;
-            }
-            spinlock_release(&session_spin);
+        if (hkheartbeat > deadline)
+        {
+            dcb_close(dcb);
+        }
+        else
+        {
+            timer_arm(&dcb->timer, deadline + 1);
         }
-        spinlock_release(&timeout_lock);
     }
 }
 
@@ -1021,53 +1081,43 @@ sessionRowCallback(RESULTSET *set, void *data)
     SESSIONFILTER *cbdata = (SESSIONFILTER *)data;
     int i = 0;
     char buf[20];
-    RESULT_ROW *row;
+    RESULT_ROW *row = NULL;
     SESSION *list_session;
 
-    spinlock_acquire(&session_spin);
-    list_session = allSessions;
-    /* Skip to the first non-listener if not showing listeners */
-    while (list_session && cbdata->filter == SESSION_LIST_CONNECTION &&
-           list_session->state == SESSION_STATE_LISTENER)
-    {
-        list_session = list_session->next;
-    }
-    while (i < cbdata->index && list_session)
+    for (int shard = 0; shard < SESSION_SHARDS && row == NULL; shard++)
     {
-        if (cbdata->filter == SESSION_LIST_CONNECTION &&
-            list_session->state !=  SESSION_STATE_LISTENER)
-        {
-            i++;
-        }
-        else if (cbdata->filter == SESSION_LIST_ALL)
+        adaptive_lock_acquire(&session_shards[shard].lock);
+        for (list_session = session_shards[shard].head; list_session; list_session = list_session->next)
         {
-            i++;
+            /* Skip the listeners if not showing them */
+            if (cbdata->filter == SESSION_LIST_CONNECTION &&
+                list_session->state == SESSION_STATE_LISTENER)
+            {
+                continue;
+            }
+            if (i++ == cbdata->index)
+            {
+                row = resultset_make_row(set);
+                snprintf(buf,19, "%p", list_session);
+                buf[19] = '\0';
+                resultset_row_set(row, 0, buf);
+                resultset_row_set(row, 1, ((list_session->client_dcb && list_session->client_dcb->remote)
+                                           ? list_session->client_dcb->remote : ""));
+                resultset_row_set(row, 2, (list_session->service && list_session->service->name
+                                           ? list_session->service->name : ""));
+                resultset_row_set(row, 3, session_state(list_session->state));
+                break;
+            }
         }
-        list_session = list_session->next;
+        adaptive_lock_release(&session_shards[shard].lock);
     }
-    /* Skip to the next non-listener if not showing listeners */
-    while (list_session && cbdata->filter == SESSION_LIST_CONNECTION &&
-           list_session->state == SESSION_STATE_LISTENER)
-    {
-        list_session = list_session->next;
-    }
-    if (list_session == NULL)
+
+    if (row == NULL)
     {
-        spinlock_release(&session_spin);
         free(data);
         return NULL;
     }
     cbdata->index++;
-    row = resultset_make_row(set);
-    snprintf(buf,19, "%p", list_session);
-    buf[19] = '\0';
-    resultset_row_set(row, 0, buf);
-    resultset_row_set(row, 1, ((list_session->client_dcb && list_session->client_dcb->remote)
-                               ? list_session->client_dcb->remote : ""));
-    resultset_row_set(row, 2, (list_session->service && list_session->service->name
-                               ? list_session->service->name : ""));
-    resultset_row_set(row, 3, session_state(list_session->state));
-    spinlock_release(&session_spin);
     return row;
 }
 
@@ -18,12 +18,45 @@
 
 #include <statistics.h>
 #include <maxconfig.h>
+#include <stdlib.h>
 #include <string.h>
 #include <platform.h>
+#include <log_manager.h>
+
+/** A per-thread counter, padded to a cache line to avoid false sharing */
+typedef struct
+{
+    int64_t value;
+    char pad[64 - sizeof(int64_t)];
+} TS_STATS_SLOT;
+
+/** The per-thread part of a histogram, aligned to a cache line */
+typedef struct
+{
+    int64_t count;
+    int64_t sum;
+    int64_t max;
+    int64_t buckets[TS_HIST_BUCKETS];
+} __attribute__((aligned(64))) TS_HIST_SLOT;
+
+/** Update a value that only the calling thread writes. The relaxed atomic
+ * accesses keep readers from seeing torn values without locking the bus. */
+#define TS_STATS_UPDATE(field, expr) \
+    __atomic_store_n(&(field), (expr), __ATOMIC_RELAXED)
+
+#define TS_STATS_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+/** Update a value that several threads may write */
+#define TS_STATS_SHARED_ADD(field, value) \
+    __atomic_add_fetch(&(field), (value), __ATOMIC_RELAXED)
 
 thread_local int current_thread_id = 0;
 
+/** The slot of the calling thread, non-worker threads share the last one */
+static thread_local int current_slot = -1;
+
 static int thread_count = 0;
+static int slot_count = 0;
 static bool initialized = false;
 
 /**
@@ -32,7 +65,9 @@ static bool initialized = false;
 void ts_stats_init()
 {
     ss_dassert(!initialized);
-    thread_count = config_threadcount();
+    thread_count = config_threadcount() > 0 ? config_threadcount() : 1;
+    /** The threads that are not worker threads share an extra slot */
+    slot_count = thread_count + 1;
     initialized = true;
 }
 
@@ -44,6 +79,25 @@ void ts_stats_end()
     ss_dassert(initialized);
 }
 
+/**
+ * Allocate zeroed memory aligned to a cache line
+ *
+ * @param size  Size of the memory
+ * @return The memory or NULL if allocation failed
+ */
+static void *ts_stats_alloc_aligned(size_t size)
+{
+    void *ptr;
+
+    if (posix_memalign(&ptr, 64, size) != 0)
+    {
+        return NULL;
+    }
+
+    memset(ptr, 0, size);
+    return ptr;
+}
+
 /**
  * Create a new statistics object
  *
@@ -52,7 +106,7 @@ void ts_stats_end()
 ts_stats_t ts_stats_alloc()
 {
     ss_dassert(initialized);
-    return calloc(thread_count, sizeof(int));
+    return ts_stats_alloc_aligned(slot_count * sizeof(TS_STATS_SLOT));
 }
 
 /**
@@ -76,6 +130,28 @@ void ts_stats_set_thread_id(int id)
 {
     ss_dassert(initialized);
     current_thread_id = id;
+    current_slot = id >= 0 && id < thread_count ? id : -1;
+}
+
+/**
+ * Return the slot of the calling thread
+ *
+ * @return The index of the slot and whether other threads share it
+ */
+static inline int ts_stats_slot(bool *shared)
+{
+    *shared = current_slot < 0;
+    return *shared ? thread_count : current_slot;
+}
+
+/**
+ * Get the current thread id
+ *
+ * @return The id of the calling thread or zero if it is not a worker thread
+ */
+int ts_stats_get_thread_id()
+{
+    return current_thread_id;
 }
 
 /**
@@ -84,23 +160,35 @@ void ts_stats_set_thread_id(int id)
  * @param stats Statistics to add to
  * @param value Value to add
  */
-void ts_stats_add(ts_stats_t stats, int value)
+void ts_stats_add(ts_stats_t stats, int64_t value)
 {
     ss_dassert(initialized);
-    ((int*)stats)[current_thread_id] += value;
+    bool shared;
+    TS_STATS_SLOT *slot = &((TS_STATS_SLOT*)stats)[ts_stats_slot(&shared)];
+
+    if (shared)
+    {
+        TS_STATS_SHARED_ADD(slot->value, value);
+    }
+    else
+    {
+        TS_STATS_UPDATE(slot->value, slot->value + value);
+    }
 }
 
 /**
  * Assign a value to the statistics
  *
- * This sets the value for the current thread only.
+ * This sets the value for the current thread only. The threads that are not
+ * worker threads share one value.
  * @param stats Statistics to set
  * @param value Value to set to
  */
-void ts_stats_set(ts_stats_t stats, int value)
+void ts_stats_set(ts_stats_t stats, int64_t value)
 {
     ss_dassert(initialized);
-    ((int*)stats)[current_thread_id] = value;
+    bool shared;
+    TS_STATS_UPDATE(((TS_STATS_SLOT*)stats)[ts_stats_slot(&shared)].value, value);
 }
 
 /**
@@ -109,13 +197,203 @@ void ts_stats_set(ts_stats_t stats, int value)
  * @param stats Statistics to read
  * @return Value of statistics
  */
-int ts_stats_sum(ts_stats_t stats)
+int64_t ts_stats_sum(ts_stats_t stats)
 {
     ss_dassert(initialized);
-    int sum = 0;
-    for (int i = 0; i < thread_count; i++)
+    int64_t sum = 0;
+    for (int i = 0; i < slot_count; i++)
     {
-        sum += ((int*)stats)[i];
+        sum += TS_STATS_READ(((TS_STATS_SLOT*)stats)[i].value);
     }
     return sum;
 }
+
+/**
+ * Create a new histogram
+ *
+ * @return New histogram or NULL if memory allocation failed
+ */
+ts_hist_t ts_hist_alloc()
+{
+    ss_dassert(initialized);
+    return ts_stats_alloc_aligned(slot_count * sizeof(TS_HIST_SLOT));
+}
+
+/**
+ * Free a histogram
+ *
+ * @param hist Histogram to free
+ */
+void ts_hist_free(ts_hist_t hist)
+{
+    ss_dassert(initialized);
+    free(hist);
+}
+
+/**
+ * Find the bucket of a value. The first buckets hold one value each, after
+ * which each power of two is divided into TS_HIST_SUBS equal buckets so that
+ * the relative error of a bucket is at most 1 / TS_HIST_SUBS.
+ *
+ * @param value The value
+ * @return The index of the bucket
+ */
+static inline int ts_hist_bucket(uint64_t value)
+{
+    if (value < TS_HIST_SUBS)
+    {
+        return value;
+    }
+
+    int exp = 63 - __builtin_clzll(value);
+    return (exp - TS_HIST_SUB_BITS + 1) * TS_HIST_SUBS +
+        ((value >> (exp - TS_HIST_SUB_BITS)) & (TS_HIST_SUBS - 1));
+}
+
+/**
+ * Return the smallest value that goes into a bucket
+ *
+ * @param bucket The index of the bucket
+ * @return The lower bound of the bucket
+ */
+static inline uint64_t ts_hist_bucket_low(int bucket)
+{
+    if (bucket < TS_HIST_SUBS)
+    {
+        return bucket;
+    }
+
+    int exp = bucket / TS_HIST_SUBS + TS_HIST_SUB_BITS - 1;
+    uint64_t sub = bucket % TS_HIST_SUBS;
+    return (1ULL << exp) + (sub << (exp - TS_HIST_SUB_BITS));
+}
+
+/**
+ * Add a value to the histogram of the current thread
+ *
+ * @param hist  Histogram to add to
+ * @param value Value to add
+ */
+void ts_hist_add(ts_hist_t hist, uint64_t value)
+{
+    ss_dassert(initialized);
+    bool shared;
+    TS_HIST_SLOT *slot = &((TS_HIST_SLOT*)hist)[ts_stats_slot(&shared)];
+    int bucket = ts_hist_bucket(value);
+
+    if (shared)
+    {
+        int64_t max = TS_STATS_READ(slot->max);
+
+        TS_STATS_SHARED_ADD(slot->buckets[bucket], 1);
+        TS_STATS_SHARED_ADD(slot->count, 1);
+        TS_STATS_SHARED_ADD(slot->sum, (int64_t)value);
+        while ((int64_t)value > max &&
+               !__atomic_compare_exchange_n(&slot->max, &max, (int64_t)value, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            ;
+        }
+        return;
+    }
+
+    TS_STATS_UPDATE(slot->buckets[bucket], slot->buckets[bucket] + 1);
+    TS_STATS_UPDATE(slot->count, slot->count + 1);
+    TS_STATS_UPDATE(slot->sum, slot->sum + (int64_t)value);
+    if ((int64_t)value > slot->max)
+    {
+        TS_STATS_UPDATE(slot->max, (int64_t)value);
+    }
+}
+
+/**
+ * Merge the per-thread parts of a histogram. The threads keep adding values
+ * meanwhile, so the snapshot is not an exact point in time view. The count
+ * is calculated from the buckets so that it matches them.
+ *
+ * @param hist      Histogram to read
+ * @param snapshot  Where the merged values are stored
+ */
+void ts_hist_merge(ts_hist_t hist, ts_hist_snapshot_t *snapshot)
+{
+    ss_dassert(initialized);
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    for (int i = 0; i < slot_count; i++)
+    {
+        TS_HIST_SLOT *slot = &((TS_HIST_SLOT*)hist)[i];
+        int64_t max = TS_STATS_READ(slot->max);
+
+        snapshot->sum += TS_STATS_READ(slot->sum);
+        if (max > snapshot->max)
+        {
+            snapshot->max = max;
+        }
+        for (int b = 0; b < TS_HIST_BUCKETS; b++)
+        {
+            int64_t n = TS_STATS_READ(slot->buckets[b]);
+            snapshot->buckets[b] += n;
+            snapshot->count += n;
+        }
+    }
+}
+
+/**
+ * Calculate a percentile of the values in a histogram. The result is the
+ * upper bound of the bucket the percentile falls into, but never more than
+ * the largest value.
+ *
+ * @param snapshot      The merged histogram
+ * @param percentile    The percentile, from 0 to 100
+ * @return The value below which the given percentage of values are
+ */
+int64_t ts_hist_percentile(const ts_hist_snapshot_t *snapshot, double percentile)
+{
+    int64_t target;
+    int64_t seen = 0;
+
+    if (snapshot->count == 0)
+    {
+        return 0;
+    }
+
+    target = (int64_t)(snapshot->count * percentile / 100.0 + 0.5);
+    if (target < 1)
+    {
+        target = 1;
+    }
+
+    for (int b = 0; b < TS_HIST_BUCKETS; b++)
+    {
+        seen += snapshot->buckets[b];
+        if (seen >= target)
+        {
+            int64_t upper = b + 1 < TS_HIST_BUCKETS ?
+                (int64_t)ts_hist_bucket_low(b + 1) - 1 : INT64_MAX;
+            return upper < snapshot->max ? upper : snapshot->max;
+        }
+    }
+
+    return snapshot->max;
+}
+
+/**
+ * Count the values in a histogram that are smaller than a given value. The
+ * result is exact when the value is a power of two or smaller than
+ * TS_HIST_SUBS and otherwise rounded to a bucket boundary.
+ *
+ * @param snapshot  The merged histogram
+ * @param value     The limit
+ * @return Number of values smaller than the limit
+ */
+int64_t ts_hist_count_below(const ts_hist_snapshot_t *snapshot, uint64_t value)
+{
+    int64_t count = 0;
+
+    for (int b = 0; b < TS_HIST_BUCKETS && ts_hist_bucket_low(b) < value; b++)
+    {
+        count += snapshot->buckets[b];
+    }
+
+    return count;
+}
@@ -0,0 +1,839 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file benchpoll.c  - Throughput and latency of the event loop
+ *
+ * Queries are sent through the whole path of a routed query: the polling
+ * threads, the MySQL client and backend protocols and a router. The backend
+ * is a stub server in the same process that answers every SELECT with a one
+ * row result set and every other query with an OK packet.
+ *
+ * The clients connect to a UNIX domain socket listener and each sends its
+ * next query as soon as it has read the reply to the previous one. After a
+ * warm-up second, the queries are counted and their latencies recorded for
+ * the given duration. The measurement is repeated with readconnroute and
+ * readwritesplit for each number of polling threads, each in a process of
+ * its own since the polling system is initialised only once per process.
+ *
+ * Usage: bench_poll [-t <thread counts>] [-c <clients>] [-d <seconds>]
+ *                   [-w <percentage of writes>]
+ *
+ * The modules are loaded from the build tree, so the benchmark is run in the
+ * directory it was built in. It exits with an error if a query fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <maxscale_test.h>
+#include <test_utils.h>
+#include <service.h>
+#include <server.h>
+#include <users.h>
+#include <dbusers.h>
+#include <modules.h>
+#include <gwdirs.h>
+#include <thread.h>
+#include <maxconfig.h>
+#include <query_classifier.h>
+
+#define BENCH_USER          "bench"
+#define BENCH_SOCKET        "/tmp/bench_poll_%d_%s.sock"
+#define BENCH_VERSION       "5.5.5-10.0.0-bench"
+#define BENCH_READ_QUERY    "SELECT 1"
+#define BENCH_WRITE_QUERY   "UPDATE bench SET a = 1"
+#define BENCH_BUFSIZE       16384
+#define BENCH_HIST_US       100000  /*< Latencies are recorded up to 100ms in 1us steps */
+#define BENCH_MAX_THREADS   64
+
+#define BENCH_COM_QUIT      0x01
+#define BENCH_COM_QUERY     0x03
+
+/** Server capabilities: protocol 4.1, secure connection and pluggable authentication */
+#define BENCH_SERVER_CAPABILITIES 0x000ba20f
+/** Client capabilities: protocol 4.1 and secure connection */
+#define BENCH_CLIENT_CAPABILITIES 0x0000a205
+
+/**
+ * The phases of a measurement
+ */
+typedef enum
+{
+    BENCH_WARMUP,
+    BENCH_MEASURE,
+    BENCH_STOP
+} bench_phase_t;
+
+/**
+ * A connection with a buffer for reading whole packets
+ */
+typedef struct
+{
+    int     fd;
+    size_t  start;              /*< Start of the unread data */
+    size_t  end;                /*< End of the unread data */
+    uint8_t buf[BENCH_BUFSIZE];
+} BENCH_CONN;
+
+/**
+ * A client sending queries
+ */
+typedef struct
+{
+    const char *socket;         /*< The listener to connect to */
+    THREAD     thread;
+    long       queries;         /*< Queries completed while measuring */
+    long       errors;          /*< Failed connections and queries */
+    uint32_t   *hist;           /*< Latencies in microseconds */
+    BENCH_CONN conn;
+} BENCH_CLIENT;
+
+static int n_clients = 16;
+static int duration = 5;
+static int write_pct = 25;
+static int phase = BENCH_WARMUP;
+
+/** The replies of the stub backend */
+static uint8_t greeting[128];
+static size_t greeting_len;
+static uint8_t resultset[128];
+static size_t resultset_len;
+
+static uint32_t
+bench_get3(const uint8_t *ptr)
+{
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16);
+}
+
+/**
+ * Add a packet header in front of a payload that has been written at
+ * buf + 4
+ *
+ * @param buf   The start of the packet
+ * @param len   Length of the payload
+ * @param seq   Sequence number of the packet
+ * @return      Length of the packet
+ */
+static size_t
+bench_header(uint8_t *buf, size_t len, uint8_t seq)
+{
+    buf[0] = len;
+    buf[1] = len >> 8;
+    buf[2] = len >> 16;
+    buf[3] = seq;
+    return len + 4;
+}
+
+/**
+ * Write a whole buffer to a socket
+ *
+ * @return True if all the data was written
+ */
+static bool
+bench_write(int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+
+        if (n <= 0)
+        {
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * Read the next packet from a connection
+ *
+ * @param conn      The connection
+ * @param payload   Set to the payload, valid until the next read
+ * @return          Length of the payload or -1 on error
+ */
+static int
+bench_read_packet(BENCH_CONN *conn, uint8_t **payload)
+{
+    while (true)
+    {
+        size_t avail = conn->end - conn->start;
+
+        if (avail >= 4)
+        {
+            size_t len = bench_get3(conn->buf + conn->start);
+
+            if (avail >= len + 4)
+            {
+                *payload = conn->buf + conn->start + 4;
+                conn->start += len + 4;
+                return len;
+            }
+        }
+
+        if (conn->start > 0)
+        {
+            memmove(conn->buf, conn->buf + conn->start, avail);
+            conn->start = 0;
+            conn->end = avail;
+        }
+        if (conn->end == sizeof(conn->buf))
+        {
+            return -1;
+        }
+
+        ssize_t n = read(conn->fd, conn->buf + conn->end, sizeof(conn->buf) - conn->end);
+
+        if (n <= 0)
+        {
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        conn->end += n;
+    }
+}
+
+/**
+ * Send an OK packet
+ */
+static bool
+bench_send_ok(int fd, uint8_t seq)
+{
+    uint8_t ok[] = { 7, 0, 0, seq, 0x00, 0, 0, 0x02, 0, 0, 0 };
+
+    return bench_write(fd, ok, sizeof(ok));
+}
+
+/**
+ * Build the handshake and the result set that the stub backend sends
+ */
+static void
+bench_build_replies()
+{
+    uint8_t *ptr = greeting + 4;
+    static const uint8_t column[] =
+    {
+        3, 'd', 'e', 'f', 0, 0, 0, 1, '1', 0,   /*< catalog, schema, tables and names */
+        0x0c, 0x21, 0, 1, 0, 0, 0,              /*< charset and length */
+        0x08, 0x81, 0, 0, 0, 0                  /*< type, flags, decimals and filler */
+    };
+    static const uint8_t eof[] = { 0xfe, 0, 0, 0x02, 0 };
+    static const uint8_t row[] = { 1, '1' };
+
+    *ptr++ = 10;
+    memcpy(ptr, BENCH_VERSION, sizeof(BENCH_VERSION));
+    ptr += sizeof(BENCH_VERSION);
+    memcpy(ptr, "\x01\x00\x00\x00", 4);                 /*< Thread ID */
+    ptr += 4;
+    memcpy(ptr, "abcdefgh", 9);                         /*< Scramble and filler */
+    ptr += 9;
+    *ptr++ = BENCH_SERVER_CAPABILITIES & 0xff;
+    *ptr++ = (BENCH_SERVER_CAPABILITIES >> 8) & 0xff;
+    *ptr++ = 0x21;                                      /*< Character set */
+    *ptr++ = 0x02;                                      /*< Status, autocommit */
+    *ptr++ = 0;
+    *ptr++ = (BENCH_SERVER_CAPABILITIES >> 16) & 0xff;
+    *ptr++ = (BENCH_SERVER_CAPABILITIES >> 24) & 0xff;
+    *ptr++ = 21;                                        /*< Scramble length */
+    memset(ptr, 0, 10);
+    ptr += 10;
+    memcpy(ptr, "ijklmnopqrst", 13);                    /*< Rest of the scramble */
+    ptr += 13;
+    memcpy(ptr, "mysql_native_password", 22);
+    ptr += 22;
+    greeting_len = bench_header(greeting, ptr - greeting - 4, 0);
+
+    ptr = resultset;
+    ptr[4] = 1;                                         /*< Column count */
+    ptr += bench_header(ptr, 1, 1);
+    memcpy(ptr + 4, column, sizeof(column));
+    ptr += bench_header(ptr, sizeof(column), 2);
+    memcpy(ptr + 4, eof, sizeof(eof));
+    ptr += bench_header(ptr, sizeof(eof), 3);
+    memcpy(ptr + 4, row, sizeof(row));
+    ptr += bench_header(ptr, sizeof(row), 4);
+    memcpy(ptr + 4, eof, sizeof(eof));
+    ptr += bench_header(ptr, sizeof(eof), 5);
+    resultset_len = ptr - resultset;
+}
+
+/**
+ * Serve one connection of the stub backend
+ *
+ * @param arg   The connection
+ */
+static void
+backend_session(void *arg)
+{
+    BENCH_CONN *conn = arg;
+    uint8_t *payload;
+    int len;
+
+    if (bench_write(conn->fd, greeting, greeting_len) &&
+        bench_read_packet(conn, &payload) >= 0 &&
+        bench_send_ok(conn->fd, 2))
+    {
+        while ((len = bench_read_packet(conn, &payload)) > 0 && payload[0] != BENCH_COM_QUIT)
+        {
+            bool ok;
+
+            if (payload[0] == BENCH_COM_QUERY && len > 6 &&
+                strncasecmp((char *)payload + 1, "SELECT", 6) == 0)
+            {
+                ok = bench_write(conn->fd, resultset, resultset_len);
+            }
+            else
+            {
+                ok = bench_send_ok(conn->fd, 1);
+            }
+
+            if (!ok)
+            {
+                break;
+            }
+        }
+    }
+
+    close(conn->fd);
+    free(conn);
+}
+
+/**
+ * Accept the connections of the stub backend
+ *
+ * @param arg   The listening socket
+ */
+static void
+backend_listener(void *arg)
+{
+    int listener = (intptr_t)arg;
+    int fd;
+
+    while ((fd = accept(listener, NULL, NULL)) != -1)
+    {
+        BENCH_CONN *conn = calloc(1, sizeof(BENCH_CONN));
+        THREAD thread;
+
+        conn->fd = fd;
+        if (thread_start(&thread, backend_session, conn) != NULL)
+        {
+            pthread_detach(thread);
+        }
+        else
+        {
+            close(fd);
+            free(conn);
+        }
+    }
+}
+
+/**
+ * Start the stub backend on a free port of the loopback interface
+ *
+ * @return The port or 0 on error
+ */
+static unsigned short
+backend_start()
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    THREAD thread;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 1024) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addrlen) != 0 ||
+        thread_start(&thread, backend_listener, (void *)(intptr_t)fd) == NULL)
+    {
+        perror("Failed to start the stub backend");
+        return 0;
+    }
+
+    return ntohs(addr.sin_port);
+}
+
+/**
+ * Connect a client to a listener and log in
+ *
+ * @param client    The client
+ * @return          True if the client is logged in
+ */
+static bool
+client_connect(BENCH_CLIENT *client)
+{
+    struct sockaddr_un addr;
+    uint8_t auth[128];
+    uint8_t *ptr = auth + 4;
+    uint8_t *payload;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, client->socket, sizeof(addr.sun_path) - 1);
+
+    if ((client->conn.fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+        connect(client->conn.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        bench_read_packet(&client->conn, &payload) <= 0)
+    {
+        return false;
+    }
+
+    memset(ptr, 0, 32);
+    ptr[0] = BENCH_CLIENT_CAPABILITIES & 0xff;
+    ptr[1] = (BENCH_CLIENT_CAPABILITIES >> 8) & 0xff;
+    ptr[6] = 0x01;                                      /*< Max packet size 16MB */
+    ptr[8] = 0x21;                                      /*< Character set */
+    ptr += 32;
+    memcpy(ptr, BENCH_USER, sizeof(BENCH_USER));
+    ptr += sizeof(BENCH_USER);
+    *ptr++ = 0;                                         /*< No password */
+
+    return bench_write(client->conn.fd, auth, bench_header(auth, ptr - auth - 4, 1)) &&
+           bench_read_packet(&client->conn, &payload) > 0 && payload[0] == 0x00;
+}
+
+/**
+ * Read the reply to a query
+ *
+ * @param conn  The connection
+ * @return      True if the reply was an OK packet or a result set
+ */
+static bool
+client_read_reply(BENCH_CONN *conn)
+{
+    uint8_t *payload;
+    int len = bench_read_packet(conn, &payload);
+    int eofs = 0;
+
+    if (len <= 0 || payload[0] == 0xff)
+    {
+        return false;
+    }
+    if (payload[0] == 0x00)
+    {
+        return true;
+    }
+
+    /** A result set ends with the EOF packet after the rows */
+    while (eofs < 2)
+    {
+        if ((len = bench_read_packet(conn, &payload)) <= 0 || payload[0] == 0xff)
+        {
+            return false;
+        }
+        if (payload[0] == 0xfe && len < 9)
+        {
+            eofs++;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Send queries until the measurement ends
+ *
+ * @param arg   The client
+ */
+static void
+client_run(void *arg)
+{
+    BENCH_CLIENT *client = arg;
+    uint8_t read_query[64];
+    uint8_t write_query[64];
+    size_t read_len, write_len;
+    uint8_t quit[] = { 1, 0, 0, 0, BENCH_COM_QUIT };
+
+    read_query[4] = BENCH_COM_QUERY;
+    memcpy(read_query + 5, BENCH_READ_QUERY, strlen(BENCH_READ_QUERY));
+    read_len = bench_header(read_query, strlen(BENCH_READ_QUERY) + 1, 0);
+    write_query[4] = BENCH_COM_QUERY;
+    memcpy(write_query + 5, BENCH_WRITE_QUERY, strlen(BENCH_WRITE_QUERY));
+    write_len = bench_header(write_query, strlen(BENCH_WRITE_QUERY) + 1, 0);
+
+    if (!client_connect(client))
+    {
+        client->errors++;
+        close(client->conn.fd);
+        return;
+    }
+
+    for (long i = 0; __atomic_load_n(&phase, __ATOMIC_RELAXED) != BENCH_STOP; i++)
+    {
+        /** Spread the writes evenly over the queries */
+        bool write = (i + 1) * write_pct / 100 != i * write_pct / 100;
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (!bench_write(client->conn.fd, write ? write_query : read_query,
+                         write ? write_len : read_len) ||
+            !client_read_reply(&client->conn))
+        {
+            client->errors++;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (__atomic_load_n(&phase, __ATOMIC_RELAXED) == BENCH_MEASURE)
+        {
+            long us = (end.tv_sec - start.tv_sec) * 1000000 +
+                (end.tv_nsec - start.tv_nsec) / 1000;
+
+            client->hist[us < BENCH_HIST_US ? us : BENCH_HIST_US]++;
+            client->queries++;
+        }
+    }
+
+    bench_write(client->conn.fd, quit, sizeof(quit));
+    close(client->conn.fd);
+}
+
+/**
+ * Find a percentile of the recorded latencies
+ *
+ * @param hist  The merged histogram
+ * @param total Number of recorded latencies
+ * @param pct   The percentile
+ * @param buf   Buffer where the latency is formatted
+ * @return      The buffer
+ */
+static char *
+bench_percentile(uint64_t *hist, uint64_t total, double pct, char *buf)
+{
+    uint64_t target = total * pct / 100.0;
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < BENCH_HIST_US && (sum += hist[i]) <= target; i++)
+    {
+        ;
+    }
+
+    if (i < BENCH_HIST_US)
+    {
+        sprintf(buf, "%d", i);
+    }
+    else
+    {
+        sprintf(buf, ">%d", BENCH_HIST_US);
+    }
+
+    return buf;
+}
+
+/**
+ * Measure the throughput and latency of one service
+ *
+ * @param service   The service
+ * @param socket    The listener of the service
+ * @param n_threads Number of polling threads
+ * @return          Number of errors
+ */
+static int
+bench_service(SERVICE *service, const char *socket, int n_threads)
+{
+    BENCH_CLIENT *clients = calloc(n_clients, sizeof(BENCH_CLIENT));
+    uint64_t *hist = calloc(BENCH_HIST_US + 1, sizeof(uint64_t));
+    struct timespec start, end;
+    uint64_t total = 0;
+    long errors = 0;
+    int n_started;
+    char p50[16], p90[16], p99[16], p999[16];
+    double elapsed;
+
+    __atomic_store_n(&phase, BENCH_WARMUP, __ATOMIC_RELAXED);
+
+    for (n_started = 0; n_started < n_clients; n_started++)
+    {
+        BENCH_CLIENT *client = &clients[n_started];
+
+        client->socket = socket;
+        if ((client->hist = calloc(BENCH_HIST_US + 1, sizeof(uint32_t))) == NULL ||
+            thread_start(&client->thread, client_run, client) == NULL)
+        {
+            fprintf(stderr, "Failed to start client %d.\n", n_started);
+            free(client->hist);
+            errors++;
+            break;
+        }
+    }
+
+    sleep(1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    __atomic_store_n(&phase, BENCH_MEASURE, __ATOMIC_RELAXED);
+    sleep(duration);
+    __atomic_store_n(&phase, BENCH_STOP, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (int i = 0; i < n_started; i++)
+    {
+        thread_wait(clients[i].thread);
+
+        for (int j = 0; j <= BENCH_HIST_US; j++)
+        {
+            hist[j] += clients[i].hist[j];
+        }
+        total += clients[i].queries;
+        errors += clients[i].errors;
+        free(clients[i].hist);
+    }
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+    printf("%-16s %7d %7d %10.0f %9s %9s %9s %9s %6ld\n",
+           service->routerModule, n_threads, n_clients, total / elapsed,
+           bench_percentile(hist, total, 50, p50),
+           bench_percentile(hist, total, 90, p90),
+           bench_percentile(hist, total, 99, p99),
+           bench_percentile(hist, total, 99.9, p999),
+           errors);
+    fflush(stdout);
+
+    free(hist);
+    free(clients);
+
+    return errors > 0 || total == 0;
+}
+
+/**
+ * Create a service with a UNIX domain socket listener
+ *
+ * @param name      Name of the service
+ * @param router    The router module
+ * @param libdir    Directory of the router module
+ * @param socket    Path of the listener
+ * @param servers   The backend servers
+ * @return          The service or NULL on error
+ */
+static SERVICE *
+bench_create_service(char *name, char *router, char *libdir, char *socket, SERVER **servers)
+{
+    SERVICE *service;
+
+    set_libdir(strdup(libdir));
+
+    if ((service = service_alloc(name, router)) == NULL)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; servers[i]; i++)
+    {
+        serviceAddBackend(service, servers[i]);
+    }
+    serviceSetUser(service, BENCH_USER, "");
+    serviceAddProtocol(service, "MySQLClient", socket, 0, NULL, NULL);
+
+    /** The users are added here instead of being loaded from the stub
+     * backend, which only answers the permission checks */
+    service->users = mysql_users_alloc();
+    add_mysql_users_with_host_ipv4(service->users, BENCH_USER, "127.0.0.1", "", "Y", NULL);
+
+    return service;
+}
+
+/**
+ * A polling thread
+ *
+ * @param arg   The thread ID
+ */
+static void
+bench_poll_thread(void *arg)
+{
+    if (qc_thread_init())
+    {
+        poll_waitevents(arg);
+        qc_thread_end();
+    }
+}
+
+/**
+ * Run the benchmark with a number of polling threads
+ *
+ * @param n_threads Number of polling threads
+ * @return          Number of failed measurements
+ */
+static int
+bench_run(int n_threads)
+{
+    THREAD threads[BENCH_MAX_THREADS];
+    SERVER *servers[3];
+    SERVICE *readconn, *rwsplit;
+    char readconn_socket[PATH_MAX];
+    char rwsplit_socket[PATH_MAX];
+    unsigned short port;
+    int n_started;
+    int result = 0;
+
+    config_get_global_options()->n_threads = n_threads;
+    init_test_env(NULL);
+
+    set_libdir(strdup("../../../query_classifier/qc_sqlite/"));
+    if (!qc_init("qc_sqlite") || (port = backend_start()) == 0)
+    {
+        return 1;
+    }
+
+    servers[0] = server_alloc("127.0.0.1", "MySQLBackend", port);
+    servers[1] = server_alloc("127.0.0.1", "MySQLBackend", port);
+    servers[2] = NULL;
+    server_set_unique_name(servers[0], "bench-master");
+    server_set_unique_name(servers[1], "bench-slave");
+    server_set_status(servers[0], SERVER_RUNNING | SERVER_MASTER);
+    server_set_status(servers[1], SERVER_RUNNING | SERVER_SLAVE);
+
+    snprintf(readconn_socket, sizeof(readconn_socket), BENCH_SOCKET, getpid(), "readconn");
+    snprintf(rwsplit_socket, sizeof(rwsplit_socket), BENCH_SOCKET, getpid(), "rwsplit");
+
+    readconn = bench_create_service("Read Connection Router", "readconnroute",
+                                    "../../modules/routing/", readconn_socket, servers);
+    rwsplit = bench_create_service("Read-Write Split Router", "readwritesplit",
+                                   "../../modules/routing/readwritesplit/", rwsplit_socket, servers);
+
+    set_libdir(strdup("../../modules/protocol/"));
+    if (readconn == NULL || rwsplit == NULL ||
+        load_module("MySQLBackend", MODULE_PROTOCOL) == NULL ||
+        serviceStart(readconn) == 0 || serviceStart(rwsplit) == 0)
+    {
+        fprintf(stderr, "Failed to start the services, see the log in %s.\n", TEST_LOG_DIR);
+        return 1;
+    }
+
+    for (n_started = 0; n_started < n_threads; n_started++)
+    {
+        if (thread_start(&threads[n_started], bench_poll_thread,
+                         (void *)(intptr_t)n_started) == NULL)
+        {
+            fprintf(stderr, "Failed to start polling thread %d.\n", n_started);
+            result++;
+            break;
+        }
+    }
+
+    if (result == 0)
+    {
+        result += bench_service(readconn, readconn_socket, n_threads);
+        result += bench_service(rwsplit, rwsplit_socket, n_threads);
+    }
+
+    poll_shutdown();
+    for (int i = 0; i < n_started; i++)
+    {
+        thread_wait(threads[i]);
+    }
+
+    unlink(readconn_socket);
+    unlink(rwsplit_socket);
+
+    return result;
+}
+
+int
+main(int argc, char **argv)
+{
+    char default_thread_counts[] = "1,2,4,8";
+    char *thread_counts = default_thread_counts;
+    int result = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:c:d:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            thread_counts = optarg;
+            break;
+        case 'c':
+            n_clients = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'w':
+            write_pct = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t <thread counts>] [-c <clients>] [-d <seconds>] "
+                    "[-w <percentage of writes>]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (n_clients <= 0 || duration <= 0 || write_pct < 0 || write_pct > 100)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        exit(1);
+    }
+
+    bench_build_replies();
+
+    printf("%-16s %7s %7s %10s %9s %9s %9s %9s %6s\n", "Router", "Threads", "Clients",
+           "Queries/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "Errors");
+    fflush(stdout);
+
+    for (char *tok = strtok(thread_counts, ","); tok; tok = strtok(NULL, ","))
+    {
+        int n_threads = atoi(tok);
+        pid_t pid;
+        int status;
+
+        if (n_threads <= 0 || n_threads > BENCH_MAX_THREADS)
+        {
+            fprintf(stderr, "Invalid number of threads: %s\n", tok);
+            exit(1);
+        }
+
+        if ((pid = fork()) == 0)
+        {
+            exit(bench_run(n_threads));
+        }
+        else if (pid == -1 || waitpid(pid, &status, 0) != pid ||
+                 !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "The benchmark with %d threads failed.\n", n_threads);
+            result = 1;
+        }
+    }
+
+    exit(result);
+}
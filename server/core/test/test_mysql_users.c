@@ -41,8 +41,10 @@
 #include <secrets.h>
 #include <dbusers.h>
 #include <mysql_client_server_protocol.h>
+#include <mysql_auth.h>
 
 #include <arpa/inet.h>
+#include <time.h>
 
 extern int setipaddress();
 
@@ -269,6 +271,189 @@ int set_and_get_mysql_users_wildcards(char *username, char *hostname, char *pass
 	return ret;
 }
 
+/**
+ * Look up a user with the masked address probes that were used before the
+ * host match index existed.
+ */
+static char *probe_mysql_users(USERS *mysql_users, MYSQL_USER_HOST *key) {
+	MYSQL_USER_HOST probe = *key;
+	char *fetch_data;
+
+	if ((fetch_data = mysql_users_fetch(mysql_users, &probe)))
+		return fetch_data;
+	probe.ipv4.sin_addr.s_addr &= 0x00FFFFFF;
+	probe.netmask = 24;
+	if ((fetch_data = mysql_users_fetch(mysql_users, &probe)))
+		return fetch_data;
+	probe.ipv4.sin_addr.s_addr &= 0x0000FFFF;
+	probe.netmask = 16;
+	if ((fetch_data = mysql_users_fetch(mysql_users, &probe)))
+		return fetch_data;
+	probe.ipv4.sin_addr.s_addr &= 0x000000FF;
+	probe.netmask = 8;
+	if ((fetch_data = mysql_users_fetch(mysql_users, &probe)))
+		return fetch_data;
+	memset(&probe.ipv4, 0, sizeof(probe.ipv4));
+	probe.netmask = 0;
+	return mysql_users_fetch(mysql_users, &probe);
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/**
+ * Load n_users users with hosts_per_user grants each, a mix of exact
+ * addresses and class C/B networks, and compare the cost of a login lookup
+ * through the host match index with the masked address probes.
+ *
+ * @return 0 if every lookup found the expected grant
+ */
+int benchmark_mysql_users_find(int n_users, int hosts_per_user, int n_lookups) {
+	USERS *mysql_users;
+	MYSQL_USER_HOST key;
+	struct timespec start, end;
+	char user[32];
+	char host[32];
+	char remote[INET_ADDRSTRLEN];
+	int i, j, found = 0, probed = 0;
+	double find_ns, probe_ns;
+
+	mysql_users = mysql_users_alloc();
+	assert(mysql_users != NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_users; i++) {
+		snprintf(user, sizeof(user), "bench_%d", i);
+
+		for (j = 0; j < hosts_per_user; j++) {
+			if (j % 10 == 9)
+				snprintf(host, sizeof(host), "10.%d.%%", i % 256);
+			else if (j % 10 == 8)
+				snprintf(host, sizeof(host), "10.%d.%d.%%", i % 256, j);
+			else
+				snprintf(host, sizeof(host), "10.%d.%d.%d", i % 256, j, (i / 256) % 256);
+			add_mysql_users_with_host_ipv4(mysql_users, user, host, "pwd", "Y", "");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(stderr, "Loaded %d grants in %.1f ms\n", mysql_users->stats.n_entries,
+		elapsed_ns(&start, &end) / 1e6);
+
+	memset(&key, 0, sizeof(key));
+	key.user = user;
+	key.resource = "";
+	key.netmask = 32;
+	key.ipv4.sin_family = AF_INET;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_lookups; i++) {
+		int u = (i * 7919) % n_users;
+		snprintf(user, sizeof(user), "bench_%d", u);
+		key.ipv4.sin_addr.s_addr = htonl(0x0A000000 | (u % 256) << 16 | ((i % hosts_per_user) << 8) | ((u / 256) % 256));
+		inet_ntop(AF_INET, &key.ipv4.sin_addr, remote, sizeof(remote));
+		strcpy(key.hostname, remote);
+		if (mysql_users_find(mysql_users, &key, true))
+			found++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	find_ns = elapsed_ns(&start, &end) / n_lookups;
+
+	key.hostname[0] = '\0';
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_lookups; i++) {
+		int u = (i * 7919) % n_users;
+		snprintf(user, sizeof(user), "bench_%d", u);
+		key.ipv4.sin_addr.s_addr = htonl(0x0A000000 | (u % 256) << 16 | ((i % hosts_per_user) << 8) | ((u / 256) % 256));
+		if (probe_mysql_users(mysql_users, &key))
+			probed++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	probe_ns = elapsed_ns(&start, &end) / n_lookups;
+
+	fprintf(stderr, "%d lookups: index %.0f ns/lookup, masked probes %.0f ns/lookup\n",
+		n_lookups, find_ns, probe_ns);
+
+	users_free(mysql_users);
+
+	return found == n_lookups && probed == n_lookups ? 0 : 1;
+}
+
+/**
+ * Verify n_handshakes client tokens against a user with a password and
+ * report the number of handshakes one core can check per second. The
+ * tokens are computed beforehand for a set of scrambles so that only the
+ * server side of the authentication is measured.
+ *
+ * @return 0 if every token was accepted and a wrong one was rejected
+ */
+int benchmark_scramble_check(int n_handshakes) {
+	const char *secret = "benchmark-secret";
+	uint8_t scramble[64][GW_MYSQL_SCRAMBLE_SIZE];
+	uint8_t token[64][SHA_DIGEST_LENGTH];
+	uint8_t hash1[SHA_DIGEST_LENGTH], hash2[SHA_DIGEST_LENGTH], step1[SHA_DIGEST_LENGTH];
+	uint8_t stage1[SHA_DIGEST_LENGTH];
+	char hex[2 * SHA_DIGEST_LENGTH + 1];
+	struct timespec start, end;
+	MYSQL_session *data;
+	SERVICE *service;
+	DCB *dcb;
+	int i, j, accepted = 0;
+	double ns;
+
+	dcb = dcb_alloc(DCB_ROLE_INTERNAL);
+	service = calloc(1, sizeof(SERVICE));
+	data = calloc(1, sizeof(MYSQL_session));
+	assert(dcb && service && data);
+
+	/* SHA1(SHA1(password)) in hex, as in the mysql.user table */
+	gw_sha1_str((uint8_t *)secret, strlen(secret), hash1);
+	gw_sha1_str(hash1, SHA_DIGEST_LENGTH, hash2);
+	gw_bin2hex(hex, hash2, SHA_DIGEST_LENGTH);
+
+	service->users = mysql_users_alloc();
+	add_mysql_users_with_host_ipv4(service->users, "bench", "%", hex, "Y", "");
+
+	setipaddress(&dcb->ipv4.sin_addr, "192.168.10.10");
+	dcb->ipv4.sin_family = AF_INET;
+	dcb->remote = strdup("192.168.10.10");
+	dcb->service = service;
+	dcb->data = data;
+
+	for (i = 0; i < 64; i++) {
+		for (j = 0; j < GW_MYSQL_SCRAMBLE_SIZE; j++)
+			scramble[i][j] = (uint8_t)(33 + (i * 31 + j * 7) % 90);
+		gw_sha1_2_str(scramble[i], GW_MYSQL_SCRAMBLE_SIZE, hash2, SHA_DIGEST_LENGTH, step1);
+		gw_str_xor(token[i], step1, hash1, SHA_DIGEST_LENGTH);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n_handshakes; i++) {
+		if (gw_check_mysql_scramble_data(dcb, token[i % 64], SHA_DIGEST_LENGTH,
+						 scramble[i % 64], GW_MYSQL_SCRAMBLE_SIZE,
+						 "bench", stage1) == MYSQL_AUTH_SUCCEEDED &&
+		    memcmp(stage1, hash1, SHA_DIGEST_LENGTH) == 0)
+			accepted++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = elapsed_ns(&start, &end) / n_handshakes;
+
+	fprintf(stderr, "%d handshakes: %.0f ns/handshake, %.0f handshakes/s per core\n",
+		n_handshakes, ns, 1e9 / ns);
+
+	/* A token computed for another scramble must not be accepted */
+	if (gw_check_mysql_scramble_data(dcb, token[1], SHA_DIGEST_LENGTH,
+					 scramble[0], GW_MYSQL_SCRAMBLE_SIZE,
+					 "bench", stage1) == MYSQL_AUTH_SUCCEEDED)
+		accepted = -1;
+
+	users_free(service->users);
+	free(service);
+	dcb_close(dcb);
+
+	return accepted == n_handshakes ? 0 : 1;
+}
+
 int main() {
 	int ret;
 	int i = 0;
@@ -416,6 +601,12 @@ int main() {
 	if (!ret) fprintf(stderr, "\t-- Expecting ok\n");
 	assert(ret == 0);
 
+	ret = benchmark_mysql_users_find(1000, 50, 100000);
+	assert(ret == 0);
+
+	ret = benchmark_scramble_check(100000);
+	assert(ret == 0);
+
 	fprintf(stderr, "----------------\n");
 	fprintf(stderr, "<<< Test completed\n");
 
@@ -0,0 +1,118 @@
+/*
+ * This file is distributed as part of MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <adaptive_lock.h>
+#include <thread.h>
+#include <skygw_debug.h>
+
+#define THREADS 8
+#define ITERATIONS 200000
+
+static ADAPTIVE_LOCK lock = ADAPTIVE_LOCK_INIT;
+static long counter = 0;
+static int acquired = 0;
+
+static void
+increment(void *data)
+{
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        adaptive_lock_acquire(&lock);
+        counter++;
+        adaptive_lock_release(&lock);
+    }
+}
+
+static void
+acquire_once(void *data)
+{
+    adaptive_lock_acquire(&lock);
+    __atomic_store_n(&acquired, 1, __ATOMIC_SEQ_CST);
+    adaptive_lock_release(&lock);
+}
+
+/**
+ * test1    The lock is only held by one thread at a time when more threads
+ *          than processors contend for it
+ */
+static int
+test1()
+{
+    THREAD threads[THREADS];
+
+    for (int i = 0; i < THREADS; i++)
+    {
+        thread_start(&threads[i], increment, NULL);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        thread_wait(threads[i]);
+    }
+
+    ss_info_dassert(counter == (long)THREADS * ITERATIONS, "Increments should not be lost");
+    ss_info_dassert(!ADAPTIVE_LOCK_IS_LOCKED(&lock), "Lock should be free");
+
+    return 0;
+}
+
+/**
+ * test2    A thread that waits longer than it spins sleeps until the lock is
+ *          released and acquire_nowait fails on a held lock
+ */
+static int
+test2()
+{
+    THREAD thread;
+
+    adaptive_lock_acquire(&lock);
+    ss_info_dassert(!adaptive_lock_acquire_nowait(&lock), "Held lock should not be acquired");
+
+    thread_start(&thread, acquire_once, NULL);
+    thread_millisleep(200);
+    ss_info_dassert(__atomic_load_n(&acquired, __ATOMIC_SEQ_CST) == 0,
+                    "Lock should not be acquired while it is held");
+    ss_info_dassert(lock.lock == 2, "Waiting thread should be sleeping");
+
+    adaptive_lock_release(&lock);
+    thread_wait(thread);
+    ss_info_dassert(acquired == 1, "Sleeping thread should acquire the released lock");
+    ss_info_dassert(adaptive_lock_acquire_nowait(&lock), "Free lock should be acquired");
+    adaptive_lock_release(&lock);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <affinity.h>
+#include <maxconfig.h>
+#include <thread.h>
+#include <skygw_debug.h>
+
+static cpu_set_t process_cpus;
+static int child_cpus = 0;
+
+static void
+get_cpus(void *data)
+{
+    cpu_set_t cpus;
+
+    pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    child_cpus = CPU_COUNT(&cpus);
+}
+
+/**
+ * test1    CPU lists in the format of the kernel are parsed
+ */
+static int
+test1()
+{
+    cpu_set_t set;
+
+    ss_info_dassert(affinity_parse_cpulist("0-3,8", &set) == 5, "List should have five CPUs");
+    ss_info_dassert(CPU_ISSET(3, &set) && CPU_ISSET(8, &set) && !CPU_ISSET(4, &set),
+                    "List should have CPUs 0 to 3 and 8");
+    ss_info_dassert(affinity_parse_cpulist("2\n", &set) == 1, "Trailing newline should be ignored");
+    ss_info_dassert(affinity_parse_cpulist("3-1", &set) == -1, "Reversed range should be rejected");
+    ss_info_dassert(affinity_parse_cpulist("1,a", &set) == -1, "Letters should be rejected");
+    ss_info_dassert(affinity_parse_cpulist("1-", &set) == -1, "Open range should be rejected");
+
+    return 0;
+}
+
+/**
+ * test2    A polling thread is bound to its CPU and the threads it starts
+ *          may run on all the CPUs of the process
+ */
+static int
+test2()
+{
+    GATEWAY_CONF *conf = config_get_global_options();
+    THREAD thread;
+    cpu_set_t cpus;
+    int cpu = 0;
+
+    while (!CPU_ISSET(cpu, &process_cpus))
+    {
+        cpu++;
+    }
+    snprintf(conf->thread_affinity, sizeof(conf->thread_affinity), "%d", cpu);
+
+    ss_info_dassert(affinity_init(2), "Placement should be initialised");
+    affinity_thread_start(0);
+
+    pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    ss_info_dassert(CPU_COUNT(&cpus) == 1 && CPU_ISSET(cpu, &cpus),
+                    "Thread should be bound to the CPU");
+    ss_info_dassert(sched_getcpu() == cpu, "Thread should run on the CPU");
+    ss_info_dassert(affinity_node() >= 0 && affinity_node() < affinity_nodes(),
+                    "Node of the thread should be known");
+
+    thread_start(&thread, get_cpus, NULL);
+    thread_wait(thread);
+    ss_info_dassert(child_cpus == CPU_COUNT(&process_cpus),
+                    "Started thread should not inherit the CPU of the polling thread");
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    sched_getaffinity(0, sizeof(process_cpus), &process_cpus);
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -72,11 +72,9 @@ int     buflen;
         ss_dfprintf(stderr, "\t..done\nMake clone DCB a zombie");
         clone->state = DCB_STATE_NOPOLLING;
         dcb_close(clone);
-        ss_info_dassert(dcb_get_zombies() == clone, "Clone DCB must be start of zombie list now");
-        ss_dfprintf(stderr, "\t..done\nProcess the zombies list");
-        dcb_process_zombies(0);
         ss_dfprintf(stderr, "\t..done\nCheck clone no longer valid");
-        ss_info_dassert(!dcb_isvalid(clone), "After zombie processing, clone DCB must not be valid");
+        /** Without polling threads a closed DCB has no grace period */
+        ss_info_dassert(!dcb_isvalid(clone), "After closing, clone DCB must not be valid");
         ss_dfprintf(stderr, "\t..done\n");
 		
 	return 0;
@@ -0,0 +1,152 @@
+/*
+ * This file is distributed as part of MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <housekeeper.h>
+#include <thread.h>
+#include <skygw_debug.h>
+
+static int n_fast = 0;
+static int n_slow = 0;
+static int n_oneshot = 0;
+static int n_self = 0;
+
+static void
+count_task(void *data)
+{
+    __atomic_add_fetch((int *)data, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+slow_task(void *data)
+{
+    thread_millisleep(1000);
+    __atomic_add_fetch(&n_slow, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+remove_self(void *data)
+{
+    n_self++;
+    hktask_remove("self");
+}
+
+/**
+ * test1    Tasks run with millisecond frequencies and one-shot tasks are
+ *          run once and removed
+ */
+static int
+test1()
+{
+    ss_info_dassert(hktask_add_ms("fast", count_task, &n_fast, 20), "Task should be added");
+    ss_info_dassert(!hktask_add_ms("fast", count_task, &n_fast, 20), "Task names must be unique");
+    ss_info_dassert(hktask_oneshot_ms("oneshot", count_task, &n_oneshot, 50), "Task should be added");
+
+    thread_millisleep(500);
+    ss_info_dassert(n_fast >= 10, "Task should run every 20 milliseconds");
+    ss_info_dassert(n_oneshot == 1, "One-shot task should run once");
+    ss_info_dassert(!hktask_remove("oneshot"), "One-shot task should be removed once run");
+
+    ss_info_dassert(hktask_remove("fast"), "Task should be removed");
+    n_fast = 0;
+    thread_millisleep(100);
+    ss_info_dassert(n_fast == 0, "Removed task should not run");
+
+    return 0;
+}
+
+/**
+ * test2    A slow concurrent task delays neither the other tasks nor the
+ *          heartbeat and removing it waits until it has finished
+ */
+static int
+test2()
+{
+    long beat;
+    int fast;
+
+    ss_info_dassert(hktask_oneshot_concurrent_ms("slow", slow_task, NULL, 0), "Task should be added");
+    ss_info_dassert(hktask_add_ms("fast", count_task, &n_fast, 20), "Task should be added");
+
+    thread_millisleep(100);
+    beat = hkheartbeat;
+    fast = n_fast;
+    thread_millisleep(500);
+    ss_info_dassert(n_slow == 0, "Slow task should still be running");
+    ss_info_dassert(n_fast - fast >= 10, "Fast task should run while the slow task runs");
+    ss_info_dassert(hkheartbeat - beat >= 4, "Heartbeat should advance while the slow task runs");
+
+    ss_info_dassert(hktask_remove("slow"), "Running task should be removed");
+    ss_info_dassert(n_slow == 1, "Removal should wait for the running task");
+    hktask_remove("fast");
+
+    ss_info_dassert(hktask_add_ms("self", remove_self, NULL, 10), "Task should be added");
+    thread_millisleep(100);
+    ss_info_dassert(n_self == 1, "Task should be able to remove itself");
+    ss_info_dassert(!hktask_remove("self"), "Task should have removed itself");
+
+    return 0;
+}
+
+/**
+ * test3    Exclusive tasks are not run at the same time
+ */
+static int
+test3()
+{
+    int fast;
+
+    n_slow = 0;
+    ss_info_dassert(hktask_oneshot_ms("slow", slow_task, NULL, 0), "Task should be added");
+    ss_info_dassert(hktask_add_ms("fast", count_task, &n_fast, 20), "Task should be added");
+
+    thread_millisleep(100);
+    fast = n_fast;
+    thread_millisleep(500);
+    ss_info_dassert(n_slow == 0, "Slow task should still be running");
+    ss_info_dassert(n_fast == fast, "Exclusive task should wait for the slow task");
+
+    thread_millisleep(800);
+    ss_info_dassert(n_slow == 1, "Slow task should have finished");
+    ss_info_dassert(n_fast - fast >= 10, "Exclusive task should run once the slow task has finished");
+    hktask_remove("fast");
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    hkinit();
+    result += test1();
+    result += test2();
+    result += test3();
+    hkshutdown();
+
+    exit(result);
+}
@@ -0,0 +1,139 @@
+/*
+ * This file is distributed as part of MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <metrics.h>
+#include <buffer.h>
+#include <skygw_debug.h>
+
+static int64_t value = 0;
+
+static int64_t
+read_value(void *data)
+{
+    return *(int64_t *)data;
+}
+
+/**
+ * Take a snapshot and return it as a string
+ *
+ * @param buf   Buffer for the text
+ * @param size  Size of the buffer
+ * @return      The text of the snapshot
+ */
+static char *
+take_snapshot(char *buf, size_t size)
+{
+    GWBUF *snapshot;
+
+    metrics_snapshot(NULL);
+    snapshot = metrics_get();
+    ss_info_dassert(snapshot, "Snapshot should be taken");
+    ss_info_dassert(GWBUF_LENGTH(snapshot) < size, "Snapshot should fit the buffer");
+    memcpy(buf, GWBUF_DATA(snapshot), GWBUF_LENGTH(snapshot));
+    buf[GWBUF_LENGTH(snapshot)] = '\0';
+    gwbuf_free(snapshot);
+
+    return buf;
+}
+
+/**
+ * test1    Metrics are formatted into families and the snapshot only
+ *          changes when a new one is taken
+ */
+static int
+test1()
+{
+    static int64_t other = 7;
+    char buf[1024];
+    GWBUF *snapshot;
+
+    ss_info_dassert(metrics_get() == NULL, "There should be no snapshot before the first one");
+    ss_info_dassert(metric_add("test_sessions", "Number of sessions", METRIC_GAUGE,
+                               "service", "RW \"Split\"\\Router", read_value, &value),
+                    "Metric should be added");
+    ss_info_dassert(metric_add("test_sessions", "Number of sessions", METRIC_GAUGE,
+                               "service", "Other", read_value, &other),
+                    "Metric should be added to the family");
+    ss_info_dassert(!metric_add("test_sessions", "Number of sessions", METRIC_COUNTER,
+                                "service", "Third", read_value, &other),
+                    "Metric with a different type should not be added to the family");
+    ss_info_dassert(metric_add("test_queries_total", "Number of queries\nrouted", METRIC_COUNTER,
+                               NULL, NULL, read_value, &value),
+                    "Metric should be added");
+
+    value = 42;
+    take_snapshot(buf, sizeof(buf));
+    ss_info_dassert(strcmp(buf,
+                           "# HELP test_sessions Number of sessions\n"
+                           "# TYPE test_sessions gauge\n"
+                           "test_sessions{service=\"RW \\\"Split\\\"\\\\Router\"} 42\n"
+                           "test_sessions{service=\"Other\"} 7\n"
+                           "# HELP test_queries_total Number of queries\\nrouted\n"
+                           "# TYPE test_queries_total counter\n"
+                           "test_queries_total 42\n") == 0,
+                    "Snapshot should be in the text exposition format");
+
+    value = 43;
+    snapshot = metrics_get();
+    ss_info_dassert(GWBUF_LENGTH(snapshot) == strlen(buf) &&
+                    memcmp(GWBUF_DATA(snapshot), buf, strlen(buf)) == 0,
+                    "Snapshot should not change until a new one is taken");
+    gwbuf_free(snapshot);
+
+    return 0;
+}
+
+/**
+ * test2    Removed metrics are left out of the next snapshot
+ */
+static int
+test2()
+{
+    char buf[1024];
+
+    metrics_remove(&value);
+    take_snapshot(buf, sizeof(buf));
+    ss_info_dassert(strcmp(buf,
+                           "# HELP test_sessions Number of sessions\n"
+                           "# TYPE test_sessions gauge\n"
+                           "test_sessions{service=\"Other\"} 7\n") == 0,
+                    "Removed metrics and empty families should not be in the snapshot");
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -101,12 +101,56 @@ char query[129];
 
 }
 
+int
+test3()
+{
+GWBUF   *head, *tail;
+char    *sql;
+int     length;
+const char *query = "select * from some_table";
+
+        ss_dfprintf(stderr, "testmodutil : SQL view of a contiguous buffer");
+        head = gwbuf_alloc(5 + strlen(query));
+        *((unsigned char*)head->start) = strlen(query) + 1;
+        *((unsigned char*)head->start+1) = 0;
+        *((unsigned char*)head->start+2) = 0;
+        *((unsigned char*)head->start+3) = 0;
+        *((unsigned char*)head->start+4) = 0x03;
+        memcpy(head->start + 5, query, strlen(query));
+        ss_info_dassert(modutil_get_SQL_view(head, &sql, &length), "View should succeed");
+        ss_info_dassert(length == strlen(query), "View length should match the query");
+        ss_info_dassert(sql == (char*)head->start + 5, "View should point into the buffer");
+        ss_info_dassert(strncmp(sql, query, length) == 0, "View should match the query");
+        gwbuf_free(head);
+
+        ss_dfprintf(stderr, "\t..done\nSQL view of a chained buffer");
+        head = gwbuf_alloc(5 + 10);
+        tail = gwbuf_alloc(strlen(query) - 10);
+        *((unsigned char*)head->start) = strlen(query) + 1;
+        *((unsigned char*)head->start+1) = 0;
+        *((unsigned char*)head->start+2) = 0;
+        *((unsigned char*)head->start+3) = 0;
+        *((unsigned char*)head->start+4) = 0x03;
+        memcpy(head->start + 5, query, 10);
+        memcpy(tail->start, query + 10, strlen(query) - 10);
+        head = gwbuf_append(head, tail);
+        ss_info_dassert(modutil_get_SQL_view(head, &sql, &length), "View should succeed");
+        ss_info_dassert(length == strlen(query), "View length should match the query");
+        ss_info_dassert(strncmp(sql, query, length) == 0, "View should match the query");
+        ss_info_dassert(modutil_get_SQL_view(head, &sql, &length), "Cached view should succeed");
+        ss_info_dassert(strncmp(sql, query, length) == 0, "Cached view should match the query");
+        gwbuf_free(head);
+        ss_dfprintf(stderr, "\t..done\n");
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 int	result = 0;
 
 	result += test1();
 	result += test2();
+	result += test3();
 	exit(result);
 }
 
@@ -0,0 +1,132 @@
+/*
+ * This file is distributed as part of MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <rcu.h>
+#include <skygw_debug.h>
+
+static int n_freed = 0;
+
+static void
+count_free(void *data)
+{
+    n_freed++;
+}
+
+/**
+ * test1    Objects are released immediately before initialisation
+ */
+static int
+test1()
+{
+    rcu_call(count_free, NULL);
+    ss_info_dassert(n_freed == 1, "Object should be released without grace period");
+    ss_info_dassert(rcu_pending() == 0, "Nothing should be pending");
+    return 0;
+}
+
+/**
+ * test2    Objects are released only after all threads are quiescent
+ */
+static int
+test2()
+{
+    int *value = malloc(sizeof(int));
+
+    n_freed = 0;
+    rcu_init(3);
+
+    rcu_call(count_free, value);
+    ss_info_dassert(rcu_pending() == 1, "Object should be pending");
+
+    rcu_quiescent(0);
+    rcu_quiescent(1);
+    ss_info_dassert(n_freed == 0, "Thread 2 has not been quiescent");
+
+    rcu_quiescent(2);
+    ss_info_dassert(n_freed == 1, "Object should be released after all threads are quiescent");
+    ss_info_dassert(rcu_pending() == 0, "Nothing should be pending");
+
+    /** A quiescent state seen before the object was retired does not count */
+    rcu_call(count_free, value);
+    rcu_quiescent(0);
+    rcu_quiescent(1);
+    ss_info_dassert(n_freed == 1, "Thread 2 has not been quiescent since the object was retired");
+
+    /** An offline thread does not hold back reclamation */
+    rcu_offline(2);
+    rcu_quiescent(0);
+    ss_info_dassert(n_freed == 2, "Offline thread should not block reclamation");
+
+    free(value);
+    return 0;
+}
+
+/**
+ * test3    Objects retired by a polling thread wait in its own limbo list
+ */
+static int
+test3()
+{
+    RCU_HEAD rcu;
+
+    n_freed = 0;
+
+    /** Being quiescent makes the caller a polling thread */
+    rcu_quiescent(0);
+    rcu_quiescent(1);
+
+    rcu_retire(&rcu, count_free, NULL);
+    ss_info_dassert(rcu_pending() == 1, "Object should be in the limbo list");
+
+    rcu_quiescent(1);
+    ss_info_dassert(n_freed == 0, "Thread 0 has not been quiescent");
+
+    rcu_quiescent(0);
+    ss_info_dassert(n_freed == 1, "Object should be released after all threads are quiescent");
+    ss_info_dassert(rcu_pending() == 0, "Nothing should be pending");
+
+    /** The limbo list of an exiting thread is released by the others */
+    rcu_retire(&rcu, count_free, NULL);
+    rcu_offline(0);
+    ss_info_dassert(rcu_pending() == 1, "Object should be in the shared list");
+    rcu_quiescent(1);
+    ss_info_dassert(n_freed == 2, "Object should be released by the remaining thread");
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+    result += test3();
+
+    exit(result);
+}
@@ -0,0 +1,159 @@
+/*
+ * This file is distributed as part of MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <statistics.h>
+#include <thread.h>
+#include <skygw_debug.h>
+
+static ts_hist_snapshot_t snapshot;
+
+/**
+ * test1    Counters hold 64-bit values
+ */
+static int
+test1()
+{
+    ts_stats_t stats = ts_stats_alloc();
+
+    ss_info_dassert(stats != NULL, "Counter should be allocated");
+    ss_info_dassert(ts_stats_sum(stats) == 0, "New counter should be zero");
+
+    ts_stats_add(stats, 5);
+    ts_stats_add(stats, 1L << 40);
+    ss_info_dassert(ts_stats_sum(stats) == (1L << 40) + 5, "Counters should be 64-bit");
+
+    ts_stats_set(stats, 1);
+    ss_info_dassert(ts_stats_sum(stats) == 1, "Set should replace the value");
+
+    ts_stats_free(stats);
+    return 0;
+}
+
+/**
+ * test2    Histogram percentiles stay within the bucket error and small
+ *          values and powers of two are counted exactly
+ */
+static int
+test2()
+{
+    ts_hist_t hist = ts_hist_alloc();
+
+    ss_info_dassert(hist != NULL, "Histogram should be allocated");
+    ts_hist_merge(hist, &snapshot);
+    ss_info_dassert(snapshot.count == 0, "New histogram should be empty");
+    ss_info_dassert(ts_hist_percentile(&snapshot, 50) == 0, "Empty histogram has no percentiles");
+
+    for (int i = 1; i <= 1000; i++)
+    {
+        ts_hist_add(hist, i);
+    }
+
+    ts_hist_merge(hist, &snapshot);
+    ss_info_dassert(snapshot.count == 1000, "All values should be counted");
+    ss_info_dassert(snapshot.sum == 500500, "Sum should be exact");
+    ss_info_dassert(snapshot.max == 1000, "Maximum should be exact");
+
+    int64_t p50 = ts_hist_percentile(&snapshot, 50);
+    int64_t p99 = ts_hist_percentile(&snapshot, 99);
+    ss_info_dassert(p50 >= 500 && p50 <= 500 + 500 / TS_HIST_SUBS, "Median should be within the bucket error");
+    ss_info_dassert(p99 >= 990 && p99 <= 1000, "99th percentile should be within the bucket error");
+    ss_info_dassert(ts_hist_percentile(&snapshot, 100) == 1000, "100th percentile is the maximum");
+
+    ss_info_dassert(ts_hist_count_below(&snapshot, 1) == 0, "No values below one");
+    ss_info_dassert(ts_hist_count_below(&snapshot, 5) == 4, "Small values should be exact");
+    ss_info_dassert(ts_hist_count_below(&snapshot, 512) == 511, "Powers of two should be exact");
+    ss_info_dassert(ts_hist_count_below(&snapshot, 1024) == 1000, "Powers of two should be exact");
+
+    ts_hist_add(hist, UINT64_MAX / 2);
+    ts_hist_merge(hist, &snapshot);
+    ss_info_dassert(ts_hist_percentile(&snapshot, 100) == UINT64_MAX / 2, "Large values should be counted");
+
+    ts_hist_free(hist);
+    return 0;
+}
+
+#define TEST_THREADS 4
+#define TEST_ADDS    100000
+
+static ts_stats_t shared_stats;
+static ts_hist_t shared_hist;
+
+static void
+add_values(void *data)
+{
+    for (int i = 0; i < TEST_ADDS; i++)
+    {
+        ts_stats_add(shared_stats, 1);
+        ts_hist_add(shared_hist, i);
+    }
+}
+
+/**
+ * test3    Threads that are not worker threads share a slot without losing
+ *          updates
+ */
+static int
+test3()
+{
+    THREAD threads[TEST_THREADS];
+
+    shared_stats = ts_stats_alloc();
+    shared_hist = ts_hist_alloc();
+
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        ss_info_dassert(thread_start(&threads[i], add_values, NULL), "Thread should start");
+    }
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        thread_wait(threads[i]);
+    }
+
+    ts_hist_merge(shared_hist, &snapshot);
+    ss_info_dassert(ts_stats_sum(shared_stats) == TEST_THREADS * TEST_ADDS,
+                    "No counter updates should be lost");
+    ss_info_dassert(snapshot.count == TEST_THREADS * TEST_ADDS,
+                    "No histogram updates should be lost");
+    ss_info_dassert(snapshot.max == TEST_ADDS - 1, "Maximum should be exact");
+
+    ts_stats_free(shared_stats);
+    ts_hist_free(shared_hist);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    ts_stats_init();
+    result += test1();
+    result += test2();
+    result += test3();
+
+    exit(result);
+}
@@ -0,0 +1,154 @@
+/*
+ * This file is distributed as part of MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <timer_wheel.h>
+#include <hk_heartbeat.h>
+#include <skygw_debug.h>
+
+static int n_expired = 0;
+static long expired_at = 0;
+
+static void
+count_expired(void *data)
+{
+    n_expired++;
+    expired_at = hkheartbeat;
+}
+
+static void
+rearm_expired(void *data)
+{
+    TIMER *timer = (TIMER *)data;
+
+    n_expired++;
+    if (n_expired < 3)
+    {
+        timer_arm(timer, hkheartbeat + 5);
+    }
+}
+
+/**
+ * Advance the heartbeat one tick at a time, as the housekeeper would, and
+ * process the wheel of thread 0 after each tick
+ *
+ * @param ticks Number of heartbeats to advance
+ */
+static void
+advance(long ticks)
+{
+    while (ticks-- > 0)
+    {
+        hkheartbeat++;
+        timer_wheel_process(0);
+    }
+}
+
+/**
+ * test1    Timers expire on their deadline on every level of the wheel
+ */
+static int
+test1()
+{
+    long deltas[] = {1, 63, 64, 65, 1000, 4095, 4096, 5000, 300000};
+    TIMER timer;
+
+    timer_wheel_init(2);
+    timer_wheel_thread(0);
+    timer_init(&timer, count_expired, NULL);
+
+    for (int i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++)
+    {
+        long deadline = hkheartbeat + deltas[i];
+
+        n_expired = 0;
+        timer_arm(&timer, deadline);
+        ss_info_dassert(timer_wheel_armed() == 1, "Timer should be armed");
+        ss_info_dassert(timer_wheel_next(0) >= 0, "Next deadline should be known");
+        ss_info_dassert(timer_wheel_next(0) <= deltas[i] * 100, "Wheel must not sleep past the deadline");
+
+        advance(deltas[i] - 1);
+        ss_info_dassert(n_expired == 0, "Timer should not expire early");
+        advance(1);
+        ss_info_dassert(n_expired == 1, "Timer should expire on its deadline");
+        ss_info_dassert(expired_at == deadline, "Timer should expire on its deadline");
+        ss_info_dassert(timer_wheel_armed() == 0, "Timer should not be armed");
+    }
+
+    return 0;
+}
+
+/**
+ * test2    Cancelled timers do not expire and timers can be armed again
+ *          from their own function
+ */
+static int
+test2()
+{
+    TIMER timer;
+    TIMER other;
+
+    timer_init(&timer, count_expired, NULL);
+    timer_init(&other, count_expired, NULL);
+
+    n_expired = 0;
+    timer_arm(&timer, hkheartbeat + 10);
+    timer_arm(&other, hkheartbeat + 10);
+    ss_info_dassert(timer_cancel(&timer), "Armed timer should be cancelled");
+    ss_info_dassert(!timer_cancel(&timer), "Cancelled timer is not armed");
+    advance(10);
+    ss_info_dassert(n_expired == 1, "Only the other timer should expire");
+
+    /** Moving an armed timer replaces the old deadline */
+    n_expired = 0;
+    timer_arm(&timer, hkheartbeat + 10);
+    timer_arm(&timer, hkheartbeat + 100);
+    advance(10);
+    ss_info_dassert(n_expired == 0, "Moved timer should not expire on the old deadline");
+    advance(90);
+    ss_info_dassert(n_expired == 1, "Moved timer should expire on the new deadline");
+
+    n_expired = 0;
+    timer_init(&timer, rearm_expired, &timer);
+    timer_arm(&timer, hkheartbeat + 5);
+    advance(20);
+    ss_info_dassert(n_expired == 3, "Timer should be armed again by its function");
+    ss_info_dassert(timer_wheel_next(0) == -1, "No timers should be armed");
+    timer_cancel_sync(&timer);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -16,6 +16,7 @@
  * Copyright MariaDB Corporation Ab 2013-2014
  */
 #include <thread.h>
+#include <affinity.h>
 
 /**
  * @file thread.c  - Implementation of thread related operations
@@ -40,7 +41,15 @@
  */
 THREAD *thread_start(THREAD *thd, void (*entry)(void *), void *arg)
 {
-    if (pthread_create(thd, NULL, (void *(*)(void *))entry, arg) != 0)
+    pthread_attr_t attr;
+    int rc;
+
+    pthread_attr_init(&attr);
+    affinity_thread_attr(&attr);
+    rc = pthread_create(thd, &attr, (void *(*)(void *))entry, arg);
+    pthread_attr_destroy(&attr);
+
+    if (rc != 0)
     {
         return NULL;
     }
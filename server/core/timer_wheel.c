@@ -0,0 +1,450 @@
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file timer_wheel.c  - Per-thread hierarchical timer wheels
+ *
+ * A wheel has four levels of 64 slots. The first level holds the timers
+ * that expire within 64 heartbeats, one slot per heartbeat. Each slot of
+ * the next level covers 64 times the span of a slot of the level below it.
+ * Whenever the first level wraps around, the timers of the current slot of
+ * the second level are moved down to the first level, and so on upwards.
+ * Arming and cancelling a timer is a list operation and advancing the wheel
+ * by one heartbeat touches a single slot, apart from the cascades that
+ * happen once every 64 heartbeats.
+ *
+ * Each wheel has a lock so that a timer can be cancelled by a thread other
+ * than the one that armed it. The lock is only contended when that happens.
+ */
+
+#include <stdlib.h>
+#include <sched.h>
+#include <timer_wheel.h>
+#include <spinlock.h>
+#include <platform.h>
+#include <hk_heartbeat.h>
+#include <log_manager.h>
+
+#define TIMER_LEVELS    4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS     (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+/** The longest time a timer can be armed for, about 19 days */
+#define TIMER_MAX_DELTA ((1L << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+/** The length of a heartbeat in milliseconds */
+#define TIMER_TICK_MS 100
+
+typedef struct timer_wheel
+{
+    SPINLOCK lock;
+    long     now;                   /*< The next heartbeat to process */
+    int      count;                 /*< Number of armed timers */
+    TIMER    *running;              /*< Timer whose function is being called */
+    TIMER    *slots[TIMER_LEVELS][TIMER_SLOTS];
+} TIMER_WHEEL;
+
+static TIMER_WHEEL *wheels = NULL;
+static int n_wheels = 0;
+
+/** The wheel of the calling polling thread, NULL for other threads */
+static thread_local TIMER_WHEEL *timer_self = NULL;
+
+/**
+ * Initialise the timer wheels. Timers that are armed before this is
+ * called are ignored.
+ *
+ * @param n_threads Number of polling threads
+ */
+void
+timer_wheel_init(int n_threads)
+{
+    TIMER_WHEEL *new_wheels;
+
+    if (wheels || n_threads <= 0)
+    {
+        return;
+    }
+
+    if ((new_wheels = calloc(n_threads, sizeof(TIMER_WHEEL))) == NULL)
+    {
+        MXS_ERROR("Failed to allocate memory for the timer wheels.");
+        return;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        spinlock_init(&new_wheels[i].lock);
+        new_wheels[i].now = hkheartbeat;
+    }
+
+    n_wheels = n_threads;
+    wheels = new_wheels;
+}
+
+/**
+ * Make the calling thread arm its timers in the wheel of a polling thread
+ *
+ * @param thread_id The polling thread ID of the calling thread
+ */
+void
+timer_wheel_thread(int thread_id)
+{
+    if (wheels && thread_id >= 0 && thread_id < n_wheels)
+    {
+        timer_self = &wheels[thread_id];
+    }
+}
+
+/**
+ * Link a timer into the slot matching its deadline. The caller holds the
+ * lock of the wheel.
+ *
+ * @param wheel The wheel
+ * @param timer The timer
+ */
+static void
+timer_wheel_insert(TIMER_WHEEL *wheel, TIMER *timer)
+{
+    long delta = timer->expires - wheel->now;
+    TIMER **slot;
+
+    if (delta < 0)
+    {
+        /** Already expired, run it on the next heartbeat processed */
+        slot = &wheel->slots[0][wheel->now & TIMER_SLOT_MASK];
+    }
+    else
+    {
+        int level = 0;
+
+        if (delta > TIMER_MAX_DELTA)
+        {
+            timer->expires = wheel->now + TIMER_MAX_DELTA;
+            delta = TIMER_MAX_DELTA;
+        }
+
+        while (delta >= (1L << ((level + 1) * TIMER_SLOT_BITS)))
+        {
+            level++;
+        }
+
+        slot = &wheel->slots[level][(timer->expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+    }
+
+    timer->next = *slot;
+    if (timer->next)
+    {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/**
+ * Unlink a timer from its slot. The caller holds the lock of the wheel.
+ *
+ * @param timer The timer
+ */
+static void
+timer_unlink(TIMER *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * Move the timers of a slot on an upper level to the levels below it
+ *
+ * @param wheel The wheel
+ * @param level The level of the slot
+ * @param index The index of the slot
+ */
+static void
+timer_wheel_cascade(TIMER_WHEEL *wheel, int level, int index)
+{
+    TIMER *timer = wheel->slots[level][index];
+
+    wheel->slots[level][index] = NULL;
+
+    while (timer)
+    {
+        TIMER *next = timer->next;
+        timer_wheel_insert(wheel, timer);
+        timer = next;
+    }
+}
+
+/**
+ * Call the functions of the timers of a polling thread that have expired.
+ * The functions are called without holding the lock of the wheel so that
+ * they can arm and cancel timers.
+ *
+ * @param thread_id The polling thread ID
+ * @return Number of timers that expired
+ */
+int
+timer_wheel_process(int thread_id)
+{
+    TIMER_WHEEL *wheel;
+    int n_expired = 0;
+
+    if (wheels == NULL || thread_id < 0 || thread_id >= n_wheels)
+    {
+        return 0;
+    }
+
+    wheel = &wheels[thread_id];
+
+    if (wheel->now > hkheartbeat)
+    {
+        return 0;
+    }
+
+    spinlock_acquire(&wheel->lock);
+
+    while (wheel->now <= hkheartbeat)
+    {
+        int index = wheel->now & TIMER_SLOT_MASK;
+        TIMER *expired;
+        TIMER *timer;
+
+        if (index == 0)
+        {
+            for (int level = 1; level < TIMER_LEVELS; level++)
+            {
+                int upper = (wheel->now >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+                timer_wheel_cascade(wheel, level, upper);
+                if (upper != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        /** Detach the slot first, the functions may arm timers that land
+         * in the same slot again */
+        expired = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+        if (expired)
+        {
+            expired->pprev = &expired;
+        }
+        wheel->now++;
+
+        while ((timer = expired) != NULL)
+        {
+            /** The running timer is published before the timer is marked
+             * unarmed so that timer_cancel_sync() cannot miss it */
+            __atomic_store_n(&wheel->running, timer, __ATOMIC_RELEASE);
+            timer_unlink(timer);
+            __atomic_store_n(&timer->wheel, NULL, __ATOMIC_RELEASE);
+            wheel->count--;
+            spinlock_release(&wheel->lock);
+
+            timer->func(timer->data);
+            n_expired++;
+
+            spinlock_acquire(&wheel->lock);
+            __atomic_store_n(&wheel->running, NULL, __ATOMIC_RELEASE);
+        }
+    }
+
+    spinlock_release(&wheel->lock);
+
+    return n_expired;
+}
+
+/**
+ * Return how long a polling thread may block before its next timer expires.
+ * The result is a lower bound: when the nearest timer is on an upper level,
+ * the time to the next cascade is returned.
+ *
+ * @param thread_id The polling thread ID
+ * @return Milliseconds until the next deadline or -1 if no timers are armed
+ */
+int
+timer_wheel_next(int thread_id)
+{
+    TIMER_WHEEL *wheel;
+    long next;
+    long delta;
+
+    if (wheels == NULL || thread_id < 0 || thread_id >= n_wheels)
+    {
+        return -1;
+    }
+
+    wheel = &wheels[thread_id];
+
+    if (wheel->count == 0)
+    {
+        return -1;
+    }
+
+    spinlock_acquire(&wheel->lock);
+    next = (wheel->now | TIMER_SLOT_MASK) + 1;
+    for (long tick = wheel->now; tick < next; tick++)
+    {
+        if (wheel->slots[0][tick & TIMER_SLOT_MASK])
+        {
+            next = tick;
+            break;
+        }
+    }
+    spinlock_release(&wheel->lock);
+
+    delta = next - hkheartbeat;
+
+    return delta > 0 ? delta * TIMER_TICK_MS : 0;
+}
+
+/**
+ * Return the number of armed timers in all wheels
+ *
+ * @return Number of armed timers
+ */
+int
+timer_wheel_armed()
+{
+    int count = 0;
+
+    for (int i = 0; i < n_wheels; i++)
+    {
+        count += wheels[i].count;
+    }
+
+    return count;
+}
+
+/**
+ * Initialise a timer
+ *
+ * @param timer The timer
+ * @param func  Function called when the timer expires
+ * @param data  Argument of the function
+ */
+void
+timer_init(TIMER *timer, void (*func)(void *), void *data)
+{
+    timer->func = func;
+    timer->data = data;
+    timer->expires = 0;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->wheel = NULL;
+}
+
+/**
+ * Arm a timer in the wheel of the calling thread. A timer that is already
+ * armed is moved to the new deadline. Threads that are not polling threads
+ * use the wheel of the first polling thread.
+ *
+ * @param timer     The timer
+ * @param expires   The heartbeat at which the timer expires
+ */
+void
+timer_arm(TIMER *timer, long expires)
+{
+    TIMER_WHEEL *wheel;
+
+    timer_cancel(timer);
+
+    if (wheels == NULL)
+    {
+        return;
+    }
+
+    wheel = timer_self ? timer_self : &wheels[0];
+
+    spinlock_acquire(&wheel->lock);
+    timer->expires = expires;
+    timer_wheel_insert(wheel, timer);
+    wheel->count++;
+    __atomic_store_n(&timer->wheel, wheel, __ATOMIC_RELEASE);
+    spinlock_release(&wheel->lock);
+}
+
+/**
+ * Cancel a timer. This can be called from any thread. If the function of
+ * the timer is being called at the same time, it is not waited for.
+ *
+ * @param timer The timer
+ * @return True if the timer was armed
+ */
+bool
+timer_cancel(TIMER *timer)
+{
+    TIMER_WHEEL *wheel;
+
+    while ((wheel = __atomic_load_n(&timer->wheel, __ATOMIC_ACQUIRE)) != NULL)
+    {
+        spinlock_acquire(&wheel->lock);
+        if (timer->wheel == wheel)
+        {
+            timer_unlink(timer);
+            timer->wheel = NULL;
+            wheel->count--;
+            spinlock_release(&wheel->lock);
+            return true;
+        }
+        spinlock_release(&wheel->lock);
+    }
+
+    return false;
+}
+
+/**
+ * Cancel a timer and wait until its function is no longer being called by
+ * another thread. This must be called before the memory of the timer is
+ * freed and must not be called with locks held that the function takes.
+ *
+ * @param timer The timer
+ */
+void
+timer_cancel_sync(TIMER *timer)
+{
+    do
+    {
+        timer_cancel(timer);
+
+        for (int i = 0; i < n_wheels; i++)
+        {
+            TIMER_WHEEL *wheel = &wheels[i];
+
+            /** A function that frees its own timer has already returned
+             * from the wheel's point of view */
+            if (wheel == timer_self)
+            {
+                continue;
+            }
+
+            while (__atomic_load_n(&wheel->running, __ATOMIC_ACQUIRE) == timer)
+            {
+                sched_yield();
+            }
+        }
+    }
+    while (__atomic_load_n(&timer->wheel, __ATOMIC_ACQUIRE) != NULL);
+}
@@ -87,6 +87,14 @@ users_free(USERS *users)
     {
         hashtable_free(users->data);
     }
+    if (users->index && users->indexFree)
+    {
+        users->indexFree(users->index);
+    }
+    if (users->rows && users->rowsFree)
+    {
+        users->rowsFree(users->rows);
+    }
     free(users);
 }
 
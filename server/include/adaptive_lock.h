@@ -0,0 +1,110 @@
+#ifndef _ADAPTIVE_LOCK_H
+#define _ADAPTIVE_LOCK_H
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file adaptive_lock.h  - Locks that spin briefly and then sleep
+ *
+ * An adaptive lock is taken with a single atomic operation when it is free.
+ * A thread that finds it taken spins with the processor's pause instruction
+ * and an exponentially growing delay for a short while, and then sleeps on a
+ * futex until the holder releases the lock. A holder that is preempted does
+ * therefore not make the waiting threads burn their time slices.
+ *
+ * Every time a thread has to wait for a lock, the call site and the time it
+ * waited are recorded. The uncontended path records nothing.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct dcb;
+
+/**
+ * The adaptive lock. The value is 0 if the lock is free, 1 if it is held
+ * and 2 if it is held and threads may be sleeping on it.
+ */
+typedef struct adaptive_lock
+{
+    int lock;
+} ADAPTIVE_LOCK;
+
+#define ADAPTIVE_LOCK_INIT { 0 }
+
+#define ADAPTIVE_LOCK_IS_LOCKED(l) ((l)->lock != 0 ? true : false)
+
+/** Acquire a lock, recording the call site if the lock is contended */
+#define adaptive_lock_acquire(l) adaptive_lock_acquire_at((l), #l, __FILE__, __LINE__)
+
+void adaptive_lock_init(ADAPTIVE_LOCK *lock);
+void adaptive_lock_wait(ADAPTIVE_LOCK *lock, const char *name, const char *file, int line);
+void adaptive_lock_wake(ADAPTIVE_LOCK *lock);
+void dShowLockStats(struct dcb *dcb);
+
+/**
+ * Acquire a lock. Use adaptive_lock_acquire() instead of calling this
+ * directly.
+ *
+ * @param lock  The lock
+ * @param name  The lock expression at the call site
+ * @param file  The file of the call site
+ * @param line  The line of the call site
+ */
+static inline void
+adaptive_lock_acquire_at(ADAPTIVE_LOCK *lock, const char *name, const char *file, int line)
+{
+    int expected = 0;
+
+    if (!__atomic_compare_exchange_n(&lock->lock, &expected, 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        adaptive_lock_wait(lock, name, file, line);
+    }
+}
+
+/**
+ * Acquire a lock if it is free
+ *
+ * @param lock  The lock
+ * @return      True if the lock was acquired
+ */
+static inline bool
+adaptive_lock_acquire_nowait(ADAPTIVE_LOCK *lock)
+{
+    int expected = 0;
+
+    return __atomic_compare_exchange_n(&lock->lock, &expected, 1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/**
+ * Release a lock and wake up a sleeping thread, if there may be one
+ *
+ * @param lock  The lock
+ */
+static inline void
+adaptive_lock_release(ADAPTIVE_LOCK *lock)
+{
+    if (__atomic_exchange_n(&lock->lock, 0, __ATOMIC_RELEASE) == 2)
+    {
+        adaptive_lock_wake(lock);
+    }
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file affinity.h  - Placement of the polling threads on CPUs and NUMA nodes
+ *
+ * The thread_affinity parameter selects the CPUs the polling threads are
+ * bound to. A bound thread allocates its memory from the NUMA node of its
+ * CPU, so the DCBs and buffers it creates are local to it. Each DCB records
+ * the node it was created on, which lets the polling system count the
+ * events processed on another node.
+ */
+
+#include <stdbool.h>
+#include <sched.h>
+#include <pthread.h>
+
+struct dcb;
+
+bool affinity_init(int n_threads);
+void affinity_thread_start(int thread_id);
+void affinity_thread_attr(pthread_attr_t *attr);
+int affinity_node();
+int affinity_nodes();
+int affinity_parse_cpulist(const char *str, cpu_set_t *set);
+void dprintAffinity(struct dcb *dcb);
+
+#endif
@@ -52,6 +52,7 @@
 #include <hint.h>
 #include <spinlock.h>
 #include <stdint.h>
+#include <rdtsc.h>
 
 EXTERN_C_BLOCK_BEGIN
 
@@ -114,7 +115,8 @@ typedef enum
  */
 typedef enum
 {
-    GWBUF_PARSING_INFO
+    GWBUF_PARSING_INFO,
+    GWBUF_SQL_VIEW
 } bufobj_id_t;
 
 typedef struct buffer_object_st buffer_object_t;
@@ -149,6 +151,7 @@ typedef struct gwbuf
     gwbuf_type_t    gwbuf_type; /*< buffer's data type information */
     HINT            *hint;  /*< Hint data for this buffer */
     BUF_PROPERTY    *properties; /*< Buffer properties */
+    CYCLES          stamp;  /*< When the data was read from a traced client or 0 */
 } GWBUF;
 
 /*<
@@ -41,6 +41,8 @@
 /* Refresh rate limits for load users from database */
 #define USERS_REFRESH_TIME 30           /* Allowed time interval (in seconds) after last update*/
 #define USERS_REFRESH_MAX_PER_TIME 4    /* Max number of load calls within the time interval */
+#define USERS_REFRESH_COALESCE 5        /* Heartbeats after a reload during which refresh
+                                         * requests reuse it instead of loading again */
 
 /** Default timeout values used by the connections which fetch user authentication data */
 #define DEFAULT_AUTH_CONNECT_TIMEOUT 3
@@ -74,6 +76,9 @@ extern int load_mysql_users(SERVICE *service);
 extern int mysql_users_add(USERS *users, MYSQL_USER_HOST *key, char *auth);
 extern USERS *mysql_users_alloc();
 extern char *mysql_users_fetch(USERS *users, MYSQL_USER_HOST *key);
+extern char *mysql_users_find(USERS *users, MYSQL_USER_HOST *key, bool wildcard_hosts);
+extern bool mysql_users_find_password(USERS *users, MYSQL_USER_HOST *key, bool wildcard_hosts,
+                                      uint8_t *password);
 extern int reload_mysql_users(SERVICE *service);
 extern int replace_mysql_users(SERVICE *service);
 
@@ -18,11 +18,14 @@
  * Copyright MariaDB Corporation Ab 2013-2014
  */
 #include <spinlock.h>
+#include <adaptive_lock.h>
 #include <buffer.h>
 #include <gw_protocol.h>
 #include <gw_ssl.h>
 #include <modinfo.h>
 #include <gwbitmask.h>
+#include <rcu.h>
+#include <timer_wheel.h>
 #include <skygw_utils.h>
 #include <netinet/in.h>
 
@@ -76,7 +79,7 @@ struct dcb;
  *      processing_events       The evets currently being processed
  *      processing              Flag to indicate the processing status of the DCB
  *      eventqlock              Spinlock to protect this structure
- *      inserted                Insertion time for logging purposes
+ *      inserted                Insertion time in microseconds for the statistics
  *      started                 Time that the processign started
  */
 typedef struct
@@ -117,17 +120,14 @@ typedef struct dcbstats
  * call, the is the only way we can be sure that no polling thread is pending a wakeup or
  * processing an event that will access the DCB.
  *
- * We solve this issue by making the dcb_free routine merely mark a DCB as a zombie and
- * place it on a special zombie list. Before placing the DCB on the zombie list we create
- * a bitmask with a bit set in it for each active polling thread. Each thread will call
- * a routine to process the zombie list at the end of the polling loop. This routine
- * will clear the bit value that corresponds to the calling thread. Once the bitmask
- * is completely cleared the DCB can finally be freed and removed from the zombie list.
+ * We solve this issue by making dcb_close merely mark a DCB as a zombie and retire it
+ * with rcu_retire. The closing thread keeps it in a thread local list and the DCB is
+ * finally freed once every polling thread has returned to the top of its polling loop,
+ * where it can no longer be processing an event for the DCB.
  */
 typedef struct
 {
-    GWBITMASK       bitmask;        /*< The bitmask of threads */
-    struct dcb      *next;          /*< Next pointer for the zombie list */
+    RCU_HEAD        rcu;            /*< Deferred reclamation of the closed DCB */
 } DCBMM;
 
 /* DCB states */
@@ -219,7 +219,7 @@ typedef struct dcb
     GWPROTOCOL      func;           /**< The functions for this descriptor */
 
     int             writeqlen;      /**< Current number of byes in the write queue */
-    SPINLOCK        writeqlock;     /**< Write Queue spinlock */
+    ADAPTIVE_LOCK   writeqlock;     /**< Write Queue lock */
     GWBUF           *writeq;        /**< Write Data Queue */
     SPINLOCK        delayqlock;     /**< Delay Backend Write Queue spinlock */
     GWBUF           *delayq;        /**< Delay Backend Write Data Queue */
@@ -228,7 +228,9 @@ typedef struct dcb
 
     DCBSTATS        stats;          /**< DCB related statistics */
     unsigned int    dcb_server_status; /*< the server role indicator from SERVER */
-    struct dcb      *next;          /**< Next DCB in the chain of allocated DCB's */
+    struct dcb      *next;          /**< Next DCB in the registry shard */
+    struct dcb      *prev;          /**< Previous DCB in the registry shard */
+    int             shard;          /**< The registry shard of the DCB */
     struct dcb      *nextpersistent;   /**< Next DCB in the persistent pool for SERVER */
     time_t          persistentstart;   /**< Time when DCB placed in persistent pool */
     struct service  *service;       /**< The related service */
@@ -244,6 +246,10 @@ typedef struct dcb
     int             polloutbusy;
     int             writecheck;
     unsigned long   last_read;      /*< Last time the DCB received data */
+    TIMER           timer;          /*< Idle timeout or persistent pool expiry */
+    int             read_size;      /*< Read buffer size, adapted to earlier reads */
+    int             numa_node;      /*< NUMA node of the thread that created the DCB */
+    void            *poll_handle;   /*< Poll backend registration of the DCB */
     unsigned int    high_water;     /**< High water mark */
     unsigned int    low_water;      /**< Low water mark */
     struct server   *server;        /**< The associated backend server */
@@ -290,7 +296,6 @@ int           fail_accept_errno;
 
 #define DCB_POLL_BUSY(x)                ((x)->evq.next != NULL)
 
-DCB *dcb_get_zombies(void);
 int dcb_write(DCB *, GWBUF *);
 DCB *dcb_alloc(dcb_role_t);
 void dcb_free(DCB *);
@@ -299,14 +304,17 @@ DCB *dcb_connect(struct server *, struct session *, const char *);
 DCB *dcb_clone(DCB *);
 int dcb_read(DCB *, GWBUF **, int);
 int dcb_drain_writeq(DCB *);
+void dcb_defer_writes();
+void dcb_flush_deferred();
 void dcb_close(DCB *);
-DCB *dcb_process_zombies(int);              /* Process Zombies except the one behind the pointer */
 void printAllDCBs();                         /* Debug to print all DCB in the system */
 void printDCB(DCB *);                        /* Debug print routine */
 void dprintAllDCBs(DCB *);                   /* Debug to print all DCB in the system */
 void dprintOneDCB(DCB *, DCB *);             /* Debug to print one DCB */
 void dprintDCB(DCB *, DCB *);                /* Debug to print a DCB in the system */
 void dListDCBs(DCB *);                       /* List all DCBs in the system */
+void dprintDCBIOStats(DCB *);                /* Print the socket system call statistics */
+void dcb_init_io_stats();                    /* Allocate the socket system call statistics */
 void dListClients(DCB *);                    /* List al the client DCBs */
 const char *gw_dcb_state2string(int);              /* DCB state to string */
 void dcb_printf(DCB *, const char *, ...);   /* DCB version of printf */
@@ -30,6 +30,7 @@
 #include <dcb.h>
 #include <session.h>
 #include <buffer.h>
+#include <resultset.h>
 #include <stdint.h>
 
 /**
@@ -65,6 +66,9 @@ typedef struct
  *      clientReply             Called for each reply packet
  *      diagnostics             Called to force the filter to print
  *                              diagnostic output
+ *      getStatistics           Optional, called to obtain the instance
+ *                              wide statistics of the filter as a
+ *                              result set
  *
  * @endverbatim
  *
@@ -81,6 +85,7 @@ typedef struct filter_object
     int    (*routeQuery)(FILTER *instance, void *fsession, GWBUF *queue);
     int    (*clientReply)(FILTER *instance, void *fsession, GWBUF *queue);
     void   (*diagnostics)(FILTER *instance, void *fsession, DCB *dcb);
+    RESULTSET *(*getStatistics)(FILTER *instance);
 } FILTER_OBJECT;
 
 /**
@@ -88,7 +93,7 @@ typedef struct filter_object
  * is changed these values must be updated in line with the rules in the
  * file modinfo.h.
  */
-#define FILTER_VERSION  {1, 1, 0}
+#define FILTER_VERSION  {1, 2, 0}
 /**
  * The definition of a filter from the configuration file.
  * This is basically the link between a plugin to load and the
@@ -103,6 +108,7 @@ typedef struct filter_def
     FILTER filter;                 /**< The runtime filter */
     FILTER_OBJECT *obj;            /**< The "MODULE_OBJECT" for the filter */
     SPINLOCK spin;                 /**< Spinlock to protect the filter definition */
+    struct query_trace_stats *trace_stats; /**< Query trace histogram or NULL */
     struct filter_def *next;       /**< Next filter in the chain of all filters */
 } FILTER_DEF;
 
@@ -118,5 +124,6 @@ int filter_standard_parameter(char *);
 void dprintAllFilters(DCB *);
 void dprintFilter(DCB *, FILTER_DEF *);
 void dListFilters(DCB *);
+RESULTSET *filterGetStatistics(char *);
 
 #endif
@@ -74,6 +74,9 @@ typedef struct ssl_listener
     char *ssl_key;                      /*< SSL private key */
     char *ssl_ca_cert;                  /*< SSL CA certificate */
     bool ssl_init_done;                 /*< If SSL has already been initialized for this service */
+    int ssl_session_cache_size;         /*< Number of sessions cached for resumption, 0 disables */
+    int ssl_session_timeout;            /*< Lifetime of a cached session or ticket in seconds */
+    bool ssl_session_tickets;           /*< Whether session tickets are issued to clients */
 } SSL_LISTENER;
 
 int ssl_authenticate_client(struct dcb *dcb, const char *user, bool is_capable);
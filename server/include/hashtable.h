@@ -113,6 +113,8 @@ extern int hashtable_delete(HASHTABLE *, void *);
 /**< Delete an entry table */
 extern void *hashtable_fetch(HASHTABLE *, void *);
 /**< Fetch the data for a given key */
+extern void *hashtable_fetch_nolock(HASHTABLE *, void *);
+/**< Fetch from a table that is no longer modified */
 extern void hashtable_stats(HASHTABLE *);                   /**< Print statisitics */
 void hashtable_get_stats(void* hashtable,
                          int*  hashsize,
@@ -2,8 +2,10 @@
 #define _HK_HEARTBEAT_H
 
 /**
- * The global housekeeper heartbeat value. This value is incremented
- * every 100 milliseconds and may be used for crude timing etc.
+ * The global housekeeper heartbeat value. This value is the number of
+ * 100 millisecond periods since the housekeeper was started and may be
+ * used for crude timing etc. It is advanced by the housekeeper's scheduler
+ * from the monotonic clock, independently of the tasks being run.
  */
 
 extern long	hkheartbeat;
@@ -17,6 +17,7 @@
  *
  * Copyright MariaDB Corporation Ab 2014
  */
+#include <stdbool.h>
 #include <time.h>
 #include <dcb.h>
 #include <hk_heartbeat.h>
@@ -38,6 +39,13 @@ typedef enum
     HK_ONESHOT
 } HKTASK_TYPE;
 
+typedef enum
+{
+    HK_SCHEDULED = 1,   /*< Waiting in the heap for its next run */
+    HK_QUEUED,          /*< Waiting for a worker thread */
+    HK_RUNNING          /*< Being run by a worker thread */
+} HKTASK_STATE;
+
 /**
  * The housekeeper task list
  */
@@ -46,15 +54,29 @@ typedef struct hktask
     char *name;               /*< A simple task name */
     void (*task)(void *data); /*< The task to call */
     void *data;               /*< Data to pass the task */
-    int frequency;            /*< How often to call the tasks (seconds) */
-    time_t nextdue;           /*< When the task should be next run */
+    int frequency;            /*< How often to call the tasks (milliseconds) */
+    long nextdue;             /*< When the task should be next run (monotonic milliseconds) */
     HKTASK_TYPE type;         /*< The task type */
+    HKTASK_STATE state;       /*< Whether the task is scheduled, queued or running */
+    int index;                /*< Position of the task in the heap */
+    bool exclusive;           /*< Never run at the same time as other exclusive tasks */
+    bool removed;             /*< Removed while queued or running */
+    bool waited;              /*< The remover waits for the task to finish */
+    unsigned long runs;       /*< Number of times the task has been run */
+    long total_us;            /*< Total run time (microseconds) */
+    long max_us;              /*< Longest run time (microseconds) */
+    long last_us;             /*< Run time of the last run (microseconds) */
     struct hktask *next;      /*< Next task in the list */
+    struct hktask *next_queued; /*< Next task in the queue of the workers */
 } HKTASK;
 
 extern void hkinit();
 extern int  hktask_add(const char *name, void (*task)(void *), void *data, int frequency);
+extern int  hktask_add_ms(const char *name, void (*task)(void *), void *data, int frequency);
 extern int  hktask_oneshot(const char *name, void (*task)(void *), void *data, int when);
+extern int  hktask_oneshot_ms(const char *name, void (*task)(void *), void *data, int when);
+extern int  hktask_add_concurrent_ms(const char *name, void (*task)(void *), void *data, int frequency);
+extern int  hktask_oneshot_concurrent_ms(const char *name, void (*task)(void *), void *data, int when);
 extern int  hktask_remove(const char *name);
 extern void hkshutdown();
 extern void hkshow_tasks(DCB *pdcb);
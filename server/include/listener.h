@@ -50,6 +50,8 @@ typedef struct servlistener
     char *authenticator;        /**< Name of authenticator */
     SSL_LISTENER *ssl;          /**< Structure of SSL data or NULL */
     DCB *listener;              /**< The DCB for the listener */
+    DCB **shards;               /**< Additional SO_REUSEPORT listeners on the same port */
+    int n_shards;               /**< Number of additional listeners */
     struct  servlistener *next; /**< Next service protocol */
 } SERV_LISTENER;
 
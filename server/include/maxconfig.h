@@ -42,6 +42,12 @@
 #define _SYSNAME_STR_LENGTH     256     /**< sysname len */
 #define _RELEASE_STR_LENGTH     256     /**< release len */
 #define DEFAULT_NTHREADS        1 /**< Default number of polling threads */
+#define DEFAULT_ACCEPT_BATCH    0       /**< Default number of accepts per wakeup, 0 for no limit */
+#define DEFAULT_POLL_BACKEND    "epoll" /**< Default network I/O notification mechanism */
+#define DEFAULT_SSL_SESSION_CACHE_SIZE 20480 /**< Default number of cached SSL sessions per listener */
+#define DEFAULT_SSL_SESSION_TIMEOUT 300 /**< Default lifetime of SSL sessions in seconds */
+#define DEFAULT_QUERY_TRACE_SLOWEST 10  /**< Default number of slowest queries kept by query tracing */
+#define DEFAULT_THREAD_AFFINITY "none"  /**< Default placement of the polling threads on CPUs */
 /**
  * Maximum length for configuration parameter value.
  */
@@ -126,6 +132,13 @@ typedef struct
     unsigned int  auth_read_timeout;                   /**< Read timeout for the user authentication */
     unsigned int  auth_write_timeout;                  /**< Write timeout for the user authentication */
     char          qc_name[PATH_MAX];                   /**< The name of the query classifier to load */
+    int           reuseport;                           /**< One SO_REUSEPORT listener socket per thread */
+    unsigned int  accept_batch;                        /**< Max. connections accepted per wakeup */
+    char          poll_backend[16];                    /**< Network I/O notification mechanism */
+    int           deferred_flush;                      /**< Flush writes at the end of each event */
+    int           query_trace;                         /**< Trace the latency of queries */
+    unsigned int  query_trace_slowest;                 /**< Number of slowest queries to keep */
+    char          thread_affinity[MAX_PARAM_LEN];      /**< CPUs of the polling threads */
 } GATEWAY_CONF;
 
 
@@ -151,13 +164,20 @@ bool                config_get_valtarget(target_t*           val,
                                          config_param_type_t ptype);
 int                 config_load(char *);
 unsigned int        config_nbpolls();
+unsigned int        config_accept_batch();
+bool                config_deferred_flush();
 double              config_percentage_value(char *str);
 unsigned int        config_pollsleep();
+const char*         config_poll_backend();
+bool                config_query_trace();
+unsigned int        config_query_trace_slowest();
 int                 config_reload();
+bool                config_reuseport();
 bool                config_set_qualified_param(CONFIG_PARAMETER* param,
                                                void* val,
                                                config_param_type_t type);
 int                 config_threadcount();
+const char*         config_thread_affinity();
 int                 config_truth_value(char *);
 void                free_config_parameter(CONFIG_PARAMETER* p1);
 bool                is_internal_service(const char *router);
@@ -49,7 +49,14 @@ typedef enum
     POLL_STAT_EVQ_PENDING,
     POLL_STAT_EVQ_MAX,
     POLL_STAT_MAX_QTIME,
-    POLL_STAT_MAX_EXECTIME
+    POLL_STAT_MAX_EXECTIME,
+    POLL_STAT_QTIME_P50,        /*< Percentiles of the event times in microseconds */
+    POLL_STAT_QTIME_P90,
+    POLL_STAT_QTIME_P99,
+    POLL_STAT_EXECTIME_P50,
+    POLL_STAT_EXECTIME_P90,
+    POLL_STAT_EXECTIME_P99,
+    POLL_STAT_CROSSNODE         /*< Events processed on another NUMA node than their DCB */
 } POLL_STAT;
 
 extern  void            poll_init();
@@ -65,7 +72,7 @@ extern  void            dShowThreads(DCB *dcb);
 extern  void            poll_add_epollin_event_to_dcb(DCB* dcb, GWBUF* buf);
 extern  void            dShowEventQ(DCB *dcb);
 extern  void            dShowEventStats(DCB *dcb);
-extern  int             poll_get_stat(POLL_STAT stat);
+extern  int64_t         poll_get_stat(POLL_STAT stat);
 extern  RESULTSET       *eventTimesGetList();
 extern  void            poll_fake_event(DCB *dcb, uint32_t ev);
 extern  void            poll_fake_hangup_event(DCB *dcb);
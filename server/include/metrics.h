@@ -0,0 +1,63 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file metrics.h  - Metrics in the Prometheus text exposition format
+ *
+ * A metric is registered once with a function that returns its current
+ * value. The housekeeper reads all metrics periodically and formats them
+ * into a snapshot, which is copied to the clients that request it. Serving
+ * a request does not read any of the metrics, so the frequency of the
+ * requests does not affect the rest of MaxScale.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct dcb;
+struct gwbuf;
+
+/** The URI of the metrics in the maxinfo HTTP interface */
+#define METRICS_URI "/metrics"
+
+/** The content type of the metrics */
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+
+/** How often the snapshot is taken, in milliseconds */
+#define METRICS_INTERVAL 1000
+
+typedef enum
+{
+    METRIC_COUNTER,     /*< A value that only increases */
+    METRIC_GAUGE        /*< A value that can go up and down */
+} metric_type_t;
+
+/** A function that returns the value of a metric */
+typedef int64_t (*METRIC_FUNC)(void *data);
+
+void metrics_init();
+bool metric_add(const char *name, const char *help, metric_type_t type,
+                const char *label, const char *value, METRIC_FUNC func, void *data);
+void metrics_remove(void *data);
+void metrics_snapshot(void *data);
+struct gwbuf *metrics_get();
+void metrics_stream(struct dcb *dcb);
+
+#endif
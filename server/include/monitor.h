@@ -167,9 +167,14 @@ typedef struct monitor_servers
     int mon_err_count;
     unsigned int mon_prev_status;
     unsigned int pending_status;  /**< Pending Status flag bitmap */
+    unsigned long probe_usec;     /**< Duration of the last probe in microseconds */
+    unsigned long max_probe_usec; /**< Duration of the longest probe in microseconds */
     struct monitor_servers *next; /**< The next server in the list */
 } MONITOR_SERVERS;
 
+/** Worker threads that probe the servers of a monitor in parallel */
+typedef struct mon_probe_pool MON_PROBE_POOL;
+
 /**
  * Representation of the running monitor.
  */
@@ -194,9 +199,16 @@ typedef struct monitor
     MONITOR_OBJECT *module;       /**< The "monitor object" */
     void *handle;                 /**< Handle returned from startMonitor */
     size_t interval;              /**< The monitor interval */
+    int probe_threads;            /**< Maximum number of parallel probes, 0 for one per server */
+    MON_PROBE_POOL *probe_pool;   /**< Probe worker threads, created on first use */
+    unsigned long cycle_usec;     /**< Duration of the last probe cycle in microseconds */
+    unsigned long max_cycle_usec; /**< Duration of the longest probe cycle in microseconds */
     struct monitor *next;         /**< Next monitor in the linked list */
 } MONITOR;
 
+/** Probe function that is called for each monitored server */
+typedef void (*mon_probe_func_t)(MONITOR *, MONITOR_SERVERS *);
+
 extern MONITOR *monitor_alloc(char *, char *);
 extern void monitor_free(MONITOR *);
 extern MONITOR *monitor_find(char *);
@@ -212,6 +224,7 @@ extern void monitorShow(DCB *, MONITOR *);
 extern void monitorList(DCB *);
 extern void monitorSetInterval (MONITOR *, unsigned long);
 extern bool monitorSetNetworkTimeout(MONITOR *, int, int);
+extern bool monitorSetProbeThreads(MONITOR *, int);
 extern RESULTSET *monitorGetList();
 extern bool check_monitor_permissions(MONITOR* monitor, const char* query);
 
@@ -227,5 +240,6 @@ int mon_parse_event_string(bool* events, size_t count, char* string);
 connect_result_t mon_connect_to_db(MONITOR* mon, MONITOR_SERVERS *database);
 void mon_log_connect_error(MONITOR_SERVERS* database, connect_result_t rval);
 void mon_log_state_change(MONITOR_SERVERS *ptr);
+void mon_probe_servers(MONITOR *mon, mon_probe_func_t probe);
 
 #endif
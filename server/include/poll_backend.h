@@ -0,0 +1,58 @@
+#ifndef _POLL_BACKEND_H
+#define _POLL_BACKEND_H
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file poll_backend.h  - The event notification mechanisms of the poll system
+ *
+ * The polling threads collect the readiness events of the DCBs through a
+ * backend that is chosen when the poll system is initialised. The event bits
+ * are the EPOLL* values for all backends and the descriptors are always
+ * registered edge-triggered.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <dcb.h>
+
+/**
+ * An event returned by a backend
+ */
+typedef struct
+{
+    DCB      *dcb;      /*< The DCB the event is for */
+    uint32_t events;    /*< EPOLL* event bits */
+} POLL_EVENT;
+
+/**
+ * The entry points of a poll backend. The add and remove functions return
+ * 0 on success and -1 with errno set on error, wait returns the number of
+ * events or -1 with errno set.
+ */
+typedef struct poll_backend
+{
+    const char *name;
+    int (*add)(DCB *dcb, uint32_t events);
+    int (*remove)(DCB *dcb);
+    int (*wait)(POLL_EVENT *events, int max_events, int timeout);
+} POLL_BACKEND;
+
+extern POLL_BACKEND *poll_uring_init(int max_events);
+
+#endif
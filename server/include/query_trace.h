@@ -0,0 +1,167 @@
+#ifndef _QUERY_TRACE_H
+#define _QUERY_TRACE_H
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file query_trace.h  - Per-query latency tracing
+ *
+ * When query tracing is enabled, every query routed through a session is
+ * timed with the processor time-stamp counter and its latency is broken
+ * down into phases:
+ *
+ * - client read: from reading the first bytes of the query from the client
+ *   socket until it is handed to the filter chain
+ * - filters: time spent in the filters, excluding the components they call
+ * - classify: time spent in the query classifier
+ * - route: time spent in the router, excluding the classifier
+ * - backend: from the end of routing until the router returns the first
+ *   part of the reply
+ * - client write: time spent passing the first part of the reply through
+ *   the filters and writing it to the client
+ *
+ * The phases are aggregated into histograms per service and the time of
+ * each filter into a histogram per filter. The slowest queries are kept
+ * with their breakdown.
+ */
+
+#include <stdbool.h>
+#include <rdtsc.h>
+#include <spinlock.h>
+#include <statistics.h>
+#include <platform.h>
+
+struct session;
+struct service;
+struct filter_def;
+struct dcb;
+struct gwbuf;
+
+/** The length of the query text kept for the slowest queries */
+#define QUERY_TRACE_SQL_LEN 128
+
+/**
+ * The phases of a query
+ */
+typedef enum
+{
+    QUERY_TRACE_READ,
+    QUERY_TRACE_FILTERS,
+    QUERY_TRACE_CLASSIFY,
+    QUERY_TRACE_ROUTE,
+    QUERY_TRACE_BACKEND,
+    QUERY_TRACE_WRITE,
+    QUERY_TRACE_TOTAL,
+    QUERY_TRACE_PHASES
+} query_trace_phase_t;
+
+/**
+ * The histograms of a service or a filter. The times are in nanoseconds.
+ */
+typedef struct query_trace_stats
+{
+    const char *name;                       /*< Name of the service or filter */
+    const char *module;                     /*< Router or filter module */
+    bool       filter;                      /*< Only the filters phase is used */
+    ts_hist_t  phases[QUERY_TRACE_PHASES];  /*< Time spent in each phase */
+    struct query_trace_stats *next;         /*< Next in the list of all stats */
+} QUERY_TRACE_STATS;
+
+/**
+ * A link in the downstream chain of a traced session. The filters of the
+ * session route their queries to a link, which calls the next component and
+ * charges the time spent in it to the component.
+ */
+typedef struct query_trace_link
+{
+    struct query_trace *trace;      /*< The trace of the session */
+    void *instance;                 /*< Instance of the next component */
+    void *session;                  /*< Session of the next component */
+    int (*routeQuery)(void *instance, void *session, struct gwbuf *request);
+    struct filter_def *filter;      /*< The filter or NULL for the router */
+    CYCLES cycles;                  /*< Time spent in the current query */
+} QUERY_TRACE_LINK;
+
+/**
+ * The timings of one query
+ */
+typedef struct
+{
+    unsigned long seq;                      /*< Number of the query in its session */
+    CYCLES start;                           /*< When the query was read */
+    CYCLES sent;                            /*< When the query reached the router */
+    CYCLES phases[QUERY_TRACE_PHASES];      /*< Time spent in each phase */
+    char   sql[QUERY_TRACE_SQL_LEN];        /*< Start of the query text */
+} QUERY_TRACE_TIMES;
+
+/**
+ * The trace state of a session
+ */
+typedef struct query_trace
+{
+    struct session    *session;     /*< The traced session */
+    SPINLOCK          lock;         /*< Protects the pending query */
+    bool              waiting;      /*< A routed query waits for a reply */
+    unsigned long     seq;          /*< Number of the last query routed */
+    unsigned long     published;    /*< Number of the last query handed over */
+    QUERY_TRACE_TIMES current;      /*< The query being routed */
+    QUERY_TRACE_TIMES pending;      /*< The routed query */
+    int               n_links;      /*< Number of filters and the router */
+    QUERY_TRACE_LINK  links[];      /*< The filters and the router */
+} QUERY_TRACE;
+
+void query_trace_init();
+bool query_trace_enabled();
+bool query_trace_session_init(struct session *session);
+void query_trace_session_free(struct session *session);
+int query_trace_route_query(struct session *session, struct gwbuf *buf);
+int query_trace_route_reply(struct session *session, struct gwbuf *buf);
+void dprintQueryTrace(struct dcb *dcb);
+
+/** The trace of the query the calling thread is routing */
+extern thread_local QUERY_TRACE_TIMES *query_trace_current;
+
+/** Time spent in traced components called by the current component */
+extern thread_local CYCLES query_trace_nested;
+
+/**
+ * Start timing a call to the query classifier
+ *
+ * @return The time-stamp or 0 if no traced query is being routed
+ */
+static inline CYCLES query_trace_classify_start()
+{
+    return query_trace_current ? rdtsc() : 0;
+}
+
+/**
+ * End timing a call to the query classifier
+ *
+ * @param start The value returned by query_trace_classify_start()
+ */
+static inline void query_trace_classify_end(CYCLES start)
+{
+    if (start)
+    {
+        CYCLES elapsed = rdtsc() - start;
+        query_trace_current->phases[QUERY_TRACE_CLASSIFY] += elapsed;
+        query_trace_nested += elapsed;
+    }
+}
+
+#endif
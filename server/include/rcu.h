@@ -0,0 +1,62 @@
+#ifndef _RCU_H
+#define _RCU_H
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file rcu.h  - Deferred reclamation of shared read-mostly data
+ *
+ * Data that is read without locks by the polling threads is replaced by
+ * publishing a new pointer with rcu_assign_pointer() and handing the old
+ * object to rcu_call(). The old object is released once every polling
+ * thread has passed through a quiescent state, that is, returned to the
+ * top of its event loop where it can no longer hold a reference to it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The reclamation node of a retired object. It is embedded in objects that
+ * are retired often so that retiring them does not allocate memory.
+ */
+typedef struct rcu_head
+{
+    void (*func)(void *);       /*< Function that releases the object */
+    void *data;                 /*< The object */
+    uint64_t epoch;             /*< Epoch in which the object was retired */
+    struct rcu_head *next;
+} RCU_HEAD;
+
+/** Load a published pointer */
+#define rcu_dereference(p) (__atomic_load_n(&(p), __ATOMIC_ACQUIRE))
+
+/** Publish a pointer so that readers see a fully initialised object */
+#define rcu_assign_pointer(p, v) (__atomic_store_n(&(p), (v), __ATOMIC_RELEASE))
+
+/** Exchange a published pointer, returns the old value */
+#define rcu_xchg_pointer(p, v) (__atomic_exchange_n(&(p), (v), __ATOMIC_ACQ_REL))
+
+void rcu_init(int n_threads);
+void rcu_quiescent(int thread_id);
+void rcu_offline(int thread_id);
+void rcu_call(void (*func)(void *), void *data);
+void rcu_retire(RCU_HEAD *rcu, void (*func)(void *), void *data);
+int rcu_pending();
+
+#endif
@@ -36,6 +36,8 @@
  * @endverbatim
  */
 
+#include <time.h>
+
 typedef unsigned long long CYCLES;
 
 /**
@@ -50,12 +52,23 @@ typedef unsigned long long CYCLES;
  * obtian accurate timing. This may be done by setting pocessor affinity for
  * the thread. See sched_setaffinity/sched_getaffinity.
  *
+ * The counter is read as two 32-bit halves so that the full value is also
+ * returned on x86-64. Other architectures count nanoseconds of the
+ * monotonic clock instead.
+ *
  * @return CPU cycle count
  */
 static __inline__ CYCLES rdtsc(void)
 {
-    unsigned long long int x;
-    __asm__ volatile (".byte 0x0f, 0x31" : "=A" (x));
-    return x;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int lo, hi;
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((CYCLES)hi << 32) | lo;
+#else
+    /** No time-stamp counter, count nanoseconds instead */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (CYCLES)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
 }
 #endif
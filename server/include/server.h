@@ -90,6 +90,7 @@ typedef struct server {
     unsigned short port;           /**< Port to listen on */
     char           *protocol;      /**< Protocol module to use */
     SSL_LISTENER   *server_ssl;    /**< SSL data structure for server, if any */
+    SSL_SESSION    *ssl_session;   /**< Last SSL session with the server, protected by lock */
     unsigned int   status;         /**< Status flag bitmap for the server */
     char           *monuser;       /**< User name to use to monitor the db */
     char           *monpw;         /**< Password to use to monitor the db */
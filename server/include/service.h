@@ -94,6 +94,25 @@ typedef struct
     time_t last;
 } SERVICE_REFRESH_RATE;
 
+/**
+ * Statistics of the users table reloads of a service
+ */
+typedef struct
+{
+    int n_reloads;         /**< Reloads that replaced the users table */
+    int n_partial;         /**< Reloads that fetched only the changed partitions */
+    int n_unchanged;       /**< Reloads skipped because no users had changed */
+    int n_coalesced;       /**< Refresh requests served by a reload that had just completed */
+    int n_rate_limited;    /**< Refresh requests rejected by the rate limit */
+    int n_failed;          /**< Reloads that failed */
+    long rows;             /**< Rows transferred from the backends */
+    int last_rows;         /**< Rows transferred by the latest reload */
+    long total_ms;         /**< Total time spent reloading */
+    int last_ms;           /**< Duration of the latest reload */
+    int max_ms;            /**< Longest reload */
+    long completed;        /**< The hkheartbeat when the latest reload completed */
+} SERVICE_USERS_STATS;
+
 typedef struct server_ref_t
 {
     struct server_ref_t *next;
@@ -148,6 +167,7 @@ typedef struct service
     bool optimize_wildcard;            /*< Convert wildcard grants to individual database grants */
     SPINLOCK users_table_spin;         /**< The spinlock for users data refresh */
     SERVICE_REFRESH_RATE rate_limit;   /**< The refresh rate limit for users table */
+    SERVICE_USERS_STATS users_stats;   /**< Statistics of the users table reloads */
     FILTER_DEF **filters;              /**< Ordered list of filters */
     int n_filters;                     /**< Number of filters */
     long conn_idle_timeout;            /**< Session timeout in seconds */
@@ -155,6 +175,7 @@ typedef struct service
     struct service *next;              /**< The next service in the linked list */
     bool retry_start;                  /*< If starting of the service should be retried later */
     bool log_auth_warnings;            /*< Log authentication failures and warnings */
+    struct query_trace_stats *trace_stats; /*< Query trace histograms or NULL */
 } SERVICE;
 
 typedef enum count_spec_t
@@ -44,6 +44,7 @@
 #include <resultset.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <query_trace.h>
 
 struct dcb;
 struct service;
@@ -137,41 +138,39 @@ typedef struct session
     SESSION_FILTER  *filters;         /*< The filters in use within this session */
     DOWNSTREAM      head;             /*< Head of the filter chain */
     UPSTREAM        tail;             /*< The tail of the filter chain */
-    struct session  *next;            /*< Linked list of all sessions */
+    struct session  *next;            /*< Next session in the registry shard */
+    struct session  *prev;            /*< Previous session in the registry shard */
+    int             shard;            /*< The registry shard of the session */
     int             refcount;         /*< Reference count on the session */
     bool            ses_is_child;     /*< this is a child session */
+    QUERY_TRACE     *trace;           /*< The query trace or NULL if not traced */
 #if defined(SS_DEBUG)
     skygw_chk_t     ses_chk_tail;
 #endif
 } SESSION;
 
-/** Whether to do session timeout checks */
-extern bool check_timeouts;
-
-/** When the next timeout check is done. This is compared to hkheartbeat in
- * hk_heartbeat.h */
-extern long next_timeout_check;
-
 #define SESSION_PROTOCOL(x, type)       DCB_PROTOCOL((x)->client_dcb, type)
 
 /**
  * A convenience macro that can be used by the protocol modules to route
  * the incoming data to the first element in the pipeline of filters and
- * routers.
+ * routers. The queries of traced sessions are timed.
  */
 #define SESSION_ROUTE_QUERY(sess, buf)                          \
-    ((sess)->head.routeQuery)((sess)->head.instance,            \
-                              (sess)->head.session, (buf))
+    ((sess)->trace ? query_trace_route_query((sess), (buf)) :   \
+     ((sess)->head.routeQuery)((sess)->head.instance,           \
+                               (sess)->head.session, (buf)))
 /**
  * A convenience macro that can be used by the router modules to route
  * the replies to the first element in the pipeline of filters and
- * the protocol.
+ * the protocol. The replies of traced sessions are timed.
  */
 #define SESSION_ROUTE_REPLY(sess, buf)                          \
-    ((sess)->tail.clientReply)((sess)->tail.instance,           \
-                               (sess)->tail.session, (buf))
+    ((sess)->trace ? query_trace_route_reply((sess), (buf)) :   \
+     ((sess)->tail.clientReply)((sess)->tail.instance,          \
+                                (sess)->tail.session, (buf)))
 
-SESSION *get_all_sessions();
+bool session_foreach(bool (*func)(SESSION *, void *), void *data);
 SESSION *session_alloc(struct service *, struct dcb *);
 SESSION *session_set_dummy(struct dcb *);
 bool session_free(SESSION *);
@@ -191,6 +190,4 @@ SESSION* get_session_by_router_ses(void* rses);
 void session_enable_log_priority(SESSION* ses, int priority);
 void session_disable_log_priority(SESSION* ses, int priority);
 RESULTSET *sessionGetList(SESSIONLISTFILTER);
-void process_idle_sessions();
-void enable_session_timeouts();
 #endif
@@ -27,9 +27,36 @@
  * Date         Who              Description
  * 21/01/16     Markus Makela    Initial implementation
  * @endverbatim
+ *
+ * The counters and histograms have a slot for each worker thread and one
+ * slot that the other threads, such as the main, monitor and housekeeper
+ * threads, share. A worker thread only writes to its own slot and the slots
+ * are on separate cache lines, so the workers need neither locks nor atomic
+ * read-modify-write operations. The shared slot is updated atomically.
+ * Readers sum up the slots without stopping the writers.
  */
 
+#include <stdint.h>
+
 typedef void* ts_stats_t;
+typedef void* ts_hist_t;
+
+/** The histograms have exact buckets for values below 2^TS_HIST_SUB_BITS and
+ * split every power of two above that into 2^TS_HIST_SUB_BITS buckets */
+#define TS_HIST_SUB_BITS 3
+#define TS_HIST_SUBS     (1 << TS_HIST_SUB_BITS)
+#define TS_HIST_BUCKETS  ((64 - TS_HIST_SUB_BITS + 1) * TS_HIST_SUBS)
+
+/**
+ * The merged values of a histogram
+ */
+typedef struct
+{
+    int64_t count;                      /*< Number of values */
+    int64_t sum;                        /*< Sum of the values */
+    int64_t max;                        /*< Largest value */
+    int64_t buckets[TS_HIST_BUCKETS];   /*< Number of values in each bucket */
+} ts_hist_snapshot_t;
 
 /** stats_init should be called only once */
 void ts_stats_init();
@@ -40,10 +67,20 @@ void ts_stats_end();
 /** Every thread should call set_current_thread_id only once */
 void ts_stats_set_thread_id(int id);
 
+/** Get the id set with ts_stats_set_thread_id, zero for non-worker threads */
+int ts_stats_get_thread_id();
+
 ts_stats_t ts_stats_alloc();
 void ts_stats_free(ts_stats_t stats);
-void ts_stats_add(ts_stats_t stats, int value);
-void ts_stats_set(ts_stats_t stats, int value);
-int ts_stats_sum(ts_stats_t stats);
+void ts_stats_add(ts_stats_t stats, int64_t value);
+void ts_stats_set(ts_stats_t stats, int64_t value);
+int64_t ts_stats_sum(ts_stats_t stats);
+
+ts_hist_t ts_hist_alloc();
+void ts_hist_free(ts_hist_t hist);
+void ts_hist_add(ts_hist_t hist, uint64_t value);
+void ts_hist_merge(ts_hist_t hist, ts_hist_snapshot_t *snapshot);
+int64_t ts_hist_percentile(const ts_hist_snapshot_t *snapshot, double percentile);
+int64_t ts_hist_count_below(const ts_hist_snapshot_t *snapshot, uint64_t value);
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+/*
+ * This file is distributed as part of the MariaDB Corporation MaxScale.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright MariaDB Corporation Ab 2016
+ */
+
+/**
+ * @file timer_wheel.h  - Per-thread hierarchical timer wheels
+ *
+ * Every polling thread owns a timer wheel that it advances in its event
+ * loop. A timer is armed in the wheel of the thread that arms it and its
+ * function is called by that thread once hkheartbeat reaches the deadline.
+ * Deadlines are expressed in heartbeats, that is, in 100 millisecond units.
+ *
+ * The timer nodes are embedded in the objects they belong to so arming and
+ * cancelling a timer never allocates memory and takes constant time. A timer
+ * may be cancelled from any thread, but only one thread at a time may arm it.
+ * The owner of a timer calls timer_cancel_sync() before freeing it.
+ */
+
+#include <stdbool.h>
+
+/**
+ * A timer
+ */
+typedef struct timer
+{
+    void (*func)(void *);       /*< Called when the timer expires */
+    void *data;                 /*< Argument of the function */
+    long expires;               /*< Deadline in heartbeats */
+    struct timer *next;         /*< Next timer in the same slot */
+    struct timer **pprev;       /*< The link that points to this timer */
+    struct timer_wheel *wheel;  /*< The wheel the timer is armed in or NULL */
+} TIMER;
+
+void timer_wheel_init(int n_threads);
+void timer_wheel_thread(int thread_id);
+int timer_wheel_process(int thread_id);
+int timer_wheel_next(int thread_id);
+int timer_wheel_armed();
+void timer_init(TIMER *timer, void (*func)(void *), void *data);
+void timer_arm(TIMER *timer, long expires);
+bool timer_cancel(TIMER *timer);
+void timer_cancel_sync(TIMER *timer);
+
+#endif
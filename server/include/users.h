@@ -60,6 +60,10 @@ typedef struct users
     char *(*usersCustomUserFormat)(void *); /**< Optional username format routine */
     USERS_STATS stats;                      /**< The statistics for the users table */
     unsigned char cksum[SHA_DIGEST_LENGTH]; /**< The users' table ckecksum */
+    void *index;                            /**< Optional lookup index built by the table owner */
+    void (*indexFree)(void *);              /**< Frees the lookup index */
+    void *rows;                             /**< Optional copy of the loaded rows */
+    void (*rowsFree)(void *);               /**< Frees the copy of the loaded rows */
 } USERS;
 
 extern USERS *users_alloc();                      /**< Allocate a users table */
@@ -1659,7 +1659,8 @@ bool rule_is_active(RULE* rule)
  * @param my_session Fwfilter session
  * @param queue The GWBUF containing the query
  * @param rulelist The rule to check
- * @param query Pointer to the null-terminated query string
+ * @param query Pointer to the query string, not null-terminated
+ * @param query_len Length of the query string
  * @return true if the query matches the rule
  */
 bool rule_matches(FW_INSTANCE* my_instance,
@@ -1667,7 +1668,8 @@ bool rule_matches(FW_INSTANCE* my_instance,
                   GWBUF *queue,
                   USER* user,
                   RULELIST *rulelist,
-                  char* query)
+                  char* query,
+                  int query_len)
 {
     char *ptr, *where, *msg = NULL;
     char emsg[512];
@@ -1711,7 +1713,7 @@ bool rule_matches(FW_INSTANCE* my_instance,
                     if (mdata)
                     {
                         if (pcre2_match((pcre2_code*) rulelist->rule->data,
-                                        (PCRE2_SPTR) query, PCRE2_ZERO_TERMINATED,
+                                        (PCRE2_SPTR) query, query_len,
                                         0, 0, mdata, NULL) > 0)
                         {
                             matches = true;
@@ -1954,7 +1956,10 @@ bool check_match_any(FW_INSTANCE* my_instance, FW_SESSION* my_session,
         (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue) ||
          MYSQL_IS_COM_INIT_DB(queue)))
     {
-        char *fullquery = modutil_get_SQL(queue);
+        char *fullquery = NULL;
+        int qlen = 0;
+        modutil_get_SQL_view(queue, &fullquery, &qlen);
+
         while (rulelist)
         {
             if (!rule_is_active(rulelist->rule))
@@ -1962,7 +1967,7 @@ bool check_match_any(FW_INSTANCE* my_instance, FW_SESSION* my_session,
                 rulelist = rulelist->next;
                 continue;
             }
-            if (rule_matches(my_instance, my_session, queue, user, rulelist, fullquery))
+            if (rule_matches(my_instance, my_session, queue, user, rulelist, fullquery, qlen))
             {
                 *rulename = rulelist->rule->name;
                 rval = true;
@@ -1970,8 +1975,6 @@ bool check_match_any(FW_INSTANCE* my_instance, FW_SESSION* my_session,
             }
             rulelist = rulelist->next;
         }
-
-        free(fullquery);
     }
     return rval;
 }
@@ -1993,7 +1996,9 @@ bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
 
     if (rulelist && (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue)))
     {
-        char *fullquery = modutil_get_SQL(queue);
+        char *fullquery = NULL;
+        int qlen = 0;
+        modutil_get_SQL_view(queue, &fullquery, &qlen);
         rval = true;
         while (rulelist)
         {
@@ -2005,7 +2010,7 @@ bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
 
             have_active_rule = true;
 
-            if (!rule_matches(my_instance, my_session, queue, user, rulelist, fullquery))
+            if (!rule_matches(my_instance, my_session, queue, user, rulelist, fullquery, qlen))
             {
                 *rulename = rulelist->rule->name;
                 rval = false;
@@ -2022,7 +2027,6 @@ bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
             /** No active rules */
             rval = false;
         }
-        free(fullquery);
     }
 
     return rval;
@@ -2136,7 +2140,7 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
             {
                 char *sql;
                 int len;
-                if (modutil_extract_SQL(queue, &sql, &len))
+                if (modutil_get_SQL_view(queue, &sql, &len))
                 {
                     len = MIN(len, FW_MAX_SQL_LEN);
                     if (match && my_instance->log_match & FW_LOG_MATCH)
@@ -39,6 +39,20 @@
  * is defined and valid, the matching entry point function in Lua will be called.
  * The same holds true for session script apart from no calls to createInstance
  * or diagnostic being made for the session script.
+ *
+ * The session script is compiled into bytecode once and the session Lua states
+ * are created from the bytecode. Each thread keeps a pool of ready Lua states
+ * which are leased either for the lifetime of a session or for a single call.
+ *
+ * Optional parameters:
+ *  * pool_size=<n>       - Free session states kept per thread, default 0, or 4
+ *                          with lease=call. A state returned to the pool keeps
+ *                          its global variables.
+ *  * lease=session|call  - Lease a state for the whole session (default) or
+ *                          only for the duration of one call. Requires a
+ *                          non-zero pool_size.
+ *  * reload_interval=<s> - Check the scripts for modifications every s seconds
+ *                          and reload them. Existing sessions keep their states.
  */
 
 #include <skygw_types.h>
@@ -46,9 +60,15 @@
 #include <skygw_debug.h>
 #include <log_manager.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <filter.h>
 #include <session.h>
 #include <modutil.h>
+#include <atomic.h>
+#include <housekeeper.h>
+#include <statistics.h>
+#include <maxconfig.h>
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
@@ -61,7 +81,10 @@ MODULE_INFO info =
     "Lua Filter"
 };
 
-static const char *version_str = "V1.0.0";
+static const char *version_str = "V1.1.0";
+
+/** Default pool size when states are leased per call */
+#define LUA_CALL_POOL_SIZE 4
 
 /**
  * Implementation of the mandatory version entry point
@@ -116,6 +139,7 @@ GetModuleObject()
 }
 
 static int id_pool = 0;
+static int hktask_id = 0;
 
 /**
  * Push an unique integer to the Lua state's stack
@@ -128,6 +152,40 @@ static int id_gen(lua_State* state)
     return 1;
 }
 
+/**
+ * A session script Lua state
+ */
+typedef struct lua_session_state
+{
+    lua_State* state; /*< The Lua state */
+    int generation; /*< Script generation the state was created from */
+    struct lua_session_state* next; /*< Next free state in the pool */
+} LUA_STATE;
+
+/**
+ * Precompiled Lua bytecode
+ */
+typedef struct
+{
+    char* data;
+    size_t len;
+} LUA_CHUNK;
+
+/**
+ * Per thread pool of ready session script states and call statistics
+ */
+typedef struct
+{
+    SPINLOCK lock;
+    LUA_STATE* free; /*< Free states */
+    int n_free; /*< Number of free states */
+    int created; /*< States created from the bytecode */
+    int leased; /*< States leased from the pool */
+    unsigned long calls; /*< Calls to Lua functions */
+    unsigned long cpu_usec; /*< CPU time spent in Lua functions */
+    unsigned long max_usec; /*< Longest call to a Lua function */
+} LUA_POOL;
+
 /**
  * The Lua filter instance.
  */
@@ -137,6 +195,16 @@ typedef struct
     char* global_script;
     char* session_script;
     SPINLOCK lock;
+    LUA_CHUNK chunk; /*< Precompiled session script */
+    int generation; /*< Incremented each time the session script is reloaded */
+    SPINLOCK chunk_lock; /*< Protects the precompiled session script */
+    LUA_POOL* pools; /*< Per thread state pools */
+    int n_pools; /*< Number of pools */
+    int pool_size; /*< Maximum number of free states per thread */
+    bool lease_per_call; /*< Lease session states for one call at a time */
+    int reload_interval; /*< How often to check for modified scripts */
+    time_t global_mtime; /*< Modification time of the loaded global script */
+    time_t session_mtime; /*< Modification time of the loaded session script */
 } LUA_INSTANCE;
 
 /**
@@ -145,10 +213,12 @@ typedef struct
 typedef struct
 {
     SESSION* session;
-    lua_State* lua_state;
+    LUA_STATE* lua_state; /*< Leased state, NULL when leasing per call */
     SPINLOCK lock;
     DOWNSTREAM down;
     UPSTREAM up;
+    unsigned long calls; /*< Calls to Lua functions */
+    unsigned long cpu_usec; /*< CPU time spent in Lua functions */
 } LUA_SESSION;
 
 /**
@@ -160,11 +230,445 @@ ModuleInit()
 {
 }
 
+/**
+ * Get the state pool of the calling thread
+ * @param instance Filter instance
+ * @return The state pool
+ */
+static LUA_POOL* lua_get_pool(LUA_INSTANCE *instance)
+{
+    return &instance->pools[ts_stats_get_thread_id() % instance->n_pools];
+}
+
+/**
+ * Call a Lua function and record the CPU time spent in it
+ *
+ * The function and its arguments must already be on the stack.
+ * @param instance Filter instance
+ * @param session Filter session or NULL for calls outside a session
+ * @param state Lua state
+ * @param nargs Number of arguments
+ * @param nresults Number of results
+ * @return The return value of lua_pcall
+ */
+static int lua_timed_pcall(LUA_INSTANCE *instance, LUA_SESSION *session,
+                           lua_State *state, int nargs, int nresults)
+{
+    struct timespec start, end;
+    unsigned long usec;
+    int rc;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    rc = lua_pcall(state, nargs, nresults, 0);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+    usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+
+    if (instance->pools)
+    {
+        LUA_POOL *pool = lua_get_pool(instance);
+        spinlock_acquire(&pool->lock);
+        pool->calls++;
+        pool->cpu_usec += usec;
+        if (usec > pool->max_usec)
+        {
+            pool->max_usec = usec;
+        }
+        spinlock_release(&pool->lock);
+    }
+
+    if (session)
+    {
+        session->calls++;
+        session->cpu_usec += usec;
+    }
+
+    return rc;
+}
+
+/**
+ * Append a piece of a dumped Lua chunk to a buffer
+ * @param state Lua state
+ * @param p Data to append
+ * @param sz Size of the data
+ * @param ud The buffer
+ * @return 0 on success, 1 on memory allocation failure
+ */
+static int lua_chunk_writer(lua_State *state, const void *p, size_t sz, void *ud)
+{
+    LUA_CHUNK *chunk = (LUA_CHUNK*) ud;
+    char *data = realloc(chunk->data, chunk->len + sz);
+
+    if (data == NULL)
+    {
+        return 1;
+    }
+
+    memcpy(data + chunk->len, p, sz);
+    chunk->data = data;
+    chunk->len += sz;
+    return 0;
+}
+
+/**
+ * Compile a Lua script into bytecode
+ * @param script Path to the script
+ * @param dest Where the bytecode is stored
+ * @return True if the script was compiled successfully
+ */
+static bool lua_compile_script(const char *script, LUA_CHUNK *dest)
+{
+    lua_State *state;
+    bool rval = false;
+
+    dest->data = NULL;
+    dest->len = 0;
+
+    if ((state = luaL_newstate()) == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        return false;
+    }
+
+    if (luaL_loadfile(state, script))
+    {
+        MXS_ERROR("luafilter: Failed to load session script at '%s': %s.",
+                  script, lua_tostring(state, -1));
+    }
+#if LUA_VERSION_NUM >= 503
+    else if (lua_dump(state, lua_chunk_writer, dest, 0))
+#else
+    else if (lua_dump(state, lua_chunk_writer, dest))
+#endif
+    {
+        MXS_ERROR("luafilter: Failed to compile session script at '%s'.", script);
+        free(dest->data);
+        dest->data = NULL;
+    }
+    else
+    {
+        rval = true;
+    }
+
+    lua_close(state);
+    return rval;
+}
+
+/**
+ * Create a new session script state from the precompiled bytecode
+ *
+ * The script is executed on a global level and the id_gen function is
+ * exported to it.
+ * @param instance Filter instance
+ * @return New state or NULL on error
+ */
+static LUA_STATE* lua_create_state(LUA_INSTANCE *instance)
+{
+    LUA_STATE *st;
+    int rc;
+
+    if ((st = calloc(1, sizeof(LUA_STATE))) == NULL)
+    {
+        return NULL;
+    }
+
+    if ((st->state = luaL_newstate()) == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        free(st);
+        return NULL;
+    }
+
+    luaL_openlibs(st->state);
+    lua_pushcfunction(st->state, id_gen);
+    lua_setglobal(st->state, "id_gen");
+
+    spinlock_acquire(&instance->chunk_lock);
+    st->generation = instance->generation;
+    rc = luaL_loadbuffer(st->state, instance->chunk.data, instance->chunk.len,
+                         instance->session_script);
+    spinlock_release(&instance->chunk_lock);
+
+    if (rc || lua_pcall(st->state, 0, 0, 0))
+    {
+        MXS_ERROR("luafilter: Failed to execute session script at '%s': %s.",
+                  instance->session_script, lua_tostring(st->state, -1));
+        lua_close(st->state);
+        free(st);
+        return NULL;
+    }
+
+    return st;
+}
+
+/**
+ * Free a session script state
+ * @param st State to free
+ */
+static void lua_free_state(LUA_STATE *st)
+{
+    lua_close(st->state);
+    free(st);
+}
+
+/**
+ * Lease a session script state from the pool of the calling thread
+ *
+ * States created from an older version of the script are discarded. If the
+ * pool is empty, a new state is created.
+ * @param instance Filter instance
+ * @return Leased state or NULL on error
+ */
+static LUA_STATE* lua_lease_state(LUA_INSTANCE *instance)
+{
+    LUA_POOL *pool = lua_get_pool(instance);
+    LUA_STATE *st = NULL, *stale = NULL;
+
+    spinlock_acquire(&pool->lock);
+    while (pool->free && st == NULL)
+    {
+        LUA_STATE *next = pool->free->next;
+
+        if (pool->free->generation == instance->generation)
+        {
+            st = pool->free;
+        }
+        else
+        {
+            pool->free->next = stale;
+            stale = pool->free;
+        }
+        pool->free = next;
+        pool->n_free--;
+    }
+    pool->leased++;
+    spinlock_release(&pool->lock);
+
+    while (stale)
+    {
+        LUA_STATE *next = stale->next;
+        lua_free_state(stale);
+        stale = next;
+    }
+
+    if (st == NULL && (st = lua_create_state(instance)))
+    {
+        atomic_add(&pool->created, 1);
+    }
+
+    if (st)
+    {
+        st->next = NULL;
+    }
+
+    return st;
+}
+
+/**
+ * Return a leased state to the pool of the calling thread
+ *
+ * The state is freed if the pool is full or the script has been reloaded.
+ * @param instance Filter instance
+ * @param st Leased state
+ */
+static void lua_release_state(LUA_INSTANCE *instance, LUA_STATE *st)
+{
+    LUA_POOL *pool = lua_get_pool(instance);
+    bool pooled = false;
+
+    lua_settop(st->state, 0);
+
+    spinlock_acquire(&pool->lock);
+    if (pool->n_free < instance->pool_size && st->generation == instance->generation)
+    {
+        st->next = pool->free;
+        pool->free = st;
+        pool->n_free++;
+        pooled = true;
+    }
+    spinlock_release(&pool->lock);
+
+    if (!pooled)
+    {
+        lua_free_state(st);
+    }
+}
+
+/**
+ * Get the session script state for a call
+ * @param instance Filter instance
+ * @param session Filter session
+ * @return The session's state or a state leased for this call
+ */
+static LUA_STATE* lua_session_state(LUA_INSTANCE *instance, LUA_SESSION *session)
+{
+    if (instance->session_script == NULL)
+    {
+        return NULL;
+    }
+
+    return instance->lease_per_call ? lua_lease_state(instance) : session->lua_state;
+}
+
+/**
+ * Release a state returned by lua_session_state
+ * @param instance Filter instance
+ * @param st The state
+ */
+static void lua_session_state_done(LUA_INSTANCE *instance, LUA_STATE *st)
+{
+    if (st)
+    {
+        if (instance->lease_per_call)
+        {
+            lua_release_state(instance, st);
+        }
+        else
+        {
+            lua_settop(st->state, 0);
+        }
+    }
+}
+
+/**
+ * Load the global script and call its createInstance function
+ * @param script Path to the script
+ * @return New Lua state or NULL on error
+ */
+static lua_State* lua_load_global_script(const char *script)
+{
+    lua_State *state;
+
+    if ((state = luaL_newstate()) == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        return NULL;
+    }
+
+    luaL_openlibs(state);
+
+    if (luaL_dofile(state, script))
+    {
+        MXS_ERROR("luafilter: Failed to execute global script at '%s':%s.",
+                  script, lua_tostring(state, -1));
+        lua_close(state);
+        return NULL;
+    }
+
+    lua_getglobal(state, "createInstance");
+    if (lua_pcall(state, 0, 0, 0))
+    {
+        MXS_WARNING("luafilter: Failed to get global variable 'createInstance':  %s."
+                    " The createInstance entry point will not be called for the global script.",
+                    lua_tostring(state, -1));
+    }
+    lua_settop(state, 0);
+
+    return state;
+}
+
+/**
+ * Get the modification time of a file
+ * @param path Path to the file
+ * @return Modification time or 0 if the file could not be accessed
+ */
+static time_t lua_script_mtime(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+/**
+ * Housekeeper task that reloads modified scripts
+ *
+ * A modified session script is recompiled and new sessions will use the new
+ * version. Existing sessions keep their states until they are closed. A
+ * modified global script replaces the global state. If a script fails to load,
+ * the old version remains in use.
+ * @param data Filter instance
+ */
+static void lua_reload_scripts(void *data)
+{
+    LUA_INSTANCE *instance = (LUA_INSTANCE*) data;
+    time_t mtime;
+
+    if (instance->session_script &&
+        (mtime = lua_script_mtime(instance->session_script)) != instance->session_mtime)
+    {
+        LUA_CHUNK compiled;
+        instance->session_mtime = mtime;
+
+        if (lua_compile_script(instance->session_script, &compiled))
+        {
+            char *old;
+
+            spinlock_acquire(&instance->chunk_lock);
+            old = instance->chunk.data;
+            instance->chunk = compiled;
+            atomic_add(&instance->generation, 1);
+            spinlock_release(&instance->chunk_lock);
+
+            free(old);
+            MXS_NOTICE("luafilter: Reloaded session script '%s'.", instance->session_script);
+        }
+    }
+
+    if (instance->global_script &&
+        (mtime = lua_script_mtime(instance->global_script)) != instance->global_mtime)
+    {
+        lua_State *state, *old;
+        instance->global_mtime = mtime;
+
+        if ((state = lua_load_global_script(instance->global_script)))
+        {
+            spinlock_acquire(&instance->lock);
+            old = instance->global_lua_state;
+            instance->global_lua_state = state;
+            spinlock_release(&instance->lock);
+
+            lua_close(old);
+            MXS_NOTICE("luafilter: Reloaded global script '%s'.", instance->global_script);
+        }
+    }
+}
+
+/**
+ * Free a filter instance
+ * @param instance Instance to free
+ */
+static void lua_free_instance(LUA_INSTANCE *instance)
+{
+    if (instance->pools)
+    {
+        for (int i = 0; i < instance->n_pools; i++)
+        {
+            while (instance->pools[i].free)
+            {
+                LUA_STATE *next = instance->pools[i].free->next;
+                lua_free_state(instance->pools[i].free);
+                instance->pools[i].free = next;
+            }
+        }
+        free(instance->pools);
+    }
+
+    if (instance->global_lua_state)
+    {
+        lua_close(instance->global_lua_state);
+    }
+
+    free(instance->chunk.data);
+    free(instance->global_script);
+    free(instance->session_script);
+    free(instance);
+}
+
 /**
  * Create a new instance of the Lua filter.
  *
  * The global script will be loaded in this function and executed once on a global
- * level before calling the createInstance function in the Lua script.
+ * level before calling the createInstance function in the Lua script. The session
+ * script is compiled into bytecode and the state pools are filled.
  * @param options The options for this filter
  * @param params  Filter parameters
  * @return The instance data for this new instance
@@ -173,6 +677,7 @@ static FILTER *
 createInstance(char **options, FILTER_PARAMETER **params)
 {
     LUA_INSTANCE *my_instance;
+    bool pool_size_set = false;
     bool error = false;
 
     if ((my_instance = (LUA_INSTANCE*) calloc(1, sizeof(LUA_INSTANCE))) == NULL)
@@ -181,6 +686,7 @@ createInstance(char **options, FILTER_PARAMETER **params)
     }
 
     spinlock_init(&my_instance->lock);
+    spinlock_init(&my_instance->chunk_lock);
 
     for (int i = 0; params[i] && !error; i++)
     {
@@ -192,6 +698,35 @@ createInstance(char **options, FILTER_PARAMETER **params)
         {
             error = (my_instance->session_script = strdup(params[i]->value)) == NULL;
         }
+        else if (strcmp(params[i]->name, "pool_size") == 0)
+        {
+            if ((my_instance->pool_size = atoi(params[i]->value)) < 0)
+            {
+                MXS_ERROR("luafilter: Invalid value for 'pool_size': %s", params[i]->value);
+                error = true;
+            }
+            pool_size_set = true;
+        }
+        else if (strcmp(params[i]->name, "lease") == 0)
+        {
+            if (strcmp(params[i]->value, "call") == 0)
+            {
+                my_instance->lease_per_call = true;
+            }
+            else if (strcmp(params[i]->value, "session") != 0)
+            {
+                MXS_ERROR("luafilter: Invalid value for 'lease': %s", params[i]->value);
+                error = true;
+            }
+        }
+        else if (strcmp(params[i]->name, "reload_interval") == 0)
+        {
+            if ((my_instance->reload_interval = atoi(params[i]->value)) < 0)
+            {
+                MXS_ERROR("luafilter: Invalid value for 'reload_interval': %s", params[i]->value);
+                error = true;
+            }
+        }
         else if (!filter_standard_parameter(params[i]->name))
         {
             MXS_ERROR("Unexpected parameter '%s'", params[i]->name);
@@ -199,46 +734,82 @@ createInstance(char **options, FILTER_PARAMETER **params)
         }
     }
 
-    if (error)
+    if (!error && my_instance->lease_per_call)
     {
-        free(my_instance->global_script);
-        free(my_instance->session_script);
-        free(my_instance);
-        return NULL;
+        /** Without a pool every call would create and load a new state */
+        if (!pool_size_set)
+        {
+            my_instance->pool_size = LUA_CALL_POOL_SIZE;
+        }
+        else if (my_instance->pool_size == 0)
+        {
+            MXS_ERROR("luafilter: 'lease=call' requires a non-zero 'pool_size'.");
+            error = true;
+        }
+    }
+
+    if (!error && my_instance->session_script && my_instance->pool_size > 0)
+    {
+        MXS_WARNING("luafilter: The session states of '%s' are pooled and reused, "
+                    "their global variables are kept from one session to the next.",
+                    my_instance->session_script);
+    }
+
+    if (!error && my_instance->session_script)
+    {
+        my_instance->session_mtime = lua_script_mtime(my_instance->session_script);
+        error = !lua_compile_script(my_instance->session_script, &my_instance->chunk);
+    }
+
+    if (!error)
+    {
+        my_instance->n_pools = config_threadcount();
+        error = (my_instance->pools = calloc(my_instance->n_pools, sizeof(LUA_POOL))) == NULL;
+
+        for (int i = 0; !error && i < my_instance->n_pools; i++)
+        {
+            spinlock_init(&my_instance->pools[i].lock);
+        }
     }
 
-    if (my_instance->global_script)
+    if (!error && my_instance->global_script)
     {
-        if ((my_instance->global_lua_state = luaL_newstate()))
+        my_instance->global_mtime = lua_script_mtime(my_instance->global_script);
+        error = (my_instance->global_lua_state =
+                 lua_load_global_script(my_instance->global_script)) == NULL;
+    }
+
+    /** Fill the pools so that new sessions do not need to create states */
+    for (int i = 0; !error && my_instance->session_script && i < my_instance->n_pools; i++)
+    {
+        LUA_POOL *pool = &my_instance->pools[i];
+
+        while (!error && pool->n_free < my_instance->pool_size)
         {
-            luaL_openlibs(my_instance->global_lua_state);
+            LUA_STATE *st = lua_create_state(my_instance);
 
-            if (luaL_dofile(my_instance->global_lua_state, my_instance->global_script))
+            if (st)
             {
-                MXS_ERROR("luafilter: Failed to execute global script at '%s':%s.",
-                          my_instance->global_script, lua_tostring(my_instance->global_lua_state, -1));
-                free(my_instance->global_script);
-                free(my_instance->session_script);
-                free(my_instance);
-                my_instance = NULL;
-            }
-            else if (my_instance->global_lua_state)
-            {
-                lua_getglobal(my_instance->global_lua_state, "createInstance");
-                if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
-                {
-                    MXS_WARNING("luafilter: Failed to get global variable 'createInstance':  %s."
-                                " The createInstance entry point will not be called for the global script.",
-                                lua_tostring(my_instance->global_lua_state, -1));
-                }
+                st->next = pool->free;
+                pool->free = st;
+                pool->n_free++;
+                pool->created++;
             }
+            error = st == NULL;
         }
-        else
-        {
-            MXS_ERROR("Unable to initialize new Lua state.");
-            free(my_instance);
-            my_instance = NULL;
-        }
+    }
+
+    if (error)
+    {
+        lua_free_instance(my_instance);
+        return NULL;
+    }
+
+    if (my_instance->reload_interval > 0)
+    {
+        char taskname[64];
+        snprintf(taskname, sizeof(taskname), "luafilter reload %d", atomic_add(&hktask_id, 1));
+        hktask_add(taskname, lua_reload_scripts, my_instance, my_instance->reload_interval);
     }
 
     return(FILTER *) my_instance;
@@ -250,8 +821,9 @@ createInstance(char **options, FILTER_PARAMETER **params)
  * This function is called for each new client session and it is used to initialize
  * data used for the duration of the session.
  *
- * This function first loads the session script and executes in on a global level.
- * After this, the newSession function in the Lua scripts is called.
+ * The session leases a ready session script state from the pool of the current
+ * thread unless states are leased per call. After this, the newSession function
+ * in the Lua scripts is called.
  *
  * There is a single C function exported as a global variable for the session
  * script named id_gen. The id_gen function returns an integer that is unique for
@@ -264,6 +836,7 @@ static void * newSession(FILTER *instance, SESSION *session)
 {
     LUA_SESSION *my_session;
     LUA_INSTANCE *my_instance = (LUA_INSTANCE*) instance;
+    LUA_STATE *st;
 
     if ((my_session = (LUA_SESSION*) calloc(1, sizeof(LUA_SESSION))) == NULL)
     {
@@ -273,45 +846,38 @@ static void * newSession(FILTER *instance, SESSION *session)
     spinlock_init(&my_session->lock);
     my_session->session = session;
 
-    if (my_instance->session_script)
+    if (my_instance->session_script && !my_instance->lease_per_call &&
+        (my_session->lua_state = lua_lease_state(my_instance)) == NULL)
     {
-        my_session->lua_state = luaL_newstate();
-        luaL_openlibs(my_session->lua_state);
+        free(my_session);
+        return NULL;
+    }
 
-        if (luaL_dofile(my_session->lua_state, my_instance->session_script))
-        {
-            MXS_ERROR("luafilter: Failed to execute session script at '%s': %s.",
-                      my_instance->session_script,
-                      lua_tostring(my_session->lua_state, -1));
-            lua_close(my_session->lua_state);
-            free(my_session);
-            my_session = NULL;
-        }
-        else
+    if ((st = lua_session_state(my_instance, my_session)))
+    {
+        spinlock_acquire(&my_session->lock);
+        lua_getglobal(st->state, "newSession");
+        if (lua_timed_pcall(my_instance, my_session, st->state, 0, 0))
         {
-            lua_pushcfunction(my_session->lua_state, id_gen);
-            lua_setglobal(my_session->lua_state, "id_gen");
-
-            lua_getglobal(my_session->lua_state, "newSession");
-            if (lua_pcall(my_session->lua_state, 0, 0, 0))
-            {
-                MXS_WARNING("luafilter: Failed to get global variable 'newSession': '%s'."
-                          " The newSession entry point will not be called.",
-                          lua_tostring(my_session->lua_state, -1));
-            }
+            MXS_WARNING("luafilter: Failed to get global variable 'newSession': '%s'."
+                        " The newSession entry point will not be called.",
+                        lua_tostring(st->state, -1));
         }
+        spinlock_release(&my_session->lock);
+        lua_session_state_done(my_instance, st);
     }
 
-    if (my_session && my_instance->global_lua_state)
+    if (my_instance->global_lua_state)
     {
         spinlock_acquire(&my_instance->lock);
         lua_getglobal(my_instance->global_lua_state, "newSession");
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_timed_pcall(my_instance, my_session, my_instance->global_lua_state, 0, 0))
         {
             MXS_WARNING("luafilter: Failed to get global variable 'newSession': '%s'."
                       " The newSession entry point will not be called for the global script.",
                       lua_tostring(my_instance->global_lua_state, -1));
         }
+        lua_settop(my_instance->global_lua_state, 0);
         spinlock_release(&my_instance->lock);
     }
 
@@ -330,31 +896,33 @@ static void closeSession(FILTER *instance, void *session)
 {
     LUA_SESSION *my_session = (LUA_SESSION *) session;
     LUA_INSTANCE *my_instance = (LUA_INSTANCE*) instance;
+    LUA_STATE *st;
 
-
-    if (my_session->lua_state)
+    if ((st = lua_session_state(my_instance, my_session)))
     {
         spinlock_acquire(&my_session->lock);
-        lua_getglobal(my_session->lua_state, "closeSession");
-        if (lua_pcall(my_session->lua_state, 0, 0, 0))
+        lua_getglobal(st->state, "closeSession");
+        if (lua_timed_pcall(my_instance, my_session, st->state, 0, 0))
         {
             MXS_WARNING("luafilter: Failed to get global variable 'closeSession': '%s'."
                         " The closeSession entry point will not be called.",
-                      lua_tostring(my_session->lua_state, -1));
+                        lua_tostring(st->state, -1));
         }
         spinlock_release(&my_session->lock);
+        lua_session_state_done(my_instance, st);
     }
 
     if (my_instance->global_lua_state)
     {
         spinlock_acquire(&my_instance->lock);
         lua_getglobal(my_instance->global_lua_state, "closeSession");
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_timed_pcall(my_instance, my_session, my_instance->global_lua_state, 0, 0))
         {
             MXS_WARNING("luafilter: Failed to get global variable 'closeSession': '%s'."
                         " The closeSession entry point will not be called for the global script.",
                         lua_tostring(my_instance->global_lua_state, -1));
         }
+        lua_settop(my_instance->global_lua_state, 0);
         spinlock_release(&my_instance->lock);
     }
 }
@@ -362,13 +930,18 @@ static void closeSession(FILTER *instance, void *session)
 /**
  * Free the memory associated with the session
  *
+ * A state leased for the session is returned to the pool.
  * @param instance	The filter instance
  * @param session	The filter session
  */
 static void freeSession(FILTER *instance, void *session)
 {
     LUA_SESSION *my_session = (LUA_SESSION *) session;
-    lua_close(my_session->lua_state);
+
+    if (my_session->lua_state)
+    {
+        lua_release_state((LUA_INSTANCE*) instance, my_session->lua_state);
+    }
     free(my_session);
 }
 
@@ -411,27 +984,30 @@ static int clientReply(FILTER *instance, void *session, GWBUF *queue)
 {
     LUA_SESSION *my_session = (LUA_SESSION *) session;
     LUA_INSTANCE *my_instance = (LUA_INSTANCE *) instance;
+    LUA_STATE *st;
 
-    if (my_session->lua_state)
+    if ((st = lua_session_state(my_instance, my_session)))
     {
         spinlock_acquire(&my_session->lock);
-        lua_getglobal(my_session->lua_state, "clientReply");
-        if (lua_pcall(my_session->lua_state, 0, 0, 0))
+        lua_getglobal(st->state, "clientReply");
+        if (lua_timed_pcall(my_instance, my_session, st->state, 0, 0))
         {
             MXS_ERROR("luafilter: Session scope call to 'clientReply' failed: '%s'.",
-                      lua_tostring(my_session->lua_state, -1));
+                      lua_tostring(st->state, -1));
         }
         spinlock_release(&my_session->lock);
+        lua_session_state_done(my_instance, st);
     }
     if (my_instance->global_lua_state)
     {
         spinlock_acquire(&my_instance->lock);
         lua_getglobal(my_instance->global_lua_state, "clientReply");
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_timed_pcall(my_instance, my_session, my_instance->global_lua_state, 0, 0))
         {
             MXS_ERROR("luafilter: Global scope call to 'clientReply' failed: '%s'.",
-                      lua_tostring(my_session->lua_state, -1));
+                      lua_tostring(my_instance->global_lua_state, -1));
         }
+        lua_settop(my_instance->global_lua_state, 0);
         spinlock_release(&my_instance->lock);
     }
 
@@ -462,73 +1038,77 @@ static int routeQuery(FILTER *instance, void *session, GWBUF *queue)
     LUA_SESSION *my_session = (LUA_SESSION *) session;
     LUA_INSTANCE *my_instance = (LUA_INSTANCE *) instance;
     DCB* dcb = my_session->session->client_dcb;
-    char *fullquery = NULL, *ptr;
+    char *sql;
+    int length;
     bool route = true;
     GWBUF* forward = queue;
+    LUA_STATE *st;
     int rc = 0;
 
-    if (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue))
+    if ((modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue)) &&
+        modutil_get_SQL_view(queue, &sql, &length))
     {
-        fullquery = modutil_get_SQL(queue);
+        /** The query is pushed to both scripts before the original buffer is freed */
+        GWBUF *replaced = NULL;
 
-        if (fullquery && my_session->lua_state)
+        if ((st = lua_session_state(my_instance, my_session)))
         {
             spinlock_acquire(&my_session->lock);
-            lua_getglobal(my_session->lua_state, "routeQuery");
-            lua_pushlstring(my_session->lua_state, fullquery, strlen(fullquery));
-            if (lua_pcall(my_session->lua_state, 1, 1, 0))
+            lua_getglobal(st->state, "routeQuery");
+            lua_pushlstring(st->state, sql, length);
+            if (lua_timed_pcall(my_instance, my_session, st->state, 1, 1))
             {
                 MXS_ERROR("luafilter: Session scope call to 'routeQuery' failed: '%s'.",
-                          lua_tostring(my_session->lua_state, -1));
+                          lua_tostring(st->state, -1));
             }
-            else if (lua_gettop(my_session->lua_state))
+            else if (lua_gettop(st->state))
             {
-                if (lua_isstring(my_session->lua_state, -1))
+                if (lua_isstring(st->state, -1))
                 {
-                    if (forward)
-                    {
-                        gwbuf_free(forward);
-                    }
-                    forward = modutil_create_query((char*) lua_tostring(my_session->lua_state, -1));
+                    gwbuf_free(replaced);
+                    replaced = modutil_create_query((char*) lua_tostring(st->state, -1));
                 }
-                else if (lua_isboolean(my_session->lua_state, -1))
+                else if (lua_isboolean(st->state, -1))
                 {
-                    route = lua_toboolean(my_session->lua_state, -1);
+                    route = lua_toboolean(st->state, -1);
                 }
             }
             spinlock_release(&my_session->lock);
+            lua_session_state_done(my_instance, st);
         }
 
         if (my_instance->global_lua_state)
         {
             spinlock_acquire(&my_instance->lock);
             lua_getglobal(my_instance->global_lua_state, "routeQuery");
-            lua_pushlstring(my_instance->global_lua_state, fullquery, strlen(fullquery));
-            if (lua_pcall(my_instance->global_lua_state, 1, 0, 0))
+            lua_pushlstring(my_instance->global_lua_state, sql, length);
+            if (lua_timed_pcall(my_instance, my_session, my_instance->global_lua_state, 1, 0))
             {
                 MXS_ERROR("luafilter: Global scope call to 'routeQuery' failed: '%s'.",
-                          lua_tostring(my_session->lua_state, -1));
+                          lua_tostring(my_instance->global_lua_state, -1));
             }
             else if (lua_gettop(my_instance->global_lua_state))
             {
                 if (lua_isstring(my_instance->global_lua_state, -1))
                 {
-                    if (forward)
-                    {
-                        gwbuf_free(forward);
-                    }
-                    forward = modutil_create_query((char*)
-                                                   lua_tostring(my_instance->global_lua_state, -1));
+                    gwbuf_free(replaced);
+                    replaced = modutil_create_query((char*)
+                                                    lua_tostring(my_instance->global_lua_state, -1));
                 }
                 else if (lua_isboolean(my_instance->global_lua_state, -1))
                 {
                     route = lua_toboolean(my_instance->global_lua_state, -1);
                 }
             }
+            lua_settop(my_instance->global_lua_state, 0);
             spinlock_release(&my_instance->lock);
         }
 
-        free(fullquery);
+        if (replaced)
+        {
+            gwbuf_free(queue);
+            queue = forward = replaced;
+        }
     }
 
     if (!route)
@@ -558,6 +1138,7 @@ static int routeQuery(FILTER *instance, void *session, GWBUF *queue)
 static void diagnostic(FILTER *instance, void *fsession, DCB *dcb)
 {
     LUA_INSTANCE *my_instance = (LUA_INSTANCE *) instance;
+    LUA_SESSION *my_session = (LUA_SESSION *) fsession;
 
     if (my_instance)
     {
@@ -579,6 +1160,7 @@ static void diagnostic(FILTER *instance, void *fsession, DCB *dcb)
                 dcb_printf(dcb, "Global scope call to 'diagnostic' failed: '%s'.\n",
                            lua_tostring(my_instance->global_lua_state, -1));
             }
+            lua_settop(my_instance->global_lua_state, 0);
             spinlock_release(&my_instance->lock);
         }
         if (my_instance->global_script)
@@ -588,6 +1170,39 @@ static void diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         if (my_instance->session_script)
         {
             dcb_printf(dcb, "Session script: %s\n", my_instance->session_script);
+            dcb_printf(dcb, "Session script version: %d\n", my_instance->generation);
+            dcb_printf(dcb, "State lease: %s\n", my_instance->lease_per_call ? "call" : "session");
+        }
+
+        if (my_session)
+        {
+            dcb_printf(dcb, "Lua calls: %lu\n", my_session->calls);
+            dcb_printf(dcb, "CPU time in Lua: %lu usec\n", my_session->cpu_usec);
+        }
+        else
+        {
+            unsigned long calls = 0, cpu_usec = 0, max_usec = 0;
+            int n_free = 0, created = 0, leased = 0;
+
+            for (int i = 0; i < my_instance->n_pools; i++)
+            {
+                LUA_POOL *pool = &my_instance->pools[i];
+                spinlock_acquire(&pool->lock);
+                calls += pool->calls;
+                cpu_usec += pool->cpu_usec;
+                max_usec = MAX(max_usec, pool->max_usec);
+                n_free += pool->n_free;
+                created += pool->created;
+                leased += pool->leased;
+                spinlock_release(&pool->lock);
+            }
+
+            dcb_printf(dcb, "Free pooled states: %d\n", n_free);
+            dcb_printf(dcb, "States created: %d\n", created);
+            dcb_printf(dcb, "States leased: %d\n", leased);
+            dcb_printf(dcb, "Lua calls: %lu\n", calls);
+            dcb_printf(dcb, "CPU time in Lua: %lu usec\n", cpu_usec);
+            dcb_printf(dcb, "Longest Lua call: %lu usec\n", max_usec);
         }
     }
 }
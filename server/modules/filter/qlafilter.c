@@ -450,16 +450,16 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
 
     if (my_session->active)
     {
-        if (queue->next != NULL)
-        {
-            queue = gwbuf_make_contiguous(queue);
-        }
-        if ((ptr = modutil_get_SQL(queue)) != NULL)
+        if (modutil_get_SQL_view(queue, &ptr, &length))
         {
+            /** The SQL is not NULL terminated, REG_STARTEND limits the match */
+            regmatch_t limits[] = {{0, length}};
+            regmatch_t nolimits[] = {{0, length}};
+
             if ((my_instance->match == NULL ||
-                 regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
+                 regexec(&my_instance->re, ptr, 1, limits, REG_STARTEND) == 0) &&
                 (my_instance->nomatch == NULL ||
-                 regexec(&my_instance->nore, ptr, 0, NULL, 0) != 0))
+                 regexec(&my_instance->nore, ptr, 1, nolimits, REG_STARTEND) != 0))
             {
                 gettimeofday(&tv, NULL);
                 localtime_r(&tv.tv_sec, &t);
@@ -468,10 +468,9 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
                         t.tm_hour, t.tm_min, t.tm_sec, (int) (tv.tv_usec / 1000),
                         t.tm_mday, t.tm_mon + 1, 1900 + t.tm_year);
                 fprintf(my_session->fp, "%s@%s, ", my_session->user, my_session->remote);
-                fprintf(my_session->fp, "%s\n", ptr);
+                fprintf(my_session->fp, "%.*s\n", length, ptr);
 
             }
-            free(ptr);
         }
     }
     /* Pass the query downstream */
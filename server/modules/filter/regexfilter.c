@@ -24,8 +24,10 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <string.h>
+#include <ctype.h>
 #include <pcre2.h>
 #include <atomic.h>
+#include <statistics.h>
 #include "maxconfig.h"
 
 /**
@@ -36,6 +38,9 @@
  * Two parameters should be defined in the filter configuration
  *      match=<regular expression>
  *      replace=<replacement text>
+ * Additional rules can be defined with numbered parameters
+ *      match<N>=<regular expression>
+ *      replace<N>=<replacement text>
  * Two optional parameters
  *      source=<source address to limit filter>
  *      user=<username to limit filter>
@@ -53,7 +58,13 @@ MODULE_INFO info =
     "A query rewrite filter that uses regular expressions to rewite queries"
 };
 
-static char *version_str = "V1.1.0";
+static char *version_str = "V1.2.0";
+
+/** Default number of cached rewrites per thread */
+#define REGEX_DEFAULT_CACHE_SIZE 1024
+
+/** Longest statement that is stored in the rewrite cache */
+#define REGEX_CACHE_MAX_LENGTH 4096
 
 static FILTER *createInstance(char **options, FILTER_PARAMETER **params);
 static void *newSession(FILTER *instance, SESSION *session);
@@ -63,8 +74,8 @@ static void setDownstream(FILTER *instance, void *fsession, DOWNSTREAM *downstre
 static int routeQuery(FILTER *instance, void *fsession, GWBUF *queue);
 static void diagnostic(FILTER *instance, void *fsession, DCB *dcb);
 
-static char *regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *study,
-                           const char *replace);
+static char *regex_replace(const char *sql, int length, pcre2_code *re,
+                           pcre2_match_data *match_data, const char *replace);
 
 static FILTER_OBJECT MyObject =
 {
@@ -80,16 +91,59 @@ static FILTER_OBJECT MyObject =
 };
 
 /**
- * Instance structure
+ * A single match and replace rule
  */
 typedef struct
 {
-    char *source; /*< Source address to restrict matches */
-    char *user; /*< User name to restrict matches */
+    int number; /*< Rule number, zero for match and replace */
     char *match; /*< Regular expression to match */
     char *replace; /*< Replacement text */
     pcre2_code *re; /*< Compiled regex text */
-    pcre2_match_data *match_data; /*< Matching data used by the compiled regex */
+    char *literal; /*< Text that every match must contain, NULL if unknown */
+    int literal_len; /*< Length of the literal */
+} REGEX_RULE;
+
+/**
+ * A cached result of applying the rules to a statement
+ */
+typedef struct
+{
+    unsigned int hash; /*< Hash of the original statement */
+    char *sql; /*< The original statement */
+    int length; /*< Length of the original statement */
+    char *result; /*< The rewritten statement, NULL if nothing matched */
+    int rule; /*< Index of the first rule that changed the statement */
+} REGEX_CACHE_ENTRY;
+
+/**
+ * Matching state that is private to one worker thread
+ */
+typedef struct
+{
+    SPINLOCK lock; /*< Only contended if a non-worker thread routes queries */
+    pcre2_match_data *match_data; /*< Matching data used by all the rules */
+    char *candidates; /*< Rules that passed the literal prefilter */
+    REGEX_CACHE_ENTRY *cache; /*< Rewrite cache, NULL if disabled */
+    int prefiltered; /*< Queries rejected without running a regex */
+    int cache_hits; /*< Queries found in the cache */
+    int cache_misses; /*< Queries not found in the cache */
+} REGEX_THREAD;
+
+/**
+ * Instance structure
+ */
+typedef struct
+{
+    char *source; /*< Source address to restrict matches */
+    char *user; /*< User name to restrict matches */
+    char *match; /*< Description of the rules for logging */
+    REGEX_RULE *rules; /*< The rules in the order they are applied */
+    int n_rules; /*< Number of rules */
+    pcre2_code *combined; /*< All rules in one program, NULL if only one rule */
+    bool jit; /*< Whether the rules were JIT compiled */
+    int cache_size; /*< Number of cached rewrites per thread */
+    REGEX_THREAD *threads; /*< Per thread matching state */
+    int n_threads; /*< Number of thread states */
     FILE* logfile; /*< Log file */
     bool log_trace; /*< Whether messages should be printed to tracelog */
 } REGEX_INSTANCE;
@@ -106,8 +160,9 @@ typedef struct
     int active; /* Is filter active */
 } REGEX_SESSION;
 
-void log_match(REGEX_INSTANCE* inst, char* re, char* old, char* new);
-void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old);
+void log_match(REGEX_INSTANCE* inst, char* re, char* old, int oldlen, char* new);
+void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old, int oldlen);
+static char *regex_rewrite(REGEX_INSTANCE *instance, const char *sql, int length, int *rule);
 
 /**
  * Implementation of the mandatory version entry point
@@ -151,24 +206,400 @@ void free_instance(REGEX_INSTANCE *instance)
 {
     if (instance)
     {
-        if (instance->re)
+        for (int i = 0; i < instance->n_rules; i++)
+        {
+            if (instance->rules[i].re)
+            {
+                pcre2_code_free(instance->rules[i].re);
+            }
+            free(instance->rules[i].match);
+            free(instance->rules[i].replace);
+            free(instance->rules[i].literal);
+        }
+
+        if (instance->combined)
+        {
+            pcre2_code_free(instance->combined);
+        }
+
+        if (instance->threads)
         {
-            pcre2_code_free(instance->re);
+            for (int i = 0; i < instance->n_threads; i++)
+            {
+                REGEX_THREAD *thr = &instance->threads[i];
+
+                if (thr->match_data)
+                {
+                    pcre2_match_data_free(thr->match_data);
+                }
+
+                if (thr->cache)
+                {
+                    for (int j = 0; j < instance->cache_size; j++)
+                    {
+                        free(thr->cache[j].sql);
+                        free(thr->cache[j].result);
+                    }
+                    free(thr->cache);
+                }
+                free(thr->candidates);
+            }
+            free(instance->threads);
         }
 
-        if (instance->match_data)
+        if (instance->logfile)
         {
-            pcre2_match_data_free(instance->match_data);
+            fclose(instance->logfile);
         }
 
+        free(instance->rules);
         free(instance->match);
-        free(instance->replace);
         free(instance->source);
         free(instance->user);
         free(instance);
     }
 }
 
+/**
+ * Parse the rule number from the suffix of a match or replace parameter.
+ *
+ * @param suffix    The part of the parameter name after match or replace
+ * @param number    Where the rule number is stored
+ * @return True if the suffix is empty or a number
+ */
+static bool
+regex_rule_number(const char *suffix, int *number)
+{
+    char *end;
+
+    if (*suffix == '\0')
+    {
+        *number = 0;
+        return true;
+    }
+
+    if (!isdigit((unsigned char) *suffix))
+    {
+        return false;
+    }
+
+    *number = strtol(suffix, &end, 10);
+    return *end == '\0';
+}
+
+/**
+ * Find a rule by its number or add a new one to the end of the rule array.
+ * The array is large enough to hold one rule per filter parameter.
+ *
+ * @param instance  The filter instance
+ * @param number    Rule number
+ * @return The rule
+ */
+static REGEX_RULE *
+regex_get_rule(REGEX_INSTANCE *instance, int number)
+{
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        if (instance->rules[i].number == number)
+        {
+            return &instance->rules[i];
+        }
+    }
+
+    instance->rules[instance->n_rules].number = number;
+    return &instance->rules[instance->n_rules++];
+}
+
+static int
+regex_rule_cmp(const void *a, const void *b)
+{
+    return ((const REGEX_RULE*) a)->number - ((const REGEX_RULE*) b)->number;
+}
+
+/**
+ * Find the longest run of literal text that every match of a pattern must
+ * contain. Only text outside of groups and character classes is considered
+ * and any construct that is not understood makes the whole pattern opaque.
+ * The result is always compared without case so options that change the case
+ * sensitivity of the pattern do not need to be considered.
+ *
+ * @param pattern   The regular expression
+ * @return The literal text or NULL if none could be found
+ */
+static char *
+regex_required_literal(const char *pattern)
+{
+    int plen = strlen(pattern);
+    char run[plen + 1], best[plen + 1];
+    int runlen = 0, bestlen = 0, depth = 0;
+    bool in_class = false;
+    const char *p = pattern;
+
+    while (*p)
+    {
+        bool literal = false;
+        char c = *p;
+
+        if (in_class)
+        {
+            if (*p == '\\' && p[1])
+            {
+                p++;
+            }
+            else if (*p == '[' && p[1] == ':')
+            {
+                /** POSIX class name, skip to the closing ':]' */
+                if ((p = strstr(p, ":]")) == NULL)
+                {
+                    return NULL;
+                }
+                p++;
+            }
+            else if (*p == ']')
+            {
+                in_class = false;
+            }
+            p++;
+            continue;
+        }
+
+        switch (*p)
+        {
+        case '|':
+            /** Alternation means no text is required */
+            return NULL;
+
+        case '\\':
+            if (p[1] == '\0')
+            {
+                return NULL;
+            }
+            else if (!isalnum((unsigned char) p[1]))
+            {
+                c = p[1];
+                literal = true;
+                p++;
+            }
+            else if (strchr("dDsSwWbBhHvVRAzZG", p[1]) == NULL)
+            {
+                /** Back references, hexadecimal values, quoting and so on */
+                return NULL;
+            }
+            else
+            {
+                p++;
+            }
+            break;
+
+        case '[':
+            in_class = true;
+            if (p[1] == ']')
+            {
+                p++;
+            }
+            else if (p[1] == '^' && p[2] == ']')
+            {
+                p += 2;
+            }
+            break;
+
+        case '(':
+            if (p[1] == '?' && (isalpha((unsigned char) p[2]) || p[2] == '-' || p[2] == '^'))
+            {
+                /** Option settings such as extended mode */
+                return NULL;
+            }
+            depth++;
+            break;
+
+        case ')':
+            depth--;
+            break;
+
+        case '*':
+        case '?':
+        case '{':
+            /** The preceding character is optional */
+            if (runlen > 0)
+            {
+                runlen--;
+            }
+            /** Fallthrough */
+        case '+':
+            if (runlen > bestlen)
+            {
+                memcpy(best, run, runlen);
+                bestlen = runlen;
+            }
+            runlen = 0;
+
+            if (*p == '{')
+            {
+                while (*p && *p != '}')
+                {
+                    p++;
+                }
+                if (*p == '\0')
+                {
+                    return NULL;
+                }
+            }
+
+            if (p[1] == '?' || p[1] == '+')
+            {
+                /** Lazy or possessive quantifier */
+                p++;
+            }
+            break;
+
+        case '.':
+        case '^':
+        case '$':
+            break;
+
+        default:
+            literal = true;
+            break;
+        }
+
+        if (literal && depth == 0)
+        {
+            run[runlen++] = c;
+        }
+        else if (!literal || depth > 0)
+        {
+            if (runlen > bestlen)
+            {
+                memcpy(best, run, runlen);
+                bestlen = runlen;
+            }
+            runlen = 0;
+        }
+        p++;
+    }
+
+    if (runlen > bestlen)
+    {
+        memcpy(best, run, runlen);
+        bestlen = runlen;
+    }
+
+    return bestlen > 0 ? strndup(best, bestlen) : NULL;
+}
+
+/**
+ * Compile a regular expression and JIT compile it if possible.
+ *
+ * @param pattern   The regular expression
+ * @param cflags    Compilation options
+ * @param jit       Set to false if JIT compilation failed
+ * @return The compiled pattern or NULL on error
+ */
+static pcre2_code *
+regex_compile(const char *pattern, int cflags, bool *jit)
+{
+    pcre2_code *re;
+    int errnumber;
+    PCRE2_SIZE erroffset;
+
+    if ((re = pcre2_compile((PCRE2_SPTR) pattern, PCRE2_ZERO_TERMINATED, cflags,
+                            &errnumber, &erroffset, NULL)) == NULL)
+    {
+        char errbuffer[1024];
+        pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) & errbuffer, sizeof(errbuffer));
+        MXS_ERROR("regexfilter: Compiling regular expression '%s' failed at %lu: %s",
+                  pattern, erroffset, errbuffer);
+    }
+    else if (pcre2_jit_compile(re, PCRE2_JIT_COMPLETE) != 0)
+    {
+        *jit = false;
+    }
+
+    return re;
+}
+
+/**
+ * Build a single program that matches if any of the rules match. The branch
+ * reset group keeps the group numbers of each rule intact so that back
+ * references inside the rules still work.
+ *
+ * @param instance  The filter instance
+ * @param cflags    Compilation options
+ * @return The compiled program or NULL if it could not be built
+ */
+static pcre2_code *
+regex_compile_combined(REGEX_INSTANCE *instance, int cflags)
+{
+    pcre2_code *re = NULL;
+    size_t len = sizeof("(?|)");
+    char *pattern;
+
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        len += strlen(instance->rules[i].match) + sizeof("(?:)|");
+    }
+
+    if ((pattern = malloc(len)) != NULL)
+    {
+        strcpy(pattern, "(?|");
+
+        for (int i = 0; i < instance->n_rules; i++)
+        {
+            strcat(pattern, i == 0 ? "(?:" : "|(?:");
+            strcat(pattern, instance->rules[i].match);
+            strcat(pattern, ")");
+        }
+        strcat(pattern, ")");
+
+        re = regex_compile(pattern, cflags | PCRE2_DUPNAMES, &instance->jit);
+        free(pattern);
+    }
+
+    return re;
+}
+
+/**
+ * Allocate the per thread matching state.
+ *
+ * @param instance  The filter instance
+ * @return True on success
+ */
+static bool
+regex_alloc_threads(REGEX_INSTANCE *instance)
+{
+    uint32_t captures = 0;
+
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        uint32_t n;
+        pcre2_pattern_info(instance->rules[i].re, PCRE2_INFO_CAPTURECOUNT, &n);
+        captures = MAX(captures, n);
+    }
+
+    instance->n_threads = config_threadcount();
+
+    if ((instance->threads = calloc(instance->n_threads, sizeof(REGEX_THREAD))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < instance->n_threads; i++)
+    {
+        REGEX_THREAD *thr = &instance->threads[i];
+        spinlock_init(&thr->lock);
+
+        if ((thr->match_data = pcre2_match_data_create(captures + 1, NULL)) == NULL ||
+            (thr->candidates = calloc(instance->n_rules, sizeof(char))) == NULL ||
+            (instance->cache_size > 0 &&
+             (thr->cache = calloc(instance->cache_size, sizeof(REGEX_CACHE_ENTRY))) == NULL))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -182,25 +613,40 @@ static FILTER *
 createInstance(char **options, FILTER_PARAMETER **params)
 {
     REGEX_INSTANCE *my_instance;
-    int i, errnumber, cflags = PCRE2_CASELESS;
-    PCRE2_SIZE erroffset;
+    int i, n_params, number, cflags = PCRE2_CASELESS;
     char *logfile = NULL;
-    const char *errmsg;
+
+    for (n_params = 0; params && params[n_params]; n_params++)
+    {
+        ;
+    }
 
     if ((my_instance = calloc(1, sizeof(REGEX_INSTANCE))) != NULL)
     {
-        my_instance->match = NULL;
-        my_instance->replace = NULL;
+        my_instance->jit = true;
+        my_instance->cache_size = REGEX_DEFAULT_CACHE_SIZE;
+
+        if ((my_instance->rules = calloc(n_params + 1, sizeof(REGEX_RULE))) == NULL)
+        {
+            free(my_instance);
+            return NULL;
+        }
 
         for (i = 0; params && params[i]; i++)
         {
-            if (!strcmp(params[i]->name, "match"))
+            if (!strncmp(params[i]->name, "match", 5) &&
+                regex_rule_number(params[i]->name + 5, &number))
             {
-                my_instance->match = strdup(params[i]->value);
+                REGEX_RULE *rule = regex_get_rule(my_instance, number);
+                free(rule->match);
+                rule->match = strdup(params[i]->value);
             }
-            else if (!strcmp(params[i]->name, "replace"))
+            else if (!strncmp(params[i]->name, "replace", 7) &&
+                     regex_rule_number(params[i]->name + 7, &number))
             {
-                my_instance->replace = strdup(params[i]->value);
+                REGEX_RULE *rule = regex_get_rule(my_instance, number);
+                free(rule->replace);
+                rule->replace = strdup(params[i]->value);
             }
             else if (!strcmp(params[i]->name, "source"))
             {
@@ -222,6 +668,17 @@ createInstance(char **options, FILTER_PARAMETER **params)
                 }
                 logfile = strdup(params[i]->value);
             }
+            else if (!strcmp(params[i]->name, "cache_size"))
+            {
+                my_instance->cache_size = atoi(params[i]->value);
+
+                if (my_instance->cache_size < 0)
+                {
+                    MXS_ERROR("regexfilter: Invalid value for 'cache_size': %s",
+                              params[i]->value);
+                    my_instance->cache_size = 0;
+                }
+            }
             else if (!filter_standard_parameter(params[i]->name))
             {
                 MXS_ERROR("regexfilter: Unexpected parameter '%s'.",
@@ -264,29 +721,58 @@ createInstance(char **options, FILTER_PARAMETER **params)
         }
         free(logfile);
 
-        if (my_instance->match == NULL || my_instance->replace == NULL)
+        if (my_instance->n_rules == 0)
         {
+            MXS_ERROR("regexfilter: No 'match' and 'replace' parameters defined.");
             free_instance(my_instance);
             return NULL;
         }
 
-        if ((my_instance->re = pcre2_compile((PCRE2_SPTR) my_instance->match,
-                                             PCRE2_ZERO_TERMINATED,
-                                             cflags,
-                                             &errnumber,
-                                             &erroffset,
-                                             NULL)) == NULL)
+        qsort(my_instance->rules, my_instance->n_rules, sizeof(REGEX_RULE), regex_rule_cmp);
+
+        for (i = 0; i < my_instance->n_rules; i++)
         {
-            char errbuffer[1024];
-            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) & errbuffer, sizeof(errbuffer));
-            MXS_ERROR("regexfilter: Compiling regular expression '%s' failed at %lu: %s",
-                      my_instance->match, erroffset, errbuffer);
-            free_instance(my_instance);
-            return NULL;
+            REGEX_RULE *rule = &my_instance->rules[i];
+
+            if (rule->match == NULL || rule->replace == NULL)
+            {
+                MXS_ERROR("regexfilter: Rule %d is missing the '%s' parameter.",
+                          rule->number, rule->match ? "replace" : "match");
+                free_instance(my_instance);
+                return NULL;
+            }
+
+            if ((rule->re = regex_compile(rule->match, cflags, &my_instance->jit)) == NULL)
+            {
+                free_instance(my_instance);
+                return NULL;
+            }
+
+            if ((rule->literal = regex_required_literal(rule->match)) != NULL)
+            {
+                rule->literal_len = strlen(rule->literal);
+            }
+        }
+
+        if (my_instance->n_rules > 1 &&
+            (my_instance->combined = regex_compile_combined(my_instance, cflags)) == NULL)
+        {
+            MXS_WARNING("regexfilter: The rules could not be combined into a single "
+                        "regular expression, each rule is matched separately.");
+        }
+
+        if (my_instance->n_rules == 1)
+        {
+            my_instance->match = strdup(my_instance->rules[0].match);
+        }
+        else
+        {
+            char desc[64];
+            snprintf(desc, sizeof(desc), "%d rules", my_instance->n_rules);
+            my_instance->match = strdup(desc);
         }
 
-        if ((my_instance->match_data =
-             pcre2_match_data_create_from_pattern(my_instance->re, NULL)) == NULL)
+        if (my_instance->match == NULL || !regex_alloc_threads(my_instance))
         {
             MXS_ERROR("regexfilter: Failure to create PCRE2 matching data. "
                       "This is most likely caused by a lack of available memory.");
@@ -390,37 +876,35 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
     REGEX_INSTANCE *my_instance = (REGEX_INSTANCE *) instance;
     REGEX_SESSION *my_session = (REGEX_SESSION *) session;
     char *sql, *newsql;
+    int length, rule = 0;
 
     if (my_session->active && modutil_is_SQL(queue))
     {
-        if (queue->next != NULL)
-        {
-            queue = gwbuf_make_contiguous(queue);
-        }
-        if ((sql = modutil_get_SQL(queue)) != NULL)
+        if (modutil_get_SQL_view(queue, &sql, &length))
         {
-            newsql = regex_replace(sql,
-                                   my_instance->re,
-                                   my_instance->match_data,
-                                   my_instance->replace);
+            newsql = regex_rewrite(my_instance, sql, length, &rule);
             if (newsql)
             {
-                queue = modutil_replace_SQL(queue, newsql);
-                queue = gwbuf_make_contiguous(queue);
+                /** Log before the replacement, the view points into the buffer */
                 spinlock_acquire(&my_session->lock);
-                log_match(my_instance, my_instance->match, sql, newsql);
+                log_match(my_instance, my_instance->rules[rule].match, sql, length, newsql);
                 spinlock_release(&my_session->lock);
+                if (queue->next != NULL)
+                {
+                    queue = gwbuf_make_contiguous(queue);
+                }
+                queue = modutil_replace_SQL(queue, newsql);
+                queue = gwbuf_make_contiguous(queue);
                 free(newsql);
                 my_session->replacements++;
             }
             else
             {
                 spinlock_acquire(&my_session->lock);
-                log_nomatch(my_instance, my_instance->match, sql);
+                log_nomatch(my_instance, my_instance->match, sql, length);
                 spinlock_release(&my_session->lock);
                 my_session->no_change++;
             }
-            free(sql);
         }
 
     }
@@ -445,8 +929,27 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
     REGEX_INSTANCE *my_instance = (REGEX_INSTANCE *) instance;
     REGEX_SESSION *my_session = (REGEX_SESSION *) fsession;
 
-    dcb_printf(dcb, "\t\tSearch and replace:            s/%s/%s/\n",
-               my_instance->match, my_instance->replace);
+    for (int i = 0; i < my_instance->n_rules; i++)
+    {
+        dcb_printf(dcb, "\t\tSearch and replace:            s/%s/%s/\n",
+                   my_instance->rules[i].match, my_instance->rules[i].replace);
+    }
+    dcb_printf(dcb, "\t\tJIT compiled:                  %s\n",
+               my_instance->jit ? "yes" : "no");
+    if (my_session == NULL)
+    {
+        int prefiltered = 0, hits = 0, misses = 0;
+
+        for (int i = 0; i < my_instance->n_threads; i++)
+        {
+            prefiltered += my_instance->threads[i].prefiltered;
+            hits += my_instance->threads[i].cache_hits;
+            misses += my_instance->threads[i].cache_misses;
+        }
+        dcb_printf(dcb, "\t\tQueries rejected by prefilter: %d\n", prefiltered);
+        dcb_printf(dcb, "\t\tRewrite cache hits:            %d\n", hits);
+        dcb_printf(dcb, "\t\tRewrite cache misses:          %d\n", misses);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of queries unaltered by filter:    %d\n",
@@ -472,38 +975,218 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
  * Perform a regular expression match and substitution on the SQL
  *
  * @param   sql The original SQL text
+ * @param   length Length of the SQL text
  * @param   re  The compiled regular expression
  * @param   match_data The PCRE2 matching data buffer
  * @param   replace The replacement text
  * @return  The replaced text or NULL if no replacement was done.
  */
 static char *
-regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *match_data, const char *replace)
+regex_replace(const char *sql, int length, pcre2_code *re, pcre2_match_data *match_data,
+              const char *replace)
+{
+    size_t size = length + strlen(replace) + 1;
+    char *result = malloc(size);
+    PCRE2_SIZE result_size = size;
+    int rc = 0;
+
+    while (result &&
+           (rc = pcre2_substitute(re, (PCRE2_SPTR) sql, length, 0,
+                                  PCRE2_SUBSTITUTE_GLOBAL, match_data, NULL,
+                                  (PCRE2_SPTR) replace, PCRE2_ZERO_TERMINATED,
+                                  (PCRE2_UCHAR*) result, &result_size)) == PCRE2_ERROR_NOMEMORY)
+    {
+        char *tmp;
+        if ((tmp = realloc(result, (size *= 1.5))) == NULL)
+        {
+            free(result);
+        }
+        result = tmp;
+        result_size = size;
+    }
+
+    /** No substitutions were made */
+    if (result && rc <= 0)
+    {
+        free(result);
+        result = NULL;
+    }
+
+    return result;
+}
+
+/**
+ * Check whether the SQL contains a literal, ignoring case.
+ *
+ * @param sql       The SQL text
+ * @param length    Length of the SQL text
+ * @param literal   The literal to look for
+ * @param litlen    Length of the literal
+ * @return True if the literal was found
+ */
+static bool
+regex_contains(const char *sql, int length, const char *literal, int litlen)
+{
+    int first = tolower((unsigned char) literal[0]);
+
+    for (int i = 0; i + litlen <= length; i++)
+    {
+        if (tolower((unsigned char) sql[i]) == first &&
+            strncasecmp(sql + i + 1, literal + 1, litlen - 1) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Apply all rules to the SQL in order. Rules whose literal text is not found
+ * in the SQL are skipped and if more than one rule remains, the combined
+ * program is used to reject the SQL with a single match.
+ *
+ * @param instance  The filter instance
+ * @param thr       Matching state of the current thread
+ * @param sql       The SQL text
+ * @param length    Length of the SQL text
+ * @param rule      Set to the index of the first rule that changed the SQL
+ * @return The rewritten SQL or NULL if no rule matched
+ */
+static char *
+regex_apply_rules(REGEX_INSTANCE *instance, REGEX_THREAD *thr, const char *sql,
+                  int length, int *rule)
 {
     char *result = NULL;
-    size_t result_size;
+    int n_candidates = 0;
+
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        REGEX_RULE *r = &instance->rules[i];
+        thr->candidates[i] = r->literal == NULL ||
+            regex_contains(sql, length, r->literal, r->literal_len);
+        n_candidates += thr->candidates[i];
+    }
 
-    /** This should never fail with rc == 0 because we used pcre2_match_data_create_from_pattern() */
-    if (pcre2_match(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL))
+    if (n_candidates == 0)
     {
-        result_size = strlen(sql) + strlen(replace);
-        result = malloc(result_size);
+        thr->prefiltered++;
+        return NULL;
+    }
+
+    if (n_candidates > 1 && instance->combined &&
+        pcre2_match(instance->combined, (PCRE2_SPTR) sql, length, 0, 0,
+                    thr->match_data, NULL) == PCRE2_ERROR_NOMATCH)
+    {
+        return NULL;
+    }
 
-        while (result &&
-               pcre2_substitute(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0,
-                                PCRE2_SUBSTITUTE_GLOBAL, match_data, NULL,
-                                (PCRE2_SPTR) replace, PCRE2_ZERO_TERMINATED,
-                                (PCRE2_UCHAR*) result, (PCRE2_SIZE*) & result_size) == PCRE2_ERROR_NOMEMORY)
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        REGEX_RULE *r = &instance->rules[i];
+        const char *text = result ? result : sql;
+        int len = result ? strlen(result) : length;
+        char *newsql;
+
+        /** The literals must be checked again once the SQL has been changed */
+        if (result ? (r->literal && !regex_contains(text, len, r->literal, r->literal_len)) :
+            !thr->candidates[i])
+        {
+            continue;
+        }
+
+        if ((newsql = regex_replace(text, len, r->re, thr->match_data, r->replace)))
         {
-            char *tmp;
-            if ((tmp = realloc(result, (result_size *= 1.5))) == NULL)
+            if (result == NULL)
             {
-                free(result);
-                result = NULL;
+                *rule = i;
             }
-            result = tmp;
+            free(result);
+            result = newsql;
         }
     }
+
+    return result;
+}
+
+/**
+ * Calculate the hash of the SQL for the rewrite cache.
+ *
+ * @param sql       The SQL text
+ * @param length    Length of the SQL text
+ * @return The hash value
+ */
+static unsigned int
+regex_hash(const char *sql, int length)
+{
+    unsigned int hash = 2166136261u;
+
+    for (int i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char) sql[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Rewrite the SQL with the rules of the filter. The result of the rules for
+ * recently seen statements is kept in a cache that is private to each thread.
+ *
+ * @param instance  The filter instance
+ * @param sql       The SQL text
+ * @param length    Length of the SQL text
+ * @param rule      Set to the index of the first rule that changed the SQL
+ * @return The rewritten SQL which must be freed by the caller or NULL if
+ * no rule matched
+ */
+static char *
+regex_rewrite(REGEX_INSTANCE *instance, const char *sql, int length, int *rule)
+{
+    REGEX_THREAD *thr = &instance->threads[ts_stats_get_thread_id() % instance->n_threads];
+    REGEX_CACHE_ENTRY *entry = NULL;
+    unsigned int hash = 0;
+    char *result;
+
+    spinlock_acquire(&thr->lock);
+
+    if (thr->cache && length <= REGEX_CACHE_MAX_LENGTH)
+    {
+        hash = regex_hash(sql, length);
+        entry = &thr->cache[hash % instance->cache_size];
+
+        if (entry->sql && entry->hash == hash && entry->length == length &&
+            memcmp(entry->sql, sql, length) == 0)
+        {
+            thr->cache_hits++;
+            *rule = entry->rule;
+            result = entry->result ? strdup(entry->result) : NULL;
+            spinlock_release(&thr->lock);
+            return result;
+        }
+        thr->cache_misses++;
+    }
+
+    result = regex_apply_rules(instance, thr, sql, length, rule);
+
+    if (entry)
+    {
+        free(entry->sql);
+        free(entry->result);
+        entry->hash = hash;
+        entry->length = length;
+        entry->rule = *rule;
+        entry->result = result ? strdup(result) : NULL;
+        entry->sql = NULL;
+
+        /** A failed copy of the result must not be cached as a non-match */
+        if ((result == NULL || entry->result) && (entry->sql = malloc(length)) != NULL)
+        {
+            memcpy(entry->sql, sql, length);
+        }
+    }
+
+    spinlock_release(&thr->lock);
     return result;
 }
 
@@ -513,18 +1196,19 @@ regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *match_data, con
  * @param inst Regex filter instance
  * @param re Regular expression
  * @param old Old SQL statement
+ * @param oldlen Length of the old SQL statement
  * @param new New SQL statement
  */
-void log_match(REGEX_INSTANCE* inst, char* re, char* old, char* new)
+void log_match(REGEX_INSTANCE* inst, char* re, char* old, int oldlen, char* new)
 {
     if (inst->logfile)
     {
-        fprintf(inst->logfile, "Matched %s: [%s] -> [%s]\n", re, old, new);
+        fprintf(inst->logfile, "Matched %s: [%.*s] -> [%s]\n", re, oldlen, old, new);
         fflush(inst->logfile);
     }
     if (inst->log_trace)
     {
-        MXS_INFO("Match %s: [%s] -> [%s]", re, old, new);
+        MXS_INFO("Match %s: [%.*s] -> [%s]", re, oldlen, old, new);
     }
 }
 
@@ -533,16 +1217,17 @@ void log_match(REGEX_INSTANCE* inst, char* re, char* old, char* new)
  * @param inst Regex filter instance
  * @param re Regular expression
  * @param old SQL statement
+ * @param oldlen Length of the SQL statement
  */
-void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old)
+void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old, int oldlen)
 {
     if (inst->logfile)
     {
-        fprintf(inst->logfile, "No match %s: [%s]\n", re, old);
+        fprintf(inst->logfile, "No match %s: [%.*s]\n", re, oldlen, old);
         fflush(inst->logfile);
     }
     if (inst->log_trace)
     {
-        MXS_INFO("No match %s: [%s]", re, old);
+        MXS_INFO("No match %s: [%.*s]", re, oldlen, old);
     }
 }
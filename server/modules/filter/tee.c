@@ -34,6 +34,11 @@
  *		of the request (optional)
  * user		A user name to match against. If present only requests that
  *		originate from this user will be duplciated (optional)
+ * async	Do not wait for the replies of the branch service, the
+ *		duplicates are queued for the branch session (optional)
+ * async_queue_size	The maximum number of duplicates queued for the
+ *		branch sessions of the service in asynchronous mode,
+ *		duplicates that do not fit in the queue are dropped (optional)
  *
  * Revision History
  * ================
@@ -80,6 +85,8 @@
 #define PARENT                          0
 #define CHILD                           1
 
+#define DEFAULT_ASYNC_QUEUE_SIZE        1024
+
 #ifdef SS_DEBUG
 static int debug_seq = 0;
 #endif
@@ -147,6 +154,10 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *nomatch; /* Optional text to match against for exclusion */
     regex_t nore; /* Compiled regex nomatch text */
+    bool async; /* Do not wait for the replies of the branch */
+    int async_queue_size; /* Maximum number of queued duplicates of all sessions */
+    int async_queued; /* Number of duplicates queued by all sessions */
+    int n_dropped; /* Number of duplicates dropped by all sessions */
 } TEE_INSTANCE;
 
 /**
@@ -182,6 +193,11 @@ typedef struct
     GWBUF* queue;
     SPINLOCK tee_lock;
     DCB* client_dcb;
+    GWBUF* async_queue; /* Duplicates waiting for the branch session */
+    int async_queued; /* Number of packets in async_queue */
+    bool async_busy; /* The branch session is executing a duplicate */
+    unsigned char async_command; /* The command the branch session is executing */
+    int n_dropped; /* Number of duplicates dropped because the queue was full */
 
 #ifdef SS_DEBUG
     long d_id;
@@ -213,6 +229,10 @@ int route_single_query(TEE_INSTANCE* my_instance,
                        GWBUF* clone);
 int reset_session_state(TEE_SESSION* my_session, GWBUF* buffer);
 void create_orphan(SESSION* ses);
+static void reset_branch_state(TEE_SESSION* my_session, int branch, unsigned char command);
+static void update_reply_state(TEE_SESSION* my_session, int branch, GWBUF* complete, int min_eof);
+static int route_async_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* queue);
+static int async_client_reply(FILTER* instance, TEE_SESSION* my_session, GWBUF* reply);
 
 static void
 orphan_free(void* data)
@@ -372,6 +392,10 @@ createInstance(char **options, FILTER_PARAMETER **params)
         my_instance->userName = NULL;
         my_instance->match = NULL;
         my_instance->nomatch = NULL;
+        my_instance->async = false;
+        my_instance->async_queue_size = DEFAULT_ASYNC_QUEUE_SIZE;
+        my_instance->async_queued = 0;
+        my_instance->n_dropped = 0;
         if (params)
         {
             for (i = 0; params[i]; i++)
@@ -400,6 +424,22 @@ createInstance(char **options, FILTER_PARAMETER **params)
                 {
                     my_instance->userName = strdup(params[i]->value);
                 }
+                else if (!strcmp(params[i]->name, "async"))
+                {
+                    my_instance->async = config_truth_value(params[i]->value);
+                }
+                else if (!strcmp(params[i]->name, "async_queue_size"))
+                {
+                    my_instance->async_queue_size = atoi(params[i]->value);
+
+                    if (my_instance->async_queue_size <= 0)
+                    {
+                        MXS_ERROR("tee: Invalid value '%s' for the async_queue_size "
+                                  "parameter, using the default value of %d.",
+                                  params[i]->value, DEFAULT_ASYNC_QUEUE_SIZE);
+                        my_instance->async_queue_size = DEFAULT_ASYNC_QUEUE_SIZE;
+                    }
+                }
                 else if (!filter_standard_parameter(params[i]->name))
                 {
                     MXS_ERROR("tee: Unexpected parameter '%s'.",
@@ -617,6 +657,33 @@ retblock:
     return my_session;
 }
 
+/**
+ * Close the branch session and all its connections
+ *
+ * @param bsession	The branch session
+ */
+static void
+close_branch_session(SESSION *bsession)
+{
+    ROUTER_OBJECT *router;
+    void *router_instance, *rsession;
+
+    CHK_SESSION(bsession);
+    spinlock_acquire(&bsession->ses_lock);
+
+    if (bsession->state != SESSION_STATE_STOPPING)
+    {
+        bsession->state = SESSION_STATE_STOPPING;
+    }
+    router = bsession->service->router;
+    router_instance = bsession->service->router_instance;
+    rsession = bsession->router_session;
+    spinlock_release(&bsession->ses_lock);
+
+    /** Close router session and all its connections */
+    router->closeSession(router_instance, rsession);
+}
+
 /**
  * Close a session with the filter, this is the mechanism
  * by which a filter may cleanup data structure etc.
@@ -630,8 +697,6 @@ static void
 closeSession(FILTER *instance, void *session)
 {
     TEE_SESSION *my_session = (TEE_SESSION *) session;
-    ROUTER_OBJECT *router;
-    void *router_instance, *rsession;
     SESSION *bsession;
 #ifdef SS_DEBUG
     MXS_INFO("Tee close: %d", atomic_add(&debug_seq, 1));
@@ -641,20 +706,7 @@ closeSession(FILTER *instance, void *session)
 
         if ((bsession = my_session->branch_session) != NULL)
         {
-            CHK_SESSION(bsession);
-            spinlock_acquire(&bsession->ses_lock);
-
-            if (bsession->state != SESSION_STATE_STOPPING)
-            {
-                bsession->state = SESSION_STATE_STOPPING;
-            }
-            router = bsession->service->router;
-            router_instance = bsession->service->router_instance;
-            rsession = bsession->router_session;
-            spinlock_release(&bsession->ses_lock);
-
-            /** Close router session and all its connections */
-            router->closeSession(router_instance, rsession);
+            close_branch_session(bsession);
         }
         /* No need to free the session, this is done as
          * a side effect of closing the client DCB of the
@@ -726,6 +778,11 @@ freeSession(FILTER *instance, void *session)
     {
         gwbuf_free(my_session->tee_replybuf);
     }
+    if (my_session->async_queued > 0)
+    {
+        atomic_add(&my_session->instance->async_queued, -my_session->async_queued);
+    }
+    gwbuf_free(my_session->async_queue);
     free(session);
 
     orphan_free(NULL);
@@ -799,6 +856,10 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
              ((char*) queue->start + 5));
 #endif
 
+    if (my_instance->async)
+    {
+        return route_async_query(my_instance, my_session, queue);
+    }
 
     spinlock_acquire(&my_session->tee_lock);
 
@@ -923,54 +984,22 @@ uint16_t get_response_flags(uint8_t* datastart, bool ok_packet)
 }
 
 /**
- * The clientReply entry point. This is passed the response buffer
- * to which the filter should be applied. Once processed the
- * query is passed to the upstream component
- * (filter or router) in the filter chain.
+ * Update the reply state of a branch with a set of complete reply packets.
+ * Once the whole reply to the current query has been received, the branch
+ * is no longer waiting.
  *
- * @param instance	The filter instance data
- * @param session	The filter session
- * @param reply		The response data
+ * @param my_session	Tee session
+ * @param branch	PARENT or CHILD
+ * @param complete	Contiguous buffer with complete packets
+ * @param min_eof	Number of EOF packets that end a result set
  */
-static int
-clientReply(FILTER* instance, void *session, GWBUF *reply)
+static void
+update_reply_state(TEE_SESSION* my_session, int branch, GWBUF* complete, int min_eof)
 {
-    int rc = 1, branch, eof;
-    TEE_SESSION *my_session = (TEE_SESSION *) session;
-    bool route = true;
-    GWBUF *complete = NULL;
-    unsigned char *ptr;
+    unsigned char *ptr = (unsigned char*) complete->start;
     uint16_t flags = 0;
     int more_results = 0;
-
-    spinlock_acquire(&my_session->tee_lock);
-    int min_eof = my_session->command != 0x04 ? 2 : 1;
-
-    if (!my_session->active)
-    {
-        spinlock_release(&my_session->tee_lock);
-        MXS_INFO("Tee: Failed to return reply, session is already closed");
-        gwbuf_free(reply);
-        return 0;
-    }
-
-    branch = instance == NULL ? CHILD : PARENT;
-
-    my_session->tee_partials[branch] = gwbuf_append(my_session->tee_partials[branch], reply);
-    my_session->tee_partials[branch] = gwbuf_make_contiguous(my_session->tee_partials[branch]);
-    complete = modutil_get_complete_packets(&my_session->tee_partials[branch]);
-
-    if (complete == NULL)
-    {
-        spinlock_release(&my_session->tee_lock);
-        /** Incomplete packet */
-        MXS_DEBUG("tee.c: Incomplete packet, "
-                  "waiting for a complete packet before forwarding.");
-        return 1;
-    }
-
-    complete = gwbuf_make_contiguous(complete);
-    ptr = (unsigned char*) complete->start;
+    int eof;
 
     if (my_session->replies[branch] == 0)
     {
@@ -1015,6 +1044,61 @@ clientReply(FILTER* instance, void *session, GWBUF *reply)
         }
     }
 
+    my_session->replies[branch]++;
+}
+
+/**
+ * The clientReply entry point. This is passed the response buffer
+ * to which the filter should be applied. Once processed the
+ * query is passed to the upstream component
+ * (filter or router) in the filter chain.
+ *
+ * @param instance	The filter instance data
+ * @param session	The filter session
+ * @param reply		The response data
+ */
+static int
+clientReply(FILTER* instance, void *session, GWBUF *reply)
+{
+    int rc = 1, branch;
+    TEE_SESSION *my_session = (TEE_SESSION *) session;
+    bool route = true;
+    GWBUF *complete = NULL;
+
+    if (my_session->instance->async)
+    {
+        return async_client_reply(instance, my_session, reply);
+    }
+
+    spinlock_acquire(&my_session->tee_lock);
+    int min_eof = my_session->command != 0x04 ? 2 : 1;
+
+    if (!my_session->active)
+    {
+        spinlock_release(&my_session->tee_lock);
+        MXS_INFO("Tee: Failed to return reply, session is already closed");
+        gwbuf_free(reply);
+        return 0;
+    }
+
+    branch = instance == NULL ? CHILD : PARENT;
+
+    my_session->tee_partials[branch] = gwbuf_append(my_session->tee_partials[branch], reply);
+    my_session->tee_partials[branch] = gwbuf_make_contiguous(my_session->tee_partials[branch]);
+    complete = modutil_get_complete_packets(&my_session->tee_partials[branch]);
+
+    if (complete == NULL)
+    {
+        spinlock_release(&my_session->tee_lock);
+        /** Incomplete packet */
+        MXS_DEBUG("tee.c: Incomplete packet, "
+                  "waiting for a complete packet before forwarding.");
+        return 1;
+    }
+
+    complete = gwbuf_make_contiguous(complete);
+    update_reply_state(my_session, branch, complete, min_eof);
+
     if (branch == PARENT)
     {
         my_session->tee_replybuf = gwbuf_append(my_session->tee_replybuf, complete);
@@ -1024,8 +1108,6 @@ clientReply(FILTER* instance, void *session, GWBUF *reply)
         gwbuf_free(complete);
     }
 
-    my_session->replies[branch]++;
-
     if (my_session->tee_replybuf == NULL ||
         (!my_session->waiting[PARENT] && my_session->waiting[CHILD]) ||
         ((my_session->multipacket[PARENT] || my_session->multipacket[CHILD]) &&
@@ -1110,12 +1192,28 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match		%s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->async)
+    {
+        dcb_printf(dcb, "\t\tAsynchronous queue size	%d\n",
+                   my_instance->async_queue_size);
+        dcb_printf(dcb, "\t\tNo. of statements queued:	%d.\n",
+                   my_instance->async_queued);
+        dcb_printf(dcb, "\t\tNo. of statements dropped:	%d.\n",
+                   my_instance->n_dropped);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of statements duplicated:	%d.\n",
                    my_session->n_duped);
         dcb_printf(dcb, "\t\tNo. of statements rejected:	%d.\n",
                    my_session->n_rejected);
+        if (my_instance->async)
+        {
+            dcb_printf(dcb, "\t\tNo. of statements queued:	%d.\n",
+                       my_session->async_queued);
+            dcb_printf(dcb, "\t\tNo. of statements dropped:	%d.\n",
+                       my_session->n_dropped);
+        }
     }
 }
 
@@ -1218,6 +1316,7 @@ GWBUF* clone_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* bu
     GWBUF* clone = NULL;
     int residual = 0;
     char* ptr;
+    int length;
 
     if (my_session->branch_session &&
         my_session->branch_session->state == SESSION_STATE_ROUTER_READY)
@@ -1237,17 +1336,20 @@ GWBUF* clone_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* bu
                 my_session->residual = 0;
             }
         }
-        else if (my_session->active && (ptr = modutil_get_SQL(buffer)) != NULL)
+        else if (my_session->active && modutil_get_SQL_view(buffer, &ptr, &length))
         {
+            /** The SQL is not NULL terminated, REG_STARTEND limits the match */
+            regmatch_t limits[] = {{0, length}};
+            regmatch_t nolimits[] = {{0, length}};
+
             if ((my_instance->match == NULL ||
-                 regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
+                 regexec(&my_instance->re, ptr, 1, limits, REG_STARTEND) == 0) &&
                 (my_instance->nomatch == NULL ||
-                 regexec(&my_instance->nore, ptr, 0, NULL, 0) != 0))
+                 regexec(&my_instance->nore, ptr, 1, nolimits, REG_STARTEND) != 0))
             {
                 clone = gwbuf_clone_all(buffer);
                 my_session->residual = residual;
             }
-            free(ptr);
         }
         else if (packet_is_required(buffer))
         {
@@ -1327,30 +1429,301 @@ int reset_session_state(TEE_SESSION* my_session, GWBUF* buffer)
 
     unsigned char command = *((unsigned char*) buffer->start + 4);
 
+    if (command == 0x1b)
+    {
+        my_session->client_multistatement = *((unsigned char*) buffer->start + 5);
+        MXS_INFO("tee: client %s multistatements",
+                 my_session->client_multistatement ? "enabled" : "disabled");
+    }
+
+    reset_branch_state(my_session, PARENT, command);
+    reset_branch_state(my_session, CHILD, command);
+    my_session->command = command;
+
+    return 1;
+}
+
+/**
+ * Reset the reply counters of one branch of the session.
+ * @param my_session Tee session
+ * @param branch PARENT or CHILD
+ * @param command The command the branch is about to execute
+ */
+static void
+reset_branch_state(TEE_SESSION* my_session, int branch, unsigned char command)
+{
     switch (command)
     {
         case 0x1b:
-            my_session->client_multistatement = *((unsigned char*) buffer->start + 5);
-            MXS_INFO("tee: client %s multistatements",
-                     my_session->client_multistatement ? "enabled" : "disabled");
         case 0x03:
         case 0x16:
         case 0x17:
         case 0x04:
         case 0x0a:
-            memset(my_session->multipacket, (char) true, 2 * sizeof(bool));
+            my_session->multipacket[branch] = true;
             break;
         default:
-            memset(my_session->multipacket, (char) false, 2 * sizeof(bool));
+            my_session->multipacket[branch] = false;
             break;
     }
 
-    memset(my_session->replies, 0, 2 * sizeof(int));
-    memset(my_session->reply_packets, 0, 2 * sizeof(int));
-    memset(my_session->eof, 0, 2 * sizeof(int));
-    memset(my_session->waiting, 1, 2 * sizeof(bool));
-    my_session->command = command;
+    my_session->replies[branch] = 0;
+    my_session->reply_packets[branch] = 0;
+    my_session->eof[branch] = 0;
+    my_session->waiting[branch] = true;
+}
+
+/**
+ * Take the next duplicate from the asynchronous queue of the session if the
+ * branch session is not busy executing an earlier one. Commands that do
+ * not generate a reply do not make the branch session busy.
+ *
+ * This must be called with the tee_lock held.
+ * @param my_session Tee session
+ * @return The duplicate to route to the branch session or NULL
+ */
+static GWBUF*
+async_next_clone(TEE_SESSION* my_session)
+{
+    GWBUF* clone;
+    unsigned char command;
+
+    if (my_session->async_busy ||
+        (clone = modutil_get_next_MySQL_packet(&my_session->async_queue)) == NULL)
+    {
+        return NULL;
+    }
+
+    my_session->async_queued--;
+    atomic_add(&my_session->instance->async_queued, -1);
+    my_session->n_duped++;
+    command = GWBUF_LENGTH(clone) > 4 ? *((unsigned char*) clone->start + 4) : 0;
+
+    if (command != MYSQL_COM_QUIT &&
+        command != MYSQL_COM_STMT_SEND_LONG_DATA &&
+        command != MYSQL_COM_STMT_CLOSE)
+    {
+        my_session->async_busy = true;
+        my_session->async_command = command;
+        reset_branch_state(my_session, CHILD, command);
+    }
+
+    return clone;
+}
+
+/**
+ * Discard the queued duplicates of a session whose branch session can no
+ * longer execute them. No reply is expected from the branch session after
+ * this.
+ *
+ * This must be called with the tee_lock held.
+ * @param my_session Tee session
+ */
+static void
+async_discard_queue(TEE_SESSION* my_session)
+{
+    if (my_session->async_queued > 0)
+    {
+        my_session->n_dropped += my_session->async_queued;
+        atomic_add(&my_session->instance->n_dropped, my_session->async_queued);
+        atomic_add(&my_session->instance->async_queued, -my_session->async_queued);
+        my_session->async_queued = 0;
+    }
+    gwbuf_free(my_session->async_queue);
+    my_session->async_queue = NULL;
+    my_session->async_busy = false;
+    my_session->async_command = 0;
+    my_session->waiting[CHILD] = false;
+}
+
+/**
+ * Check whether the branch session can execute duplicates
+ * @param my_session Tee session
+ * @return True if the branch session is open
+ */
+static bool
+async_branch_ready(TEE_SESSION* my_session)
+{
+    return my_session->branch_session &&
+        my_session->branch_session->state == SESSION_STATE_ROUTER_READY;
+}
+
+/**
+ * Route the duplicates that are ready to be executed to the branch session.
+ * The duplicates are routed without holding the tee_lock.
+ * @param my_session Tee session
+ * @param clone The first duplicate to route, may be NULL
+ */
+static void
+async_route_clones(TEE_SESSION* my_session, GWBUF* clone)
+{
+    while (clone)
+    {
+        bool routed = false;
+
+        if (async_branch_ready(my_session))
+        {
+            routed = SESSION_ROUTE_QUERY(my_session->branch_session, clone);
+        }
+        else
+        {
+            gwbuf_free(clone);
+        }
+
+        spinlock_acquire(&my_session->tee_lock);
+        if (!routed)
+        {
+            /** No reply will arrive to clear the busy state */
+            async_discard_queue(my_session);
+        }
+        clone = async_next_clone(my_session);
+        spinlock_release(&my_session->tee_lock);
+    }
+}
+
+/**
+ * Route queries in asynchronous mode. The queries are routed downstream
+ * without waiting for the branch session. The duplicates are added to
+ * the queue of the branch session and dropped if the queued duplicates of
+ * all the sessions of the service exceed the queue size. Commands that are
+ * required to keep the branch session consistent are never dropped, the
+ * branch session is closed instead.
+ * @param my_instance Tee instance
+ * @param my_session Tee session
+ * @param queue The query data
+ * @return 1 on success, 0 on failure.
+ */
+static int
+route_async_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* queue)
+{
+    GWBUF *buffer, *clone, *next = NULL;
+    bool close_branch = false;
+    int rval = 1;
+
+    spinlock_acquire(&my_session->tee_lock);
+
+    if (!my_session->active)
+    {
+        MXS_INFO("Tee: Received a query when the session was closed.");
+        gwbuf_free(queue);
+        spinlock_release(&my_session->tee_lock);
+        return 0;
+    }
+
+    my_session->queue = gwbuf_append(my_session->queue, queue);
+
+    while (rval && (buffer = modutil_get_next_MySQL_packet(&my_session->queue)) != NULL)
+    {
+        if (GWBUF_LENGTH(buffer) > 5 && *((unsigned char*) buffer->start + 4) == 0x1b)
+        {
+            my_session->client_multistatement = *((unsigned char*) buffer->start + 5);
+        }
+
+        if ((clone = clone_query(my_instance, my_session, buffer)) == NULL)
+        {
+            my_session->n_rejected++;
+        }
+        else if (!async_branch_ready(my_session))
+        {
+            /** The branch session was closed, possibly while it was
+             * executing a duplicate */
+            gwbuf_free(clone);
+            async_discard_queue(my_session);
+        }
+        else if (atomic_add(&my_instance->async_queued, 1) >= my_instance->async_queue_size)
+        {
+            atomic_add(&my_instance->async_queued, -1);
+
+            if (packet_is_required(clone))
+            {
+                /** The branch session would be inconsistent without it */
+                MXS_WARNING("Tee: The asynchronous queue of service '%s' is full, "
+                            "closing the branch session.", my_instance->service->name);
+                async_discard_queue(my_session);
+                close_branch = true;
+            }
+            gwbuf_free(clone);
+            my_session->n_dropped++;
+            atomic_add(&my_instance->n_dropped, 1);
+        }
+        else
+        {
+            my_session->async_queue = gwbuf_append(my_session->async_queue, clone);
+            my_session->async_queued++;
+            next = async_next_clone(my_session);
+        }
+
+        spinlock_release(&my_session->tee_lock);
+        if (close_branch)
+        {
+            close_branch_session(my_session->branch_session);
+            close_branch = false;
+        }
+        async_route_clones(my_session, next);
+        next = NULL;
+        rval = my_session->down.routeQuery(my_session->down.instance,
+                                           my_session->down.session,
+                                           buffer);
+        spinlock_acquire(&my_session->tee_lock);
+    }
+
+    spinlock_release(&my_session->tee_lock);
+    return rval;
+}
+
+/**
+ * Handle a reply in asynchronous mode. Replies from the main service are
+ * passed upstream as such. Replies from the branch session are discarded,
+ * once the complete reply to a duplicate has been received the next queued
+ * duplicate is routed to the branch session.
+ * @param instance The filter instance, NULL for replies from the branch
+ * @param my_session Tee session
+ * @param reply The reply
+ * @return 1 on success, 0 on failure.
+ */
+static int
+async_client_reply(FILTER* instance, TEE_SESSION* my_session, GWBUF* reply)
+{
+    GWBUF *complete, *next = NULL;
+
+    if (!my_session->active)
+    {
+        MXS_INFO("Tee: Failed to return reply, session is already closed");
+        gwbuf_free(reply);
+        return 0;
+    }
+
+    if (instance != NULL)
+    {
+        return my_session->up.clientReply(my_session->up.instance,
+                                          my_session->up.session,
+                                          reply);
+    }
+
+    spinlock_acquire(&my_session->tee_lock);
+    my_session->tee_partials[CHILD] = gwbuf_append(my_session->tee_partials[CHILD], reply);
+    my_session->tee_partials[CHILD] = gwbuf_make_contiguous(my_session->tee_partials[CHILD]);
+
+    if ((complete = modutil_get_complete_packets(&my_session->tee_partials[CHILD])) != NULL)
+    {
+        complete = gwbuf_make_contiguous(complete);
+
+        if (my_session->async_busy)
+        {
+            update_reply_state(my_session, CHILD, complete,
+                               my_session->async_command != 0x04 ? 2 : 1);
+
+            if (!my_session->waiting[CHILD])
+            {
+                my_session->async_busy = false;
+                next = async_next_clone(my_session);
+            }
+        }
+        gwbuf_free(complete);
+    }
+    spinlock_release(&my_session->tee_lock);
 
+    async_route_clones(my_session, next);
     return 1;
 }
 
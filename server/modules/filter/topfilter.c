@@ -31,6 +31,13 @@
  * file to which the queries are logged. A serial number is appended to this
  * name in order that each session logs to a different file.
  *
+ * In addition to the per session report, the filter can aggregate the
+ * statistics of all sessions by query digest. The digest of a query is its
+ * canonical form as returned by qc_get_canonical(). The number of digests
+ * kept is bounded by the max_digests parameter, statements that do not fit
+ * into the table are accounted for in a single overflow digest. The digest
+ * statistics are available through maxinfo.
+ *
  * Date         Who             Description
  * 18/06/2014   Mark Riddoch    Addition of source and user filters
  *
@@ -49,6 +56,10 @@
 #include <sys/time.h>
 #include <regex.h>
 #include <atomic.h>
+#include <spinlock.h>
+#include <hashtable.h>
+#include <resultset.h>
+#include <query_classifier.h>
 
 MODULE_INFO info =
 {
@@ -72,6 +83,7 @@ static void setUpstream(FILTER *instance, void *fsession, UPSTREAM *upstream);
 static int routeQuery(FILTER *instance, void *fsession, GWBUF *queue);
 static int clientReply(FILTER *instance, void *fsession, GWBUF *queue);
 static void diagnostic(FILTER *instance, void *fsession, DCB *dcb);
+static RESULTSET *getStatistics(FILTER *instance);
 
 
 static FILTER_OBJECT MyObject =
@@ -85,8 +97,38 @@ static FILTER_OBJECT MyObject =
     routeQuery,
     clientReply,
     diagnostic,
+    getStatistics,
 };
 
+/** Number of buckets in the latency histogram of a digest */
+#define TOPN_HISTOGRAM_BUCKETS 32
+
+/** Canonical queries longer than this are truncated before the lookup */
+#define TOPN_DIGEST_MAX_LENGTH 1024
+
+/** The name of the digest that collects the statements that did not fit */
+#define TOPN_OVERFLOW_DIGEST "<other>"
+
+/**
+ * The statistics of one query digest, shared by all sessions of the
+ * filter instance.
+ *
+ * Bucket n of the histogram counts the executions that took between
+ * 2^(n-1) and 2^n microseconds, the last bucket also counts all slower
+ * executions. The percentiles are estimated from the histogram.
+ */
+typedef struct topn_digest
+{
+    SPINLOCK lock;                  /*< Protects the statistics */
+    char *canonical;                /*< The canonical form of the query */
+    unsigned long count;            /*< Number of executions */
+    unsigned long long total;       /*< Total execution time in microseconds */
+    unsigned long long min;         /*< Fastest execution in microseconds */
+    unsigned long long max;         /*< Slowest execution in microseconds */
+    unsigned long histogram[TOPN_HISTOGRAM_BUCKETS]; /*< Execution time histogram */
+    struct topn_digest *next;       /*< Next digest of the instance */
+} TOPN_DIGEST;
+
 /**
  * A instance structure, the assumption is that the option passed
  * to the filter is simply a base for the filename to which the queries
@@ -106,6 +148,12 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *exclude; /* Optional text to match against for exclusion */
     regex_t exre; /* Compiled regex nomatch text */
+    int max_digests; /* Maximum number of digests, 0 disables the digests */
+    HASHTABLE *digests; /* The digests keyed by the canonical query */
+    TOPN_DIGEST *digest_list; /* All digests, in order of creation */
+    int n_digests; /* Number of digests in the table */
+    TOPN_DIGEST *overflow; /* Statements that did not fit in the table */
+    SPINLOCK digest_lock; /* Serialises the addition of new digests */
 } TOPN_INSTANCE;
 
 /**
@@ -136,6 +184,7 @@ typedef struct
     int fd;
     struct timeval start;
     char *current;
+    TOPN_DIGEST *current_digest;
     TOPNQ **top;
     int n_statements;
     struct timeval total;
@@ -176,6 +225,167 @@ GetModuleObject()
 {
     return &MyObject;
 }
+
+/**
+ * Allocate a new digest
+ *
+ * @param canonical The canonical query of the digest
+ * @return The new digest or NULL if memory allocation failed
+ */
+static TOPN_DIGEST *
+topn_digest_alloc(const char *canonical)
+{
+    TOPN_DIGEST *digest;
+
+    if ((digest = calloc(1, sizeof(TOPN_DIGEST))) != NULL)
+    {
+        if ((digest->canonical = strdup(canonical)) == NULL)
+        {
+            free(digest);
+            return NULL;
+        }
+        spinlock_init(&digest->lock);
+    }
+    return digest;
+}
+
+/**
+ * Find the digest of a query, adding a new digest to the table if the query
+ * has not been seen before. Once the table is full, all new queries are
+ * accounted for in the overflow digest.
+ *
+ * @param my_instance   The filter instance
+ * @param queue         A contiguous buffer containing the query
+ * @return The digest of the query or NULL if the query has no canonical form
+ */
+static TOPN_DIGEST *
+topn_digest_find(TOPN_INSTANCE *my_instance, GWBUF *queue)
+{
+    TOPN_DIGEST *digest;
+    char *canonical;
+
+    if ((canonical = qc_get_canonical(queue)) == NULL)
+    {
+        return NULL;
+    }
+
+    if (strlen(canonical) > TOPN_DIGEST_MAX_LENGTH)
+    {
+        canonical[TOPN_DIGEST_MAX_LENGTH] = '\0';
+    }
+
+    if ((digest = hashtable_fetch(my_instance->digests, canonical)) == NULL)
+    {
+        spinlock_acquire(&my_instance->digest_lock);
+        if ((digest = hashtable_fetch(my_instance->digests, canonical)) == NULL)
+        {
+            if (my_instance->n_digests < my_instance->max_digests &&
+                (digest = topn_digest_alloc(canonical)) != NULL)
+            {
+                if (hashtable_add(my_instance->digests, digest->canonical, digest))
+                {
+                    digest->next = my_instance->digest_list;
+                    my_instance->digest_list = digest;
+                    my_instance->n_digests++;
+                }
+                else
+                {
+                    free(digest->canonical);
+                    free(digest);
+                    digest = NULL;
+                }
+            }
+
+            if (digest == NULL)
+            {
+                digest = my_instance->overflow;
+            }
+        }
+        spinlock_release(&my_instance->digest_lock);
+    }
+
+    free(canonical);
+    return digest;
+}
+
+/**
+ * Add one execution of a query to the statistics of its digest
+ *
+ * @param digest    The digest to update
+ * @param duration  The execution time of the query
+ */
+static void
+topn_digest_update(TOPN_DIGEST *digest, struct timeval *duration)
+{
+    unsigned long long usec = (unsigned long long) duration->tv_sec * 1000000
+        + duration->tv_usec;
+    int bucket = 0;
+
+    while (bucket < TOPN_HISTOGRAM_BUCKETS - 1 && (1ULL << bucket) <= usec)
+    {
+        bucket++;
+    }
+
+    spinlock_acquire(&digest->lock);
+    if (digest->count == 0 || usec < digest->min)
+    {
+        digest->min = usec;
+    }
+    if (usec > digest->max)
+    {
+        digest->max = usec;
+    }
+    digest->count++;
+    digest->total += usec;
+    digest->histogram[bucket]++;
+    spinlock_release(&digest->lock);
+}
+
+/**
+ * Estimate a percentile of the execution times of a digest. The value is
+ * interpolated linearly inside the histogram bucket that holds the rank.
+ *
+ * @param digest    A consistent copy of the digest
+ * @param pct       The percentile to estimate, between 0 and 100
+ * @return The estimated execution time in microseconds
+ */
+static double
+topn_digest_percentile(TOPN_DIGEST *digest, double pct)
+{
+    double rank = pct * digest->count / 100;
+    double low, high, result;
+    unsigned long seen = 0;
+    int i;
+
+    if (digest->count == 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < TOPN_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        if (seen + digest->histogram[i] >= rank && digest->histogram[i] > 0)
+        {
+            break;
+        }
+        seen += digest->histogram[i];
+    }
+
+    low = i > 0 ? (double) (1ULL << (i - 1)) : 0;
+    high = i < TOPN_HISTOGRAM_BUCKETS - 1 ? (double) (1ULL << i) : (double) digest->max;
+    result = digest->histogram[i] > 0 ?
+        low + (high - low) * (rank - seen) / digest->histogram[i] : high;
+
+    if (result < digest->min)
+    {
+        result = digest->min;
+    }
+    if (result > digest->max)
+    {
+        result = digest->max;
+    }
+    return result;
+}
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -199,6 +409,12 @@ createInstance(char **options, FILTER_PARAMETER **params)
         my_instance->source = NULL;
         my_instance->user = NULL;
         my_instance->filebase = NULL;
+        my_instance->max_digests = 0;
+        my_instance->digests = NULL;
+        my_instance->digest_list = NULL;
+        my_instance->n_digests = 0;
+        my_instance->overflow = NULL;
+        spinlock_init(&my_instance->digest_lock);
         bool error = false;
 
         for (i = 0; params && params[i]; i++)
@@ -227,6 +443,10 @@ createInstance(char **options, FILTER_PARAMETER **params)
             {
                 my_instance->user = strdup(params[i]->value);
             }
+            else if (!strcmp(params[i]->name, "max_digests"))
+            {
+                my_instance->max_digests = atoi(params[i]->value);
+            }
             else if (!filter_standard_parameter(params[i]->name))
             {
                 MXS_ERROR("topfilter: Unexpected parameter '%s'.",
@@ -262,12 +482,26 @@ createInstance(char **options, FILTER_PARAMETER **params)
             }
         }
 
-        if (my_instance->filebase == NULL)
+        if (my_instance->filebase == NULL && my_instance->max_digests <= 0)
         {
-            MXS_ERROR("topfilter: No 'filebase' parameter defined.");
+            MXS_ERROR("topfilter: Neither the 'filebase' nor the 'max_digests' "
+                      "parameter is defined.");
             error = true;
         }
 
+        if (!error && my_instance->max_digests > 0)
+        {
+            if ((my_instance->digests = hashtable_alloc(my_instance->max_digests,
+                                                        simple_str_hash, strcmp)) == NULL ||
+                (my_instance->overflow = topn_digest_alloc(TOPN_OVERFLOW_DIGEST)) == NULL)
+            {
+                MXS_ERROR("topfilter: Memory allocation failed when creating "
+                          "the digest table.");
+                hashtable_free(my_instance->digests);
+                error = true;
+            }
+        }
+
         my_instance->sessions = 0;
         if (my_instance->match &&
             regcomp(&my_instance->re, my_instance->match, cflags))
@@ -333,15 +567,18 @@ newSession(FILTER *instance, SESSION *session)
 
     if ((my_session = calloc(1, sizeof(TOPN_SESSION))) != NULL)
     {
-        if ((my_session->filename =
-             (char *) malloc(strlen(my_instance->filebase) + 20))
-            == NULL)
+        if (my_instance->filebase)
         {
-            free(my_session);
-            return NULL;
+            if ((my_session->filename =
+                 (char *) malloc(strlen(my_instance->filebase) + 20))
+                == NULL)
+            {
+                free(my_session);
+                return NULL;
+            }
+            sprintf(my_session->filename, "%s.%d", my_instance->filebase,
+                    my_instance->sessions);
         }
-        sprintf(my_session->filename, "%s.%d", my_instance->filebase,
-                my_instance->sessions);
         atomic_add(&my_instance->sessions, 1);
         my_session->top = (TOPNQ **) calloc(my_instance->topN + 1,
                                             sizeof(TOPNQ *));
@@ -354,6 +591,7 @@ newSession(FILTER *instance, SESSION *session)
         my_session->total.tv_sec = 0;
         my_session->total.tv_usec = 0;
         my_session->current = NULL;
+        my_session->current_digest = NULL;
         if ((remote = session_get_remote(session)) != NULL)
         {
             my_session->clientHost = strdup(remote);
@@ -382,8 +620,11 @@ newSession(FILTER *instance, SESSION *session)
             my_session->active = 0;
         }
 
-        sprintf(my_session->filename, "%s.%d", my_instance->filebase,
-                my_instance->sessions);
+        if (my_session->filename)
+        {
+            sprintf(my_session->filename, "%s.%d", my_instance->filebase,
+                    my_instance->sessions);
+        }
         gettimeofday(&my_session->connect, NULL);
     }
 
@@ -393,7 +634,8 @@ newSession(FILTER *instance, SESSION *session)
 /**
  * Close a session with the filter, this is the mechanism
  * by which a filter may cleanup data structure etc.
- * In the case of the TOPN filter we simple close the file descriptor.
+ * In the case of the TOPN filter we write the report of the session
+ * if a filebase has been configured.
  *
  * @param instance  The filter instance data
  * @param session   The session being closed
@@ -410,7 +652,7 @@ closeSession(FILTER *instance, void *session)
 
     gettimeofday(&my_session->disconnect, NULL);
     timersub((&my_session->disconnect), &(my_session->connect), &diff);
-    if ((fp = fopen(my_session->filename, "w")) != NULL)
+    if (my_session->filename && (fp = fopen(my_session->filename, "w")) != NULL)
     {
         statements = my_session->n_statements != 0 ? my_session->n_statements : 1;
 
@@ -524,6 +766,7 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
     TOPN_INSTANCE *my_instance = (TOPN_INSTANCE *) instance;
     TOPN_SESSION *my_session = (TOPN_SESSION *) session;
     char *ptr;
+    int length;
 
     if (my_session->active)
     {
@@ -531,24 +774,27 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         {
             queue = gwbuf_make_contiguous(queue);
         }
-        if ((ptr = modutil_get_SQL(queue)) != NULL)
+        if (modutil_get_SQL_view(queue, &ptr, &length))
         {
+            /** The SQL is not NULL terminated, REG_STARTEND limits the match */
+            regmatch_t limits[] = {{0, length}};
+            regmatch_t exlimits[] = {{0, length}};
+
             if ((my_instance->match == NULL ||
-                 regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
+                 regexec(&my_instance->re, ptr, 1, limits, REG_STARTEND) == 0) &&
                 (my_instance->exclude == NULL ||
-                 regexec(&my_instance->exre, ptr, 0, NULL, 0) != 0))
+                 regexec(&my_instance->exre, ptr, 1, exlimits, REG_STARTEND) != 0))
             {
                 my_session->n_statements++;
                 if (my_session->current)
                 {
                     free(my_session->current);
                 }
+                my_session->current = strndup(ptr, length);
+                my_session->current_digest = my_instance->digests ?
+                    topn_digest_find(my_instance, queue) : NULL;
+                /** Taken after the digest so that the parsing is not timed */
                 gettimeofday(&my_session->start, NULL);
-                my_session->current = ptr;
-            }
-            else
-            {
-                free(ptr);
             }
         }
     }
@@ -585,6 +831,12 @@ clientReply(FILTER *instance, void *session, GWBUF *reply)
 
         timeradd(&(my_session->total), &diff, &(my_session->total));
 
+        if (my_session->current_digest)
+        {
+            topn_digest_update(my_session->current_digest, &diff);
+            my_session->current_digest = NULL;
+        }
+
         inserted = 0;
         for (i = 0; i < my_instance->topN; i++)
         {
@@ -662,10 +914,20 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->exclude);
     }
+    if (my_instance->digests)
+    {
+        dcb_printf(dcb, "\t\tQuery digests            %d of %d\n",
+                   my_instance->n_digests, my_instance->max_digests);
+        dcb_printf(dcb, "\t\tStatements not in a digest   %lu\n",
+                   my_instance->overflow->count);
+    }
     if (my_session)
     {
-        dcb_printf(dcb, "\t\tLogging to file %s.\n",
-                   my_session->filename);
+        if (my_session->filename)
+        {
+            dcb_printf(dcb, "\t\tLogging to file %s.\n",
+                       my_session->filename);
+        }
         dcb_printf(dcb, "\t\tCurrent Top %d:\n", my_instance->topN);
         for (i = 0; i < my_instance->topN; i++)
         {
@@ -681,3 +943,159 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         }
     }
 }
+
+/**
+ * The state of a digest result set, a sorted copy of the digests
+ */
+typedef struct
+{
+    TOPN_DIGEST *digests; /*< Copies of the digests */
+    int n_digests; /*< Number of digests in the copy */
+    int index; /*< The next row to send */
+} TOPN_DIGEST_SET;
+
+static int
+cmp_digest(const void *va, const void *vb)
+{
+    const TOPN_DIGEST *a = (const TOPN_DIGEST *) va;
+    const TOPN_DIGEST *b = (const TOPN_DIGEST *) vb;
+
+    if (a->total == b->total)
+    {
+        return 0;
+    }
+    return b->total > a->total ? 1 : -1;
+}
+
+/**
+ * Provide a row to the result set of digests
+ *
+ * @param set   The result set
+ * @param data  The digest set
+ * @return The next row or NULL
+ */
+static RESULT_ROW *
+digestRowCallback(RESULTSET *set, void *data)
+{
+    TOPN_DIGEST_SET *dset = (TOPN_DIGEST_SET *) data;
+    TOPN_DIGEST *digest;
+    RESULT_ROW *row;
+    char buf[40];
+
+    if (dset->index >= dset->n_digests)
+    {
+        for (int i = 0; i < dset->n_digests; i++)
+        {
+            free(dset->digests[i].canonical);
+        }
+        free(dset->digests);
+        free(dset);
+        return NULL;
+    }
+    digest = &dset->digests[dset->index++];
+    row = resultset_make_row(set);
+    resultset_row_set(row, 0, digest->canonical);
+    snprintf(buf, sizeof(buf), "%lu", digest->count);
+    resultset_row_set(row, 1, buf);
+    snprintf(buf, sizeof(buf), "%.6f", (double) digest->total / 1000000);
+    resultset_row_set(row, 2, buf);
+    snprintf(buf, sizeof(buf), "%.6f", (double) digest->min / 1000000);
+    resultset_row_set(row, 3, buf);
+    snprintf(buf, sizeof(buf), "%.6f", (double) digest->max / 1000000);
+    resultset_row_set(row, 4, buf);
+    snprintf(buf, sizeof(buf), "%.6f", topn_digest_percentile(digest, 50) / 1000000);
+    resultset_row_set(row, 5, buf);
+    snprintf(buf, sizeof(buf), "%.6f", topn_digest_percentile(digest, 95) / 1000000);
+    resultset_row_set(row, 6, buf);
+    snprintf(buf, sizeof(buf), "%.6f", topn_digest_percentile(digest, 99) / 1000000);
+    resultset_row_set(row, 7, buf);
+    return row;
+}
+
+/**
+ * Return the top N digests of the filter instance, ordered by the total
+ * execution time, as a result set. The digests are copied when the result
+ * set is created so that the statistics are not locked while streaming.
+ *
+ * @param instance  The filter instance
+ * @return A result set or NULL if the digests are disabled
+ */
+static RESULTSET *
+getStatistics(FILTER *instance)
+{
+    TOPN_INSTANCE *my_instance = (TOPN_INSTANCE *) instance;
+    TOPN_DIGEST_SET *dset;
+    TOPN_DIGEST *digest;
+    RESULTSET *set;
+    int n = 0;
+
+    if (my_instance->digests == NULL ||
+        (dset = calloc(1, sizeof(TOPN_DIGEST_SET))) == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&my_instance->digest_lock);
+    digest = my_instance->digest_list;
+    n = my_instance->n_digests;
+    spinlock_release(&my_instance->digest_lock);
+
+    /** The digests are never freed and new ones are added to the head of
+     * the list, the part of the list read above is therefore stable. */
+    if ((dset->digests = calloc(n + 1, sizeof(TOPN_DIGEST))) == NULL)
+    {
+        free(dset);
+        return NULL;
+    }
+
+    for (int i = 0; i <= n; i++)
+    {
+        TOPN_DIGEST *src = i < n ? digest : my_instance->overflow;
+        TOPN_DIGEST *dest = &dset->digests[dset->n_digests];
+
+        spinlock_acquire(&src->lock);
+        *dest = *src;
+        spinlock_release(&src->lock);
+
+        if (i < n)
+        {
+            digest = digest->next;
+        }
+
+        if (dest->count > 0 && (dest->canonical = strdup(src->canonical)) != NULL)
+        {
+            dset->n_digests++;
+        }
+    }
+
+    qsort(dset->digests, dset->n_digests, sizeof(TOPN_DIGEST), cmp_digest);
+    if (dset->n_digests > my_instance->topN)
+    {
+        for (int i = my_instance->topN; i < dset->n_digests; i++)
+        {
+            free(dset->digests[i].canonical);
+        }
+        dset->n_digests = my_instance->topN;
+    }
+
+    if ((set = resultset_create(digestRowCallback, dset)) == NULL)
+    {
+        for (int i = 0; i < dset->n_digests; i++)
+        {
+            free(dset->digests[i].canonical);
+        }
+        free(dset->digests);
+        free(dset);
+        return NULL;
+    }
+    resultset_add_column(set, "Digest", 80, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Count", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Total", 16, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Min", 16, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Max", 16, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "P50", 16, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "P95", 16, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "P99", 16, COL_TYPE_VARCHAR);
+
+    return set;
+}
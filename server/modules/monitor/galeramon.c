@@ -508,9 +508,15 @@ monitorMain(void *arg)
         while (ptr)
         {
             ptr->mon_prev_status = ptr->server->status;
+            ptr = ptr->next;
+        }
+
+        mon_probe_servers(mon, monitorDatabase);
 
-            monitorDatabase(mon, ptr);
+        ptr = mon->databases;
 
+        while (ptr)
+        {
             /* Log server status change */
             if (mon_status_changed(ptr))
             {
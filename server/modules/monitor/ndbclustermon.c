@@ -245,10 +245,11 @@ diagnostics(DCB *dcb, void *arg)
 /**
  * Monitor an individual server
  *
+ * @param mon		The monitor
  * @param database	The database to probe
  */
 static void
-monitorDatabase(MONITOR_SERVERS *database, char *defaultUser, char *defaultPasswd, MONITOR *mon)
+monitorDatabase(MONITOR *mon, MONITOR_SERVERS *database)
 {
     MYSQL_ROW row;
     MYSQL_RES *result;
@@ -407,8 +408,15 @@ monitorMain(void *arg)
         while (ptr)
         {
             ptr->mon_prev_status = ptr->server->status;
-            monitorDatabase(ptr, mon->user, mon->password, mon);
+            ptr = ptr->next;
+        }
 
+        mon_probe_servers(mon, monitorDatabase);
+
+        ptr = mon->databases;
+
+        while (ptr)
+        {
             if (ptr->server->status != ptr->mon_prev_status ||
                 SERVER_IS_DOWN(ptr->server))
             {
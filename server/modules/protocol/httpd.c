@@ -43,6 +43,7 @@
 #include <modinfo.h>
 #include <log_manager.h>
 #include <resultset.h>
+#include <metrics.h>
 
 MODULE_INFO info =
 {
@@ -65,7 +66,7 @@ static int httpd_accept(DCB *dcb);
 static int httpd_close(DCB *dcb);
 static int httpd_listen(DCB *dcb, char *config);
 static int httpd_get_line(int sock, char *buf, int size);
-static void httpd_send_headers(DCB *dcb, int final);
+static void httpd_send_headers(DCB *dcb, int final, const char *content_type);
 
 /**
  * The "module object" for the httpd protocol module.
@@ -236,7 +237,8 @@ static int httpd_read_event(DCB* dcb)
      */
 
     /* send all the basic headers and close with \r\n */
-    httpd_send_headers(dcb, 1);
+    httpd_send_headers(dcb, 1, strcmp(url, METRICS_URI) == 0 ?
+                       METRICS_CONTENT_TYPE : "application/json");
 
 #if 0
     /**
@@ -517,8 +519,12 @@ static int httpd_get_line(int sock, char *buf, int size)
 
 /**
  * HTTPD send basic headers with 200 OK
+ *
+ * @param dcb           The client DCB
+ * @param final         Close the headers
+ * @param content_type  The type of the content that follows
  */
-static void httpd_send_headers(DCB *dcb, int final)
+static void httpd_send_headers(DCB *dcb, int final, const char *content_type)
 {
     char date[64] = "";
     const char *fmt = "%a, %d %b %Y %H:%M:%S GMT";
@@ -530,8 +536,8 @@ static void httpd_send_headers(DCB *dcb, int final)
 
     dcb_printf(dcb,
                "HTTP/1.1 200 OK\r\nDate: %s\r\nServer: %s\r\nConnection: "
-               "close\r\nContent-Type: application/json\r\n",
-               date, HTTP_SERVER_STRING);
+               "close\r\nContent-Type: %s\r\n",
+               date, HTTP_SERVER_STRING, content_type);
 
     /* close the headers */
     if (final)
@@ -357,7 +357,6 @@ gw_check_mysql_scramble_data(DCB *dcb,
     uint8_t step1[GW_MYSQL_SCRAMBLE_SIZE]="";
     uint8_t step2[GW_MYSQL_SCRAMBLE_SIZE +1]="";
     uint8_t check_hash[GW_MYSQL_SCRAMBLE_SIZE]="";
-    char hex_double_sha1[2 * GW_MYSQL_SCRAMBLE_SIZE + 1]="";
     uint8_t password[GW_MYSQL_SCRAMBLE_SIZE]="";
     /* The following can be compared using memcmp to detect a null password */
     uint8_t null_client_sha1[MYSQL_SCRAMBLE_LEN]="";
@@ -384,16 +383,7 @@ gw_check_mysql_scramble_data(DCB *dcb,
         return MYSQL_FAILED_AUTH;
     }
 
-    if (token && token_len)
-    {
-        /*<
-         * convert in hex format: this is the content of mysql.user table.
-         * The field password is without the '*' prefix and it is 40 bytes long
-         */
-
-        gw_bin2hex(hex_double_sha1, password, SHA_DIGEST_LENGTH);
-    }
-    else
+    if (token == NULL || token_len == 0)
     {
         /* check if the password is not set in the user table */
         return memcmp(password, null_client_sha1, MYSQL_SCRAMBLE_LEN) ?
@@ -60,6 +60,7 @@
 #include <sys/stat.h>
 #include <modutil.h>
 #include <netinet/tcp.h>
+#include <maxconfig.h>
 
 MODULE_INFO info =
 {
@@ -1001,6 +1002,16 @@ int gw_MySQLListener(DCB *listen_dcb, char *config_bind)
                       errno,
                       strerror_r(errno, errbuf, sizeof(errbuf)));
         }
+#ifdef SO_REUSEPORT
+        /** The service opens one socket per thread on the same port */
+        if (config_reuseport() &&
+            setsockopt(l_so, SOL_SOCKET, SO_REUSEPORT, (char *) &one, sizeof(one)) != 0)
+        {
+            MXS_ERROR("Failed to set SO_REUSEPORT on the listening socket. Error %d: %s",
+                      errno,
+                      strerror_r(errno, errbuf, sizeof(errbuf)));
+        }
+#endif
     }
     // set NONBLOCKING mode
     if (setnonblocking(l_so) != 0)
@@ -1096,17 +1107,16 @@ int gw_MySQLListener(DCB *listen_dcb, char *config_bind)
 
 
 /**
- * @node (write brief function description here)
+ * Accept new client connections on a listener
  *
- * Parameters:
- * @param listener - <usage>
- *          <description>
+ * Connections are accepted until the queue of the listening socket is empty
+ * or, when accept_batch is configured, until that many connections have been
+ * accepted. In the latter case a read event is queued for the listener so
+ * that the remaining connections are accepted after the other pending events
+ * have been processed.
  *
+ * @param listener The listener DCB
  * @return 0 in success, 1 in failure
- *
- *
- * @details (write detailed description here)
- *
  */
 int gw_MySQLAccept(DCB *listener)
 {
@@ -1114,18 +1124,29 @@ int gw_MySQLAccept(DCB *listener)
     DCB *client_dcb;
     MySQLProtocol *protocol;
     int c_sock;
-    struct sockaddr client_conn;
+    struct sockaddr_storage client_conn;
     socklen_t client_len = sizeof(struct sockaddr_storage);
     int sendbuf = GW_BACKEND_SO_SNDBUF;
     socklen_t optlen = sizeof(sendbuf);
     int eno = 0;
     int syseno = 0;
     int i = 0;
+    unsigned int n_accepted = 0;
+    unsigned int accept_batch = config_accept_batch();
 
     CHK_DCB(listener);
 
     while (1)
     {
+        if (accept_batch && n_accepted == accept_batch)
+        {
+            /** Yield and continue from the event queue, the listener is
+             * edge-triggered so epoll will not report it again */
+            poll_fake_read_event(listener);
+            rc = 1;
+            goto return_rc;
+        }
+
     retry_accept:
 
 #if defined(FAKE_CODE)
@@ -1139,10 +1160,12 @@ int gw_MySQLAccept(DCB *listener)
         {
             fail_accept_errno = 0;
 #endif /* FAKE_CODE */
-            // new connection from client
-            c_sock = accept(listener->fd,
-                            (struct sockaddr *) &client_conn,
-                            &client_len);
+            // new connection from client, already in non-blocking mode
+            client_len = sizeof(client_conn);
+            c_sock = accept4(listener->fd,
+                             (struct sockaddr *) &client_conn,
+                             &client_len,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
             eno = errno;
             errno = 0;
 #if defined(FAKE_CODE)
@@ -1213,6 +1236,7 @@ int gw_MySQLAccept(DCB *listener)
         } /* if (c_sock == -1) */
         /* reset counter */
         i = 0;
+        n_accepted++;
 
         listener->stats.n_accepts++;
 #if defined(SS_DEBUG)
@@ -1223,7 +1247,6 @@ int gw_MySQLAccept(DCB *listener)
 #if defined(FAKE_CODE)
         conn_open[c_sock] = true;
 #endif /* FAKE_CODE */
-        /* set nonblocking  */
         sendbuf = GW_CLIENT_SO_SNDBUF;
         char errbuf[STRERROR_BUFLEN];
 
@@ -1240,7 +1263,6 @@ int gw_MySQLAccept(DCB *listener)
             MXS_ERROR("Failed to set socket options. Error %d: %s",
                       errno, strerror_r(errno, errbuf, sizeof(errbuf)));
         }
-        setnonblocking(c_sock);
 
         client_dcb = dcb_alloc(DCB_ROLE_REQUEST_HANDLER);
 
@@ -1258,7 +1280,7 @@ int gw_MySQLAccept(DCB *listener)
         client_dcb->fd = c_sock;
 
         // get client address
-        if (client_conn.sa_family == AF_UNIX)
+        if (client_conn.ss_family == AF_UNIX)
         {
             // client address
             client_dcb->remote = strdup("localhost_from_socket");
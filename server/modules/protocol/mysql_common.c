@@ -53,6 +53,7 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <netinet/tcp.h>
+#include <rcu.h>
 
 /* The following can be compared using memcmp to detect a null password */
 uint8_t null_client_sha1[MYSQL_SCRAMBLE_LEN]="";
@@ -539,7 +540,6 @@ int gw_send_authentication_to_backend(char *dbname,
     uint8_t client_capabilities[4];
     uint32_t server_capabilities = 0;
     uint32_t final_capabilities  = 0;
-    char dbpass[MYSQL_USER_MAXLEN + 1]="";
     GWBUF *buffer;
     DCB *dcb;
 
@@ -596,9 +596,6 @@ int gw_send_authentication_to_backend(char *dbname,
         // hash2 is the SHA1(input data), where input_data = SHA1(real_password)
         gw_sha1_str(hash1, GW_MYSQL_SCRAMBLE_SIZE, hash2);
 
-        // dbpass is the HEX form of SHA1(SHA1(real_password))
-        gw_bin2hex(dbpass, hash2, GW_MYSQL_SCRAMBLE_SIZE);
-
         // new_sha is the SHA1(CONCAT(scramble, hash2)
         gw_sha1_2_str(conn->scramble, GW_MYSQL_SCRAMBLE_SIZE, hash2, GW_MYSQL_SCRAMBLE_SIZE, new_sha);
 
@@ -1099,7 +1096,6 @@ GWBUF* gw_create_change_user_packet(MYSQL_session*  mses,
     uint8_t client_scramble[GW_MYSQL_SCRAMBLE_SIZE];
     uint32_t server_capabilities = 0;
     uint32_t final_capabilities  = 0;
-    char dbpass[MYSQL_USER_MAXLEN + 1]="";
     char* curr_db = NULL;
     uint8_t* curr_passwd = NULL;
     unsigned int charset;
@@ -1148,9 +1144,6 @@ GWBUF* gw_create_change_user_packet(MYSQL_session*  mses,
          */
         gw_sha1_str(hash1, GW_MYSQL_SCRAMBLE_SIZE, hash2);
 
-        /** dbpass is the HEX form of SHA1(SHA1(real_password)) */
-        gw_bin2hex(dbpass, hash2, GW_MYSQL_SCRAMBLE_SIZE);
-
         /** new_sha is the SHA1(CONCAT(scramble, hash2) */
         gw_sha1_2_str(protocol->scramble,
                       GW_MYSQL_SCRAMBLE_SIZE,
@@ -1302,8 +1295,8 @@ int gw_send_change_user_to_backend(char          *dbname,
  * The users' table is dcb->service->users or a different one specified with void *repository
  * The user lookup uses username,host and db name (if passed in connection or change user)
  *
- * If found the HEX password, representing sha1(sha1(password)), is converted in binary data and
- * copied into gateway_password
+ * If found the binary sha1(sha1(password)), decoded when the users table was
+ * loaded, is copied into gateway_password
  *
  * @param username              The user to look for
  * @param gateway_password      The related SHA1(SHA1(password)), the pointer must be preallocated
@@ -1316,18 +1309,23 @@ int gw_find_mysql_user_password_sha1(char *username, uint8_t *gateway_password,
 {
     SERVICE *service = NULL;
     struct sockaddr_in *client;
-    char *user_password = NULL;
+    bool found;
     MYSQL_USER_HOST key;
     MYSQL_session *client_data = NULL;
+    USERS *users;
 
     client_data = (MYSQL_session *) dcb->data;
     service = (SERVICE *) dcb->service;
+    /** Use one snapshot of the users table for the whole lookup, it stays
+     * valid until this thread returns to the poll loop */
+    users = rcu_dereference(service->users);
     client = (struct sockaddr_in *) &dcb->ipv4;
 
     key.user = username;
     memcpy(&key.ipv4, client, sizeof(struct sockaddr_in));
     key.netmask = 32;
     key.resource = client_data->db;
+    key.hostname[0] = '\0';
     if (strlen(dcb->remote) < MYSQL_HOST_MAXLEN)
     {
         strcpy(key.hostname, dcb->remote);
@@ -1340,122 +1338,29 @@ int gw_find_mysql_user_password_sha1(char *username, uint8_t *gateway_password,
               key.resource != NULL ?" db: " :"",
               key.resource != NULL ?key.resource :"");
 
-    /* look for user@current_ipv4 now */
-    user_password = mysql_users_fetch(service->users, &key);
-
-    if (!user_password)
-    {
-        /* The user is not authenticated @ current IPv4 */
-
-        while (1)
-        {
-            /*
-             * (1) Check for localhost first: 127.0.0.1 (IPv4 only)
-             */
-
-            if ((key.ipv4.sin_addr.s_addr == 0x0100007F) &&
-                !dcb->service->localhost_match_wildcard_host)
-            {
-                /* Skip the wildcard check and return 1 */
-                break;
-            }
-
-            /*
-             * (2) check for possible IPv4 class C,B,A networks
-             */
-
-            /* Class C check */
-            key.ipv4.sin_addr.s_addr &= 0x00FFFFFF;
-            key.netmask -= 8;
-
-            user_password = mysql_users_fetch(service->users, &key);
-
-            if (user_password)
-            {
-                break;
-            }
-
-            /* Class B check */
-            key.ipv4.sin_addr.s_addr &= 0x0000FFFF;
-            key.netmask -= 8;
-
-            user_password = mysql_users_fetch(service->users, &key);
-
-            if (user_password)
-            {
-                break;
-            }
-
-            /* Class A check */
-            key.ipv4.sin_addr.s_addr &= 0x000000FF;
-            key.netmask -= 8;
-
-            user_password = mysql_users_fetch(service->users, &key);
-
-            if (user_password)
-            {
-                break;
-            }
-
-            /*
-             * (3) Continue check for wildcard host, user@%
-             */
-
-            memset(&key.ipv4, 0, sizeof(struct sockaddr_in));
-            key.netmask = 0;
-
-            MXS_DEBUG("%lu [MySQL Client Auth], checking user [%s@%s] with "
-                      "wildcard host [%%]",
-                      pthread_self(),
-                      key.user,
-                      dcb->remote);
-
-            user_password = mysql_users_fetch(service->users, &key);
-
-            if (user_password)
-            {
-                break;
-            }
-
-            if (!user_password)
-            {
-                /*
-                 * user@% not found.
-                 */
-
-                MXS_DEBUG("%lu [MySQL Client Auth], user [%s@%s] not existent",
-                          pthread_self(),
-                          key.user,
-                          dcb->remote);
+    /*
+     * Find the most specific grant for user@current_ipv4. Unless allowed by
+     * the service, a client connecting from localhost (127.0.0.1) only
+     * matches grants for its exact address.
+     */
+    bool wildcard_hosts = key.ipv4.sin_addr.s_addr != 0x0100007F ||
+        dcb->service->localhost_match_wildcard_host;
 
-                MXS_INFO("Authentication Failed: user [%s@%s] not found.",
-                         key.user,
-                         dcb->remote);
-                break;
-            }
+    found = mysql_users_find_password(users, &key, wildcard_hosts, gateway_password);
 
-        }
-    }
-
-    /* If user@host has been found we get the the password in binary format*/
-    if (user_password)
+    if (!found)
     {
-        /*
-         * Convert the hex data (40 bytes) to binary (20 bytes).
-         * The gateway_password represents the SHA1(SHA1(real_password)).
-         * Please note: the real_password is unknown and SHA1(real_password) is unknown as well
-         */
-        int passwd_len=strlen(user_password);
-        if (passwd_len)
-        {
-            passwd_len = (passwd_len <= (SHA_DIGEST_LENGTH * 2)) ? passwd_len : (SHA_DIGEST_LENGTH * 2);
-            gw_hex2bin(gateway_password, user_password, passwd_len);
-        }
+        MXS_DEBUG("%lu [MySQL Client Auth], user [%s@%s] not existent",
+                  pthread_self(),
+                  key.user,
+                  dcb->remote);
 
-        return 0;
-    } else {
-        return 1;
+        MXS_INFO("Authentication Failed: user [%s@%s] not found.",
+                 key.user,
+                 dcb->remote);
     }
+
+    return found ? 0 : 1;
 }
 
 /**
@@ -1600,6 +1505,7 @@ GWBUF* gw_MySQL_get_next_packet(GWBUF** p_readbuf)
     packetbuf = gwbuf_alloc(packetlen);
     target = GWBUF_DATA(packetbuf);
     packetbuf->gwbuf_type = readbuf->gwbuf_type; /*< Copy the type too */
+    packetbuf->stamp = readbuf->stamp;
     /**
      * Copy first MySQL packet to packetbuf and leave posible other
      * packets to read buffer.
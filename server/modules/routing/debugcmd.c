@@ -72,6 +72,8 @@
 #include <monitor.h>
 #include <debugcli.h>
 #include <housekeeper.h>
+#include <query_trace.h>
+#include <adaptive_lock.h>
 
 #include <skygw_utils.h>
 #include <log_manager.h>
@@ -153,6 +155,10 @@ struct subcommand showoptions[] = {
       "Show all filters",
       "Show all filters",
       {0, 0, 0} },
+    { "locks", 0, dShowLockStats,
+      "Show where threads have waited for the adaptive locks",
+      "Show where threads have waited for the adaptive locks",
+      {0, 0, 0} },
     { "modules", 0, dprintAllModules,
       "Show all currently loaded modules",
       "Show all currently loaded modules",
@@ -170,6 +176,10 @@ struct subcommand showoptions[] = {
       "Show persistent pool for a server, e.g. show persistent 0x485390. "
       "The address may also be replaced with the server name from the configuration file",
       {ARG_TYPE_SERVER, 0, 0} },
+    { "querytrace", 0, dprintQueryTrace,
+      "Show the latency of the queries routed by each service and filter",
+      "Show the latency of the queries routed by each service and filter",
+      {0, 0, 0} },
     { "server", 1, dprintServer,
       "Show details for a named server, e.g. show server dbnode1",
       "Show details for a server, e.g. show server 0x485390. The address may also be "
@@ -1469,6 +1479,60 @@ static bool get_log_action(const char* name, struct log_action_entry* entryp)
     return found;
 }
 
+/**
+ * The session and log priority to change with set_session_log_priority()
+ */
+typedef struct
+{
+    size_t id;
+    int priority;
+    bool enable;
+} SESSION_LOG_PRIORITY;
+
+/**
+ * Change the log priority of a session if it is the one looked for
+ *
+ * @param session The session
+ * @param data The SESSION_LOG_PRIORITY to apply
+ * @return False if the session was found
+ */
+static bool session_log_priority_cb(SESSION *session, void *data)
+{
+    SESSION_LOG_PRIORITY *change = (SESSION_LOG_PRIORITY *)data;
+
+    if (session->ses_id == change->id)
+    {
+        if (change->enable)
+        {
+            session_enable_log_priority(session, change->priority);
+        }
+        else
+        {
+            session_disable_log_priority(session, change->priority);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Enable or disable a log priority for the session with the given id
+ * @param dcb Client DCB
+ * @param id The session id as a string
+ * @param priority The syslog priority
+ * @param enable Whether to enable or disable the priority
+ */
+static void set_session_log_priority(DCB *dcb, char *id, int priority, bool enable)
+{
+    SESSION_LOG_PRIORITY change = { (size_t) strtol(id, 0, 0), priority, enable };
+
+    if (session_foreach(session_log_priority_cb, &change))
+    {
+        dcb_printf(dcb, "Session not found: %s.\n", id);
+    }
+}
+
 /**
  * Enables a log for a single session
  * @param session The session in question
@@ -1481,25 +1545,7 @@ static void enable_sess_log_action(DCB *dcb, char *arg1, char *arg2)
 
     if (get_log_action(arg1, &entry))
     {
-        size_t id = (size_t) strtol(arg2, 0, 0);
-
-        // TODO: This is totally non thread-safe.
-        SESSION* session = get_all_sessions();
-
-        while (session)
-        {
-            if (session->ses_id == id)
-            {
-                session_enable_log_priority(session, entry.priority);
-                break;
-            }
-            session = session->next;
-        }
-
-        if (!session)
-        {
-            dcb_printf(dcb, "Session not found: %s.\n", arg2);
-        }
+        set_session_log_priority(dcb, arg2, entry.priority, true);
     }
     else
     {
@@ -1519,25 +1565,7 @@ static void disable_sess_log_action(DCB *dcb, char *arg1, char *arg2)
 
     if (get_log_action(arg1, &entry))
     {
-        size_t id = (size_t) strtol(arg2, 0, 0);
-
-        // TODO: This is totally non thread-safe.
-        SESSION* session = get_all_sessions();
-
-        while (session)
-        {
-            if (session->ses_id == id)
-            {
-                session_disable_log_priority(session, entry.priority);
-                break;
-            }
-            session = session->next;
-        }
-
-        if (!session)
-        {
-            dcb_printf(dcb, "Session not found: %s.\n", arg2);
-        }
+        set_session_log_priority(dcb, arg2, entry.priority, false);
     }
     else
     {
@@ -1594,25 +1622,7 @@ static void enable_sess_log_priority(DCB *dcb, char *arg1, char *arg2)
 
     if (priority != -1)
     {
-        size_t id = (size_t) strtol(arg2, 0, 0);
-
-        // TODO: This is totally non thread-safe.
-        SESSION* session = get_all_sessions();
-
-        while (session)
-        {
-            if (session->ses_id == id)
-            {
-                session_enable_log_priority(session, priority);
-                break;
-            }
-            session = session->next;
-        }
-
-        if (!session)
-        {
-            dcb_printf(dcb, "Session not found: %s.\n", arg2);
-        }
+        set_session_log_priority(dcb, arg2, priority, true);
     }
     else
     {
@@ -1632,25 +1642,7 @@ static void disable_sess_log_priority(DCB *dcb, char *arg1, char *arg2)
 
     if (priority != -1)
     {
-        size_t id = (size_t) strtol(arg2, 0, 0);
-
-        // TODO: This is totally non thread-safe.
-        SESSION* session = get_all_sessions();
-
-        while (session)
-        {
-            if (session->ses_id == id)
-            {
-                session_disable_log_priority(session, priority);
-                break;
-            }
-            session = session->next;
-        }
-
-        if (!session)
-        {
-            dcb_printf(dcb, "Session not found: %s.\n", arg2);
-        }
+        set_session_log_priority(dcb, arg2, priority, false);
     }
     else
     {
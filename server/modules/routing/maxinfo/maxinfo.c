@@ -56,6 +56,8 @@
 #include <secrets.h>
 #include <users.h>
 #include <dbusers.h>
+#include <filter.h>
+#include <metrics.h>
 
 
 MODULE_INFO 	info = {
@@ -696,6 +698,13 @@ static struct uri_table {
 	{ NULL, NULL }
 };
 
+/**
+ * The prefix of the URI that returns the statistics of the filter whose
+ * name follows the prefix
+ */
+#define FILTER_STATISTICS_URI	"/filter/statistics/"
+
+
 /**
  * We have data from the client, this is a HTTP URL
  *
@@ -721,6 +730,16 @@ RESULTSET	*set;
 			resultset_free(set);
 		}
 	}
+	if (strcmp(uri, METRICS_URI) == 0)
+	{
+		metrics_stream(session->dcb);
+	}
+	if (strncmp(uri, FILTER_STATISTICS_URI, strlen(FILTER_STATISTICS_URI)) == 0 &&
+		(set = filterGetStatistics(uri + strlen(FILTER_STATISTICS_URI))) != NULL)
+	{
+		resultset_stream_json(set, session->dcb);
+		resultset_free(set);
+	}
 	gwbuf_free(queue);
 	return 1;
 }
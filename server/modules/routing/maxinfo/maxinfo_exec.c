@@ -49,6 +49,7 @@
 #include <log_manager.h>
 #include <resultset.h>
 #include <maxconfig.h>
+#include <filter.h>
 
 static void exec_show(DCB *dcb, MAXINFO_TREE *tree);
 static void exec_select(DCB *dcb, MAXINFO_TREE *tree);
@@ -250,6 +251,36 @@ RESULTSET	*set;
 	resultset_free(set);
 }
 
+/**
+ * Fetch the statistics of a filter and stream as a result set
+ *
+ * @param dcb	DCB to which to stream result set
+ * @param tree	Like clause that holds the name of the filter
+ */
+static void
+exec_show_filterStatistics(DCB *dcb, MAXINFO_TREE *tree)
+{
+RESULTSET	*set;
+char		errmsg[120];
+
+	if (tree == NULL || tree->value == NULL)
+	{
+		maxinfo_send_error(dcb, 0, "Expected the name of a filter");
+		return;
+	}
+	if ((set = filterGetStatistics(tree->value)) == NULL)
+	{
+		if (strlen(tree->value) > 80)	// Prevent buffer overrun
+			tree->value[80] = 0;
+		sprintf(errmsg, "Filter '%s' does not provide statistics", tree->value);
+		maxinfo_send_error(dcb, 0, errmsg);
+		return;
+	}
+	
+	resultset_stream_mysql(set, dcb);
+	resultset_free(set);
+}
+
 /**
  * The table of show commands that are supported
  */
@@ -267,6 +298,7 @@ static struct {
 	{ "modules", exec_show_modules },
 	{ "monitors", exec_show_monitors },
 	{ "eventTimes", exec_show_eventTimes },
+	{ "filterStatistics", exec_show_filterStatistics },
 	{ NULL, NULL }
 };
 
@@ -955,7 +987,7 @@ maxinfo_zombie_dcbs()
 /**
  * Interface to poll stats for reads
  */
-static int
+static int64_t
 maxinfo_read_events()
 {
 	return poll_get_stat(POLL_STAT_READ);
@@ -964,7 +996,7 @@ maxinfo_read_events()
 /**
  * Interface to poll stats for writes
  */
-static int
+static int64_t
 maxinfo_write_events()
 {
 	return poll_get_stat(POLL_STAT_WRITE);
@@ -973,7 +1005,7 @@ maxinfo_write_events()
 /**
  * Interface to poll stats for errors
  */
-static int
+static int64_t
 maxinfo_error_events()
 {
 	return poll_get_stat(POLL_STAT_ERROR);
@@ -982,7 +1014,7 @@ maxinfo_error_events()
 /**
  * Interface to poll stats for hangup
  */
-static int
+static int64_t
 maxinfo_hangup_events()
 {
 	return poll_get_stat(POLL_STAT_HANGUP);
@@ -991,7 +1023,7 @@ maxinfo_hangup_events()
 /**
  * Interface to poll stats for accepts
  */
-static int
+static int64_t
 maxinfo_accept_events()
 {
 	return poll_get_stat(POLL_STAT_ACCEPT);
@@ -1000,7 +1032,7 @@ maxinfo_accept_events()
 /**
  * Interface to poll stats for event queue length
  */
-static int
+static int64_t
 maxinfo_event_queue_length()
 {
 	return poll_get_stat(POLL_STAT_EVQ_LEN);
@@ -1009,7 +1041,7 @@ maxinfo_event_queue_length()
 /**
  * Interface to poll stats for event pending queue length
  */
-static int
+static int64_t
 maxinfo_event_pending_queue_length()
 {
 	return poll_get_stat(POLL_STAT_EVQ_PENDING);
@@ -1018,7 +1050,7 @@ maxinfo_event_pending_queue_length()
 /**
  * Interface to poll stats for max event queue length
  */
-static int
+static int64_t
 maxinfo_max_event_queue_length()
 {
 	return poll_get_stat(POLL_STAT_EVQ_MAX);
@@ -1027,7 +1059,7 @@ maxinfo_max_event_queue_length()
 /**
  * Interface to poll stats for max queue time
  */
-static int
+static int64_t
 maxinfo_max_event_queue_time()
 {
 	return poll_get_stat(POLL_STAT_MAX_QTIME);
@@ -1036,12 +1068,66 @@ maxinfo_max_event_queue_time()
 /**
  * Interface to poll stats for max event execution time
  */
-static int
+static int64_t
 maxinfo_max_event_exec_time()
 {
 	return poll_get_stat(POLL_STAT_MAX_EXECTIME);
 }
 
+/**
+ * Interface to poll stats for the 50th percentile of the queue time
+ */
+static int64_t
+maxinfo_event_queue_time_p50()
+{
+	return poll_get_stat(POLL_STAT_QTIME_P50);
+}
+
+/**
+ * Interface to poll stats for the 90th percentile of the queue time
+ */
+static int64_t
+maxinfo_event_queue_time_p90()
+{
+	return poll_get_stat(POLL_STAT_QTIME_P90);
+}
+
+/**
+ * Interface to poll stats for the 99th percentile of the queue time
+ */
+static int64_t
+maxinfo_event_queue_time_p99()
+{
+	return poll_get_stat(POLL_STAT_QTIME_P99);
+}
+
+/**
+ * Interface to poll stats for the 50th percentile of the event execution time
+ */
+static int64_t
+maxinfo_event_exec_time_p50()
+{
+	return poll_get_stat(POLL_STAT_EXECTIME_P50);
+}
+
+/**
+ * Interface to poll stats for the 90th percentile of the event execution time
+ */
+static int64_t
+maxinfo_event_exec_time_p90()
+{
+	return poll_get_stat(POLL_STAT_EXECTIME_P90);
+}
+
+/**
+ * Interface to poll stats for the 99th percentile of the event execution time
+ */
+static int64_t
+maxinfo_event_exec_time_p99()
+{
+	return poll_get_stat(POLL_STAT_EXECTIME_P99);
+}
+
 /**
  * Variables that may be sent in a show status
  */
@@ -1072,6 +1158,12 @@ static struct {
 	{ "Max_event_queue_length", VT_INT, (STATSFUNC)maxinfo_max_event_queue_length },
 	{ "Max_event_queue_time", VT_INT, (STATSFUNC)maxinfo_max_event_queue_time },
 	{ "Max_event_execution_time", VT_INT, (STATSFUNC)maxinfo_max_event_exec_time },
+	{ "Event_queue_time_p50", VT_INT, (STATSFUNC)maxinfo_event_queue_time_p50 },
+	{ "Event_queue_time_p90", VT_INT, (STATSFUNC)maxinfo_event_queue_time_p90 },
+	{ "Event_queue_time_p99", VT_INT, (STATSFUNC)maxinfo_event_queue_time_p99 },
+	{ "Event_execution_time_p50", VT_INT, (STATSFUNC)maxinfo_event_exec_time_p50 },
+	{ "Event_execution_time_p90", VT_INT, (STATSFUNC)maxinfo_event_exec_time_p90 },
+	{ "Event_execution_time_p99", VT_INT, (STATSFUNC)maxinfo_event_exec_time_p99 },
 	{ NULL, 0, 	NULL }
 };
 